@@ -86,6 +86,7 @@ struct blk_args {
 	unsigned seed;  /* seed for randomization */
 	char *type_str; /* type: blk, file, memcpy */
 	char *mode_str; /* mode: stat, seq, rand */
+	size_t batch;   /* number of blocks per operation */
 };
 
 /*
@@ -98,6 +99,8 @@ struct blk_bench {
 	size_t nblocks;		  /* actual number of blocks */
 	size_t blocks_per_thread; /* number of blocks per thread */
 	worker_fn worker;	 /* worker function */
+	/* pmemblk_readv or pmemblk_writev, for batches of blk operations */
+	int (*vec)(PMEMblkpool *, const struct pmemblk_iov *, int);
 	enum op_type type;
 	enum op_mode mode;
 };
@@ -106,9 +109,10 @@ struct blk_bench {
  * struct blk_worker -- pmemblk worker context
  */
 struct blk_worker {
-	os_off_t *blocks; /* array with block numbers */
-	char *buff;       /* buffer for read/write */
-	unsigned seed;    /* worker seed */
+	os_off_t *blocks;	 /* array with block numbers */
+	struct pmemblk_iov *iov; /* vector of blocks for batches */
+	char *buff;		 /* buffer for read/write */
+	unsigned seed;		 /* worker seed */
 };
 
 /*
@@ -290,8 +294,24 @@ blk_operation(struct benchmark *bench, struct operation_info *info)
 	struct blk_bench *bb = (struct blk_bench *)pmembench_get_priv(bench);
 	struct blk_worker *bworker = (struct blk_worker *)info->worker->priv;
 
-	os_off_t off = bworker->blocks[info->index];
-	return bb->worker(bb, info->args, bworker, off);
+	struct blk_args *bargs = (struct blk_args *)info->args->opts;
+	size_t first = info->index * bargs->batch;
+
+	if (bb->vec != NULL) {
+		if (bb->vec(bb->pbp, &bworker->iov[first], (int)bargs->batch) <
+		    0) {
+			perror("pmemblk_readv/pmemblk_writev");
+			return -1;
+		}
+		return 0;
+	}
+
+	for (size_t i = 0; i < bargs->batch; i++) {
+		os_off_t off = bworker->blocks[first + i];
+		if (bb->worker(bb, info->args, bworker, off) != 0)
+			return -1;
+	}
+	return 0;
 }
 
 /*
@@ -311,6 +331,7 @@ blk_init_worker(struct benchmark *bench, struct benchmark_args *args,
 
 	struct blk_bench *bb = (struct blk_bench *)pmembench_get_priv(bench);
 	struct blk_args *bargs = (struct blk_args *)args->opts;
+	size_t nblocks;
 
 	bworker->seed = os_rand_r(&bargs->seed);
 
@@ -324,8 +345,10 @@ blk_init_worker(struct benchmark *bench, struct benchmark_args *args,
 	memset(bworker->buff, bworker->seed, args->dsize);
 
 	assert(args->n_ops_per_thread != 0);
-	bworker->blocks = (os_off_t *)malloc(sizeof(*bworker->blocks) *
-					     args->n_ops_per_thread);
+	nblocks = args->n_ops_per_thread * bargs->batch;
+	bworker->iov = NULL;
+	bworker->blocks =
+		(os_off_t *)malloc(sizeof(*bworker->blocks) * nblocks);
 	if (!bworker->blocks) {
 		perror("malloc");
 		goto err_blocks;
@@ -333,7 +356,7 @@ blk_init_worker(struct benchmark *bench, struct benchmark_args *args,
 
 	switch (bb->mode) {
 		case OP_MODE_RAND:
-			for (size_t i = 0; i < args->n_ops_per_thread; i++) {
+			for (size_t i = 0; i < nblocks; i++) {
 				bworker->blocks[i] =
 					worker->index * bb->blocks_per_thread +
 					os_rand_r(&bworker->seed) %
@@ -341,20 +364,36 @@ blk_init_worker(struct benchmark *bench, struct benchmark_args *args,
 			}
 			break;
 		case OP_MODE_SEQ:
-			for (size_t i = 0; i < args->n_ops_per_thread; i++)
+			for (size_t i = 0; i < nblocks; i++)
 				bworker->blocks[i] = i % bb->blocks_per_thread;
 			break;
 		case OP_MODE_STAT:
-			for (size_t i = 0; i < args->n_ops_per_thread; i++)
+			for (size_t i = 0; i < nblocks; i++)
 				bworker->blocks[i] = 0;
 			break;
 		default:
 			perror("unknown mode");
-			goto err_blocks;
+			goto err_mode;
+	}
+
+	if (bb->vec != NULL) {
+		bworker->iov = (struct pmemblk_iov *)malloc(
+			sizeof(*bworker->iov) * nblocks);
+		if (!bworker->iov) {
+			perror("malloc");
+			goto err_mode;
+		}
+
+		for (size_t i = 0; i < nblocks; i++) {
+			bworker->iov[i].buf = bworker->buff;
+			bworker->iov[i].blockno = bworker->blocks[i];
+		}
 	}
 
 	worker->priv = bworker;
 	return 0;
+err_mode:
+	free(bworker->blocks);
 err_blocks:
 	free(bworker->buff);
 err_buff:
@@ -371,6 +410,7 @@ blk_free_worker(struct benchmark *bench, struct benchmark_args *args,
 		struct worker_info *worker)
 {
 	struct blk_worker *bworker = (struct blk_worker *)worker->priv;
+	free(bworker->iov);
 	free(bworker->blocks);
 	free(bworker->buff);
 	free(bworker);
@@ -429,6 +469,7 @@ blk_init(struct blk_bench *bb, struct benchmark_args *args)
 	}
 
 	bb->fd = -1;
+	bb->vec = NULL;
 
 	/*
 	 * Create pmemblk in order to get the number of blocks
@@ -517,6 +558,8 @@ blk_read_init(struct benchmark *bench, struct benchmark_args *args)
 			break;
 		case OP_TYPE_BLK:
 			bb->worker = blk_read;
+			if (((struct blk_args *)args->opts)->batch > 1)
+				bb->vec = pmemblk_readv;
 			break;
 		case OP_TYPE_MEMCPY:
 			bb->worker = memcpy_read;
@@ -560,6 +603,8 @@ blk_write_init(struct benchmark *bench, struct benchmark_args *args)
 			break;
 		case OP_TYPE_BLK:
 			bb->worker = blk_write;
+			if (((struct blk_args *)args->opts)->batch > 1)
+				bb->vec = pmemblk_writev;
 			break;
 		case OP_TYPE_MEMCPY:
 			bb->worker = memcpy_write;
@@ -608,7 +653,7 @@ blk_exit(struct benchmark *bench, struct benchmark_args *args)
 	return 0;
 }
 
-static struct benchmark_clo blk_clo[5];
+static struct benchmark_clo blk_clo[6];
 static struct benchmark_info blk_read_info;
 static struct benchmark_info blk_write_info;
 
@@ -658,6 +703,19 @@ blk_constructor(void)
 	blk_clo[4].type_uint.min = 0;
 	blk_clo[4].type_uint.max = ~0;
 
+	blk_clo[5].opt_short = 'b';
+	blk_clo[5].opt_long = "batch";
+	blk_clo[5].descr = "Number of blocks per operation - with the blk "
+			   "operation type, batches are transferred by "
+			   "pmemblk_readv/pmemblk_writev";
+	blk_clo[5].type = CLO_TYPE_UINT;
+	blk_clo[5].off = clo_field_offset(struct blk_args, batch);
+	blk_clo[5].def = "1";
+	blk_clo[5].type_uint.size = clo_field_size(struct blk_args, batch);
+	blk_clo[5].type_uint.base = CLO_INT_BASE_DEC;
+	blk_clo[5].type_uint.min = 1;
+	blk_clo[5].type_uint.max = INT_MAX;
+
 	blk_read_info.name = "blk_read";
 	blk_read_info.brief = "Benchmark for blk_read() operation";
 	blk_read_info.init = blk_read_init;
@@ -31,7 +31,8 @@
  */
 
 /*
- * pmem_flush.cpp -- benchmark implementation for pmem_persist and pmem_msync
+ * pmem_flush.cpp -- benchmark implementation for pmem_persist, pmem_persistv
+ * and pmem_msync
  */
 #include <cassert>
 #include <cerrno>
@@ -42,6 +43,7 @@
 #include <fcntl.h>
 #include <libpmem.h>
 #include <sys/mman.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
 #include "benchmark.hpp"
@@ -85,6 +87,7 @@ struct pmem_args {
 	char *operation; /* msync, dummy_msync, persist, ... */
 	char *mode;      /* stat, seq, rand */
 	bool no_warmup;  /* don't do warmup */
+	unsigned ranges; /* number of ranges persisted by vector operations */
 };
 
 /*
@@ -109,6 +112,9 @@ struct pmem_bench {
 
 	/* the actual benchmark operation */
 	int (*func_op)(struct pmem_bench *pmb, void *addr, size_t len);
+
+	/* the actual benchmark operation on a vector of ranges */
+	int (*func_opv)(struct pmem_bench *pmb, struct iovec *iov, int iovcnt);
 };
 
 /*
@@ -328,24 +334,48 @@ flush_msync_invalid(struct pmem_bench *pmb, void *addr, size_t len)
 	return 0;
 }
 
+/*
+ * flush_persist_n -- flush each range of the vector using pmem_persist()
+ */
+static int
+flush_persist_n(struct pmem_bench *pmb, struct iovec *iov, int iovcnt)
+{
+	for (int i = 0; i < iovcnt; ++i)
+		pmem_persist(iov[i].iov_base, iov[i].iov_len);
+	return 0;
+}
+
+/*
+ * flush_persistv -- flush the whole vector of ranges using pmem_persistv()
+ */
+static int
+flush_persistv(struct pmem_bench *pmb, struct iovec *iov, int iovcnt)
+{
+	pmem_persistv(iov, iovcnt);
+	return 0;
+}
+
 struct op {
 	const char *opname;
 	int (*func_op)(struct pmem_bench *pmb, void *addr, size_t len);
+	int (*func_opv)(struct pmem_bench *pmb, struct iovec *iov, int iovcnt);
 };
 
 static struct op ops[] = {
-	{"noop", flush_noop},
-	{"persist", flush_persist},
-	{"persist_4K", flush_persist_4K},
-	{"persist_2M", flush_persist_2M},
-	{"msync", flush_msync},
-	{"msync_0", flush_msync_0},
-	{"msync_err", flush_msync_err},
-	{"persist_4K_msync_0", flush_persist_4K_msync_0},
-	{"persist_2M_msync_0", flush_persist_2M_msync_0},
-	{"msync_async", flush_msync_async},
-	{"msync_nodirty", flush_msync_nodirty},
-	{"msync_invalid", flush_msync_invalid},
+	{"noop", flush_noop, NULL},
+	{"persist", flush_persist, NULL},
+	{"persist_4K", flush_persist_4K, NULL},
+	{"persist_2M", flush_persist_2M, NULL},
+	{"msync", flush_msync, NULL},
+	{"msync_0", flush_msync_0, NULL},
+	{"msync_err", flush_msync_err, NULL},
+	{"persist_4K_msync_0", flush_persist_4K_msync_0, NULL},
+	{"persist_2M_msync_0", flush_persist_2M_msync_0, NULL},
+	{"msync_async", flush_msync_async, NULL},
+	{"msync_nodirty", flush_msync_nodirty, NULL},
+	{"msync_invalid", flush_msync_invalid, NULL},
+	{"persist_n", NULL, flush_persist_n},
+	{"persistv", NULL, flush_persistv},
 };
 
 #define NOPS (sizeof(ops) / sizeof(ops[0]))
@@ -392,6 +422,12 @@ pmem_flush_init(struct benchmark *bench, struct benchmark_args *args)
 		goto err_free_pmb;
 	}
 	pmb->func_op = ops[i].func_op;
+	pmb->func_opv = ops[i].func_opv;
+
+	if (pmb->pargs->ranges == 0) {
+		fprintf(stderr, "invalid number of ranges\n");
+		goto err_free_pmb;
+	}
 
 	pmb->n_offsets = args->n_ops_per_thread * args->n_threads;
 
@@ -504,6 +540,30 @@ pmem_flush_operation(struct benchmark *bench, struct operation_info *info)
 	size_t op_idx = info->index;
 	assert(op_idx < pmb->n_offsets);
 
+	if (pmb->func_opv != NULL) {
+		struct iovec *iov = (struct iovec *)info->worker->priv;
+		unsigned nranges = pmb->pargs->ranges;
+
+		/*
+		 * Each operation touches 'ranges' chunks selected by the
+		 * consecutive entries of the offsets array.
+		 */
+		for (unsigned i = 0; i < nranges; ++i) {
+			uint64_t chunk_idx = pmb->offsets[(op_idx * nranges + i) %
+							  pmb->n_offsets];
+			void *addr = (char *)pmb->pmem_addr_aligned +
+				chunk_idx * info->args->dsize;
+
+			*(int *)addr = *(int *)addr + 1;
+			iov[i].iov_base = addr;
+			iov[i].iov_len = info->args->dsize;
+		}
+
+		/* store + flush */
+		pmb->func_opv(pmb, iov, (int)nranges);
+		return 0;
+	}
+
 	uint64_t chunk_idx = pmb->offsets[op_idx];
 	void *addr =
 		(char *)pmb->pmem_addr_aligned + chunk_idx * info->args->dsize;
@@ -514,8 +574,36 @@ pmem_flush_operation(struct benchmark *bench, struct operation_info *info)
 	return 0;
 }
 
+/*
+ * pmem_flush_init_worker -- allocate the vector of ranges for a worker
+ */
+static int
+pmem_flush_init_worker(struct benchmark *bench, struct benchmark_args *args,
+		       struct worker_info *worker)
+{
+	struct pmem_args *pargs = (struct pmem_args *)args->opts;
+
+	worker->priv = malloc(pargs->ranges * sizeof(struct iovec));
+	if (worker->priv == NULL) {
+		perror("malloc");
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * pmem_flush_free_worker -- release the vector of ranges of a worker
+ */
+static void
+pmem_flush_free_worker(struct benchmark *bench, struct benchmark_args *args,
+		       struct worker_info *worker)
+{
+	free(worker->priv);
+}
+
 /* structure to define command line arguments */
-static struct benchmark_clo pmem_flush_clo[3];
+static struct benchmark_clo pmem_flush_clo[4];
 /* Stores information about benchmark. */
 static struct benchmark_info pmem_flush_bench;
 CONSTRUCTOR(pmem_flush_constructor)
@@ -543,11 +631,26 @@ pmem_flush_constructor(void)
 	pmem_flush_clo[2].type = CLO_TYPE_FLAG;
 	pmem_flush_clo[2].off = clo_field_offset(struct pmem_args, no_warmup);
 
+	pmem_flush_clo[3].opt_short = 0;
+	pmem_flush_clo[3].opt_long = "ranges";
+	pmem_flush_clo[3].descr = "Number of ranges flushed by a single "
+				  "persist_n or persistv operation";
+	pmem_flush_clo[3].type = CLO_TYPE_UINT;
+	pmem_flush_clo[3].off = clo_field_offset(struct pmem_args, ranges);
+	pmem_flush_clo[3].def = "1";
+	pmem_flush_clo[3].type_uint.size =
+		clo_field_size(struct pmem_args, ranges);
+	pmem_flush_clo[3].type_uint.base = CLO_INT_BASE_DEC;
+	pmem_flush_clo[3].type_uint.min = 1;
+	pmem_flush_clo[3].type_uint.max = UINT_MAX;
+
 	pmem_flush_bench.name = "pmem_flush";
-	pmem_flush_bench.brief = "Benchmark for pmem_msync() "
-				 "and pmem_persist()";
+	pmem_flush_bench.brief = "Benchmark for pmem_msync(), "
+				 "pmem_persist() and pmem_persistv()";
 	pmem_flush_bench.init = pmem_flush_init;
 	pmem_flush_bench.exit = pmem_flush_exit;
+	pmem_flush_bench.init_worker = pmem_flush_init_worker;
+	pmem_flush_bench.free_worker = pmem_flush_free_worker;
 	pmem_flush_bench.multithread = true;
 	pmem_flush_bench.multiops = true;
 	pmem_flush_bench.operation = pmem_flush_operation;
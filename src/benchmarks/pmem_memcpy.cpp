@@ -111,6 +111,12 @@ struct pmem_args {
 
 	/* do not do warmup */
 	bool no_warmup;
+
+	/*
+	 * The number of threads used by pmem_memcpy() with
+	 * the PMEM_MEM_PARALLEL flag. The flag is not used if zero.
+	 */
+	unsigned parallel;
 };
 
 /*
@@ -323,6 +329,30 @@ libpmem_memcpy_persist(void *dest, void *source, size_t len)
 	return 0;
 }
 
+/*
+ * libpmem_memcpy_parallel_nodrain -- copy using libpmem pmem_memcpy()
+ * function with PMEM_MEM_PARALLEL and PMEM_MEM_NODRAIN flags.
+ */
+static int
+libpmem_memcpy_parallel_nodrain(void *dest, void *source, size_t len)
+{
+	pmem_memcpy(dest, source, len, PMEM_MEM_PARALLEL | PMEM_MEM_NODRAIN);
+
+	return 0;
+}
+
+/*
+ * libpmem_memcpy_parallel_persist -- copy using libpmem pmem_memcpy()
+ * function with PMEM_MEM_PARALLEL flag.
+ */
+static int
+libpmem_memcpy_parallel_persist(void *dest, void *source, size_t len)
+{
+	pmem_memcpy(dest, source, len, PMEM_MEM_PARALLEL);
+
+	return 0;
+}
+
 /*
  * assign_size -- assigns file and buffer size
  * depending on the operation mode and type.
@@ -471,6 +501,15 @@ pmem_memcpy_init(struct benchmark *bench, struct benchmark_args *args)
 	if (pmb->pargs->memcpy) {
 		pmb->func_op =
 			pmb->pargs->persist ? libc_memcpy_persist : libc_memcpy;
+	} else if (pmb->pargs->parallel) {
+		if (pmem_set_parallel_threads(pmb->pargs->parallel)) {
+			perror("pmem_set_parallel_threads");
+			ret = -1;
+			goto err_unmap;
+		}
+		pmb->func_op = pmb->pargs->persist
+			? libpmem_memcpy_parallel_persist
+			: libpmem_memcpy_parallel_nodrain;
 	} else {
 		pmb->func_op = pmb->pargs->persist ? libpmem_memcpy_persist
 						   : libpmem_memcpy_nodrain;
@@ -535,7 +574,7 @@ pmem_memcpy_exit(struct benchmark *bench, struct benchmark_args *args)
 }
 
 /* structure to define command line arguments */
-static struct benchmark_clo pmem_memcpy_clo[8];
+static struct benchmark_clo pmem_memcpy_clo[9];
 
 /* Stores information about benchmark. */
 static struct benchmark_info pmem_memcpy_bench;
@@ -611,6 +650,20 @@ pmem_memcpy_constructor(void)
 	pmem_memcpy_clo[7].type = CLO_TYPE_FLAG;
 	pmem_memcpy_clo[7].off = clo_field_offset(struct pmem_args, no_warmup);
 
+	pmem_memcpy_clo[8].opt_short = 0;
+	pmem_memcpy_clo[8].opt_long = "parallel";
+	pmem_memcpy_clo[8].descr = "Number of threads used by "
+				   "pmem_memcpy() with PMEM_MEM_PARALLEL "
+				   "flag, 0 to not use the flag";
+	pmem_memcpy_clo[8].type = CLO_TYPE_UINT;
+	pmem_memcpy_clo[8].off = clo_field_offset(struct pmem_args, parallel);
+	pmem_memcpy_clo[8].def = "0";
+	pmem_memcpy_clo[8].type_uint.size =
+		clo_field_size(struct pmem_args, parallel);
+	pmem_memcpy_clo[8].type_uint.base = CLO_INT_BASE_DEC;
+	pmem_memcpy_clo[8].type_uint.min = 0;
+	pmem_memcpy_clo[8].type_uint.max = 64;
+
 	pmem_memcpy_bench.name = "pmem_memcpy";
 	pmem_memcpy_bench.brief = "Benchmark for"
 				  "pmem_memcpy_persist() and "
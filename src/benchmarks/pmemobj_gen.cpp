@@ -95,6 +95,10 @@ enum type_mode {
  * obj_size	: Size of each allocated object
  *
  * n_ops	: Number of operations
+ *
+ * pool_size	: Minimum size of each pool
+ *
+ * recovery_threads : Number of threads used to recover the pool on open
  */
 struct pobj_args {
 	char *type_num;
@@ -105,6 +109,8 @@ struct pobj_args {
 	bool one_obj;
 	size_t obj_size;
 	size_t n_ops;
+	size_t pool_size;
+	unsigned recovery_threads;
 };
 
 /*
@@ -329,6 +335,8 @@ pobj_init(struct benchmark *bench, struct benchmark_args *args)
 	if (bench_priv->n_pools == 1)
 		n_objs *= args->n_threads;
 	psize = n_objs * args->dsize * args->n_threads * FACTOR;
+	if (psize < bench_priv->args_priv->pool_size)
+		psize = bench_priv->args_priv->pool_size;
 	if (psize < PMEMOBJ_MIN_POOL)
 		psize = PMEMOBJ_MIN_POOL;
 
@@ -447,6 +455,22 @@ free_bench_priv:
 	return -1;
 }
 
+/*
+ * pobj_open_init -- special part of pobj_open benchmark initialization.
+ */
+static int
+pobj_open_init(struct benchmark *bench, struct benchmark_args *args)
+{
+	struct pobj_args *pa = (struct pobj_args *)args->opts;
+	int threads = (int)pa->recovery_threads;
+	if (pmemobj_ctl_set(NULL, "open.recovery.threads", &threads) != 0) {
+		fprintf(stderr, "%s\n", pmemobj_errormsg());
+		return -1;
+	}
+
+	return pobj_init(bench, args);
+}
+
 /*
  * pobj_direct_init -- special part of pobj_direct benchmark initialization.
  */
@@ -583,7 +607,7 @@ static struct benchmark_info obj_direct;
 /* Array defining common command line arguments. */
 static struct benchmark_clo pobj_direct_clo[4];
 
-static struct benchmark_clo pobj_open_clo[3];
+static struct benchmark_clo pobj_open_clo[5];
 
 CONSTRUCTOR(pmemobj_gen_constructor)
 void
@@ -652,9 +676,35 @@ pmemobj_gen_constructor(void)
 	pobj_open_clo[2].type_uint.min = 1;
 	pobj_open_clo[2].type_uint.max = UINT_MAX;
 
+	pobj_open_clo[3].opt_short = 's';
+	pobj_open_clo[3].opt_long = "pool-size";
+	pobj_open_clo[3].type = CLO_TYPE_UINT;
+	pobj_open_clo[3].descr = "Minimum size of each pool";
+	pobj_open_clo[3].off = clo_field_offset(struct pobj_args, pool_size);
+	pobj_open_clo[3].def = "0";
+	pobj_open_clo[3].type_uint.size =
+		clo_field_size(struct pobj_args, pool_size);
+	pobj_open_clo[3].type_uint.base = CLO_INT_BASE_DEC | CLO_INT_BASE_HEX;
+	pobj_open_clo[3].type_uint.min = 0;
+	pobj_open_clo[3].type_uint.max = UINT64_MAX;
+
+	pobj_open_clo[4].opt_short = 'r';
+	pobj_open_clo[4].opt_long = "recovery-threads";
+	pobj_open_clo[4].type = CLO_TYPE_UINT;
+	pobj_open_clo[4].descr = "Number of threads used to recover "
+				 "the pool on open";
+	pobj_open_clo[4].off =
+		clo_field_offset(struct pobj_args, recovery_threads);
+	pobj_open_clo[4].def = "0";
+	pobj_open_clo[4].type_uint.size =
+		clo_field_size(struct pobj_args, recovery_threads);
+	pobj_open_clo[4].type_uint.base = CLO_INT_BASE_DEC;
+	pobj_open_clo[4].type_uint.min = 0;
+	pobj_open_clo[4].type_uint.max = INT_MAX;
+
 	obj_open.name = "obj_open";
 	obj_open.brief = "pmemobj_open() benchmark";
-	obj_open.init = pobj_init;
+	obj_open.init = pobj_open_init;
 	obj_open.exit = pobj_exit;
 	obj_open.multithread = true;
 	obj_open.multiops = true;
@@ -32,7 +32,7 @@
 
 /*
  * pmemobj_tx.cpp -- pmemobj_tx_alloc(), pmemobj_tx_free(),
- * pmemobj_tx_realloc(), pmemobj_tx_add_range() benchmarks.
+ * pmemobj_tx_realloc(), pmemobj_tx_add_range(), pmemobj_tx_write() benchmarks.
  */
 #include <cassert>
 #include <cerrno>
@@ -55,6 +55,10 @@
  */
 #define MAX_OPS 10000
 
+/* size and distance of the fields used by the "fields" operation */
+#define FIELD_SIZE 8
+#define FIELD_STRIDE 24
+
 TOID_DECLARE(struct item, 0);
 
 struct obj_tx_bench;
@@ -84,6 +88,7 @@ enum op_mode {
 	OP_MODE_ONE_OBJ_NESTED,
 	OP_MODE_ONE_OBJ_RANGE,
 	OP_MODE_ONE_OBJ_NESTED_RANGE,
+	OP_MODE_ONE_OBJ_FIELDS,
 	OP_MODE_ALL_OBJ,
 	OP_MODE_ALL_OBJ_NESTED,
 	OP_MODE_UNKNOWN
@@ -153,6 +158,10 @@ struct obj_tx_args {
 	 *		  one transaction.
 	 *		- range-nested - fields of one object are added to undo
 	 *		  log many times in many nested transactions.
+	 *		- fields - small, not adjacent fields of one object
+	 *		  are added to undo log in one transaction, the same
+	 *		  fields are added again when there are more
+	 *		  operations than fields in the object.
 	 *		- one-obj-nested - one object is added to undo log many
 	 *		  times in many nested transactions.
 	 *		- all-obj-nested - all objects are added to undo log in
@@ -178,6 +187,13 @@ struct obj_tx_args {
 	 *		- dram - does not use PMEM
 	 */
 	char *lib;
+
+	/*
+	 * mode of the transactions in the obj_tx_write benchmark:
+	 *		- undo - the written ranges are snapshotted
+	 *		- redo - the new values are buffered until commit
+	 */
+	char *tx_mode;
 	unsigned nested;    /* number of nested transactions */
 	unsigned min_size;  /* minimum allocation size */
 	unsigned min_rsize; /* minimum reallocation size */
@@ -206,6 +222,7 @@ static struct obj_tx_bench {
 	int nesting_mode;   /* type of nesting in main operation */
 	fn_num_t n_oid;     /* returns object's number in array */
 	fn_os_off_t fn_off; /* returns offset for proper operation */
+	char *wbuf;	 /* source of the obj_tx_write writes */
 
 	/*
 	 * fn_type_num gets proper function assigned, depending on the
@@ -459,6 +476,70 @@ add_range_tx(struct obj_tx_bench *obj_bench, struct worker_info *worker,
 	return ret;
 }
 
+/*
+ * write_range -- writes one range of an object in a transaction
+ */
+static int
+write_range(struct obj_tx_bench *obj_bench, struct obj_tx_worker *obj_worker,
+	    size_t idx)
+{
+	size_t n_oid = obj_bench->n_oid(idx);
+	struct offset offset = obj_bench->fn_off(obj_bench, idx);
+	char *dest = (char *)pmemobj_direct(obj_worker->oids[n_oid].oid) +
+		offset.off;
+	return pmemobj_tx_write(dest, obj_bench->wbuf, offset.size);
+}
+
+/*
+ * write_nested_tx -- main operations of the obj_tx_write with nesting.
+ */
+static int
+write_nested_tx(struct obj_tx_bench *obj_bench, struct worker_info *worker,
+		size_t idx)
+{
+	int ret = 0;
+	struct obj_tx_worker *obj_worker = (struct obj_tx_worker *)worker->priv;
+	TX_BEGIN(obj_bench->pop)
+	{
+		if (obj_bench->obj_args->n_ops != obj_worker->tx_level) {
+			write_range(obj_bench, obj_worker,
+				    obj_worker->tx_level);
+			obj_worker->tx_level++;
+			ret = write_nested_tx(obj_bench, worker, idx);
+		}
+	}
+	TX_ONABORT
+	{
+		fprintf(stderr, "transaction failed\n");
+		ret = -1;
+	}
+	TX_END
+	return ret;
+}
+
+/*
+ * write_tx -- main operations of the obj_tx_write without nesting.
+ */
+static int
+write_tx(struct obj_tx_bench *obj_bench, struct worker_info *worker,
+	 size_t idx)
+{
+	int ret = 0;
+	struct obj_tx_worker *obj_worker = (struct obj_tx_worker *)worker->priv;
+	TX_BEGIN(obj_bench->pop)
+	{
+		for (size_t i = 0; i < obj_bench->obj_args->n_ops; i++)
+			ret = write_range(obj_bench, obj_worker, i);
+	}
+	TX_ONABORT
+	{
+		fprintf(stderr, "transaction failed\n");
+		ret = -1;
+	}
+	TX_END
+	return ret;
+}
+
 /*
  * obj_op_sim -- main function for benchmarks which simulates nested
  * transactions on dram or pmemobj atomic API by calling function recursively.
@@ -561,6 +642,8 @@ parse_op_mode_add_range(const char *arg)
 		return OP_MODE_ONE_OBJ_RANGE;
 	else if (strcmp(arg, "range-nested") == 0)
 		return OP_MODE_ONE_OBJ_NESTED_RANGE;
+	else if (strcmp(arg, "fields") == 0)
+		return OP_MODE_ONE_OBJ_FIELDS;
 	else if (strcmp(arg, "all-obj") == 0)
 		return OP_MODE_ALL_OBJ;
 	else if (strcmp(arg, "all-obj-nested") == 0)
@@ -594,6 +677,8 @@ static fn_op_t realloc_op[] = {realloc_dram, realloc_tx, realloc_pmem};
 
 static fn_op_t add_range_op[] = {add_range_tx, add_range_nested_tx};
 
+static fn_op_t write_op[] = {write_tx, write_nested_tx};
+
 static fn_parse_t parse_op[] = {parse_op_mode, parse_op_mode_add_range};
 
 static fn_op_t nestings[] = {obj_op_sim, obj_op_tx};
@@ -675,6 +760,19 @@ off_range(struct obj_tx_bench *obj_bench, size_t idx)
 	return offset;
 }
 
+/*
+ * off_field -- returns offset for small field in object.
+ */
+static struct offset
+off_field(struct obj_tx_bench *obj_bench, size_t idx)
+{
+	struct offset offset;
+	size_t n_fields = obj_bench->sizes[0] / FIELD_STRIDE;
+	offset.size = FIELD_SIZE;
+	offset.off = (idx % n_fields) * FIELD_STRIDE;
+	return offset;
+}
+
 /*
  * rand_values -- allocates array and if range mode calculates random
  * values as allocation sizes for each object otherwise populates whole array
@@ -823,6 +921,23 @@ obj_tx_exit_worker(struct benchmark *bench, struct benchmark_args *args,
 	free(obj_worker);
 }
 
+/*
+ * obj_tx_write_op -- main operations of the obj_tx_write benchmark.
+ */
+static int
+obj_tx_write_op(struct benchmark *bench, struct operation_info *info)
+{
+	struct obj_tx_bench *obj_bench =
+		(struct obj_tx_bench *)pmembench_get_priv(bench);
+	struct obj_tx_worker *obj_worker =
+		(struct obj_tx_worker *)info->worker->priv;
+	if (write_op[obj_bench->lib_op](obj_bench, info->worker,
+					info->index) != 0)
+		return -1;
+	obj_worker->tx_level = 0;
+	return 0;
+}
+
 /*
  * obj_tx_add_range_init -- specific part of the obj_tx_add_range
  * benchmark initialization.
@@ -854,13 +969,65 @@ obj_tx_add_range_init(struct benchmark *bench, struct benchmark_args *args)
 
 		obj_bench->sizes[0] = args->dsize;
 	}
+	if (obj_bench->op_mode == OP_MODE_ONE_OBJ_FIELDS) {
+		obj_bench->fn_off = off_field;
+		if (args->dsize < FIELD_STRIDE)
+			args->dsize = FIELD_STRIDE;
+
+		obj_bench->sizes[0] = args->dsize;
+	}
 	obj_bench->lib_op = (obj_bench->op_mode == OP_MODE_ONE_OBJ ||
+			     obj_bench->op_mode == OP_MODE_ONE_OBJ_FIELDS ||
 			     obj_bench->op_mode == OP_MODE_ALL_OBJ)
 		? ADD_RANGE_MODE_ONE_TX
 		: ADD_RANGE_MODE_NESTED_TX;
 	return 0;
 }
 
+/*
+ * obj_tx_write_init -- specific part of the obj_tx_write benchmark
+ * initialization.
+ */
+static int
+obj_tx_write_init(struct benchmark *bench, struct benchmark_args *args)
+{
+	struct obj_tx_args *obj_args = (struct obj_tx_args *)args->opts;
+
+	enum pobj_tx_mode mode;
+	if (strcmp(obj_args->tx_mode, "undo") == 0) {
+		mode = POBJ_TX_MODE_UNDO;
+	} else if (strcmp(obj_args->tx_mode, "redo") == 0) {
+		mode = POBJ_TX_MODE_REDO;
+	} else {
+		fprintf(stderr, "unknown tx mode\n");
+		return -1;
+	}
+
+	if (obj_tx_add_range_init(bench, args) != 0)
+		return -1;
+
+	struct obj_tx_bench *obj_bench =
+		(struct obj_tx_bench *)pmembench_get_priv(bench);
+
+	if (pmemobj_ctl_set(obj_bench->pop, "tx.mode", &mode) != 0) {
+		perror("pmemobj_ctl_set");
+		goto err;
+	}
+
+	obj_bench->wbuf = (char *)malloc(args->dsize);
+	if (obj_bench->wbuf == NULL) {
+		perror("malloc");
+		goto err;
+	}
+	memset(obj_bench->wbuf, 0xc5, args->dsize);
+
+	return 0;
+
+err:
+	obj_tx_exit(bench, args);
+	return -1;
+}
+
 /*
  * obj_tx_free_init -- specific part of the obj_tx_free initialization.
  */
@@ -1077,13 +1244,29 @@ obj_tx_realloc_exit(struct benchmark *bench, struct benchmark_args *args)
 	return obj_tx_exit(bench, args);
 }
 
+/*
+ * obj_tx_write_exit -- exit function of the obj_tx_write benchmark.
+ */
+static int
+obj_tx_write_exit(struct benchmark *bench, struct benchmark_args *args)
+{
+	struct obj_tx_bench *obj_bench =
+		(struct obj_tx_bench *)pmembench_get_priv(bench);
+	free(obj_bench->wbuf);
+	return obj_tx_exit(bench, args);
+}
+
 /* Array defining common command line arguments. */
 static struct benchmark_clo obj_tx_clo[8];
 
+/* Arguments of the obj_tx_add_range benchmark and the transaction mode */
+static struct benchmark_clo obj_tx_write_clo[4];
+
 static struct benchmark_info obj_tx_alloc;
 static struct benchmark_info obj_tx_free;
 static struct benchmark_info obj_tx_realloc;
 static struct benchmark_info obj_tx_add_range;
+static struct benchmark_info obj_tx_write;
 
 CONSTRUCTOR(pmemobj_tx_constructor)
 void
@@ -1236,4 +1419,29 @@ pmemobj_tx_constructor(void)
 	obj_tx_add_range.rm_file = true;
 	obj_tx_add_range.allow_poolset = true;
 	REGISTER_BENCHMARK(obj_tx_add_range);
+
+	memcpy(obj_tx_write_clo, obj_tx_clo, 3 * sizeof(obj_tx_clo[0]));
+	obj_tx_write_clo[3].opt_short = 'M';
+	obj_tx_write_clo[3].opt_long = "tx-mode";
+	obj_tx_write_clo[3].descr = "Transaction mode - undo, redo";
+	obj_tx_write_clo[3].def = "undo";
+	obj_tx_write_clo[3].off = clo_field_offset(struct obj_tx_args, tx_mode);
+	obj_tx_write_clo[3].type = CLO_TYPE_STR;
+
+	obj_tx_write.name = "obj_tx_write";
+	obj_tx_write.brief = "pmemobj_tx_write() benchmark";
+	obj_tx_write.init = obj_tx_write_init;
+	obj_tx_write.exit = obj_tx_write_exit;
+	obj_tx_write.multithread = true;
+	obj_tx_write.multiops = false;
+	obj_tx_write.init_worker = obj_tx_init_worker_alloc_obj;
+	obj_tx_write.free_worker = obj_tx_exit_worker;
+	obj_tx_write.operation = obj_tx_write_op;
+	obj_tx_write.measure_time = true;
+	obj_tx_write.clos = obj_tx_write_clo;
+	obj_tx_write.nclos = ARRAY_SIZE(obj_tx_write_clo);
+	obj_tx_write.opts_size = sizeof(struct obj_tx_args);
+	obj_tx_write.rm_file = true;
+	obj_tx_write.allow_poolset = true;
+	REGISTER_BENCHMARK(obj_tx_write);
 }
@@ -0,0 +1,175 @@
+/*
+ * Copyright 2018, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * os_numa_linux.c -- Linux abstraction layer for NUMA topology discovery
+ */
+
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <limits.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include "os.h"
+#include "out.h"
+#include "os_numa.h"
+
+#define CPU_DEVICE_PATH "/sys/devices/system/cpu"
+#define NODE_CPULIST_FMT "/sys/devices/system/node/node%d/cpulist"
+
+/* flags of the get_mempolicy system call, see numaif.h */
+#define NUMA_MPOL_F_NODE (1 << 0)
+#define NUMA_MPOL_F_ADDR (1 << 1)
+
+/*
+ * os_numa_cpu -- returns the CPU on which the calling thread is running,
+ *	-1 if unknown
+ */
+int
+os_numa_cpu(void)
+{
+	return sched_getcpu();
+}
+
+/*
+ * os_numa_node_of_cpu -- returns the NUMA node of the given CPU, -1 if unknown
+ *
+ * Each CPU directory in sysfs contains a "nodeN" link to its NUMA node.
+ */
+int
+os_numa_node_of_cpu(unsigned cpu)
+{
+	char path[PATH_MAX];
+	if (snprintf(path, PATH_MAX, CPU_DEVICE_PATH "/cpu%u", cpu) < 0)
+		return -1;
+
+	DIR *dir = opendir(path);
+	if (dir == NULL) {
+		LOG(4, "!opendir %s", path);
+		return -1;
+	}
+
+	int node = -1;
+	struct dirent *d;
+	while ((d = readdir(dir)) != NULL) {
+		if (strncmp(d->d_name, "node", strlen("node")) != 0)
+			continue;
+
+		char *end;
+		long n = strtol(d->d_name + strlen("node"), &end, 10);
+		if (*end == '\0' && n >= 0 && n <= INT_MAX) {
+			node = (int)n;
+			break;
+		}
+	}
+
+	closedir(dir);
+
+	return node;
+}
+
+/*
+ * os_numa_node_of_addr -- returns the NUMA node of the memory backing the
+ *	given address, -1 if unknown
+ */
+int
+os_numa_node_of_addr(const void *addr)
+{
+#ifdef SYS_get_mempolicy
+	int node = -1;
+	if (syscall(SYS_get_mempolicy, &node, NULL, 0, addr,
+		NUMA_MPOL_F_NODE | NUMA_MPOL_F_ADDR) != 0) {
+		LOG(4, "!get_mempolicy %p", addr);
+		return -1;
+	}
+
+	return node;
+#else
+	return -1;
+#endif
+}
+
+/*
+ * os_numa_node_cpuset -- fills the set with the CPUs of the NUMA node,
+ *	returns the number of CPUs in the set or -1 if unknown
+ */
+int
+os_numa_node_cpuset(int node, os_cpu_set_t *set)
+{
+	char path[sizeof(NODE_CPULIST_FMT) + 16];
+	if (snprintf(path, sizeof(path), NODE_CPULIST_FMT, node) < 0)
+		return -1;
+
+	FILE *f = os_fopen(path, "r");
+	if (f == NULL) {
+		LOG(4, "!%s", path);
+		return -1;
+	}
+
+	os_cpu_zero(set);
+
+	int ncpus = 0;
+	unsigned long first;
+	unsigned long last;
+	int c;
+
+	/* the list looks like "0-3,8-11" */
+	while (fscanf(f, "%lu", &first) == 1) {
+		last = first;
+		c = fgetc(f);
+		if (c == '-') {
+			if (fscanf(f, "%lu", &last) != 1)
+				break;
+			c = fgetc(f);
+		}
+
+		for (unsigned long cpu = first; cpu <= last; ++cpu) {
+			if (cpu >= sizeof(os_cpu_set_t) * 8)
+				break;
+			os_cpu_set(cpu, set);
+			ncpus++;
+		}
+
+		if (c != ',')
+			break;
+	}
+
+	(void) fclose(f);
+
+	return ncpus ? ncpus : -1;
+}
@@ -0,0 +1,103 @@
+/*
+ * Copyright 2018, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * os_numa_windows.c -- Windows abstraction layer for NUMA topology discovery
+ */
+
+#include <windows.h>
+#include <psapi.h>
+
+#include "out.h"
+#include "os_numa.h"
+
+/*
+ * os_numa_cpu -- returns the CPU on which the calling thread is running
+ */
+int
+os_numa_cpu(void)
+{
+	PROCESSOR_NUMBER p;
+	GetCurrentProcessorNumberEx(&p);
+
+	return (int)p.Group * 64 + (int)p.Number;
+}
+
+/*
+ * os_numa_node_of_cpu -- returns the NUMA node of the given CPU, -1 if unknown
+ */
+int
+os_numa_node_of_cpu(unsigned cpu)
+{
+	PROCESSOR_NUMBER p;
+	p.Group = (WORD)(cpu / 64);
+	p.Number = (BYTE)(cpu % 64);
+	p.Reserved = 0;
+
+	USHORT node;
+	if (!GetNumaProcessorNodeEx(&p, &node) || node == MAXUSHORT)
+		return -1;
+
+	return (int)node;
+}
+
+/*
+ * os_numa_node_of_addr -- returns the NUMA node of the memory backing the
+ *	given address, -1 if unknown
+ */
+int
+os_numa_node_of_addr(const void *addr)
+{
+	PSAPI_WORKING_SET_EX_INFORMATION info;
+	info.VirtualAddress = (PVOID)addr;
+
+	if (!QueryWorkingSetEx(GetCurrentProcess(), &info, sizeof(info))) {
+		LOG(4, "QueryWorkingSetEx %p failed", addr);
+		return -1;
+	}
+
+	if (!info.VirtualAttributes.Valid)
+		return -1;
+
+	return (int)info.VirtualAttributes.Node;
+}
+
+/*
+ * os_numa_node_cpuset -- fills the set with the CPUs of the NUMA node
+ *
+ * XXX not implemented on Windows.
+ */
+int
+os_numa_node_cpuset(int node, os_cpu_set_t *set)
+{
+	return -1;
+}
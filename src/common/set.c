@@ -2309,6 +2309,90 @@ util_header_create(struct pool_set *set, unsigned repidx, unsigned partidx,
 	return 0;
 }
 
+/*
+ * util_header_incompat_set -- (internal) sets incompat feature flags in
+ *	a writable pool header
+ */
+static void
+util_header_incompat_set(struct pool_hdr *hdrp, uint32_t incompat,
+	int is_pmem)
+{
+	uint32_t features = le32toh(hdrp->incompat_features) | incompat;
+	hdrp->incompat_features = htole32(features);
+
+	util_checksum(hdrp, sizeof(*hdrp), &hdrp->checksum,
+		1, POOL_HDR_CSUM_END_OFF);
+
+	util_persist_auto(is_pmem, hdrp, sizeof(*hdrp));
+}
+
+/*
+ * util_poolset_incompat_set -- sets incompat feature flags in the headers of
+ *	all parts of an open pool set
+ *
+ * The header of the first part of each replica is updated through the mapping
+ * of the pool, and is made writable if needed. The headers of the remaining
+ * parts are mapped temporarily, and updated before the first one.
+ *
+ * The update is not atomic. If interrupted, the parts can be left with
+ * different flags, which makes the pool set fail the header check on open.
+ */
+int
+util_poolset_incompat_set(struct pool_set *set, uint32_t incompat)
+{
+	LOG(3, "set %p incompat %#x", set, incompat);
+
+	for (unsigned r = 0; r < set->nreplicas; r++) {
+		if (set->replica[r]->remote) {
+			ERR("cannot update the headers of remote replicas");
+			errno = ENOTSUP;
+			return -1;
+		}
+	}
+
+	for (unsigned r = 0; r < set->nreplicas; r++) {
+		struct pool_replica *rep = set->replica[r];
+
+		for (unsigned p = 1; p < rep->nhdrs; p++) {
+			struct pool_set_part *part = &rep->part[p];
+
+			/*
+			 * The descriptors are closed once the pool is open,
+			 * but the mappings still hold the lock of the file,
+			 * so the part is reopened without taking it again.
+			 */
+			int opened = part->fd == -1;
+			if (opened) {
+				part->fd = os_open(part->path, O_RDWR);
+				if (part->fd < 0) {
+					ERR("!open \"%s\"", part->path);
+					part->fd = -1;
+					return -1;
+				}
+			}
+
+			int ret = util_map_hdr(part, MAP_SHARED, 0);
+			if (ret == 0) {
+				util_header_incompat_set(part->hdr, incompat,
+					rep->is_pmem);
+				util_unmap_hdr(part);
+			}
+
+			if (opened)
+				util_part_fdclose(part);
+
+			if (ret != 0)
+				return -1;
+		}
+
+		struct pool_hdr *hdrp = rep->part[0].addr;
+		RANGE_RW(hdrp, sizeof(*hdrp), rep->part[0].is_dev_dax);
+		util_header_incompat_set(hdrp, incompat, rep->is_pmem);
+	}
+
+	return 0;
+}
+
 /*
  * util_header_check -- (internal) validate header of a single pool set file
  */
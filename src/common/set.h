@@ -281,6 +281,8 @@ int util_unmap_parts(struct pool_replica *rep, unsigned start_index,
 int util_header_create(struct pool_set *set, unsigned repidx, unsigned partidx,
 	const struct pool_attr *attr, int overwrite);
 
+int util_poolset_incompat_set(struct pool_set *set, uint32_t incompat);
+
 int util_map_hdr(struct pool_set_part *part, int flags, int rdonly);
 int util_unmap_hdr(struct pool_set_part *part);
 
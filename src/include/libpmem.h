@@ -56,6 +56,8 @@
 #define pmem_errormsg pmem_errormsgU
 #endif
 
+#else
+#include <sys/uio.h>
 #endif
 
 #ifdef __cplusplus
@@ -99,6 +101,9 @@ int pmem_deep_drain(const void *addr, size_t len);
 int pmem_deep_persist(const void *addr, size_t len);
 void pmem_drain(void);
 int pmem_has_hw_drain(void);
+void pmem_persistv(const struct iovec *iov, int iovcnt);
+unsigned long long pmem_flush_async(const void *addr, size_t len);
+int pmem_wait(unsigned long long token);
 
 void *pmem_memmove_persist(void *pmemdest, const void *src, size_t len);
 void *pmem_memcpy_persist(void *pmemdest, const void *src, size_t len);
@@ -107,6 +112,17 @@ void *pmem_memmove_nodrain(void *pmemdest, const void *src, size_t len);
 void *pmem_memcpy_nodrain(void *pmemdest, const void *src, size_t len);
 void *pmem_memset_nodrain(void *pmemdest, int c, size_t len);
 
+/*
+ * a single copy performed by pmem_memcpy_persistv()
+ */
+struct pmem_memcpy_desc {
+	void *pmemdest;
+	const void *src;
+	size_t len;
+};
+
+void pmem_memcpy_persistv(const struct pmem_memcpy_desc *descs, int count);
+
 #define PMEM_MEM_NODRAIN	(1U << 0)
 
 #define PMEM_MEM_NONTEMPORAL	(1U << 1)
@@ -115,6 +131,14 @@ void *pmem_memset_nodrain(void *pmemdest, int c, size_t len);
 #define PMEM_MEM_WC		(1U << 3)
 #define PMEM_MEM_WB		(1U << 4)
 
+#define PMEM_MEM_PARALLEL	(1U << 5)
+
+size_t pmem_get_movnt_threshold(const void *addr);
+int pmem_set_movnt_threshold(const void *addr, size_t len, size_t threshold);
+
+unsigned pmem_get_parallel_threads(void);
+int pmem_set_parallel_threads(unsigned nthreads);
+
 void *pmem_memmove(void *pmemdest, const void *src, size_t len, unsigned flags);
 void *pmem_memcpy(void *pmemdest, const void *src, size_t len, unsigned flags);
 void *pmem_memset(void *pmemdest, int c, size_t len, unsigned flags);
@@ -139,8 +139,27 @@ size_t pmemblk_bsize(PMEMblkpool *pbp);
 size_t pmemblk_nblock(PMEMblkpool *pbp);
 int pmemblk_read(PMEMblkpool *pbp, void *buf, long long blockno);
 int pmemblk_write(PMEMblkpool *pbp, const void *buf, long long blockno);
+
+/*
+ * a single block transferred by pmemblk_readv() or pmemblk_writev()
+ */
+struct pmemblk_iov {
+	void *buf;
+	long long blockno;
+};
+
+int pmemblk_readv(PMEMblkpool *pbp, const struct pmemblk_iov *iov, int iovcnt);
+int pmemblk_writev(PMEMblkpool *pbp, const struct pmemblk_iov *iov,
+		int iovcnt);
+int pmemblk_write_range(PMEMblkpool *pbp, const void *buf, long long blockno,
+		size_t count);
+
 int pmemblk_set_zero(PMEMblkpool *pbp, long long blockno);
 int pmemblk_set_error(PMEMblkpool *pbp, long long blockno);
+int pmemblk_set_zero_range(PMEMblkpool *pbp, long long blockno,
+		size_t count);
+int pmemblk_set_error_range(PMEMblkpool *pbp, long long blockno,
+		size_t count);
 
 /*
  * Passing NULL to pmemblk_set_funcs() tells libpmemblk to continue to use the
@@ -71,9 +71,14 @@ struct pobj_action {
 	};
 };
 
+/*
+ * The number of actions that can be published without extending the redo log,
+ * larger collections require additional space allocated from the pool.
+ */
 #define POBJ_MAX_ACTIONS 60
 #define POBJ_ACTION_XRESERVE_VALID_FLAGS\
 	(POBJ_XALLOC_CLASS_MASK | POBJ_XALLOC_ZERO)
+#define POBJ_XPUBLISH_VALID_FLAGS ((uint64_t)0)
 
 PMEMoid pmemobj_reserve(PMEMobjpool *pop, struct pobj_action *act,
 	size_t size, uint64_t type_num);
@@ -84,6 +89,8 @@ void pmemobj_set_value(PMEMobjpool *pop, struct pobj_action *act,
 
 void pmemobj_publish(PMEMobjpool *pop, struct pobj_action *actv,
 	size_t actvcnt);
+int pmemobj_xpublish(PMEMobjpool *pop, struct pobj_action *actv,
+	size_t actvcnt, uint64_t flags);
 int pmemobj_tx_publish(struct pobj_action *actv, size_t actvcnt);
 
 void pmemobj_cancel(PMEMobjpool *pop, struct pobj_action *actv, size_t actvcnt);
@@ -38,6 +38,7 @@
 #define LIBPMEMOBJ_CTL_H 1
 
 #include <stddef.h>
+#include <stdint.h>
 #include <sys/types.h>
 
 #include <libpmemobj/base.h>
@@ -164,6 +165,191 @@ struct pobj_alloc_class_desc {
 	unsigned class_id;
 };
 
+/*
+ * Transaction mode, set by the tx.mode entry point
+ */
+enum pobj_tx_mode {
+	/*
+	 * Ranges modified by pmemobj_tx_write are snapshotted in the undo log
+	 * and written in place, just like with TX_MEMCPY.
+	 */
+	POBJ_TX_MODE_UNDO,
+	/*
+	 * New values passed to pmemobj_tx_write are buffered in volatile
+	 * memory, stored in the pool once on commit and then applied.
+	 * The modified ranges keep their old content until the commit.
+	 */
+	POBJ_TX_MODE_REDO,
+
+	MAX_POBJ_TX_MODES
+};
+
+/*
+ * Latency statistics
+ *
+ * Returned by the stats.tx.*_latency and stats.heap.*_latency entry points.
+ * The measurements are kept in per-lane histograms with buckets 25% wide,
+ * so the percentiles are approximate: each of them is the highest value of
+ * the bucket in which the percentile falls. All the values are in
+ * nanoseconds.
+ */
+struct pobj_stats_latency {
+	uint64_t count; /* number of measured operations */
+	uint64_t avg;
+	uint64_t p50;
+	uint64_t p90;
+	uint64_t p99;
+	uint64_t p999;
+	uint64_t max;
+};
+
+/*
+ * Occupancy of an allocation class
+ *
+ * Returned by the stats.heap.alloc_class.[class_id].occupancy entry point.
+ * The huge allocation class (id 0) hands out whole chunks, its unit is
+ * a single chunk and it has no runs, so only the allocated units are set.
+ */
+struct pobj_stats_alloc_class {
+	size_t unit_size;
+	size_t units_per_run;
+	size_t runs; /* number of runs in use */
+	size_t allocated_units;
+	size_t free_units; /* number of free units in the runs */
+	unsigned fill; /* average fill of the runs, in percent */
+};
+
+/*
+ * Summary of the heap occupancy
+ *
+ * Returned by the stats.heap.fragmentation entry point. Only the zones of
+ * the heap that have already been populated are taken into account.
+ */
+struct pobj_stats_fragmentation {
+	size_t heap_bytes; /* size of the heap */
+	size_t run_bytes; /* bytes in chunks used by runs */
+	size_t run_free_bytes; /* free bytes inside of the runs */
+	size_t huge_bytes; /* bytes in chunks used by huge allocations */
+	size_t free_bytes; /* bytes in free chunks */
+	/*
+	 * Percent of the free memory that is stranded inside of runs
+	 * and can only be used by their allocation classes.
+	 */
+	unsigned fragmentation;
+};
+
+#define POBJ_HEAP_WALK_HIST_SIZE 32
+
+enum pobj_heap_chunk_type {
+	POBJ_HEAP_CHUNK_FREE,
+	POBJ_HEAP_CHUNK_HUGE, /* a single huge allocation */
+	POBJ_HEAP_CHUNK_RUN,
+
+	MAX_POBJ_HEAP_CHUNK_TYPES
+};
+
+/*
+ * A contiguous range of chunks, reported by the heap.walk entry point
+ */
+struct pobj_heap_chunk {
+	unsigned zone_id;
+	unsigned chunk_id;
+	unsigned nchunks; /* length of the range, in chunks */
+	enum pobj_heap_chunk_type type;
+
+	/*
+	 * The allocation class of a run, -1 if the class is not defined
+	 * at runtime. The units are only set for runs.
+	 */
+	int class_id;
+	size_t unit_size;
+	unsigned units;
+	unsigned free_units;
+};
+
+typedef void (*pobj_heap_walk_cb)(PMEMobjpool *pop,
+	const struct pobj_heap_chunk *chunk, void *arg);
+
+/*
+ * Occupancy map of the heap, produced by the heap.walk entry point
+ */
+struct pobj_heap_walk {
+	/*
+	 * Optional callback, called for every range of chunks in the heap,
+	 * in the order of addresses.
+	 */
+	pobj_heap_walk_cb cb;
+	void *arg;
+
+	/*
+	 * The number of chunk ranges of each type. Set by the library.
+	 */
+	size_t nranges[MAX_POBJ_HEAP_CHUNK_TYPES];
+
+	/*
+	 * The number of chunks of each type. Set by the library.
+	 */
+	size_t nchunks[MAX_POBJ_HEAP_CHUNK_TYPES];
+
+	/*
+	 * Histogram of the free chunk ranges: the element i counts ranges
+	 * of at least 2^i and less than 2^(i+1) chunks. Set by the library.
+	 */
+	size_t free_hist[POBJ_HEAP_WALK_HIST_SIZE];
+};
+
+/*
+ * Heap fragmentation
+ *
+ * Returned by the heap.defrag.fragmentation entry point. Only the memory
+ * in runs, the chunks which are split into units of an allocation class,
+ * is taken into account. A run is sparse if it is in use, but at most
+ * heap.defrag.threshold percent of its units are allocated.
+ */
+struct pobj_defrag_fragmentation {
+	size_t runs; /* number of runs in the heap */
+	size_t sparse_runs; /* number of runs that can be compacted */
+	size_t run_bytes; /* number of bytes in all the runs */
+	size_t free_bytes; /* number of free bytes in all the runs */
+	size_t sparse_bytes; /* number of allocated bytes in sparse runs */
+};
+
+/*
+ * Relocation callback, called from within the transaction that moves
+ * the object, after its content was copied and before the old object
+ * is freed. The application is expected to update all of its references
+ * to the object, for example using pmemobj_tx_add_range.
+ */
+typedef void (*pobj_defrag_relocation)(PMEMobjpool *pop, PMEMoid oldoid,
+	PMEMoid newoid, void *arg);
+
+/*
+ * Compaction of sparse runs, performed by the heap.defrag.run entry point
+ */
+struct pobj_defrag {
+	/*
+	 * The maximum number of objects to relocate, 0 means no limit.
+	 */
+	size_t max_objects;
+
+	/*
+	 * The callback invoked for every relocated object, must be set.
+	 */
+	pobj_defrag_relocation relocated;
+	void *arg;
+
+	/*
+	 * The number of objects that were relocated. Set by the library.
+	 */
+	size_t objects;
+
+	/*
+	 * The number of sparse runs that no longer contain any objects.
+	 * Set by the library.
+	 */
+	size_t runs;
+};
+
 #ifndef _WIN32
 /* EXPERIMENTAL */
 int pmemobj_ctl_get(PMEMobjpool *pop, const char *name, void *arg);
@@ -214,6 +214,20 @@ int pmemobj_tx_xadd_range(PMEMoid oid, uint64_t off, size_t size,
  */
 int pmemobj_tx_xadd_range_direct(const void *ptr, size_t size, uint64_t flags);
 
+/*
+ * Transactionally copies 'size' bytes from 'src' to the persistent memory
+ * range 'dest'. Depending on the tx.mode CTL, the range is either snapshotted
+ * and modified immediately, or the new content is buffered and written to
+ * the pool on commit. The supplied block of memory has to be within the
+ * pool.
+ *
+ * If successful, returns zero.
+ * Otherwise, state changes to TX_STAGE_ONABORT and an error number is returned.
+ *
+ * This function must be called during TX_STAGE_WORK.
+ */
+int pmemobj_tx_write(void *dest, const void *src, size_t size);
+
 /*
  * Transactionally allocates a new object.
  *
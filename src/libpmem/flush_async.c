@@ -0,0 +1,389 @@
+/*
+ * Copyright 2018, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * flush_async.c -- asynchronous flushing of pmem ranges
+ *
+ * Ranges passed to pmem_flush_async() are split into chunks, which are
+ * queued in a ring of requests and flushed by a pool of background threads
+ * using the same flush and fence functions as pmem_persist(). Each chunk gets
+ * a sequence number and the number of the last chunk of a range is returned
+ * as its token.
+ *
+ * Chunks may complete out of order, but the completion watermark advances
+ * only over contiguous completed chunks, so waiting for a token also waits
+ * for all the ranges queued before it.
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "libpmem.h"
+#include "flush_async.h"
+#include "os.h"
+#include "os_thread.h"
+#include "out.h"
+#include "sys_util.h"
+#include "valgrind_internal.h"
+
+/* number of flush requests which can be queued at the same time */
+#define FLUSH_ASYNC_RING 1024
+
+/* maximum length of a range flushed by one worker at a time */
+#define FLUSH_ASYNC_CHUNK ((size_t)(256 * 1024))
+
+#define FLUSH_ASYNC_THREADS_DEFAULT 1
+#define FLUSH_ASYNC_THREADS_MAX 64
+
+struct flush_request {
+	const void *addr;
+	size_t len;
+	int done;
+};
+
+static struct {
+	os_mutex_t lock;
+	os_cond_t work; /* signalled when a request is queued */
+	os_cond_t done; /* signalled when the completion watermark moves */
+
+	flush_func flush;
+	predrain_fence_func fence;
+
+	unsigned nthreads; /* requested number of workers */
+	unsigned nrunning; /* number of started workers */
+	os_thread_t *threads;
+	int stop;
+
+	uint64_t next; /* sequence number of the next request */
+	uint64_t taken; /* last request taken by a worker */
+	uint64_t completed; /* all requests up to this one are done */
+
+	struct flush_request ring[FLUSH_ASYNC_RING];
+} Flush_async;
+
+/*
+ * flush_async_worker -- (internal) flush the queued requests
+ */
+static void *
+flush_async_worker(void *arg)
+{
+	(void) arg;
+
+	util_mutex_lock(&Flush_async.lock);
+
+	while (1) {
+		while (!Flush_async.stop &&
+				Flush_async.taken + 1 == Flush_async.next)
+			os_cond_wait(&Flush_async.work, &Flush_async.lock);
+
+		/* the queued requests are always flushed before exiting */
+		if (Flush_async.taken + 1 == Flush_async.next)
+			break;
+
+		uint64_t seq = ++Flush_async.taken;
+		struct flush_request *req =
+			&Flush_async.ring[seq % FLUSH_ASYNC_RING];
+
+		util_mutex_unlock(&Flush_async.lock);
+
+		Flush_async.flush(req->addr, req->len);
+		Flush_async.fence();
+
+		util_mutex_lock(&Flush_async.lock);
+
+		req->done = 1;
+
+		uint64_t completed = Flush_async.completed;
+		while (completed + 1 < Flush_async.next) {
+			struct flush_request *r =
+				&Flush_async.ring[(completed + 1) %
+					FLUSH_ASYNC_RING];
+			if (!r->done)
+				break;
+
+			r->done = 0;
+			completed++;
+		}
+
+		if (completed != Flush_async.completed) {
+			Flush_async.completed = completed;
+			os_cond_broadcast(&Flush_async.done);
+		}
+	}
+
+	util_mutex_unlock(&Flush_async.lock);
+
+	return NULL;
+}
+
+/*
+ * flush_async_start -- (internal) start the workers, if not started yet
+ *
+ * Must be called with the lock held. Returns the number of running workers.
+ */
+static unsigned
+flush_async_start(void)
+{
+	if (Flush_async.nrunning != 0 || Flush_async.nthreads == 0)
+		return Flush_async.nrunning;
+
+	Flush_async.threads = Malloc(Flush_async.nthreads *
+			sizeof(*Flush_async.threads));
+	if (Flush_async.threads == NULL) {
+		ERR("!Malloc");
+		Flush_async.nthreads = 0;
+		return 0;
+	}
+
+	for (unsigned i = 0; i < Flush_async.nthreads; ++i) {
+		errno = os_thread_create(&Flush_async.threads[i], NULL,
+				flush_async_worker, NULL);
+		if (errno) {
+			ERR("!os_thread_create");
+			break;
+		}
+
+		Flush_async.nrunning++;
+	}
+
+	if (Flush_async.nrunning == 0) {
+		/* fall back to synchronous flushing for good */
+		Free(Flush_async.threads);
+		Flush_async.threads = NULL;
+		Flush_async.nthreads = 0;
+	}
+
+	LOG(3, "started %u flushing threads", Flush_async.nrunning);
+
+	return Flush_async.nrunning;
+}
+
+/*
+ * pmem_flush_async -- start flushing the given range in the background
+ *
+ * Returns a token to be passed to pmem_wait(). If there are no background
+ * threads the range is flushed synchronously and the returned token is 0.
+ */
+unsigned long long
+pmem_flush_async(const void *addr, size_t len)
+{
+	LOG(15, "addr %p len %zu", addr, len);
+
+	VALGRIND_DO_CHECK_MEM_IS_ADDRESSABLE(addr, len);
+
+	if (len == 0)
+		return 0;
+
+	util_mutex_lock(&Flush_async.lock);
+
+	if (flush_async_start() == 0) {
+		util_mutex_unlock(&Flush_async.lock);
+		Flush_async.flush(addr, len);
+		return 0;
+	}
+
+	uint64_t seq = 0;
+	for (size_t off = 0; off < len; off += FLUSH_ASYNC_CHUNK) {
+		/* wait for a free slot */
+		while (Flush_async.next - Flush_async.completed >
+				FLUSH_ASYNC_RING)
+			os_cond_wait(&Flush_async.done, &Flush_async.lock);
+
+		seq = Flush_async.next++;
+		struct flush_request *req =
+			&Flush_async.ring[seq % FLUSH_ASYNC_RING];
+
+		req->addr = (const char *)addr + off;
+		req->len = len - off < FLUSH_ASYNC_CHUNK ?
+				len - off : FLUSH_ASYNC_CHUNK;
+		req->done = 0;
+
+		os_cond_signal(&Flush_async.work);
+	}
+
+	util_mutex_unlock(&Flush_async.lock);
+
+	return seq;
+}
+
+/*
+ * pmem_wait -- wait until the range identified by the token, and all
+ *	the ranges queued before it, are flushed and drained
+ */
+int
+pmem_wait(unsigned long long token)
+{
+	LOG(15, "token %llu", token);
+
+	util_mutex_lock(&Flush_async.lock);
+
+	if (token >= Flush_async.next && token != 0) {
+		util_mutex_unlock(&Flush_async.lock);
+		ERR("invalid token %llu", token);
+		errno = EINVAL;
+		return -1;
+	}
+
+	while (Flush_async.completed < token)
+		os_cond_wait(&Flush_async.done, &Flush_async.lock);
+
+	util_mutex_unlock(&Flush_async.lock);
+
+	/* drain the ranges flushed synchronously by this thread */
+	pmem_drain();
+
+	return 0;
+}
+
+#ifndef _WIN32
+/*
+ * flush_async_prefork -- (internal) hold the lock across fork, so that the
+ *	child gets the state in a consistent shape
+ */
+static void
+flush_async_prefork(void)
+{
+	util_mutex_lock(&Flush_async.lock);
+}
+
+/*
+ * flush_async_postfork_parent -- (internal) release the lock in the parent
+ */
+static void
+flush_async_postfork_parent(void)
+{
+	util_mutex_unlock(&Flush_async.lock);
+}
+
+/*
+ * flush_async_postfork_child -- (internal) reset the state of the workers
+ *	in the child
+ *
+ * The workers are not duplicated by fork, so the child starts its own on the
+ * next call to pmem_flush_async(). The requests which were queued, or were
+ * being flushed by the workers of the parent, are flushed right away, so
+ * that waiting for their tokens in the child does not hang.
+ */
+static void
+flush_async_postfork_child(void)
+{
+	util_mutex_init(&Flush_async.lock);
+	if ((errno = os_cond_init(&Flush_async.work)) != 0)
+		FATAL("!os_cond_init");
+	if ((errno = os_cond_init(&Flush_async.done)) != 0)
+		FATAL("!os_cond_init");
+
+	for (uint64_t seq = Flush_async.completed + 1;
+			seq < Flush_async.next; ++seq) {
+		struct flush_request *req =
+			&Flush_async.ring[seq % FLUSH_ASYNC_RING];
+
+		Flush_async.flush(req->addr, req->len);
+		req->done = 0;
+	}
+	Flush_async.fence();
+
+	Flush_async.taken = Flush_async.next - 1;
+	Flush_async.completed = Flush_async.next - 1;
+
+	Free(Flush_async.threads);
+	Flush_async.threads = NULL;
+	Flush_async.nrunning = 0;
+}
+#endif
+
+/*
+ * flush_async_init -- initialize asynchronous flushing
+ *
+ * The workers are started on the first call to pmem_flush_async().
+ */
+void
+flush_async_init(flush_func flush, predrain_fence_func fence)
+{
+	LOG(3, NULL);
+
+	util_mutex_init(&Flush_async.lock);
+	if ((errno = os_cond_init(&Flush_async.work)) != 0)
+		FATAL("!os_cond_init");
+	if ((errno = os_cond_init(&Flush_async.done)) != 0)
+		FATAL("!os_cond_init");
+
+	Flush_async.flush = flush;
+	Flush_async.fence = fence;
+	Flush_async.next = 1;
+	Flush_async.taken = 0;
+	Flush_async.completed = 0;
+	Flush_async.nthreads = FLUSH_ASYNC_THREADS_DEFAULT;
+
+	char *e = os_getenv("PMEM_FLUSH_ASYNC_THREADS");
+	if (e) {
+		long long val = atoll(e);
+
+		if (val < 0 || val > FLUSH_ASYNC_THREADS_MAX) {
+			LOG(3, "Invalid PMEM_FLUSH_ASYNC_THREADS");
+		} else {
+			LOG(3, "PMEM_FLUSH_ASYNC_THREADS set to %lld", val);
+			Flush_async.nthreads = (unsigned)val;
+		}
+	}
+
+#ifndef _WIN32
+	if ((errno = os_thread_atfork(flush_async_prefork,
+			flush_async_postfork_parent,
+			flush_async_postfork_child)) != 0)
+		FATAL("!os_thread_atfork");
+#endif
+}
+
+/*
+ * flush_async_fini -- stop the workers, after flushing the queued requests
+ */
+void
+flush_async_fini(void)
+{
+	LOG(3, NULL);
+
+	util_mutex_lock(&Flush_async.lock);
+	Flush_async.stop = 1;
+	os_cond_broadcast(&Flush_async.work);
+	util_mutex_unlock(&Flush_async.lock);
+
+	for (unsigned i = 0; i < Flush_async.nrunning; ++i)
+		os_thread_join(&Flush_async.threads[i], NULL);
+
+	Free(Flush_async.threads);
+
+	os_cond_destroy(&Flush_async.done);
+	os_cond_destroy(&Flush_async.work);
+	util_mutex_destroy(&Flush_async.lock);
+}
@@ -0,0 +1,490 @@
+/*
+ * Copyright 2018, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * memops_parallel.c -- memcpy and memset to pmem split across threads
+ *
+ * A single thread copying to persistent memory with non-temporal stores
+ * cannot saturate the write bandwidth of the modules, so operations with the
+ * PMEM_MEM_PARALLEL flag are split into chunks, which are copied by a bounded
+ * pool of worker threads and by the calling thread itself.
+ *
+ * The workers are started on the first parallel operation and are bound to
+ * the CPUs of the NUMA node the destination resides on, if it can be
+ * determined. Each worker fences its own stores after every chunk, so the
+ * caller only has to drain, as for the serial variants.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "libpmem.h"
+#include "memops_parallel.h"
+#include "os.h"
+#include "os_numa.h"
+#include "os_thread.h"
+#include "out.h"
+#include "queue.h"
+#include "sys_util.h"
+#include "util.h"
+
+/* operations shorter than two chunks of this size are not split */
+#define PARALLEL_CHUNK_MIN ((size_t)(4 << 20))
+
+/* chunks are aligned to this size */
+#define PARALLEL_CHUNK_ALIGN ((size_t)4096)
+
+#define PARALLEL_THREADS_DEFAULT 4
+#define PARALLEL_THREADS_MAX 64
+
+enum parallel_op_type {
+	PARALLEL_MEMMOVE,
+	PARALLEL_MEMSET,
+};
+
+struct parallel_op {
+	enum parallel_op_type type;
+	char *dest;
+	const char *src;
+	int c;
+	size_t len;
+	unsigned flags;
+	int node; /* NUMA node of the destination or -1 */
+
+	size_t chunk;
+	unsigned nchunks;
+	unsigned next; /* next chunk to be taken */
+	unsigned done; /* number of copied chunks */
+
+	TAILQ_ENTRY(parallel_op) entry;
+};
+
+struct parallel_worker {
+	os_thread_t thread;
+	int node; /* NUMA node the worker is bound to or -1 */
+};
+
+static struct {
+	os_mutex_t lock;
+	os_cond_t work; /* signalled when an operation is queued */
+	os_cond_t done; /* signalled when an operation is finished */
+
+	memmove_nodrain_func memmove_nodrain;
+	memset_nodrain_func memset_nodrain;
+	predrain_fence_func fence;
+
+	unsigned nthreads; /* number of threads used, including the caller */
+	unsigned nrunning; /* number of started workers */
+	struct parallel_worker workers[PARALLEL_THREADS_MAX - 1];
+	int stop;
+
+	/* operations with chunks not taken yet */
+	TAILQ_HEAD(parallel_ops, parallel_op) ops;
+} Parallel;
+
+/*
+ * parallel_chunk -- (internal) copy one chunk of the operation
+ */
+static void
+parallel_chunk(struct parallel_op *op, unsigned idx)
+{
+	size_t off = (size_t)idx * op->chunk;
+	size_t len = op->len - off < op->chunk ? op->len - off : op->chunk;
+
+	if (op->type == PARALLEL_MEMMOVE)
+		Parallel.memmove_nodrain(op->dest + off, op->src + off, len,
+				op->flags);
+	else
+		Parallel.memset_nodrain(op->dest + off, op->c, len, op->flags);
+}
+
+/*
+ * parallel_take -- (internal) take the next chunk of the operation
+ *
+ * Must be called with the lock held.
+ */
+static unsigned
+parallel_take(struct parallel_op *op)
+{
+	unsigned idx = op->next++;
+	if (op->next == op->nchunks)
+		TAILQ_REMOVE(&Parallel.ops, op, entry);
+
+	return idx;
+}
+
+/*
+ * parallel_bind -- (internal) bind the worker to the CPUs of the node
+ */
+static void
+parallel_bind(struct parallel_worker *w, int node)
+{
+	if (node < 0 || node == w->node)
+		return;
+
+	os_cpu_set_t set;
+	if (os_numa_node_cpuset(node, &set) < 0)
+		return;
+
+	int ret = os_thread_setaffinity_np(&w->thread, sizeof(set), &set);
+	if (ret) {
+		LOG(2, "cannot bind worker to node %d: %d", node, ret);
+		return;
+	}
+
+	w->node = node;
+}
+
+/*
+ * parallel_worker -- (internal) copy the chunks of the queued operations
+ */
+static void *
+parallel_worker(void *arg)
+{
+	struct parallel_worker *w = arg;
+
+	util_mutex_lock(&Parallel.lock);
+
+	while (1) {
+		while (!Parallel.stop && TAILQ_EMPTY(&Parallel.ops))
+			os_cond_wait(&Parallel.work, &Parallel.lock);
+
+		/* the callers finish their operations on their own */
+		if (Parallel.stop)
+			break;
+
+		struct parallel_op *op = TAILQ_FIRST(&Parallel.ops);
+		unsigned idx = parallel_take(op);
+
+		util_mutex_unlock(&Parallel.lock);
+
+		parallel_bind(w, op->node);
+		parallel_chunk(op, idx);
+		Parallel.fence();
+
+		util_mutex_lock(&Parallel.lock);
+
+		if (++op->done == op->nchunks)
+			os_cond_broadcast(&Parallel.done);
+	}
+
+	util_mutex_unlock(&Parallel.lock);
+
+	return NULL;
+}
+
+/*
+ * parallel_start -- (internal) start the missing workers
+ *
+ * Must be called with the lock held. Returns the number of running workers.
+ */
+static unsigned
+parallel_start(void)
+{
+	while (Parallel.nrunning + 1 < Parallel.nthreads) {
+		struct parallel_worker *w =
+			&Parallel.workers[Parallel.nrunning];
+		w->node = -1;
+
+		errno = os_thread_create(&w->thread, NULL, parallel_worker, w);
+		if (errno) {
+			ERR("!os_thread_create");
+			break;
+		}
+
+		Parallel.nrunning++;
+		LOG(3, "started parallel worker %u", Parallel.nrunning);
+	}
+
+	return Parallel.nrunning;
+}
+
+/*
+ * parallel_run -- (internal) perform the operation using the workers
+ *
+ * Returns -1 if the operation is too short to be split.
+ */
+static int
+parallel_run(struct parallel_op *op)
+{
+	util_mutex_lock(&Parallel.lock);
+
+	unsigned nthreads = Parallel.nthreads;
+	if (op->len / PARALLEL_CHUNK_MIN < nthreads)
+		nthreads = (unsigned)(op->len / PARALLEL_CHUNK_MIN);
+
+	if (nthreads < 2) {
+		util_mutex_unlock(&Parallel.lock);
+		return -1;
+	}
+
+	unsigned nworkers = parallel_start();
+	if (nworkers == 0) {
+		util_mutex_unlock(&Parallel.lock);
+		return -1;
+	}
+
+	op->chunk = ALIGN_UP(op->len / nthreads, PARALLEL_CHUNK_ALIGN);
+	op->nchunks = (unsigned)((op->len + op->chunk - 1) / op->chunk);
+	op->next = 0;
+	op->done = 0;
+
+	TAILQ_INSERT_TAIL(&Parallel.ops, op, entry);
+	os_cond_broadcast(&Parallel.work);
+
+	LOG(4, "op %p len %zu chunks %u", op, op->len, op->nchunks);
+
+	/* the caller helps until all the chunks are taken */
+	while (op->next < op->nchunks) {
+		unsigned idx = parallel_take(op);
+
+		util_mutex_unlock(&Parallel.lock);
+		parallel_chunk(op, idx);
+		util_mutex_lock(&Parallel.lock);
+
+		op->done++;
+	}
+
+	while (op->done < op->nchunks)
+		os_cond_wait(&Parallel.done, &Parallel.lock);
+
+	util_mutex_unlock(&Parallel.lock);
+
+	return 0;
+}
+
+/*
+ * memmove_nodrain_parallel -- memmove to pmem using several threads
+ */
+void *
+memmove_nodrain_parallel(void *pmemdest, const void *src, size_t len,
+		unsigned flags)
+{
+	LOG(15, "pmemdest %p src %p len %zu flags 0x%x",
+			pmemdest, src, len, flags);
+
+	const char *d = pmemdest;
+	const char *s = src;
+
+	/* overlapping ranges have to be copied in order */
+	if (len < 2 * PARALLEL_CHUNK_MIN || (d < s + len && s < d + len))
+		return Parallel.memmove_nodrain(pmemdest, src, len, flags);
+
+	struct parallel_op op;
+	op.type = PARALLEL_MEMMOVE;
+	op.dest = pmemdest;
+	op.src = src;
+	op.c = 0;
+	op.len = len;
+	op.flags = flags;
+	op.node = os_numa_node_of_addr(pmemdest);
+
+	if (parallel_run(&op))
+		return Parallel.memmove_nodrain(pmemdest, src, len, flags);
+
+	return pmemdest;
+}
+
+/*
+ * memset_nodrain_parallel -- memset to pmem using several threads
+ */
+void *
+memset_nodrain_parallel(void *pmemdest, int c, size_t len, unsigned flags)
+{
+	LOG(15, "pmemdest %p c 0x%x len %zu flags 0x%x",
+			pmemdest, c, len, flags);
+
+	if (len < 2 * PARALLEL_CHUNK_MIN)
+		return Parallel.memset_nodrain(pmemdest, c, len, flags);
+
+	struct parallel_op op;
+	op.type = PARALLEL_MEMSET;
+	op.dest = pmemdest;
+	op.src = NULL;
+	op.c = c;
+	op.len = len;
+	op.flags = flags;
+	op.node = os_numa_node_of_addr(pmemdest);
+
+	if (parallel_run(&op))
+		return Parallel.memset_nodrain(pmemdest, c, len, flags);
+
+	return pmemdest;
+}
+
+/*
+ * pmem_get_parallel_threads -- return the number of threads used by
+ *	the operations with the PMEM_MEM_PARALLEL flag
+ */
+unsigned
+pmem_get_parallel_threads(void)
+{
+	util_mutex_lock(&Parallel.lock);
+	unsigned nthreads = Parallel.nthreads;
+	util_mutex_unlock(&Parallel.lock);
+
+	return nthreads;
+}
+
+/*
+ * pmem_set_parallel_threads -- set the number of threads used by
+ *	the operations with the PMEM_MEM_PARALLEL flag
+ */
+int
+pmem_set_parallel_threads(unsigned nthreads)
+{
+	LOG(3, "nthreads %u", nthreads);
+
+	if (nthreads == 0 || nthreads > PARALLEL_THREADS_MAX) {
+		ERR("invalid number of threads %u", nthreads);
+		errno = EINVAL;
+		return -1;
+	}
+
+	util_mutex_lock(&Parallel.lock);
+	Parallel.nthreads = nthreads;
+	util_mutex_unlock(&Parallel.lock);
+
+	return 0;
+}
+
+#ifndef _WIN32
+/*
+ * parallel_prefork -- (internal) hold the lock across fork, so that the child
+ *	gets the state in a consistent shape
+ */
+static void
+parallel_prefork(void)
+{
+	util_mutex_lock(&Parallel.lock);
+}
+
+/*
+ * parallel_postfork_parent -- (internal) release the lock in the parent
+ */
+static void
+parallel_postfork_parent(void)
+{
+	util_mutex_unlock(&Parallel.lock);
+}
+
+/*
+ * parallel_postfork_child -- (internal) reset the state of the workers in
+ *	the child
+ *
+ * The workers are not duplicated by fork, so the child starts its own on the
+ * next parallel operation. The operations which were queued belong to the
+ * threads of the parent, none of which exists in the child.
+ */
+static void
+parallel_postfork_child(void)
+{
+	util_mutex_init(&Parallel.lock);
+	if ((errno = os_cond_init(&Parallel.work)) != 0)
+		FATAL("!os_cond_init");
+	if ((errno = os_cond_init(&Parallel.done)) != 0)
+		FATAL("!os_cond_init");
+
+	TAILQ_INIT(&Parallel.ops);
+	Parallel.nrunning = 0;
+}
+#endif
+
+/*
+ * memops_parallel_init -- initialize parallel memcpy and memset
+ */
+void
+memops_parallel_init(memmove_nodrain_func memmove_nodrain,
+		memset_nodrain_func memset_nodrain, predrain_fence_func fence)
+{
+	LOG(3, NULL);
+
+	util_mutex_init(&Parallel.lock);
+	if ((errno = os_cond_init(&Parallel.work)) != 0)
+		FATAL("!os_cond_init");
+	if ((errno = os_cond_init(&Parallel.done)) != 0)
+		FATAL("!os_cond_init");
+
+	TAILQ_INIT(&Parallel.ops);
+
+	Parallel.memmove_nodrain = memmove_nodrain;
+	Parallel.memset_nodrain = memset_nodrain;
+	Parallel.fence = fence;
+
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (cpus < 1)
+		cpus = 1;
+
+	Parallel.nthreads = cpus < PARALLEL_THREADS_DEFAULT ?
+			(unsigned)cpus : PARALLEL_THREADS_DEFAULT;
+
+	char *e = os_getenv("PMEM_PARALLEL_THREADS");
+	if (e) {
+		long long val = atoll(e);
+
+		if (val < 1 || val > PARALLEL_THREADS_MAX) {
+			LOG(3, "Invalid PMEM_PARALLEL_THREADS");
+		} else {
+			LOG(3, "PMEM_PARALLEL_THREADS set to %lld", val);
+			Parallel.nthreads = (unsigned)val;
+		}
+	}
+
+#ifndef _WIN32
+	if ((errno = os_thread_atfork(parallel_prefork,
+			parallel_postfork_parent,
+			parallel_postfork_child)) != 0)
+		FATAL("!os_thread_atfork");
+#endif
+}
+
+/*
+ * memops_parallel_fini -- stop the workers
+ */
+void
+memops_parallel_fini(void)
+{
+	LOG(3, NULL);
+
+	util_mutex_lock(&Parallel.lock);
+	Parallel.stop = 1;
+	os_cond_broadcast(&Parallel.work);
+	util_mutex_unlock(&Parallel.lock);
+
+	for (unsigned i = 0; i < Parallel.nrunning; ++i)
+		os_thread_join(&Parallel.workers[i].thread, NULL);
+
+	os_cond_destroy(&Parallel.done);
+	os_cond_destroy(&Parallel.work);
+	util_mutex_destroy(&Parallel.lock);
+}
@@ -105,6 +105,12 @@
  *
  *	SFENCE unless using CLFLUSH
  *
+ * pmem_flush_async(addr, len)
+ * pmem_wait(token)
+ *
+ *	The flush and drain steps done by background threads, see
+ *	flush_async.c for details
+ *
  *
  * INTERFACES FOR COPYING/SETTING RANGES OF MEMORY
  *
@@ -135,6 +141,21 @@
  *
  *	Calls the appropriate _nodrain() function followed by pmem_drain().
  *
+ * pmem_memmove(), pmem_memcpy(), pmem_memset() with PMEM_MEM_PARALLEL
+ *
+ *	Large operations are split into chunks copied by several threads,
+ *	see memops_parallel.c for details.
+ *
+ * pmem_persistv()
+ *
+ *	Flushes every range of the vector, merging the overlapping and adjacent
+ *	cache lines, followed by a single pmem_drain().
+ *
+ * pmem_memcpy_persistv()
+ *
+ *	Calls pmem_memcpy_nodrain() for every entry of the vector followed by
+ *	a single pmem_drain().
+ *
  *
  * DECISIONS MADE AT INITIALIZATION TIME
  *
@@ -170,9 +191,13 @@
 #include <sys/stat.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <inttypes.h>
+#include <time.h>
 
 #include "libpmem.h"
 #include "pmem.h"
+#include "flush_async.h"
+#include "memops_parallel.h"
 #include "out.h"
 #include "os.h"
 #include "mmap.h"
@@ -180,9 +205,49 @@
 #include "valgrind_internal.h"
 #include "os_deep.h"
 #include "os_auto_flush.h"
+#include "sys_util.h"
 
 static struct pmem_funcs Funcs;
 
+/* minimum length of a memmove/memset which uses non-temporal stores */
+size_t Movnt_threshold = MOVNT_THRESHOLD;
+
+/* calibrate the non-temporal threshold on new mappings */
+int Movnt_calibrate;
+
+/*
+ * Address ranges with their own non-temporal threshold.
+ *
+ * The array is modified only under Movnt_ranges_lock, but it is read without
+ * any locking on every memmove/memset. A reader racing with a modification
+ * may pick a stale threshold, which is harmless, because the threshold only
+ * selects between two equally correct implementations.
+ */
+unsigned Movnt_nranges;
+struct movnt_range Movnt_ranges[MOVNT_RANGES_MAX];
+static os_mutex_t Movnt_ranges_lock;
+
+/*
+ * Calibration is performed at most once for each kind of mapping (persistent
+ * memory or not), on the first such mapping created by pmem_map_file().
+ * It runs on a scratch file created next to the mapped file, never on the
+ * mapping itself.
+ */
+#define CALIBRATE_MIN_LEN ((size_t)64)
+#define CALIBRATE_MAX_LEN ((size_t)(64 * 1024))
+#define CALIBRATE_ROUNDS 64
+#define CALIBRATE_REPEATS 3
+
+struct movnt_calibration {
+	int done; /* calibration was attempted */
+	int valid; /* the threshold was measured */
+	size_t threshold;
+};
+
+static struct movnt_calibration Movnt_calibration[2];
+static unsigned Movnt_calibrated;
+static os_mutex_t Movnt_calibration_lock;
+
 /*
  * pmem_has_hw_drain -- return whether or not HW drain was found
  *
@@ -260,6 +325,94 @@ pmem_persist(const void *addr, size_t len)
 	pmem_drain();
 }
 
+/*
+ * Number of ranges sorted and merged at once by pmem_persistv() -- bounds
+ * the on-stack scratch space, larger vectors are processed in batches.
+ */
+#define PERSISTV_BATCH 64
+
+/*
+ * Granularity at which pmem_persistv() merges adjacent ranges.
+ */
+#define PERSISTV_ALIGN ((uintptr_t)64)
+
+struct persistv_range {
+	uintptr_t start;
+	uintptr_t end;
+};
+
+/*
+ * persistv_flush_batch -- (internal) sort, merge and flush a batch of
+ *	cache line aligned ranges
+ */
+static void
+persistv_flush_batch(struct persistv_range *ranges, int nranges)
+{
+	/* insertion sort, the batches are small and often already sorted */
+	for (int i = 1; i < nranges; ++i) {
+		struct persistv_range r = ranges[i];
+		int j = i - 1;
+		while (j >= 0 && ranges[j].start > r.start) {
+			ranges[j + 1] = ranges[j];
+			--j;
+		}
+		ranges[j + 1] = r;
+	}
+
+	uintptr_t start = ranges[0].start;
+	uintptr_t end = ranges[0].end;
+	for (int i = 1; i < nranges; ++i) {
+		if (ranges[i].start <= end) {
+			/* overlapping or adjacent cache lines */
+			if (ranges[i].end > end)
+				end = ranges[i].end;
+			continue;
+		}
+
+		Funcs.flush((void *)start, end - start);
+		start = ranges[i].start;
+		end = ranges[i].end;
+	}
+
+	Funcs.flush((void *)start, end - start);
+}
+
+/*
+ * pmem_persistv -- make any cached changes to a vector of pmem ranges
+ *	persistent, using a single drain
+ */
+void
+pmem_persistv(const struct iovec *iov, int iovcnt)
+{
+	LOG(15, "iov %p iovcnt %d", iov, iovcnt);
+
+	struct persistv_range ranges[PERSISTV_BATCH];
+	int nranges = 0;
+
+	for (int i = 0; i < iovcnt; ++i) {
+		if (iov[i].iov_len == 0)
+			continue;
+
+		VALGRIND_DO_CHECK_MEM_IS_ADDRESSABLE(iov[i].iov_base,
+				iov[i].iov_len);
+
+		uintptr_t addr = (uintptr_t)iov[i].iov_base;
+		ranges[nranges].start = addr & ~(PERSISTV_ALIGN - 1);
+		ranges[nranges].end = (addr + iov[i].iov_len +
+				PERSISTV_ALIGN - 1) & ~(PERSISTV_ALIGN - 1);
+
+		if (++nranges == PERSISTV_BATCH) {
+			persistv_flush_batch(ranges, nranges);
+			nranges = 0;
+		}
+	}
+
+	if (nranges != 0)
+		persistv_flush_batch(ranges, nranges);
+
+	pmem_drain();
+}
+
 /*
  * pmem_msync -- flush to persistence via msync
  *
@@ -398,6 +551,340 @@ pmem_is_pmem(const void *addr, size_t len)
 	return Funcs.is_pmem(addr, len);
 }
 
+/*
+ * movnt_threshold_lookup -- returns the non-temporal threshold for the given
+ *	address, taking the per-range thresholds into account
+ */
+size_t
+movnt_threshold_lookup(const void *addr)
+{
+	uintptr_t uaddr = (uintptr_t)addr;
+	unsigned nranges = Movnt_nranges;
+
+	for (unsigned i = 0; i < nranges && i < MOVNT_RANGES_MAX; ++i) {
+		if (uaddr >= Movnt_ranges[i].base &&
+				uaddr < Movnt_ranges[i].end)
+			return Movnt_ranges[i].threshold;
+	}
+
+	return Movnt_threshold;
+}
+
+/*
+ * movnt_range_register -- (internal) set the non-temporal threshold for
+ *	the given range
+ */
+static int
+movnt_range_register(const void *addr, size_t len, size_t threshold)
+{
+	uintptr_t base = (uintptr_t)addr;
+	uintptr_t end = base + len;
+	int ret = 0;
+
+	util_mutex_lock(&Movnt_ranges_lock);
+
+	unsigned i;
+	for (i = 0; i < Movnt_nranges; ++i) {
+		if (Movnt_ranges[i].base == base && Movnt_ranges[i].end == end)
+			break;
+	}
+
+	if (i == Movnt_nranges) {
+		if (Movnt_nranges == MOVNT_RANGES_MAX) {
+			ERR("too many ranges with non-temporal threshold set");
+			errno = ENOMEM;
+			ret = -1;
+			goto out;
+		}
+
+		Movnt_ranges[i].base = base;
+		Movnt_ranges[i].end = end;
+	}
+
+	Movnt_ranges[i].threshold = threshold;
+
+	if (i == Movnt_nranges)
+		util_fetch_and_add32(&Movnt_nranges, 1);
+
+out:
+	util_mutex_unlock(&Movnt_ranges_lock);
+
+	return ret;
+}
+
+/*
+ * movnt_range_unregister -- (internal) drop the non-temporal thresholds of
+ *	all the ranges within the given range
+ */
+static void
+movnt_range_unregister(const void *addr, size_t len)
+{
+	uintptr_t base = (uintptr_t)addr;
+	uintptr_t end = base + len;
+
+	if (Movnt_nranges == 0)
+		return;
+
+	util_mutex_lock(&Movnt_ranges_lock);
+
+	unsigned i = 0;
+	while (i < Movnt_nranges) {
+		if (Movnt_ranges[i].base < base || Movnt_ranges[i].end > end) {
+			i++;
+			continue;
+		}
+
+		unsigned last = Movnt_nranges - 1;
+		Movnt_ranges[i] = Movnt_ranges[last];
+		util_fetch_and_sub32(&Movnt_nranges, 1);
+	}
+
+	util_mutex_unlock(&Movnt_ranges_lock);
+}
+
+/*
+ * movnt_calibrate_time -- (internal) measure the time of CALIBRATE_ROUNDS
+ *	copies of the given length, using the given flags
+ */
+static uint64_t
+movnt_calibrate_time(char *pmemdest, const char *src, size_t region,
+		size_t len, unsigned flags)
+{
+	struct timespec start;
+	struct timespec end;
+
+	os_clock_gettime(CLOCK_MONOTONIC, &start);
+
+	size_t off = 0;
+	for (int i = 0; i < CALIBRATE_ROUNDS; ++i) {
+		Funcs.memmove_nodrain(pmemdest + off, src + off, len, flags);
+		Funcs.predrain_fence();
+
+		off += len;
+		if (off + len > region)
+			off = 0;
+	}
+
+	os_clock_gettime(CLOCK_MONOTONIC, &end);
+
+	return (uint64_t)(end.tv_sec - start.tv_sec) * 1000000000ULL +
+		(uint64_t)end.tv_nsec - (uint64_t)start.tv_nsec;
+}
+
+/*
+ * movnt_calibrate -- (internal) find the length above which non-temporal
+ *	stores are not slower than the temporal ones for the given scratch
+ *	mapping of CALIBRATE_MAX_LEN bytes
+ */
+static int
+movnt_calibrate(void *addr, size_t *thresholdp)
+{
+	size_t region = CALIBRATE_MAX_LEN;
+
+	char *snapshot = Zalloc(region);
+	if (snapshot == NULL) {
+		LOG(2, "!Zalloc, calibration skipped");
+		return -1;
+	}
+
+	size_t threshold = region;
+	for (size_t size = CALIBRATE_MIN_LEN; size <= region; size *= 2) {
+		/* the first copies warm up the caches and the TLB */
+		movnt_calibrate_time(addr, snapshot, region, size,
+				PMEM_MEM_TEMPORAL);
+
+		/* the best of a few runs filters out the noise */
+		uint64_t t = UINT64_MAX;
+		uint64_t nt = UINT64_MAX;
+		for (int i = 0; i < CALIBRATE_REPEATS; ++i) {
+			uint64_t tmp = movnt_calibrate_time(addr, snapshot,
+					region, size, PMEM_MEM_TEMPORAL);
+			if (tmp < t)
+				t = tmp;
+
+			tmp = movnt_calibrate_time(addr, snapshot, region,
+					size, PMEM_MEM_NONTEMPORAL);
+			if (tmp < nt)
+				nt = tmp;
+		}
+
+		LOG(4, "len %zu temporal %" PRIu64 "ns non-temporal %" PRIu64
+				"ns", size, t, nt);
+
+		if (nt <= t) {
+			threshold = size;
+			break;
+		}
+	}
+
+	Free(snapshot);
+
+	*thresholdp = threshold;
+
+	return 0;
+}
+
+/*
+ * movnt_calibrate_scratch -- (internal) calibrate the non-temporal threshold
+ *	on a scratch file created in the given directory
+ *
+ * The scratch file is fully allocated, so that the copies do not fault on
+ * holes, and unlinked right away. The measurement is used only if the scratch
+ * mapping is of the same kind as the mapping being calibrated.
+ */
+static int
+movnt_calibrate_scratch(const char *dir, int is_pmem, size_t *thresholdp)
+{
+	int ret = -1;
+	int oerrno = errno;
+
+	int fd = util_tmpfile(dir, OS_DIR_SEP_STR "pmem.XXXXXX", O_EXCL);
+	if (fd < 0) {
+		LOG(2, "cannot create a scratch file in %s", dir);
+		goto end;
+	}
+
+	if (os_posix_fallocate(fd, 0, (os_off_t)CALIBRATE_MAX_LEN) != 0) {
+		LOG(2, "cannot allocate a scratch file in %s", dir);
+		goto end_close;
+	}
+
+	void *addr = pmem_map_register(fd, CALIBRATE_MAX_LEN, dir, 0);
+	if (addr == NULL) {
+		LOG(2, "cannot map a scratch file in %s", dir);
+		goto end_close;
+	}
+
+	if ((pmem_is_pmem(addr, CALIBRATE_MAX_LEN) ? 1 : 0) == is_pmem)
+		ret = movnt_calibrate(addr, thresholdp);
+	else
+		LOG(2, "scratch file in %s is of a different kind", dir);
+
+	(void) pmem_unmap(addr, CALIBRATE_MAX_LEN);
+
+end_close:
+	(void) os_close(fd);
+end:
+	/* a failed calibration does not affect the mapping of the file */
+	errno = oerrno;
+	return ret;
+}
+
+/*
+ * pmem_movnt_calibrate_mapping -- (internal) calibrate the non-temporal
+ *	threshold for the kind of the given mapping, if not calibrated yet
+ *
+ * The first calibrated value becomes the global threshold. Mappings of other
+ * kinds, for which the calibration found a different value, have their
+ * own thresholds registered. Threads mapping files while the calibration
+ * is in progress wait for it on the lock.
+ */
+static void
+pmem_movnt_calibrate_mapping(const char *dir, void *addr, size_t len)
+{
+	int is_pmem = pmem_is_pmem(addr, len) ? 1 : 0;
+	struct movnt_calibration *c = &Movnt_calibration[is_pmem];
+
+	util_mutex_lock(&Movnt_calibration_lock);
+
+	if (!c->done) {
+		c->done = 1;
+		c->valid = movnt_calibrate_scratch(dir, is_pmem,
+			&c->threshold) == 0;
+
+		if (c->valid) {
+			LOG(3, "calibrated non-temporal threshold for "
+				"%spmem: %zu", is_pmem ? "" : "non-",
+				c->threshold);
+
+			if (util_bool_compare_and_swap32(&Movnt_calibrated,
+					0, 1))
+				Movnt_threshold = c->threshold;
+		}
+	}
+
+	util_mutex_unlock(&Movnt_calibration_lock);
+
+	if (c->valid && c->threshold != Movnt_threshold &&
+			movnt_range_register(addr, len, c->threshold))
+		LOG(2, "cannot set the calibrated threshold for %p", addr);
+}
+
+/*
+ * pmem_movnt_calibrate_file -- (internal) calibrate the non-temporal
+ *	threshold for a mapping of the given file
+ *
+ * The scratch file is created in the directory of the file (or in the given
+ * directory for temporary files). Device DAX is never calibrated.
+ */
+static void
+pmem_movnt_calibrate_file(const char *path, int tmpfile, void *addr,
+	size_t len)
+{
+	if (tmpfile) {
+		pmem_movnt_calibrate_mapping(path, addr, len);
+		return;
+	}
+
+	char *dir = Strdup(path);
+	if (dir == NULL) {
+		LOG(2, "!Strdup, calibration skipped");
+		return;
+	}
+
+	char *sep = strrchr(dir, OS_DIR_SEPARATOR);
+	if (sep == NULL)
+		pmem_movnt_calibrate_mapping(".", addr, len);
+	else if (sep == dir)
+		pmem_movnt_calibrate_mapping(OS_DIR_SEP_STR, addr, len);
+	else {
+		*sep = '\0';
+		pmem_movnt_calibrate_mapping(dir, addr, len);
+	}
+
+	Free(dir);
+}
+
+/*
+ * pmem_get_movnt_threshold -- returns the minimum length of a memmove/memset
+ *	to the given address which uses non-temporal stores
+ */
+size_t
+pmem_get_movnt_threshold(const void *addr)
+{
+	LOG(3, "addr %p", addr);
+
+	if (addr == NULL)
+		return Movnt_threshold;
+
+	return movnt_threshold(addr);
+}
+
+/*
+ * pmem_set_movnt_threshold -- sets the minimum length of a memmove/memset
+ *	which uses non-temporal stores, globally or for the given range
+ */
+int
+pmem_set_movnt_threshold(const void *addr, size_t len, size_t threshold)
+{
+	LOG(3, "addr %p len %zu threshold %zu", addr, len, threshold);
+
+	if (addr == NULL) {
+		/* an explicitly set value is never replaced by calibration */
+		Movnt_calibrated = 1;
+		Movnt_threshold = threshold;
+		return 0;
+	}
+
+	if (len == 0) {
+		ERR("zero length range");
+		errno = EINVAL;
+		return -1;
+	}
+
+	return movnt_range_register(addr, len, threshold);
+}
+
 #define PMEM_FILE_ALL_FLAGS\
 	(PMEM_FILE_CREATE|PMEM_FILE_EXCL|PMEM_FILE_SPARSE|PMEM_FILE_TMPFILE)
 
@@ -538,6 +1025,10 @@ pmem_map_fileU(const char *path, size_t len, int flags,
 	if (is_pmemp != NULL)
 		*is_pmemp = pmem_is_pmem(addr, len);
 
+	if (Movnt_calibrate && !is_dev_dax)
+		pmem_movnt_calibrate_file(path, flags & PMEM_FILE_TMPFILE,
+			addr, len);
+
 	LOG(3, "returning %p", addr);
 
 	VALGRIND_REGISTER_PMEM_MAPPING(addr, len);
@@ -595,6 +1086,7 @@ pmem_unmap(void *addr, size_t len)
 #ifndef _WIN32
 	util_range_unregister(addr, len);
 #endif
+	movnt_range_unregister(addr, len);
 	VALGRIND_REMOVE_PMEM_MAPPING(addr, len);
 	return util_unmap(addr, len);
 }
@@ -604,7 +1096,8 @@ pmem_unmap(void *addr, size_t len)
 				PMEM_MEM_NONTEMPORAL | \
 				PMEM_MEM_TEMPORAL | \
 				PMEM_MEM_WC | \
-				PMEM_MEM_WB)
+				PMEM_MEM_WB | \
+				PMEM_MEM_PARALLEL)
 #endif
 
 /*
@@ -621,7 +1114,12 @@ pmem_memmove(void *pmemdest, const void *src, size_t len, unsigned flags)
 		ERR("invalid flags 0x%x", flags);
 #endif
 
-	Funcs.memmove_nodrain(pmemdest, src, len, flags & ~PMEM_MEM_NODRAIN);
+	unsigned nflags = flags & ~(PMEM_MEM_NODRAIN | PMEM_MEM_PARALLEL);
+
+	if (flags & PMEM_MEM_PARALLEL)
+		memmove_nodrain_parallel(pmemdest, src, len, nflags);
+	else
+		Funcs.memmove_nodrain(pmemdest, src, len, nflags);
 
 	if ((flags & PMEM_MEM_NODRAIN) == 0)
 		pmem_drain();
@@ -652,7 +1150,12 @@ pmem_memset(void *pmemdest, int c, size_t len, unsigned flags)
 		ERR("invalid flags 0x%x", flags);
 #endif
 
-	Funcs.memset_nodrain(pmemdest, c, len, flags & ~PMEM_MEM_NODRAIN);
+	unsigned nflags = flags & ~(PMEM_MEM_NODRAIN | PMEM_MEM_PARALLEL);
+
+	if (flags & PMEM_MEM_PARALLEL)
+		memset_nodrain_parallel(pmemdest, c, len, nflags);
+	else
+		Funcs.memset_nodrain(pmemdest, c, len, nflags);
 
 	if ((flags & PMEM_MEM_NODRAIN) == 0)
 		pmem_drain();
@@ -696,6 +1199,22 @@ pmem_memcpy_persist(void *pmemdest, const void *src, size_t len)
 	return pmem_memcpy(pmemdest, src, len, 0);
 }
 
+/*
+ * pmem_memcpy_persistv -- perform a vector of memcpys to pmem, using a single
+ *	drain
+ */
+void
+pmem_memcpy_persistv(const struct pmem_memcpy_desc *descs, int count)
+{
+	LOG(15, "descs %p count %d", descs, count);
+
+	for (int i = 0; i < count; ++i)
+		Funcs.memmove_nodrain(descs[i].pmemdest, descs[i].src,
+				descs[i].len, 0);
+
+	pmem_drain();
+}
+
 /*
  * pmem_memset_nodrain -- memset to pmem without hw drain
  */
@@ -722,8 +1241,29 @@ pmem_init(void)
 {
 	LOG(3, NULL);
 
+	util_mutex_init(&Movnt_ranges_lock);
+	util_mutex_init(&Movnt_calibration_lock);
+
 	pmem_init_funcs(&Funcs);
 	pmem_os_init();
+
+	flush_async_init(Funcs.flush, Funcs.predrain_fence);
+	memops_parallel_init(Funcs.memmove_nodrain, Funcs.memset_nodrain,
+			Funcs.predrain_fence);
+}
+
+/*
+ * pmem_fini -- libpmem cleanup routine for pmem.c
+ */
+void
+pmem_fini(void)
+{
+	LOG(3, NULL);
+
+	memops_parallel_fini();
+	flush_async_fini();
+	util_mutex_destroy(&Movnt_ranges_lock);
+	util_mutex_destroy(&Movnt_calibration_lock);
 }
 
 /*
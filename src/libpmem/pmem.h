@@ -37,6 +37,7 @@
 #define PMEM_H
 
 #include <stddef.h>
+#include <stdint.h>
 #include "util.h"
 
 #define PMEM_LOG_PREFIX "libpmem"
@@ -60,7 +61,46 @@ struct pmem_funcs {
 	flush_func deep_flush;
 };
 
+/*
+ * default minimum length of a memmove/memset which uses non-temporal stores
+ */
+#define MOVNT_THRESHOLD 256
+
+/*
+ * maximum number of address ranges with their own non-temporal threshold
+ */
+#define MOVNT_RANGES_MAX 16
+
+struct movnt_range {
+	uintptr_t base;
+	uintptr_t end;
+	size_t threshold;
+};
+
+extern size_t Movnt_threshold;
+extern int Movnt_calibrate;
+extern unsigned Movnt_nranges;
+extern struct movnt_range Movnt_ranges[MOVNT_RANGES_MAX];
+
+size_t movnt_threshold_lookup(const void *addr);
+
+/*
+ * movnt_threshold -- returns the non-temporal threshold for the given address
+ *
+ * The per-range thresholds are only consulted if any were registered,
+ * so by default this is just a load of the global threshold.
+ */
+static force_inline size_t
+movnt_threshold(const void *addr)
+{
+	if (likely(Movnt_nranges == 0))
+		return Movnt_threshold;
+
+	return movnt_threshold_lookup(addr);
+}
+
 void pmem_init(void);
+void pmem_fini(void);
 void pmem_os_init(void);
 void pmem_init_funcs(struct pmem_funcs *funcs);
 
@@ -42,10 +42,6 @@
 #include "pmem.h"
 #include "valgrind_internal.h"
 
-#define MOVNT_THRESHOLD	256
-
-size_t Movnt_threshold = MOVNT_THRESHOLD;
-
 /*
  * predrain_fence_empty -- (internal) issue the pre-drain fence instruction
  */
@@ -125,7 +121,7 @@ memmove_nodrain_##postfix(void *dest, const void *src, size_t len, \
 		memmove_movnt_##postfix(dest, src, len);\
 	else if (flags & (PMEM_MEM_WB | PMEM_MEM_TEMPORAL))\
 		memmove_mov_##postfix(dest, src, len);\
-	else if (len < Movnt_threshold)\
+	else if (len < movnt_threshold(dest))\
 		memmove_mov_##postfix(dest, src, len);\
 	else\
 		memmove_movnt_##postfix(dest, src, len);\
@@ -144,7 +140,7 @@ memset_nodrain_##postfix(void *dest, int c, size_t len, unsigned flags)\
 		memset_movnt_##postfix(dest, c, len);\
 	else if (flags & (PMEM_MEM_WB | PMEM_MEM_TEMPORAL))\
 		memset_mov_##postfix(dest, c, len);\
-	else if (len < Movnt_threshold)\
+	else if (len < movnt_threshold(dest))\
 		memset_mov_##postfix(dest, c, len);\
 	else\
 		memset_movnt_##postfix(dest, c, len);\
@@ -435,10 +431,19 @@ pmem_init_funcs(struct pmem_funcs *funcs)
 	 * For testing, allow overriding the default threshold
 	 * for using non-temporal stores in pmem_memcpy_*(), pmem_memmove_*()
 	 * and pmem_memset_*().
+	 * The "auto" value enables calibration of the threshold on mappings
+	 * created by pmem_map_file().
 	 * It has no effect if movnt is not supported or disabled.
 	 */
 	ptr = os_getenv("PMEM_MOVNT_THRESHOLD");
-	if (ptr) {
+	if (ptr && strcmp(ptr, "auto") == 0) {
+		if (impl == MEMCPY_GENERIC || impl == MEMCPY_LIBC) {
+			LOG(3, "movnt not used, calibration disabled");
+		} else {
+			LOG(3, "PMEM_MOVNT_THRESHOLD calibration enabled");
+			Movnt_calibrate = 1;
+		}
+	} else if (ptr) {
 		long long val = atoll(ptr);
 
 		if (val < 0) {
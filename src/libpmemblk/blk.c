@@ -45,6 +45,7 @@
 #include <stdint.h>
 #include <endian.h>
 #include <stdbool.h>
+#include <limits.h>
 
 #include "libpmem.h"
 #include "libpmemblk.h"
@@ -77,17 +78,58 @@ static const struct pool_attr Blk_open_attr = {
 		{0}, {0}, {0}, {0}, {0}
 };
 
+/* number of other lanes tried before waiting for the lane of the thread */
+#define LANE_PROBES 4
+
+/*
+ * Lane of the calling thread in the last pool it used, kept across the calls
+ * so that the threads don't collide on the same lane while other lanes are
+ * idle. The lane is only a hint reduced modulo the number of lanes of the
+ * pool, so a pool reopened at the same address may keep it.
+ */
+static __thread struct {
+	PMEMblkpool *pbp;
+	unsigned lane;
+} Lane;
+
 /*
  * lane_enter -- (internal) acquire a unique lane number
+ *
+ * The thread first tries its own lane, which is uncontended unless there
+ * are more threads than lanes. If the lane is busy, the thread steals one of
+ * the next LANE_PROBES lanes that is idle and keeps it for the following
+ * calls. Otherwise, it waits for its own lane.
  */
 static void
 lane_enter(PMEMblkpool *pbp, unsigned *lane)
 {
-	unsigned mylane;
+	if (unlikely(Lane.pbp != pbp)) {
+		Lane.pbp = pbp;
+		Lane.lane = util_fetch_and_add32(&pbp->next_lane, 1);
+	}
 
-	mylane = util_fetch_and_add32(&pbp->next_lane, 1) % pbp->nlane;
+	unsigned mylane = Lane.lane % pbp->nlane;
 
-	/* lane selected, grab the per-lane lock */
+	/* uncontended path, the lane used by this thread the last time */
+	if (likely(os_mutex_trylock(&pbp->locks[mylane]) == 0)) {
+		*lane = mylane;
+		return;
+	}
+
+	unsigned nprobes = pbp->nlane - 1;
+	if (nprobes > LANE_PROBES)
+		nprobes = LANE_PROBES;
+
+	for (unsigned i = 1; i <= nprobes; i++) {
+		unsigned l = (mylane + i) % pbp->nlane;
+		if (os_mutex_trylock(&pbp->locks[l]) == 0) {
+			Lane.lane = l;
+			*lane = l;
+			return;
+		}
+	}
+
+	/* the nearby lanes are busy, wait for the lane of this thread */
 	util_mutex_lock(&pbp->locks[mylane]);
 
 	*lane = mylane;
@@ -128,19 +170,13 @@ nsread(void *ns, unsigned lane, void *buf, size_t count, uint64_t off)
 }
 
 /*
- * nswrite -- (internal) write data to the namespace encapsulating the BTT
- *
- * This routine is provided to btt_init() to allow the btt module to
- * do I/O on the memory pool containing the BTT layout.
+ * nswrite_common -- (internal) write data to the namespace, draining the
+ *	stores only if requested
  */
 static int
-nswrite(void *ns, unsigned lane, const void *buf, size_t count,
-		uint64_t off)
+nswrite_common(struct pmemblk *pbp, const void *buf, size_t count,
+		uint64_t off, int drain)
 {
-	struct pmemblk *pbp = (struct pmemblk *)ns;
-
-	LOG(13, "pbp %p lane %u count %zu off %" PRIu64, pbp, lane, count, off);
-
 	if (off + count > pbp->datasize) {
 		ERR("offset + count (%zu) past end of data area (%zu)",
 				(size_t)off + count, pbp->datasize);
@@ -171,14 +207,67 @@ nswrite(void *ns, unsigned lane, const void *buf, size_t count,
 	util_mutex_unlock(&pbp->write_lock);
 #endif
 
-	if (pbp->is_pmem)
-		pmem_drain();
-	else
+	if (!pbp->is_pmem)
 		pmem_msync(dest, count);
+	else if (drain)
+		pmem_drain();
 
 	return 0;
 }
 
+/*
+ * nswrite -- (internal) write data to the namespace encapsulating the BTT
+ *
+ * This routine is provided to btt_init() to allow the btt module to
+ * do I/O on the memory pool containing the BTT layout.
+ */
+static int
+nswrite(void *ns, unsigned lane, const void *buf, size_t count,
+		uint64_t off)
+{
+	struct pmemblk *pbp = (struct pmemblk *)ns;
+
+	LOG(13, "pbp %p lane %u count %zu off %" PRIu64, pbp, lane, count, off);
+
+	return nswrite_common(pbp, buf, count, off, 1);
+}
+
+/*
+ * nswrite_nodrain -- (internal) write data to the namespace without waiting
+ *	for the stores to become persistent
+ *
+ * This routine is provided to btt_init() to allow the btt module to
+ * combine several writes into a single drain, see nsdrain().
+ */
+static int
+nswrite_nodrain(void *ns, unsigned lane, const void *buf, size_t count,
+		uint64_t off)
+{
+	struct pmemblk *pbp = (struct pmemblk *)ns;
+
+	LOG(13, "pbp %p lane %u count %zu off %" PRIu64, pbp, lane, count, off);
+
+	return nswrite_common(pbp, buf, count, off, 0);
+}
+
+/*
+ * nsdrain -- (internal) wait for the writes done by nswrite_nodrain()
+ *
+ * The btt module calls it once after a group of nswrite_nodrain() calls.
+ * Those have already flushed the data, so only the drain is left to do.
+ */
+static void
+nsdrain(void *ns, unsigned lane)
+{
+	struct pmemblk *pbp = (struct pmemblk *)ns;
+
+	LOG(13, "pbp %p lane %u", pbp, lane);
+
+	/* msync done by nswrite_nodrain() is already synchronous */
+	if (pbp->is_pmem)
+		pmem_drain();
+}
+
 /*
  * nsmap -- (internal) allow direct access to a range of a namespace
  *
@@ -277,6 +366,8 @@ nszero(void *ns, unsigned lane, size_t count, uint64_t off)
 static struct ns_callback ns_cb = {
 	.nsread = nsread,
 	.nswrite = nswrite,
+	.nswrite_nodrain = nswrite_nodrain,
+	.nsdrain = nsdrain,
 	.nszero = nszero,
 	.nsmap = nsmap,
 	.nssync = nssync,
@@ -727,6 +818,155 @@ pmemblk_write(PMEMblkpool *pbp, const void *buf, long long blockno)
 	return err;
 }
 
+/*
+ * blk_iov_check -- (internal) validate a vector of blocks
+ *
+ * All the block numbers are checked up front, so that an invalid entry
+ * does not leave a batch of writes partially applied.
+ */
+static int
+blk_iov_check(PMEMblkpool *pbp, const struct pmemblk_iov *iov, int iovcnt)
+{
+	if (iovcnt < 0) {
+		ERR("negative number of blocks");
+		errno = EINVAL;
+		return -1;
+	}
+
+	size_t nblock = btt_nlba(pbp->bttp);
+
+	for (int i = 0; i < iovcnt; ++i) {
+		if (iov[i].blockno < 0) {
+			ERR("negative block number");
+			errno = EINVAL;
+			return -1;
+		}
+
+		if ((size_t)iov[i].blockno >= nblock) {
+			ERR("block number out of range (nblock %zu)", nblock);
+			errno = EINVAL;
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * pmemblk_readv -- read a vector of blocks in a block memory pool
+ */
+int
+pmemblk_readv(PMEMblkpool *pbp, const struct pmemblk_iov *iov, int iovcnt)
+{
+	LOG(3, "pbp %p iov %p iovcnt %d", pbp, iov, iovcnt);
+
+	if (blk_iov_check(pbp, iov, iovcnt))
+		return -1;
+
+	unsigned lane;
+
+	lane_enter(pbp, &lane);
+
+	int err = 0;
+	for (int i = 0; i < iovcnt && err == 0; ++i)
+		err = btt_read(pbp->bttp, lane, (uint64_t)iov[i].blockno,
+				iov[i].buf);
+
+	lane_exit(pbp, lane);
+
+	return err;
+}
+
+/*
+ * pmemblk_writev -- write a vector of blocks (each one atomically) in a block
+ *	memory pool
+ *
+ * The whole batch is written through a single lane.
+ */
+int
+pmemblk_writev(PMEMblkpool *pbp, const struct pmemblk_iov *iov, int iovcnt)
+{
+	LOG(3, "pbp %p iov %p iovcnt %d", pbp, iov, iovcnt);
+
+	if (pbp->rdonly) {
+		ERR("EROFS (pool is read-only)");
+		errno = EROFS;
+		return -1;
+	}
+
+	if (blk_iov_check(pbp, iov, iovcnt))
+		return -1;
+
+	unsigned lane;
+
+	lane_enter(pbp, &lane);
+
+	int err = 0;
+	for (int i = 0; i < iovcnt && err == 0; ++i)
+		err = btt_write(pbp->bttp, lane, (uint64_t)iov[i].blockno,
+				iov[i].buf);
+
+	lane_exit(pbp, lane);
+
+	return err;
+}
+
+/*
+ * blk_range_check -- (internal) validate a range of blocks to be modified
+ *
+ * Returns 0 if the range is valid, otherwise -1/errno.
+ */
+static int
+blk_range_check(PMEMblkpool *pbp, long long blockno, size_t count)
+{
+	if (pbp->rdonly) {
+		ERR("EROFS (pool is read-only)");
+		errno = EROFS;
+		return -1;
+	}
+
+	if (blockno < 0) {
+		ERR("negative block number");
+		errno = EINVAL;
+		return -1;
+	}
+
+	size_t nblock = btt_nlba(pbp->bttp);
+	if ((size_t)blockno > nblock || count > nblock - (size_t)blockno) {
+		ERR("block range out of range (nblock %zu)", nblock);
+		errno = EINVAL;
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * pmemblk_write_range -- write a range of consecutive blocks in a block
+ *	memory pool
+ */
+int
+pmemblk_write_range(PMEMblkpool *pbp, const void *buf, long long blockno,
+		size_t count)
+{
+	LOG(3, "pbp %p buf %p blockno %lld count %zu",
+			pbp, buf, blockno, count);
+
+	if (blk_range_check(pbp, blockno, count))
+		return -1;
+
+	unsigned lane;
+
+	lane_enter(pbp, &lane);
+
+	int err = btt_write_range(pbp->bttp, lane, (uint64_t)blockno,
+			count, buf);
+
+	lane_exit(pbp, lane);
+
+	return err;
+}
+
 /*
  * pmemblk_set_zero -- zero a block in a block memory pool
  */
@@ -789,6 +1029,54 @@ pmemblk_set_error(PMEMblkpool *pbp, long long blockno)
 	return err;
 }
 
+/*
+ * pmemblk_set_zero_range -- zero a range of consecutive blocks in a block
+ *	memory pool
+ */
+int
+pmemblk_set_zero_range(PMEMblkpool *pbp, long long blockno, size_t count)
+{
+	LOG(3, "pbp %p blockno %lld count %zu", pbp, blockno, count);
+
+	if (blk_range_check(pbp, blockno, count))
+		return -1;
+
+	unsigned lane;
+
+	lane_enter(pbp, &lane);
+
+	int err = btt_set_zero_range(pbp->bttp, lane, (uint64_t)blockno,
+			count);
+
+	lane_exit(pbp, lane);
+
+	return err;
+}
+
+/*
+ * pmemblk_set_error_range -- set the error state on a range of consecutive
+ *	blocks in a block memory pool
+ */
+int
+pmemblk_set_error_range(PMEMblkpool *pbp, long long blockno, size_t count)
+{
+	LOG(3, "pbp %p blockno %lld count %zu", pbp, blockno, count);
+
+	if (blk_range_check(pbp, blockno, count))
+		return -1;
+
+	unsigned lane;
+
+	lane_enter(pbp, &lane);
+
+	int err = btt_set_error_range(pbp->bttp, lane, (uint64_t)blockno,
+			count);
+
+	lane_exit(pbp, lane);
+
+	return err;
+}
+
 /*
  * pmemblk_checkU -- block memory pool consistency check
  */
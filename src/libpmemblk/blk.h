@@ -74,7 +74,7 @@ struct pmemblk {
 	size_t nlba;			/* number of LBAs in pool */
 	struct btt *bttp;		/* btt handle */
 	unsigned nlane;			/* number of lanes */
-	unsigned next_lane;		/* used to rotate through lanes */
+	unsigned next_lane;		/* used to assign lanes to threads */
 	os_mutex_t *locks;		/* one per lane */
 	int is_dev_dax;			/* true if mapped on device dax */
 
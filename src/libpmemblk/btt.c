@@ -52,6 +52,10 @@
  * (made durable) when the call returns.  Data written directly via
  * the nsmap callback must be flushed explicitly using nssync.
  *
+ * Optionally, the caller may also provide nswrite_nodrain and nsdrain,
+ * which split nswrite into the write and the wait for it to become
+ * durable, so that several writes can be made durable at once.
+ *
  * The caller passes these callbacks, along with information such as
  * namespace size and UUID to btt_init() and gets back an opaque handle
  * which is then used with the rest of the entry points.
@@ -66,10 +70,16 @@
  *
  *	btt_write	Writes a single block (atomically) at a given LBA
  *
+ *	btt_write_range	Writes consecutive blocks, placing the ones never
+ *			written before directly in their data blocks
+ *
  *	btt_set_zero	Sets a block to read back as zeros
  *
  *	btt_set_error	Sets a block to return error on read
  *
+ *	btt_set_zero_range, btt_set_error_range
+ *			Same as above, for a range of blocks
+ *
  *	btt_check	Checks the BTT metadata for consistency
  *
  *	btt_fini	Frees run-time state, done using namespace
@@ -111,7 +121,12 @@
  *	map_unlock	data structure in an area.
  *	map_abort
  *
- *	map_entry_setf	Common code for btt_set_zero() and btt_set_error().
+ *	map_entry_setf	Common code for btt_set_zero(), btt_set_error() and
+ *			their range variants.
+ *
+ *	write_range_inplace
+ *			Writes never written blocks of a map cache line
+ *			without going through the flog.
  *
  *	zero_block	Generate a block of all zeros (instead of actually
  *			doing a read), when the metadata indicates the
@@ -137,6 +152,13 @@
 #include "sys_util.h"
 #include "util.h"
 
+/*
+ * Read tracking table parameters, see build_rtt().  A slot takes a whole
+ * cache line and holds the post-map LBAs of up to BTT_RTT_SLOT_NREADS reads.
+ */
+#define BTT_RTT_SLOT_SIZE 64
+#define BTT_RTT_SLOT_NREADS (BTT_RTT_SLOT_SIZE / sizeof(uint32_t))
+
 /*
  * The opaque btt handle containing state tracked by this module
  * for the btt namespace.  This is created by btt_init(), handed to
@@ -212,16 +234,31 @@ struct btt {
 		} *flogs;
 
 		/*
-		 * Read tracking table.  Indexed by lane.
+		 * Read tracking table.  Indexed by post-map LBA modulo the
+		 * (power of two) number of slots, see rtt_slot().
+		 *
+		 * Each slot holds the post-map LBAs (map entries) of the reads
+		 * in progress on the blocks which map to it.  Before using a
+		 * free block found in the flog, the write path checks the slot
+		 * of that block to see if there are any outstanding reads on
+		 * it (reads that started before the block was freed by a
+		 * concurrent write).  This check only looks at a single slot,
+		 * no matter how many lanes there are, and only waits for the
+		 * reads of that very block, so reads of other blocks sharing
+		 * the slot never hold the write back.  Unused entries are zero,
+		 * which doesn't match any map entry of a normal block.
 		 *
-		 * Before using a free block found in the flog, the write path
-		 * scans the rtt to see if there are any outstanding reads on
-		 * that block (reads that started before the block was freed by
-		 * a concurrent write).  Unused slots in the rtt are indicated
-		 * by setting the error bit, BTT_MAP_ENTRY_ERROR, so that the
-		 * entry won't match any post-map LBA when checked.
+		 * A reader which finds all the entries of its slot taken
+		 * records the read in the overflow entry of its lane instead.
+		 * The overflow entries are only checked by the write path
+		 * while rtt_noverflow says some of them are in use.
 		 */
-		uint32_t volatile *rtt;
+		struct rtt_slot {
+			uint32_t volatile entries[BTT_RTT_SLOT_NREADS];
+		} *rtt;
+		uint32_t rtt_mask;	/* number of rtt slots - 1 */
+		uint32_t volatile *rtt_overflow; /* indexed by lane */
+		unsigned rtt_noverflow;	/* overflow entries in use */
 
 		/*
 		 * Map locking.  Indexed by pre-map LBA modulo nlane.
@@ -247,6 +284,86 @@ struct btt {
 	const struct ns_callback *ns_cbp;
 };
 
+/*
+ * rtt_slot -- (internal) return the read tracking slot of a post-map LBA
+ */
+static inline struct rtt_slot *
+rtt_slot(struct arena *arenap, uint32_t entry)
+{
+	return &arenap->rtt[(entry & BTT_MAP_ENTRY_LBA_MASK) &
+			arenap->rtt_mask];
+}
+
+/*
+ * rtt_track -- (internal) record a read in progress on a post-map LBA
+ *
+ * Returns the rtt entry to be released by rtt_untrack() once the read is
+ * done.  If all the entries of the slot are taken by reads of other blocks,
+ * the read goes to the overflow entry of the lane, which no other thread
+ * uses, so this never waits.  Both the compare-and-swap and the increment of
+ * rtt_noverflow are full barriers, which order the store before any
+ * subsequent read of the map.
+ */
+static uint32_t volatile *
+rtt_track(struct arena *arenap, unsigned lane, uint32_t entry)
+{
+	struct rtt_slot *slot = rtt_slot(arenap, entry);
+
+	for (unsigned i = 0; i < BTT_RTT_SLOT_NREADS; i++) {
+		uint32_t volatile *e = &slot->entries[i];
+		if (*e == 0 && util_bool_compare_and_swap32(e, 0, entry))
+			return e;
+	}
+
+	uint32_t volatile *e = &arenap->rtt_overflow[lane];
+	*e = entry;
+	util_fetch_and_add32(&arenap->rtt_noverflow, 1);
+
+	return e;
+}
+
+/*
+ * rtt_untrack -- (internal) drop a completed read from the rtt
+ */
+static inline void
+rtt_untrack(struct arena *arenap, unsigned lane, uint32_t volatile *e)
+{
+	util_atomic_store_explicit32(e, 0, memory_order_release);
+
+	if (e == &arenap->rtt_overflow[lane])
+		util_fetch_and_sub32(&arenap->rtt_noverflow, 1);
+}
+
+/*
+ * rtt_wait -- (internal) wait for the reads in progress on a post-map LBA
+ */
+static void
+rtt_wait(struct btt *bttp, struct arena *arenap, uint32_t entry)
+{
+	struct rtt_slot *slot = rtt_slot(arenap, entry);
+
+	for (unsigned i = 0; i < BTT_RTT_SLOT_NREADS; i++) {
+		while (slot->entries[i] == entry)
+			;
+	}
+
+	/*
+	 * A reader stores its overflow entry before it bumps the counter, so
+	 * if the counter is zero here, any read which is yet to overflow will
+	 * find the map changed and retry.
+	 */
+	unsigned noverflow;
+	util_atomic_load_explicit32(&arenap->rtt_noverflow, &noverflow,
+			memory_order_acquire);
+	if (noverflow == 0)
+		return;
+
+	for (unsigned i = 0; i < bttp->nlane; i++) {
+		while (arenap->rtt_overflow[i] == entry)
+			;
+	}
+}
+
 /*
  * Signature for arena info blocks.  Total size is 16 bytes, including
  * the '\0' added to the string by the declaration (the last two bytes
@@ -312,6 +429,39 @@ invalid_lba(struct btt *bttp, uint64_t lba)
 	return 0;
 }
 
+/*
+ * nswrite_nodrain -- (internal) write to the namespace, leaving the drain
+ *	to a later call to nsdrain()
+ *
+ * Falls back to the regular, persistent write if the namespace does not
+ * provide the non-draining callbacks.
+ */
+static int
+nswrite_nodrain(struct btt *bttp, unsigned lane, const void *buf,
+		size_t count, uint64_t off)
+{
+	if (bttp->ns_cbp->nswrite_nodrain == NULL ||
+			bttp->ns_cbp->nsdrain == NULL)
+		return (*bttp->ns_cbp->nswrite)(bttp->ns, lane, buf,
+				count, off);
+
+	return (*bttp->ns_cbp->nswrite_nodrain)(bttp->ns, lane, buf,
+			count, off);
+}
+
+/*
+ * nsdrain -- (internal) wait for the writes done by nswrite_nodrain()
+ */
+static void
+nsdrain(struct btt *bttp, unsigned lane)
+{
+	if (bttp->ns_cbp->nswrite_nodrain == NULL ||
+			bttp->ns_cbp->nsdrain == NULL)
+		return;
+
+	(*bttp->ns_cbp->nsdrain)(bttp->ns, lane);
+}
+
 /*
  * read_info -- (internal) convert btt_info to host byte order & validate
  *
@@ -594,10 +744,15 @@ flog_update(struct btt *bttp, unsigned lane, struct arena *arenap,
 	uint64_t new_flog_off =
 		arenap->flogs[lane].entries[arenap->flogs[lane].next];
 
-	/* write out first two fields first */
-	if ((*bttp->ns_cbp->nswrite)(bttp->ns, lane, &new_flog,
+	/*
+	 * Write out first two fields first. They are not used until the seq
+	 * field is written, so the caller may have left the new data block
+	 * undrained and both become persistent with a single drain.
+	 */
+	if (nswrite_nodrain(bttp, lane, &new_flog,
 				sizeof(uint32_t) * 2, new_flog_off) < 0)
 		return -1;
+	nsdrain(bttp, lane);
 	new_flog_off += sizeof(uint32_t) * 2;
 
 	/* write out new_map and seq field to make it active */
@@ -735,22 +890,38 @@ read_flogs(struct btt *bttp, unsigned lane, struct arena *arenap)
 /*
  * build_rtt -- (internal) construct a read tracking table for an arena
  *
- * Zero is returned on success, otherwise -1/errno.
- *
- * The rtt is big enough to hold an entry for each free block (nfree)
- * since nlane can't be bigger than nfree.  nlane may end up smaller,
- * in which case some of the high rtt entries will be unused.
+ * The rtt has a slot for each free block (nfree), rounded up to a power of
+ * two, so that finding the slot of a block is a simple mask.  The slots are
+ * aligned to the cache line size, so that readers on different CPUs do not
+ * contend.  The overflow entries, one per lane, are allocated for nfree lanes
+ * since nlane is not known yet.
  */
 static int
 build_rtt(struct btt *bttp, struct arena *arenap)
 {
-	if ((arenap->rtt = Malloc(bttp->nfree * sizeof(uint32_t)))
+	COMPILE_ERROR_ON(sizeof(struct rtt_slot) != BTT_RTT_SLOT_SIZE);
+
+	uint32_t nslots = 1;
+	while (nslots < bttp->nfree)
+		nslots <<= 1;
+
+	size_t size = nslots * sizeof(struct rtt_slot);
+	if ((arenap->rtt = util_aligned_malloc(BTT_RTT_SLOT_SIZE, size))
 							== NULL) {
-		ERR("!Malloc for %d rtt entries", bttp->nfree);
+		ERR("!util_aligned_malloc for %u rtt slots", nslots);
 		return -1;
 	}
-	for (uint32_t lane = 0; lane < bttp->nfree; lane++)
-		arenap->rtt[lane] = BTT_MAP_ENTRY_ERROR;
+	memset(arenap->rtt, 0, size);
+	arenap->rtt_mask = nslots - 1;
+
+	if ((arenap->rtt_overflow =
+			Zalloc(bttp->nfree * sizeof(uint32_t))) == NULL) {
+		ERR("!Zalloc for %u rtt overflow entries", bttp->nfree);
+		util_aligned_free(arenap->rtt);
+		arenap->rtt = NULL;
+		return -1;
+	}
+	arenap->rtt_noverflow = 0;
 	util_synchronize();
 
 	return 0;
@@ -927,7 +1098,9 @@ err:
 			if (bttp->arenas[i].flogs)
 				Free(bttp->arenas[i].flogs);
 			if (bttp->arenas[i].rtt)
-				Free((void *)bttp->arenas[i].rtt);
+				util_aligned_free(bttp->arenas[i].rtt);
+			if (bttp->arenas[i].rtt_overflow)
+				Free((void *)bttp->arenas[i].rtt_overflow);
 			if (bttp->arenas[i].map_locks)
 				Free((void *)bttp->arenas[i].map_locks);
 		}
@@ -1548,6 +1721,8 @@ btt_read(struct btt *bttp, unsigned lane, uint64_t lba, void *buf)
 
 	entry = le32toh(entry);
 
+	uint32_t volatile *rtt_entry;
+
 	/*
 	 * Retries come back to the top of this loop (for a rare case where
 	 * the map is changed by another thread doing writes to the same LBA).
@@ -1563,24 +1738,17 @@ btt_read(struct btt *bttp, unsigned lane, uint64_t lba, void *buf)
 			return zero_block(bttp, buf);
 
 		/*
-		 * Record the post-map LBA in the read tracking table during
-		 * the read.  The write will check entries in the read tracking
-		 * table before allocating a block for a write, waiting for
-		 * outstanding reads on that block to complete.
-		 *
-		 * Since we already checked for error, zero, and initial
-		 * states above, the entry must have both error and zero
-		 * bits set at this point (BTT_MAP_ENTRY_NORMAL).  We store
-		 * the entry that way, with those bits set, in the rtt and
-		 * btt_write() will check for it the same way, with the bits
-		 * both set.
+		 * Record the post-map LBA in the read tracking table for the
+		 * duration of the read.  The write will check the rtt before
+		 * allocating a block for a write, waiting for outstanding
+		 * reads on that block to complete.
 		 */
-		arenap->rtt[lane] = entry;
-		util_synchronize();
+		rtt_entry = rtt_track(arenap, lane, entry);
 
 		/*
 		 * In case this thread was preempted between reading entry and
-		 * storing it in the rtt, check to see if the map changed.  If
+		 * counting the read in the rtt, check to see if the map
+		 * changed.  If
 		 * it changed, the block about to be read is at least free now
 		 * (in the flog, but that's okay since the data will still be
 		 * undisturbed) and potentially allocated and being used for
@@ -1589,7 +1757,7 @@ btt_read(struct btt *bttp, unsigned lane, uint64_t lba, void *buf)
 		uint32_t latest_entry;
 		if ((*bttp->ns_cbp->nsread)(bttp->ns, lane, &latest_entry,
 				sizeof(latest_entry), map_entry_off) < 0) {
-			arenap->rtt[lane] = BTT_MAP_ENTRY_ERROR;
+			rtt_untrack(arenap, lane, rtt_entry);
 			return -1;
 		}
 
@@ -1597,8 +1765,10 @@ btt_read(struct btt *bttp, unsigned lane, uint64_t lba, void *buf)
 
 		if (entry == latest_entry)
 			break;			/* map stayed the same */
-		else
-			entry = latest_entry;	/* try again */
+
+		/* try again */
+		rtt_untrack(arenap, lane, rtt_entry);
+		entry = latest_entry;
 	}
 
 	/*
@@ -1611,8 +1781,8 @@ btt_read(struct btt *bttp, unsigned lane, uint64_t lba, void *buf)
 	int readret = (*bttp->ns_cbp->nsread)(bttp->ns, lane, buf,
 					bttp->lbasize, data_block_off);
 
-	/* done with read, so clear out rtt entry */
-	arenap->rtt[lane] = BTT_MAP_ENTRY_ERROR;
+	/* done with read, so drop it from the rtt */
+	rtt_untrack(arenap, lane, rtt_entry);
 
 	return readret;
 }
@@ -1741,9 +1911,9 @@ btt_write(struct btt *bttp, unsigned lane, uint64_t lba, const void *buf)
 	 * into the flog.  That means the free block held by flog[lane]
 	 * is assigned to this thread and to no other threads (no additional
 	 * locking required).  So start by performing the write to the
-	 * free block.  It is only safe to write to a free block if it
-	 * doesn't appear in the read tracking table, so scan that first
-	 * and if found, wait for the thread reading from it to finish.
+	 * free block.  It is only safe to write to a free block if there
+	 * are no reads in progress on it, so check the read tracking table
+	 * first and wait for any readers of the block to finish.
 	 */
 	uint32_t free_entry = (arenap->flogs[lane].flog.old_map &
 			BTT_MAP_ENTRY_LBA_MASK) | BTT_MAP_ENTRY_NORMAL;
@@ -1752,15 +1922,17 @@ btt_write(struct btt *bttp, unsigned lane, uint64_t lba, const void *buf)
 				arenap->flogs[lane].flog.old_map);
 
 	/* wait for other threads to finish any reads on free block */
-	for (unsigned i = 0; i < bttp->nlane; i++)
-		while (arenap->rtt[i] == free_entry)
-			;
+	rtt_wait(bttp, arenap, free_entry);
 
-	/* it is now safe to perform write to the free block */
+	/*
+	 * It is now safe to perform write to the free block. The block is
+	 * not referenced by anything until the flog is updated, which drains
+	 * it together with the flog entry.
+	 */
 	uint64_t data_block_off = arenap->dataoff +
 		(uint64_t)(free_entry & BTT_MAP_ENTRY_LBA_MASK) *
 		arenap->internal_lbasize;
-	if ((*bttp->ns_cbp->nswrite)(bttp->ns, lane, buf,
+	if (nswrite_nodrain(bttp, lane, buf,
 				bttp->lbasize, data_block_off) < 0)
 		return -1;
 
@@ -1796,17 +1968,263 @@ btt_write(struct btt *bttp, unsigned lane, uint64_t lba, const void *buf)
 }
 
 /*
- * map_entry_setf -- (internal) set a given flag on a map entry
+ * write_range_inplace -- (internal) write the blocks of a single map cache
+ *	line which have never been written
+ *
+ * A map entry in the initial state maps the pre-map LBA to the post-map
+ * block with the same number, which is owned by that LBA alone and reads
+ * as zeros without being accessed.  So, as long as the map lock is held,
+ * new data can be placed directly in that block and made visible by
+ * switching the map entry to the normal state, without going through the
+ * flog.  A crash before the map is updated leaves the block reading as
+ * zeros.  The data blocks of the whole cache line are drained at once and
+ * the map entries are written with a single store sequence.
+ *
+ * On return, done[i] is set for each block that has been written, the
+ * remaining ones must be written the regular way.
+ */
+static int
+write_range_inplace(struct btt *bttp, unsigned lane, struct arena *arenap,
+	uint32_t premap_lba, uint32_t count, const char *buf, int *done)
+{
+	LOG(3, "bttp %p lane %u arenap %p premap_lba %u count %u",
+			bttp, lane, arenap, premap_lba, count);
+
+	uint32_t entries[BTT_MAP_LOCK_ALIGN / BTT_MAP_ENTRY_SIZE];
+	ASSERT(count <= ARRAY_SIZE(entries));
+
+	uint64_t map_entry_off =
+			arenap->mapoff + BTT_MAP_ENTRY_SIZE * premap_lba;
+	os_mutex_t *lock = &arenap->map_locks[get_map_lock_num(premap_lba,
+				bttp->nfree)];
+
+	util_mutex_lock(lock);
+
+	if ((*bttp->ns_cbp->nsread)(bttp->ns, lane, entries,
+			count * BTT_MAP_ENTRY_SIZE, map_entry_off) < 0) {
+		util_mutex_unlock(lock);
+		return -1;
+	}
+
+	uint32_t ndone = 0;
+	for (uint32_t i = 0; i < count; i++) {
+		done[i] = 0;
+		if (!map_entry_is_initial(le32toh(entries[i])))
+			continue;
+
+		uint64_t data_block_off = arenap->dataoff +
+			(uint64_t)(premap_lba + i) * arenap->internal_lbasize;
+		if (nswrite_nodrain(bttp, lane, buf + i * bttp->lbasize,
+				bttp->lbasize, data_block_off) < 0) {
+			util_mutex_unlock(lock);
+			return -1;
+		}
+
+		entries[i] = htole32((premap_lba + i) | BTT_MAP_ENTRY_NORMAL);
+		done[i] = 1;
+		ndone++;
+	}
+
+	if (ndone == 0) {
+		util_mutex_unlock(lock);
+		return 0;
+	}
+
+	/* the data must be persistent before the map refers to it */
+	nsdrain(bttp, lane);
+
+	int err = (*bttp->ns_cbp->nswrite)(bttp->ns, lane, entries,
+			count * BTT_MAP_ENTRY_SIZE, map_entry_off);
+
+	util_mutex_unlock(lock);
+
+	if (err < 0) {
+		/*
+		 * A critical write error occurred, set the arena's
+		 * info block error bit.
+		 */
+		set_arena_error(bttp, arenap, lane);
+		errno = EIO;
+		return -1;
+	}
+
+	LOG(9, "loaded %u of map[%u..%u]", ndone, premap_lba,
+			premap_lba + count - 1);
+
+	return 0;
+}
+
+/*
+ * btt_write_range -- write a range of consecutive blocks to a btt namespace
+ *
+ * This is meant for loading the data into a new namespace.  The blocks
+ * which have never been written are placed directly in their data blocks,
+ * one map cache line at a time, see write_range_inplace().  The other
+ * blocks are written the same way as by btt_write().  Each block is
+ * written atomically, the range as a whole is not.
+ *
+ * Returns 0 on success, otherwise -1/errno.
+ */
+int
+btt_write_range(struct btt *bttp, unsigned lane, uint64_t lba,
+		uint64_t count, const void *buf)
+{
+	LOG(3, "bttp %p lane %u lba %" PRIu64 " count %" PRIu64,
+			bttp, lane, lba, count);
+
+	if (count == 0)
+		return 0;
+
+	if (invalid_lba(bttp, lba) || invalid_lba(bttp, lba + count - 1))
+		return -1;
+
+	/* first write through here will initialize the metadata layout */
+	if (!bttp->laidout) {
+		int err = 0;
+
+		util_mutex_lock(&bttp->layout_write_mutex);
+
+		if (!bttp->laidout)
+			err = write_layout(bttp, lane, 1);
+
+		util_mutex_unlock(&bttp->layout_write_mutex);
+
+		if (err < 0)
+			return err;
+	}
+
+	const uint32_t line_entries = BTT_MAP_LOCK_ALIGN / BTT_MAP_ENTRY_SIZE;
+	int done[BTT_MAP_LOCK_ALIGN / BTT_MAP_ENTRY_SIZE];
+	const char *src = buf;
+
+	while (count > 0) {
+		struct arena *arenap;
+		uint32_t premap_lba;
+		if (lba_to_arena_lba(bttp, lba, &arenap, &premap_lba) < 0)
+			return -1;
+
+		/* if the arena is in an error state, writing is not allowed */
+		if (arenap->flags & BTTINFO_FLAG_ERROR_MASK) {
+			ERR("EIO due to btt_info error flags 0x%x",
+				arenap->flags & BTTINFO_FLAG_ERROR_MASK);
+			errno = EIO;
+			return -1;
+		}
+
+		/* up to the end of the map cache line or of the arena */
+		uint32_t n = line_entries - premap_lba % line_entries;
+		if (n > arenap->external_nlba - premap_lba)
+			n = arenap->external_nlba - premap_lba;
+		if (n > count)
+			n = (uint32_t)count;
+
+		if (write_range_inplace(bttp, lane, arenap, premap_lba, n,
+				src, done) < 0)
+			return -1;
+
+		for (uint32_t i = 0; i < n; i++) {
+			if (done[i])
+				continue;
+
+			if (btt_write(bttp, lane, lba + i,
+					src + i * bttp->lbasize) < 0)
+				return -1;
+		}
+
+		lba += n;
+		count -= n;
+		src += (size_t)n * bttp->lbasize;
+	}
+
+	return 0;
+}
+
+/*
+ * map_line_setf -- (internal) set a given flag on the map entries of a single
+ *	map cache line
+ *
+ * All the entries are updated under a single map lock and written out
+ * together.  Each entry is updated atomically.
  *
  * Returns 0 on success, otherwise -1/errno.
  */
 static int
-map_entry_setf(struct btt *bttp, unsigned lane, uint64_t lba, uint32_t setf)
+map_line_setf(struct btt *bttp, unsigned lane, struct arena *arenap,
+		uint32_t premap_lba, uint32_t count, uint32_t setf)
 {
-	LOG(3, "bttp %p lane %u lba %" PRIu64 " setf 0x%x",
-	    bttp, lane, lba, setf);
+	LOG(3, "bttp %p lane %u arenap %p premap_lba %u count %u setf 0x%x",
+			bttp, lane, arenap, premap_lba, count, setf);
 
-	if (invalid_lba(bttp, lba))
+	uint32_t entries[BTT_MAP_LOCK_ALIGN / BTT_MAP_ENTRY_SIZE];
+	ASSERT(count <= ARRAY_SIZE(entries));
+
+	uint64_t map_entry_off =
+			arenap->mapoff + BTT_MAP_ENTRY_SIZE * premap_lba;
+	os_mutex_t *lock = &arenap->map_locks[get_map_lock_num(premap_lba,
+				bttp->nfree)];
+
+	util_mutex_lock(lock);
+
+	/*
+	 * Set the flags in the map entries.  To do this, read the
+	 * current map entries, set the flags, and write out the update.
+	 */
+	if ((*bttp->ns_cbp->nsread)(bttp->ns, lane, entries,
+			count * BTT_MAP_ENTRY_SIZE, map_entry_off) < 0) {
+		util_mutex_unlock(lock);
+		return -1;
+	}
+
+	uint32_t nset = 0;
+	for (uint32_t i = 0; i < count; i++) {
+		uint32_t old_entry = le32toh(entries[i]);
+
+		if (map_entry_is_zero_or_initial(old_entry) &&
+				setf == BTT_MAP_ENTRY_ZERO)
+			continue;	/* block already zero, nothing to do */
+
+		/* if map entry is in its initial state use premap_lba */
+		if (map_entry_is_initial(old_entry))
+			old_entry = premap_lba + i;
+
+		/* create the new map entry */
+		entries[i] = htole32((old_entry & BTT_MAP_ENTRY_LBA_MASK) |
+				setf);
+		nset++;
+	}
+
+	int err = 0;
+	if (nset != 0)
+		err = (*bttp->ns_cbp->nswrite)(bttp->ns, lane, entries,
+				count * BTT_MAP_ENTRY_SIZE, map_entry_off);
+
+	util_mutex_unlock(lock);
+
+	LOG(9, "set 0x%x on %u of map[%u..%u]", setf, nset, premap_lba,
+			premap_lba + count - 1);
+
+	return err;
+}
+
+/*
+ * map_entry_setf -- (internal) set a given flag on a range of map entries
+ *
+ * The entries are updated one map cache line at a time, so a range costs
+ * a single map lock round trip per cache line.
+ *
+ * Returns 0 on success, otherwise -1/errno.
+ */
+static int
+map_entry_setf(struct btt *bttp, unsigned lane, uint64_t lba, uint64_t count,
+		uint32_t setf)
+{
+	LOG(3, "bttp %p lane %u lba %" PRIu64 " count %" PRIu64 " setf 0x%x",
+	    bttp, lane, lba, count, setf);
+
+	if (count == 0)
+		return 0;
+
+	if (invalid_lba(bttp, lba) || invalid_lba(bttp, lba + count - 1))
 		return -1;
 
 	if (!bttp->laidout) {
@@ -1834,44 +2252,37 @@ map_entry_setf(struct btt *bttp, unsigned lane, uint64_t lba, uint32_t setf)
 			return err;
 	}
 
-	/* find which arena LBA lives in, and the offset to the map entry */
-	struct arena *arenap;
-	uint32_t premap_lba;
-	if (lba_to_arena_lba(bttp, lba, &arenap, &premap_lba) < 0)
-		return -1;
+	const uint32_t line_entries = BTT_MAP_LOCK_ALIGN / BTT_MAP_ENTRY_SIZE;
 
-	/* if the arena is in an error state, writing is not allowed */
-	if (arenap->flags & BTTINFO_FLAG_ERROR_MASK) {
-		ERR("EIO due to btt_info error flags 0x%x",
-			arenap->flags & BTTINFO_FLAG_ERROR_MASK);
-		errno = EIO;
-		return -1;
-	}
+	while (count > 0) {
+		/* find which arena LBA lives in */
+		struct arena *arenap;
+		uint32_t premap_lba;
+		if (lba_to_arena_lba(bttp, lba, &arenap, &premap_lba) < 0)
+			return -1;
 
-	/*
-	 * Set the flags in the map entry.  To do this, read the
-	 * current map entry, set the flags, and write out the update.
-	 */
-	uint32_t old_entry;
-	uint32_t new_entry;
+		/* if the arena is in an error state, writing is not allowed */
+		if (arenap->flags & BTTINFO_FLAG_ERROR_MASK) {
+			ERR("EIO due to btt_info error flags 0x%x",
+				arenap->flags & BTTINFO_FLAG_ERROR_MASK);
+			errno = EIO;
+			return -1;
+		}
 
-	if (map_lock(bttp, lane, arenap, &old_entry, premap_lba) < 0)
-		return -1;
+		/* up to the end of the map cache line or of the arena */
+		uint32_t n = line_entries - premap_lba % line_entries;
+		if (n > arenap->external_nlba - premap_lba)
+			n = arenap->external_nlba - premap_lba;
+		if (n > count)
+			n = (uint32_t)count;
 
-	old_entry = le32toh(old_entry);
+		if (map_line_setf(bttp, lane, arenap, premap_lba, n, setf) < 0)
+			return -1;
 
-	if (setf == BTT_MAP_ENTRY_ZERO &&
-			map_entry_is_zero_or_initial(old_entry)) {
-		map_abort(bttp, lane, arenap, premap_lba);
-		return 0;	/* block already zero, nothing to do */
+		lba += n;
+		count -= n;
 	}
 
-	/* create the new map entry */
-	new_entry = (old_entry & BTT_MAP_ENTRY_LBA_MASK) | setf;
-
-	if (map_unlock(bttp, lane, arenap, htole32(new_entry), premap_lba) < 0)
-		return -1;
-
 	return 0;
 }
 
@@ -1885,7 +2296,7 @@ btt_set_zero(struct btt *bttp, unsigned lane, uint64_t lba)
 {
 	LOG(3, "bttp %p lane %u lba %" PRIu64, bttp, lane, lba);
 
-	return map_entry_setf(bttp, lane, lba, BTT_MAP_ENTRY_ZERO);
+	return map_entry_setf(bttp, lane, lba, 1, BTT_MAP_ENTRY_ZERO);
 }
 
 /*
@@ -1898,7 +2309,38 @@ btt_set_error(struct btt *bttp, unsigned lane, uint64_t lba)
 {
 	LOG(3, "bttp %p lane %u lba %" PRIu64, bttp, lane, lba);
 
-	return map_entry_setf(bttp, lane, lba, BTT_MAP_ENTRY_ERROR);
+	return map_entry_setf(bttp, lane, lba, 1, BTT_MAP_ENTRY_ERROR);
+}
+
+/*
+ * btt_set_zero_range -- mark a range of blocks as zeroed in a btt namespace
+ *
+ * Returns 0 on success, otherwise -1/errno.
+ */
+int
+btt_set_zero_range(struct btt *bttp, unsigned lane, uint64_t lba,
+		uint64_t count)
+{
+	LOG(3, "bttp %p lane %u lba %" PRIu64 " count %" PRIu64,
+			bttp, lane, lba, count);
+
+	return map_entry_setf(bttp, lane, lba, count, BTT_MAP_ENTRY_ZERO);
+}
+
+/*
+ * btt_set_error_range -- mark a range of blocks as in an error state in
+ *	a btt namespace
+ *
+ * Returns 0 on success, otherwise -1/errno.
+ */
+int
+btt_set_error_range(struct btt *bttp, unsigned lane, uint64_t lba,
+		uint64_t count)
+{
+	LOG(3, "bttp %p lane %u lba %" PRIu64 " count %" PRIu64,
+			bttp, lane, lba, count);
+
+	return map_entry_setf(bttp, lane, lba, count, BTT_MAP_ENTRY_ERROR);
 }
 
 /*
@@ -2070,7 +2512,9 @@ btt_fini(struct btt *bttp)
 			if (bttp->arenas[i].flogs)
 				Free(bttp->arenas[i].flogs);
 			if (bttp->arenas[i].rtt)
-				Free((void *)bttp->arenas[i].rtt);
+				util_aligned_free(bttp->arenas[i].rtt);
+			if (bttp->arenas[i].rtt_overflow)
+				Free((void *)bttp->arenas[i].rtt_overflow);
 			if (bttp->arenas[i].rtt)
 				Free((void *)bttp->arenas[i].map_locks);
 		}
@@ -40,6 +40,14 @@ struct ns_callback {
 		void *buf, size_t count, uint64_t off);
 	int (*nswrite)(void *ns, unsigned lane,
 		const void *buf, size_t count, uint64_t off);
+	/*
+	 * Optional: write without waiting for the data to become persistent
+	 * and wait for all such writes done so far. If not provided, nswrite
+	 * is used instead.
+	 */
+	int (*nswrite_nodrain)(void *ns, unsigned lane,
+		const void *buf, size_t count, uint64_t off);
+	void (*nsdrain)(void *ns, unsigned lane);
 	int (*nszero)(void *ns, unsigned lane, size_t count, uint64_t off);
 	ssize_t (*nsmap)(void *ns, unsigned lane, void **addrp,
 			size_t len, uint64_t off);
@@ -56,8 +64,14 @@ unsigned btt_nlane(struct btt *bttp);
 size_t btt_nlba(struct btt *bttp);
 int btt_read(struct btt *bttp, unsigned lane, uint64_t lba, void *buf);
 int btt_write(struct btt *bttp, unsigned lane, uint64_t lba, const void *buf);
+int btt_write_range(struct btt *bttp, unsigned lane, uint64_t lba,
+		uint64_t count, const void *buf);
 int btt_set_zero(struct btt *bttp, unsigned lane, uint64_t lba);
 int btt_set_error(struct btt *bttp, unsigned lane, uint64_t lba);
+int btt_set_zero_range(struct btt *bttp, unsigned lane, uint64_t lba,
+		uint64_t count);
+int btt_set_error_range(struct btt *bttp, unsigned lane, uint64_t lba,
+		uint64_t count);
 int btt_check(struct btt *bttp);
 void btt_fini(struct btt *bttp);
 
@@ -38,6 +38,9 @@
 #include "set.h"
 #include "out.h"
 #include "ctl_global.h"
+#include "lane.h"
+#include "obj.h"
+#include "pmalloc.h"
 
 static int
 CTL_READ_HANDLER(at_create)(PMEMobjpool *pop, enum ctl_query_source source,
@@ -91,8 +94,149 @@ static const struct ctl_node CTL_NODE(prefault)[] = {
 	CTL_NODE_END
 };
 
+static int
+CTL_READ_HANDLER(threads)(PMEMobjpool *pop, enum ctl_query_source source,
+	void *arg, struct ctl_indexes *indexes)
+{
+	int *arg_out = arg;
+	*arg_out = (int)Open_recovery_threads;
+
+	return 0;
+}
+
+static int
+CTL_WRITE_HANDLER(threads)(PMEMobjpool *pop, enum ctl_query_source source,
+	void *arg, struct ctl_indexes *indexes)
+{
+	int arg_in = *(int *)arg;
+	if (arg_in < 0) {
+		ERR("number of recovery threads cannot be negative");
+		errno = EINVAL;
+		return -1;
+	}
+
+	Open_recovery_threads = (unsigned)arg_in;
+
+	return 0;
+}
+
+static struct ctl_argument CTL_ARG(threads) = CTL_ARG_INT;
+
+static const struct ctl_node CTL_NODE(recovery)[] = {
+	CTL_LEAF_RW(threads),
+
+	CTL_NODE_END
+};
+
+static int
+CTL_READ_HANDLER(background_rebuild)(PMEMobjpool *pop,
+	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
+{
+	int *arg_out = arg;
+	*arg_out = Open_heap_background_rebuild;
+
+	return 0;
+}
+
+static int
+CTL_WRITE_HANDLER(background_rebuild)(PMEMobjpool *pop,
+	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
+{
+	int arg_in = *(int *)arg;
+
+	Open_heap_background_rebuild = arg_in;
+
+	return 0;
+}
+
+static struct ctl_argument CTL_ARG(background_rebuild) = CTL_ARG_BOOLEAN;
+
+static const struct ctl_node CTL_NODE(heap)[] = {
+	CTL_LEAF_RW(background_rebuild),
+
+	CTL_NODE_END
+};
+
+static int
+CTL_READ_HANDLER(open_nlanes)(PMEMobjpool *pop, enum ctl_query_source source,
+	void *arg, struct ctl_indexes *indexes)
+{
+	int *arg_out = arg;
+	*arg_out = (int)Open_nlanes;
+
+	return 0;
+}
+
+static int
+CTL_WRITE_HANDLER(open_nlanes)(PMEMobjpool *pop, enum ctl_query_source source,
+	void *arg, struct ctl_indexes *indexes)
+{
+	int arg_in = *(int *)arg;
+	if (arg_in < 0) {
+		ERR("number of lanes cannot be negative");
+		errno = EINVAL;
+		return -1;
+	}
+
+	Open_nlanes = (unsigned)arg_in;
+
+	return 0;
+}
+
+static struct ctl_argument CTL_ARG(open_nlanes) = CTL_ARG_INT;
+
+static const struct ctl_node CTL_NODE(open)[] = {
+	CTL_CHILD(recovery),
+	CTL_CHILD(heap),
+	{CTL_STR(nlanes), CTL_NODE_LEAF,
+		{CTL_READ_HANDLER(open_nlanes), CTL_WRITE_HANDLER(open_nlanes),
+		NULL}, &CTL_ARG(open_nlanes), NULL},
+
+	CTL_NODE_END
+};
+
+static int
+CTL_READ_HANDLER(create_nlanes)(PMEMobjpool *pop,
+	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
+{
+	int *arg_out = arg;
+	*arg_out = (int)Create_nlanes;
+
+	return 0;
+}
+
+static int
+CTL_WRITE_HANDLER(create_nlanes)(PMEMobjpool *pop,
+	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
+{
+	int arg_in = *(int *)arg;
+	if (arg_in <= 0 || arg_in > OBJ_MAX_NLANES) {
+		ERR("number of lanes must be between 1 and %d",
+			OBJ_MAX_NLANES);
+		errno = EINVAL;
+		return -1;
+	}
+
+	Create_nlanes = (unsigned)arg_in;
+
+	return 0;
+}
+
+static struct ctl_argument CTL_ARG(create_nlanes) = CTL_ARG_INT;
+
+static const struct ctl_node CTL_NODE(create)[] = {
+	{CTL_STR(nlanes), CTL_NODE_LEAF,
+		{CTL_READ_HANDLER(create_nlanes),
+		CTL_WRITE_HANDLER(create_nlanes), NULL},
+		&CTL_ARG(create_nlanes), NULL},
+
+	CTL_NODE_END
+};
+
 void
 ctl_global_register(void)
 {
 	CTL_REGISTER_MODULE(NULL, prefault);
+	CTL_REGISTER_MODULE(NULL, open);
+	CTL_REGISTER_MODULE(NULL, create);
 }
@@ -0,0 +1,341 @@
+/*
+ * Copyright 2018, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * defrag.c -- compaction of sparse runs
+ *
+ * Runs are only returned to the pool of free chunks once all of their units
+ * are free. A run that is left with a handful of objects after the rest of
+ * them were freed pins the whole chunk. The compaction moves the objects
+ * from such sparse runs, least occupied first, to other places in the heap,
+ * one transaction per object, so that the emptied runs can be reclaimed.
+ * Since all the references to the objects are owned by the application,
+ * it's notified about every relocation through a callback invoked inside
+ * of the transaction.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "alloc_class.h"
+#include "defrag.h"
+#include "heap.h"
+#include "obj.h"
+#include "out.h"
+#include "palloc.h"
+#include "sys_util.h"
+#include "vec.h"
+
+struct sparse_run {
+	struct memory_block m;
+	unsigned used; /* number of allocated units */
+};
+
+VEC(sparse_runs, struct sparse_run);
+VEC(defrag_objects, uint64_t);
+
+struct defrag_scan {
+	struct palloc_heap *heap;
+	struct pobj_defrag_fragmentation *frag;
+	struct sparse_runs *sparse; /* optional, collects the sparse runs */
+};
+
+/*
+ * defrag_run_is_sparse -- (internal) checks whether the run is in use and
+ *	filled in at most the threshold percent
+ */
+static int
+defrag_run_is_sparse(struct palloc_heap *heap, const struct run_occupancy *occ)
+{
+	unsigned used = occ->nallocs - occ->nfree;
+
+	return used != 0 && (uint64_t)used * 100 <=
+		(uint64_t)occ->nallocs * heap->defrag_threshold;
+}
+
+/*
+ * defrag_scan_cb -- (internal) accounts a single run
+ */
+static int
+defrag_scan_cb(const struct memory_block *m, void *arg)
+{
+	struct defrag_scan *s = arg;
+
+	if (m->type != MEMORY_BLOCK_RUN)
+		return 0;
+
+	struct run_occupancy occ;
+	heap_run_occupancy(s->heap, m, &occ);
+
+	s->frag->runs++;
+	s->frag->run_bytes += occ.nallocs * occ.unit_size;
+	s->frag->free_bytes += occ.nfree * occ.unit_size;
+
+	if (!defrag_run_is_sparse(s->heap, &occ))
+		return 0;
+
+	unsigned used = occ.nallocs - occ.nfree;
+
+	s->frag->sparse_runs++;
+	s->frag->sparse_bytes += used * occ.unit_size;
+
+	if (s->sparse != NULL) {
+		struct sparse_run r;
+		r.m = *m;
+		r.used = used;
+		VEC_PUSH_BACK(s->sparse, r);
+	}
+
+	return 0;
+}
+
+/*
+ * defrag_scan -- (internal) walks through all the runs in the heap
+ */
+static void
+defrag_scan(struct palloc_heap *heap, struct pobj_defrag_fragmentation *frag,
+	struct sparse_runs *sparse)
+{
+	memset(frag, 0, sizeof(*frag));
+
+	struct defrag_scan s = {heap, frag, sparse};
+	heap_foreach_chunk(heap, defrag_scan_cb, &s);
+}
+
+/*
+ * defrag_fragmentation -- calculates the fragmentation of the runs
+ */
+void
+defrag_fragmentation(PMEMobjpool *pop, struct pobj_defrag_fragmentation *frag)
+{
+	defrag_scan(&pop->heap, frag, NULL);
+}
+
+/*
+ * defrag_sparse_run_cmp -- (internal) orders the runs from the least occupied
+ */
+static int
+defrag_sparse_run_cmp(const void *lhs, const void *rhs)
+{
+	const struct sparse_run *l = lhs;
+	const struct sparse_run *r = rhs;
+
+	if (l->used != r->used)
+		return l->used < r->used ? -1 : 1;
+
+	return 0;
+}
+
+struct defrag_collect {
+	struct palloc_heap *heap;
+	struct defrag_objects *objects;
+};
+
+/*
+ * defrag_collect_cb -- (internal) remembers the offset of an object
+ */
+static int
+defrag_collect_cb(const struct memory_block *m, void *arg)
+{
+	struct defrag_collect *c = arg;
+
+	/* the root object and the library metadata are never moved */
+	if (m->m_ops->get_flags(m) & OBJ_INTERNAL_OBJECT_MASK)
+		return 0;
+
+	uint64_t off = HEAP_PTR_TO_OFF(c->heap, m->m_ops->get_user_data(m));
+	VEC_PUSH_BACK(c->objects, off);
+
+	return 0;
+}
+
+/*
+ * defrag_relocate -- (internal) moves a single object out of the run
+ *
+ * Returns 0 if the object was moved, 1 if the allocator handed out memory
+ * from the same run and -1 on error.
+ */
+static int
+defrag_relocate(PMEMobjpool *pop, const struct sparse_run *r,
+	struct alloc_class *c, uint64_t off, struct pobj_defrag *d)
+{
+	struct palloc_heap *heap = &pop->heap;
+
+	PMEMoid oldoid = {pop->uuid_lo, off};
+	size_t size = palloc_usable_size(heap, off);
+	uint64_t type_num = palloc_extra(heap, off);
+
+	if (pmemobj_tx_begin(pop, NULL, TX_PARAM_NONE) != 0)
+		return -1;
+
+	PMEMoid newoid = pmemobj_tx_xalloc(size, type_num,
+		POBJ_CLASS_ID(c->id));
+	if (OID_IS_NULL(newoid))
+		goto end; /* the transaction is already aborted */
+
+	struct memory_block m = memblock_from_offset(heap, newoid.off);
+	if (m.zone_id == r->m.zone_id && m.chunk_id == r->m.chunk_id) {
+		pmemobj_tx_abort(ECANCELED);
+		goto end;
+	}
+
+	memcpy(OBJ_OFF_TO_PTR(pop, newoid.off), OBJ_OFF_TO_PTR(pop, off),
+		size);
+
+	d->relocated(pop, oldoid, newoid, d->arg);
+
+	/* the callback is allowed to abort the transaction */
+	if (pmemobj_tx_stage() == TX_STAGE_WORK)
+		pmemobj_tx_free(oldoid);
+
+	if (pmemobj_tx_stage() == TX_STAGE_WORK)
+		pmemobj_tx_commit();
+
+end:;
+	int err = pmemobj_tx_end();
+	if (err == 0)
+		return 0;
+
+	if (err == ECANCELED)
+		return 1;
+
+	errno = err;
+	return -1;
+}
+
+/*
+ * defrag_compact -- (internal) moves all the objects out of the run
+ */
+static int
+defrag_compact(PMEMobjpool *pop, struct sparse_run *r, struct pobj_defrag *d)
+{
+	struct palloc_heap *heap = &pop->heap;
+
+	/* the earlier relocations might have changed the run */
+	struct run_occupancy occ;
+	heap_run_occupancy(heap, &r->m, &occ);
+	if (!defrag_run_is_sparse(heap, &occ))
+		return 0;
+
+	struct alloc_class *c = alloc_class_by_run(heap_alloc_classes(heap),
+		occ.unit_size, r->m.header_type, r->m.size_idx);
+	if (c == NULL)
+		return 0; /* there's no class that could hold the objects */
+
+	r->used = occ.nallocs - occ.nfree;
+
+	struct defrag_objects objects;
+	VEC_INIT(&objects);
+
+	/*
+	 * The bitmap of the run is modified under its lock only once
+	 * the allocated objects are fully initialized.
+	 */
+	struct memory_block m = r->m;
+	struct defrag_collect collect = {heap, &objects};
+	os_mutex_t *lock = m.m_ops->get_lock(&m);
+	util_mutex_lock(lock);
+	heap_run_foreach_object(heap, defrag_collect_cb, &collect, &m);
+	util_mutex_unlock(lock);
+
+	int ret = 0;
+	size_t moved = 0;
+	uint64_t off;
+	VEC_FOREACH(off, &objects) {
+		if (d->max_objects != 0 && d->objects == d->max_objects)
+			break;
+
+		ret = defrag_relocate(pop, r, c, off, d);
+		if (ret != 0)
+			break;
+
+		d->objects++;
+		moved++;
+	}
+
+	if (ret >= 0 && moved == VEC_SIZE(&objects)) {
+		heap_run_occupancy(heap, &r->m, &occ);
+		if (occ.nfree == occ.nallocs)
+			d->runs++;
+	}
+
+	VEC_DELETE(&objects);
+
+	return ret < 0 ? -1 : 0;
+}
+
+/*
+ * defrag_run -- compacts the sparse runs of the heap
+ */
+int
+defrag_run(PMEMobjpool *pop, struct pobj_defrag *d)
+{
+	if (d->relocated == NULL) {
+		ERR("relocation callback must be set");
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (pmemobj_tx_stage() != TX_STAGE_NONE) {
+		ERR("heap compaction cannot be run inside of a transaction");
+		errno = EINVAL;
+		return -1;
+	}
+
+	d->objects = 0;
+	d->runs = 0;
+
+	struct sparse_runs sparse;
+	VEC_INIT(&sparse);
+
+	struct pobj_defrag_fragmentation frag;
+	defrag_scan(&pop->heap, &frag, &sparse);
+
+	if (VEC_SIZE(&sparse) != 0)
+		qsort(VEC_ARR(&sparse), VEC_SIZE(&sparse),
+			sizeof(struct sparse_run), defrag_sparse_run_cmp);
+
+	int ret = 0;
+	struct sparse_run *r;
+	VEC_FOREACH_BY_PTR(r, &sparse) {
+		if (d->max_objects != 0 && d->objects == d->max_objects)
+			break;
+
+		if ((ret = defrag_compact(pop, r, d)) != 0)
+			break;
+	}
+
+	VEC_DELETE(&sparse);
+
+	return ret;
+}
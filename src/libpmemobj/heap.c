@@ -49,8 +49,10 @@
 #include "container_ravl.h"
 #include "container_seglists.h"
 #include "alloc_class.h"
+#include "os_numa.h"
 #include "os_thread.h"
 #include "set.h"
+#include "vec.h"
 
 /* calculates the size of the entire run, including any additional chunks */
 #define SIZEOF_RUN(runp, size_idx)\
@@ -63,6 +65,13 @@
  */
 #define HEAP_DEFAULT_GROW_SIZE (1 << 27) /* 128 megabytes */
 
+#define HEAP_THREAD_CACHE_DEFAULT_BATCH 32
+
+#define HEAP_DEFRAG_DEFAULT_THRESHOLD 25 /* percent */
+
+/* NUMA node of a zone that wasn't queried yet */
+#define HEAP_ZONE_NODE_UNKNOWN (-2)
+
 /*
  * Arenas store the collection of buckets for allocation classes. Each thread
  * is assigned an arena on its first allocator operation.
@@ -72,6 +81,71 @@ struct arena {
 	struct bucket *buckets[MAX_ALLOCATION_CLASSES];
 
 	size_t nthreads;
+
+	unsigned id;
+
+	/* NUMA node of the CPU the arena was created for, -1 if unknown */
+	int node;
+
+	/* the arena is considered when assigning arenas to new threads */
+	int automatic;
+};
+
+/*
+ * Runtime state of a zone. The zones are populated lazily, preferring the ones
+ * that are local to the NUMA node of the thread that needs the memory.
+ */
+struct zone_rt {
+	int node; /* NUMA node of the zone memory, -1 if unknown */
+	int exhausted; /* the zone has been claimed for population */
+	int populated; /* the population of the zone has finished */
+
+	/*
+	 * Held for the whole population of the zone, so that the frees of
+	 * huge blocks can tell whether it will find their chunks on its own,
+	 * see heap_zone_is_populated().
+	 */
+	os_mutex_t lock;
+
+	/*
+	 * The chunks below this one have been added to the occupancy counters
+	 * by the population of the zone, see heap_chunk_account(). Accessed
+	 * atomically, UINT32_MAX once the zone is populated.
+	 */
+	uint32_t accounted;
+};
+
+/*
+ * A single reserved memory block stored in a thread cache along with the
+ * reservation counter of the run it was taken from.
+ */
+struct thread_cache_entry {
+	struct memory_block m;
+	int *resvp;
+};
+
+/*
+ * Stack of reserved, unit-sized memory blocks of a single allocation class.
+ */
+struct thread_cache_magazine {
+	unsigned nblocks;
+	unsigned capacity;
+	struct thread_cache_entry *entries;
+};
+
+/*
+ * Thread caches hold memory blocks that were reserved from the buckets of the
+ * thread's arena in batches, so that small allocations can be served without
+ * acquiring the bucket lock. Each cached block holds a reservation on its run,
+ * which prevents the run from being recycled while the block is in the cache.
+ */
+struct thread_cache {
+	struct palloc_heap *heap;
+	struct arena *arena;
+
+	struct thread_cache_magazine mags[MAX_ALLOCATION_CLASSES];
+
+	LIST_ENTRY(thread_cache) entry;
 };
 
 struct heap_rt {
@@ -79,20 +153,62 @@ struct heap_rt {
 
 	/* DON'T use these two variable directly! */
 	struct bucket *default_bucket;
-	struct arena *arenas;
+	struct arena **arenas; /* HEAP_MAX_ARENAS slots */
 
-	/* protects assignment of arenas */
+	/* protects assignment of arenas and the list of thread caches */
 	os_mutex_t arenas_lock;
 
 	/* stores a pointer to one of the arenas */
 	os_tls_key_t thread_arena;
 
+	/* stores a pointer to the thread cache of the current thread */
+	os_tls_key_t thread_cache;
+	LIST_HEAD(thread_caches, thread_cache) thread_caches;
+
 	struct recycler *recyclers[MAX_ALLOCATION_CLASSES];
 
+	/*
+	 * Occupancy of the allocation classes, updated along with every change
+	 * of the persistent state of the heap. The huge class counts chunks.
+	 */
+	struct heap_occupancy occupancy[MAX_ALLOCATION_CLASSES];
+
+	/* chunks of the runs of classes that are not defined at runtime */
+	uint64_t foreign_run_chunks;
+
 	os_mutex_t run_locks[MAX_RUN_LOCKS];
 	unsigned nzones;
 	unsigned zones_exhausted;
+
+	/*
+	 * Runtime state of the zones, allocated once for all the zones the
+	 * heap can grow into, so that it never moves.
+	 */
+	struct zone_rt *zones;
+	unsigned max_zones;
 	unsigned narenas;
+
+	/*
+	 * Protects the runtime state of zones. Must be acquired after the lock
+	 * of the default bucket, which is held for the whole time a zone is
+	 * being populated, because populating coalesces free chunks and
+	 * rewrites their headers.
+	 */
+	os_mutex_t zones_lock;
+
+	/*
+	 * The background thread populates zones into its own bucket and merges
+	 * each one into the default bucket afterwards. The allocating threads
+	 * that find no zone left to populate wait for the merge of the pending
+	 * one, signaled on zones_cond.
+	 */
+	os_thread_t rebuild_thread;
+	struct bucket *rebuild_bucket;
+	int rebuild_running;
+	int rebuild_stop;
+	int zones_pending;
+	unsigned zones_merged;
+	os_cond_t zones_cond;
 };
 
 /*
@@ -106,26 +222,50 @@ heap_alloc_classes(struct palloc_heap *heap)
 
 
 /*
- * heap_arena_init -- (internal) initializes arena instance
+ * heap_arena_new -- (internal) allocates and initializes arena instance
  */
-static void
-heap_arena_init(struct arena *arena)
+static struct arena *
+heap_arena_new(unsigned id, int node)
 {
+	struct arena *arena = Malloc(sizeof(*arena));
+	if (arena == NULL)
+		return NULL;
+
 	arena->nthreads = 0;
+	arena->id = id;
+	arena->node = node;
+	arena->automatic = 1;
 
 	for (int i = 0; i < MAX_ALLOCATION_CLASSES; ++i)
 		arena->buckets[i] = NULL;
+
+	return arena;
 }
 
 /*
- * heap_arena_destroy -- (internal) destroys arena instance
+ * heap_arena_delete -- (internal) destroys arena instance
  */
 static void
-heap_arena_destroy(struct arena *arena)
+heap_arena_delete(struct arena *arena)
 {
 	for (int i = 0; i < MAX_ALLOCATION_CLASSES; ++i)
 		if (arena->buckets[i] != NULL)
 			bucket_delete(arena->buckets[i]);
+
+	Free(arena);
+}
+
+/*
+ * heap_narenas -- (internal) returns the current number of arenas
+ */
+static unsigned
+heap_narenas(struct heap_rt *heap)
+{
+	unsigned narenas;
+	util_atomic_load_explicit32(&heap->narenas, &narenas,
+		memory_order_acquire);
+
+	return narenas;
 }
 
 /*
@@ -148,10 +288,54 @@ heap_thread_arena_destructor(void *arg)
 	util_fetch_and_sub64(&a->nthreads, 1);
 }
 
+/*
+ * heap_thread_node -- (internal) returns the NUMA node of the CPU on which
+ *	the current thread is running, -1 if unknown
+ */
+static int
+heap_thread_node(struct heap_rt *heap)
+{
+	int cpu = os_numa_cpu();
+	if (cpu < 0)
+		return -1;
+
+	/* arenas are created one per CPU, reuse the already known topology */
+	if ((unsigned)cpu < heap_narenas(heap) && heap->arenas[cpu]->node >= 0)
+		return heap->arenas[cpu]->node;
+
+	return os_numa_node_of_cpu((unsigned)cpu);
+}
+
+/*
+ * heap_arena_least_used -- (internal) returns the least used automatic arena
+ *	of the given NUMA node, NULL if there's no such arena
+ */
+static struct arena *
+heap_arena_least_used(struct heap_rt *heap, int node)
+{
+	struct arena *least_used = NULL;
+
+	struct arena *a;
+	for (unsigned i = 0; i < heap->narenas; ++i) {
+		a = heap->arenas[i];
+		if (!a->automatic ||
+		    (node >= 0 && a->node >= 0 && a->node != node))
+			continue;
+
+		if (least_used == NULL || a->nthreads < least_used->nthreads)
+			least_used = a;
+	}
+
+	return least_used;
+}
+
 /*
  * heap_thread_arena_assign -- (internal) assigns the least used arena
  *	to current thread
  *
+ * The arenas are grouped by the NUMA nodes of their CPUs and a thread is
+ * assigned one of the arenas local to the CPU it is running on, if any.
+ *
  * To avoid complexities with regards to races in the search for the least
  * used arena, a lock is used, but the nthreads counter of the arena is still
  * bumped using atomic instruction because it can happen in parallel to a
@@ -160,18 +344,20 @@ heap_thread_arena_destructor(void *arg)
 static struct arena *
 heap_thread_arena_assign(struct heap_rt *heap)
 {
+	int node = heap_thread_node(heap);
+
 	os_mutex_lock(&heap->arenas_lock);
 
-	struct arena *least_used = NULL;
+	struct arena *least_used = heap_arena_least_used(heap, node);
+	if (least_used == NULL)
+		least_used = heap_arena_least_used(heap, -1);
 
-	struct arena *a;
-	for (unsigned i = 0; i < heap->narenas; ++i) {
-		a = &heap->arenas[i];
-		if (least_used == NULL || a->nthreads < least_used->nthreads)
-			least_used = a;
-	}
+	/* all of the arenas are reserved for explicit binding */
+	if (least_used == NULL)
+		least_used = heap->arenas[0];
 
-	LOG(4, "assigning %p arena to current thread", least_used);
+	LOG(4, "assigning %p arena (node %d) to current thread",
+		least_used, least_used->node);
 
 	util_fetch_and_add64(&least_used->nthreads, 1);
 
@@ -196,6 +382,195 @@ heap_thread_arena(struct heap_rt *heap)
 	return a;
 }
 
+/*
+ * heap_get_narenas -- returns the number of arenas
+ */
+unsigned
+heap_get_narenas(struct palloc_heap *heap)
+{
+	return heap_narenas(heap->rt);
+}
+
+/*
+ * heap_set_narenas -- creates new arenas so that there's narenas of them
+ *
+ * The number of arenas cannot be decreased, because threads can be bound to
+ * any of the existing arenas.
+ */
+int
+heap_set_narenas(struct palloc_heap *heap, unsigned narenas)
+{
+	struct heap_rt *h = heap->rt;
+	int ret = 0;
+
+	util_mutex_lock(&h->arenas_lock);
+
+	if (narenas < h->narenas || narenas > HEAP_MAX_ARENAS) {
+		ERR("number of arenas can only be increased, up to %u",
+			HEAP_MAX_ARENAS);
+		errno = EINVAL;
+		ret = -1;
+		goto out;
+	}
+
+	for (unsigned i = h->narenas; i < narenas; ++i) {
+		struct arena *a = heap_arena_new(i, os_numa_node_of_cpu(i));
+		if (a == NULL)
+			goto error_arena_new;
+
+		for (uint8_t c = 0; c < MAX_ALLOCATION_CLASSES; ++c) {
+			struct alloc_class *ac =
+				alloc_class_by_id(h->alloc_classes, c);
+			if (ac == NULL)
+				continue;
+
+			a->buckets[c] = bucket_new(
+				container_new_seglists(heap), ac);
+			if (a->buckets[c] == NULL) {
+				heap_arena_delete(a);
+				goto error_arena_new;
+			}
+		}
+
+		h->arenas[i] = a;
+
+		/* the arena must be complete before it becomes visible */
+		util_atomic_store_explicit32(&h->narenas, i + 1,
+			memory_order_release);
+	}
+
+	LOG(4, "number of arenas set to %u", narenas);
+
+out:
+	util_mutex_unlock(&h->arenas_lock);
+
+	return ret;
+
+error_arena_new:
+	ERR("!cannot create arena");
+	errno = ENOMEM;
+	ret = -1;
+	goto out;
+}
+
+/*
+ * heap_get_thread_arena_id -- returns the id of the arena assigned to the
+ *	current thread, assigns one if necessary
+ */
+unsigned
+heap_get_thread_arena_id(struct palloc_heap *heap)
+{
+	return heap_thread_arena(heap->rt)->id;
+}
+
+/*
+ * heap_set_thread_arena_id -- binds the current thread to the given arena
+ */
+int
+heap_set_thread_arena_id(struct palloc_heap *heap, unsigned arena_id)
+{
+	struct heap_rt *h = heap->rt;
+
+	if (arena_id >= heap_narenas(h)) {
+		ERR("arena %u does not exist", arena_id);
+		errno = EINVAL;
+		return -1;
+	}
+
+	struct arena *a = h->arenas[arena_id];
+	struct arena *prev = os_tls_get(h->thread_arena);
+	if (prev == a)
+		return 0;
+
+	/* the cached blocks belong to the buckets of the previous arena */
+	struct thread_cache *tc = os_tls_get(h->thread_cache);
+	if (tc != NULL) {
+		heap_thread_cache_flush(heap);
+		tc->arena = a;
+	}
+
+	util_fetch_and_add64(&a->nthreads, 1);
+	if (prev != NULL)
+		util_fetch_and_sub64(&prev->nthreads, 1);
+
+	os_tls_set(h->thread_arena, a);
+
+	LOG(4, "current thread bound to arena %u", arena_id);
+
+	return 0;
+}
+
+/*
+ * heap_get_arena_nthreads -- returns the number of threads assigned to the
+ *	arena
+ */
+size_t
+heap_get_arena_nthreads(struct palloc_heap *heap, unsigned arena_id)
+{
+	ASSERT(arena_id < heap_narenas(heap->rt));
+
+	size_t nthreads;
+	util_atomic_load_explicit64(&heap->rt->arenas[arena_id]->nthreads,
+		&nthreads, memory_order_acquire);
+
+	return nthreads;
+}
+
+/*
+ * heap_get_arena_size -- returns the size of the runs that are currently
+ *	owned by the buckets of the arena
+ */
+size_t
+heap_get_arena_size(struct palloc_heap *heap, unsigned arena_id)
+{
+	ASSERT(arena_id < heap_narenas(heap->rt));
+	struct arena *a = heap->rt->arenas[arena_id];
+
+	size_t size = 0;
+	for (int c = 0; c < MAX_ALLOCATION_CLASSES; ++c) {
+		struct bucket *b = a->buckets[c];
+		if (b == NULL)
+			continue;
+
+		util_mutex_lock(&b->lock);
+		if (b->is_active) {
+			size += (size_t)b->active_memory_block->m.size_idx *
+				CHUNKSIZE;
+		}
+		util_mutex_unlock(&b->lock);
+	}
+
+	return size;
+}
+
+/*
+ * heap_get_arena_automatic -- returns whether the arena can be assigned to
+ *	threads automatically
+ */
+int
+heap_get_arena_automatic(struct palloc_heap *heap, unsigned arena_id)
+{
+	ASSERT(arena_id < heap_narenas(heap->rt));
+
+	return heap->rt->arenas[arena_id]->automatic;
+}
+
+/*
+ * heap_set_arena_automatic -- sets whether the arena can be assigned to
+ *	threads automatically
+ */
+void
+heap_set_arena_automatic(struct palloc_heap *heap, unsigned arena_id,
+	int automatic)
+{
+	struct heap_rt *h = heap->rt;
+	ASSERT(arena_id < heap_narenas(h));
+
+	util_mutex_lock(&h->arenas_lock);
+	h->arenas[arena_id]->automatic = automatic;
+	util_mutex_unlock(&h->arenas_lock);
+}
+
 /*
  * heap_bucket_acquire_by_id -- fetches by id a bucket exclusive for the thread
  *	until heap_bucket_release is called
@@ -238,6 +613,235 @@ heap_bucket_release(struct palloc_heap *heap, struct bucket *b)
 	util_mutex_unlock(&b->lock);
 }
 
+/*
+ * heap_thread_cache_drain -- (internal) returns the given number of blocks
+ *	from the top of the magazine back to the bucket
+ *
+ * Blocks that belong to the run that is still active in the bucket are
+ * inserted back into its container, the others become available again once
+ * their run is recycled.
+ */
+static void
+heap_thread_cache_drain(struct thread_cache *tc, uint8_t class_id,
+	unsigned nblocks)
+{
+	struct thread_cache_magazine *mag = &tc->mags[class_id];
+	ASSERT(nblocks <= mag->nblocks);
+
+	if (nblocks == 0)
+		return;
+
+	struct bucket *b = tc->arena->buckets[class_id];
+	ASSERTne(b, NULL);
+
+	util_mutex_lock(&b->lock);
+
+	int *active_resvp = b->is_active ? bucket_current_resvp(b) : NULL;
+
+	while (nblocks-- != 0) {
+		struct thread_cache_entry *e = &mag->entries[--mag->nblocks];
+		if (e->resvp == active_resvp)
+			bucket_insert_block(b, &e->m);
+
+		util_fetch_and_sub64(e->resvp, 1);
+	}
+
+	util_mutex_unlock(&b->lock);
+}
+
+/*
+ * heap_thread_cache_delete -- (internal) deallocates thread cache instance
+ */
+static void
+heap_thread_cache_delete(struct thread_cache *tc)
+{
+	for (int i = 0; i < MAX_ALLOCATION_CLASSES; ++i)
+		Free(tc->mags[i].entries);
+
+	Free(tc);
+}
+
+/*
+ * heap_thread_cache_destructor -- (internal) drains and removes the cache of
+ *	an exiting thread
+ */
+static void
+heap_thread_cache_destructor(void *arg)
+{
+	struct thread_cache *tc = arg;
+	struct heap_rt *rt = tc->heap->rt;
+
+	for (int i = 0; i < MAX_ALLOCATION_CLASSES; ++i)
+		heap_thread_cache_drain(tc, (uint8_t)i, tc->mags[i].nblocks);
+
+	util_mutex_lock(&rt->arenas_lock);
+	LIST_REMOVE(tc, entry);
+	util_mutex_unlock(&rt->arenas_lock);
+
+	heap_thread_cache_delete(tc);
+}
+
+/*
+ * heap_thread_cache -- (internal) returns the thread cache of the current
+ *	thread, creates one if necessary
+ */
+static struct thread_cache *
+heap_thread_cache(struct palloc_heap *heap)
+{
+	struct heap_rt *rt = heap->rt;
+	struct thread_cache *tc = os_tls_get(rt->thread_cache);
+	if (tc != NULL)
+		return tc;
+
+	tc = Zalloc(sizeof(*tc));
+	if (tc == NULL)
+		return NULL;
+
+	tc->heap = heap;
+	tc->arena = heap_thread_arena(rt);
+
+	util_mutex_lock(&rt->arenas_lock);
+	LIST_INSERT_HEAD(&rt->thread_caches, tc, entry);
+	util_mutex_unlock(&rt->arenas_lock);
+
+	os_tls_set(rt->thread_cache, tc);
+
+	return tc;
+}
+
+/*
+ * heap_thread_cache_fill -- (internal) reserves a batch of unit-sized blocks
+ *	from the bucket under a single acquisition of the bucket lock,
+ *	returns the number of cached blocks
+ */
+static unsigned
+heap_thread_cache_fill(struct palloc_heap *heap,
+	struct thread_cache_magazine *mag, struct alloc_class *c, unsigned size)
+{
+	if (mag->capacity < size) {
+		struct thread_cache_entry *entries = Realloc(mag->entries,
+			sizeof(*entries) * size);
+		if (entries == NULL)
+			return mag->nblocks;
+
+		mag->entries = entries;
+		mag->capacity = size;
+	}
+
+	unsigned batch = heap->thread_cache_batch;
+	if (batch == 0 || batch > size)
+		batch = size;
+	if (batch > size - mag->nblocks)
+		batch = size - mag->nblocks;
+
+	unsigned first = mag->nblocks;
+
+	struct bucket *b = heap_bucket_acquire(heap, c);
+
+	for (unsigned i = 0; i < batch; ++i) {
+		struct thread_cache_entry *e = &mag->entries[mag->nblocks];
+		e->m = MEMORY_BLOCK_NONE;
+		e->m.size_idx = 1;
+
+		if (heap_get_bestfit_block(heap, b, &e->m) != 0)
+			break;
+
+		e->resvp = bucket_current_resvp(b);
+		ASSERTne(e->resvp, NULL);
+		util_fetch_and_add64(e->resvp, 1);
+
+		mag->nblocks++;
+	}
+
+	heap_bucket_release(heap, b);
+
+	LOG(4, "class %u thread cache refilled with %u blocks",
+		c->id, mag->nblocks - first);
+
+	/*
+	 * The magazine is a stack, reverse the new entries to preserve the
+	 * order in which the bucket provided the blocks.
+	 */
+	for (unsigned i = first, j = mag->nblocks; i + 1 < j; ++i, --j) {
+		struct thread_cache_entry tmp = mag->entries[i];
+		mag->entries[i] = mag->entries[j - 1];
+		mag->entries[j - 1] = tmp;
+	}
+
+	return mag->nblocks;
+}
+
+/*
+ * heap_thread_cache_get -- takes a reserved unit-sized block of the given
+ *	class from the cache of the current thread, refills the cache from the
+ *	bucket if it's empty
+ *
+ * Returns 0 on success and -1 if the block has to be taken from the bucket
+ * directly, either because the cache is disabled or couldn't be refilled.
+ */
+int
+heap_thread_cache_get(struct palloc_heap *heap, struct alloc_class *c,
+	struct memory_block *m, int **resvp)
+{
+	unsigned size = heap->thread_cache_size;
+	if (size == 0 || c->type != CLASS_RUN)
+		return -1;
+
+	struct thread_cache *tc = heap_thread_cache(heap);
+	if (tc == NULL)
+		return -1;
+
+	struct thread_cache_magazine *mag = &tc->mags[c->id];
+
+	/* the cache size might have been lowered since the last refill */
+	if (mag->nblocks > size)
+		heap_thread_cache_drain(tc, c->id, mag->nblocks - size);
+
+	if (mag->nblocks == 0 &&
+	    heap_thread_cache_fill(heap, mag, c, size) == 0)
+		return -1;
+
+	struct thread_cache_entry *e = &mag->entries[--mag->nblocks];
+	*m = e->m;
+	*resvp = e->resvp;
+
+	return 0;
+}
+
+/*
+ * heap_thread_cache_put -- returns a block obtained from heap_thread_cache_get
+ *	back to the cache of the current thread
+ */
+void
+heap_thread_cache_put(struct palloc_heap *heap, struct alloc_class *c,
+	const struct memory_block *m, int *resvp)
+{
+	struct thread_cache *tc = os_tls_get(heap->rt->thread_cache);
+	ASSERTne(tc, NULL);
+
+	struct thread_cache_magazine *mag = &tc->mags[c->id];
+	ASSERT(mag->nblocks < mag->capacity);
+
+	struct thread_cache_entry *e = &mag->entries[mag->nblocks++];
+	e->m = *m;
+	e->resvp = resvp;
+}
+
+/*
+ * heap_thread_cache_flush -- returns all blocks cached by the current thread
+ *	back to the buckets
+ */
+void
+heap_thread_cache_flush(struct palloc_heap *heap)
+{
+	struct thread_cache *tc = os_tls_get(heap->rt->thread_cache);
+	if (tc == NULL)
+		return;
+
+	for (int i = 0; i < MAX_ALLOCATION_CLASSES; ++i)
+		heap_thread_cache_drain(tc, (uint8_t)i, tc->mags[i].nblocks);
+}
+
 /*
  * heap_get_run_lock -- returns the lock associated with memory block
  */
@@ -525,6 +1129,54 @@ heap_run_process_metadata(struct palloc_heap *heap, struct bucket *b,
 	return inserted_blocks;
 }
 
+/*
+ * heap_occupancy_add -- (internal) updates the occupancy counters of the class
+ */
+static void
+heap_occupancy_add(struct palloc_heap *heap, uint8_t class_id,
+	int64_t runs, int64_t allocated)
+{
+	struct heap_occupancy *occ = &heap->rt->occupancy[class_id];
+
+	if (runs != 0)
+		util_fetch_and_add64(&occ->runs, (uint64_t)runs);
+	if (allocated != 0)
+		util_fetch_and_add64(&occ->allocated, (uint64_t)allocated);
+}
+
+/*
+ * heap_run_get_class -- (internal) returns the allocation class of the run or
+ *	NULL if the class is not defined at runtime
+ */
+static struct alloc_class *
+heap_run_get_class(struct palloc_heap *heap, const struct memory_block *m)
+{
+	struct zone *z = ZID_TO_ZONE(heap->layout, m->zone_id);
+	struct chunk_header *hdr = &z->chunk_headers[m->chunk_id];
+	struct chunk_run *run = (struct chunk_run *)&z->chunks[m->chunk_id];
+
+	return alloc_class_by_run(heap->rt->alloc_classes,
+		run->block_size, m->header_type, hdr->size_idx);
+}
+
+/*
+ * heap_chunk_is_accounted -- (internal) checks whether the chunk has already
+ *	been added to the occupancy counters by the population of its zone
+ *
+ * Must be called with the lock of the chunk or the default bucket held, see
+ * heap_chunk_account().
+ */
+static int
+heap_chunk_is_accounted(struct palloc_heap *heap, uint32_t zone_id,
+	uint32_t chunk_id)
+{
+	uint32_t accounted;
+	util_atomic_load_explicit32(&heap->rt->zones[zone_id].accounted,
+		&accounted, memory_order_acquire);
+
+	return chunk_id < accounted;
+}
+
 /*
  * heap_run_create -- (internal) initializes a new run on an existing free chunk
  */
@@ -535,6 +1187,9 @@ heap_run_create(struct palloc_heap *heap, struct bucket *b,
 	heap_run_init(heap, b, m);
 	memblock_rebuild_state(heap, m);
 	heap_run_process_metadata(heap, b, m);
+
+	if (heap_chunk_is_accounted(heap, m->zone_id, m->chunk_id))
+		heap_occupancy_add(heap, b->aclass->id, 1, 0);
 }
 
 /*
@@ -602,6 +1257,15 @@ heap_run_into_free_chunk(struct palloc_heap *heap,
 	os_mutex_t *lock = m->m_ops->get_lock(m);
 	util_mutex_lock(lock);
 
+	if (heap_chunk_is_accounted(heap, m->zone_id, m->chunk_id)) {
+		struct alloc_class *c = heap_run_get_class(heap, m);
+		if (c != NULL)
+			heap_occupancy_add(heap, c->id, -1, 0);
+		else
+			util_fetch_and_sub64(&heap->rt->foreign_run_chunks,
+				m->size_idx);
+	}
+
 	heap_chunk_init(heap, hdr, CHUNK_TYPE_FREE, m->size_idx);
 	memblock_rebuild_state(heap, m);
 
@@ -647,6 +1311,67 @@ heap_reclaim_run(struct palloc_heap *heap, struct memory_block *m)
 	return 0;
 }
 
+/*
+ * heap_run_account -- (internal) adds an existing run to the occupancy
+ *	counters
+ *
+ * Must be called with the lock of the run held.
+ */
+static void
+heap_run_account(struct palloc_heap *heap, const struct memory_block *m)
+{
+	struct alloc_class *c = heap_run_get_class(heap, m);
+	if (c == NULL) {
+		util_fetch_and_add64(&heap->rt->foreign_run_chunks,
+			m->size_idx);
+		return;
+	}
+
+	struct zone *z = ZID_TO_ZONE(heap->layout, m->zone_id);
+	struct chunk_run *run = (struct chunk_run *)&z->chunks[m->chunk_id];
+
+	/* the unused bits past the last block are always set */
+	int64_t nfree = 0;
+	for (int i = 0; i < MAX_BITMAP_VALUES; ++i)
+		nfree += util_popcount64(~run->bitmap[i]);
+
+	heap_occupancy_add(heap, c->id, 1, c->run.bitmap_nallocs - nfree);
+}
+
+/*
+ * heap_chunk_account -- (internal) adds a chunk found by the population of
+ *	its zone to the occupancy counters
+ *
+ * Allocations and frees update the persistent state and the counters under
+ * the lock of the chunk (huge blocks use the run lock of their first chunk,
+ * see huge_get_lock()), so the chunk is read and marked as accounted under
+ * that lock too. Runs are created and destroyed with the default bucket held,
+ * just like the population. Any change to a chunk that isn't accounted yet
+ * leaves the counters alone, the chunk is accounted in its current state
+ * later on.
+ */
+static void
+heap_chunk_account(struct palloc_heap *heap, const struct memory_block *m)
+{
+	struct heap_rt *h = heap->rt;
+	struct zone *z = ZID_TO_ZONE(heap->layout, m->zone_id);
+	struct chunk_header *hdr = &z->chunk_headers[m->chunk_id];
+
+	os_mutex_t *lock = heap_get_run_lock(heap, m->chunk_id);
+	util_mutex_lock(lock);
+
+	if (hdr->type == CHUNK_TYPE_RUN)
+		heap_run_account(heap, m);
+	else if (hdr->type == CHUNK_TYPE_USED)
+		heap_occupancy_add(heap, DEFAULT_ALLOC_CLASS_ID,
+			0, m->size_idx);
+
+	util_atomic_store_explicit32(&h->zones[m->zone_id].accounted,
+		m->chunk_id + m->size_idx, memory_order_release);
+
+	util_mutex_unlock(lock);
+}
+
 /*
  * heap_reclaim_zone_garbage -- (internal) creates volatile state of unused runs
  */
@@ -675,64 +1400,259 @@ heap_reclaim_zone_garbage(struct palloc_heap *heap, struct bucket *bucket,
 		i += hdr->size_idx;
 	}
 
-	for (uint32_t i = 0; i < z->header.size_idx; ) {
-		struct chunk_header *hdr = &z->chunk_headers[i];
-		int rret = 0;
-		ASSERT(hdr->size_idx != 0);
-
-		struct memory_block m = MEMORY_BLOCK_NONE;
-		m.zone_id = zone_id;
-		m.chunk_id = i;
-		m.size_idx = hdr->size_idx;
+	for (uint32_t i = 0; i < z->header.size_idx; ) {
+		struct chunk_header *hdr = &z->chunk_headers[i];
+		int rret = 0;
+		ASSERT(hdr->size_idx != 0);
+
+		struct memory_block m = MEMORY_BLOCK_NONE;
+		m.zone_id = zone_id;
+		m.chunk_id = i;
+		m.size_idx = hdr->size_idx;
+
+		memblock_rebuild_state(heap, &m);
+		heap_chunk_account(heap, &m);
+
+		switch (hdr->type) {
+			case CHUNK_TYPE_RUN:
+				if ((rret = heap_reclaim_run(heap, &m)) != 0) {
+					rchunks += rret;
+					heap_run_into_free_chunk(heap, bucket,
+						&m);
+				}
+				break;
+			case CHUNK_TYPE_FREE:
+				rchunks += (int)m.size_idx;
+				heap_free_chunk_reuse(heap, bucket, &m);
+				break;
+			case CHUNK_TYPE_USED:
+				break;
+			default:
+				ASSERT(0);
+		}
+
+		i = m.chunk_id + m.size_idx; /* hdr might have changed */
+	}
+
+	return rchunks == 0 ? ENOMEM : 0;
+}
+
+/*
+ * heap_zone_node -- (internal) returns the NUMA node of the zone memory
+ */
+static int
+heap_zone_node(struct palloc_heap *heap, uint32_t zone_id)
+{
+	struct zone_rt *zrt = &heap->rt->zones[zone_id];
+	if (zrt->node == HEAP_ZONE_NODE_UNKNOWN) {
+		zrt->node = os_numa_node_of_addr(
+			ZID_TO_ZONE(heap->layout, zone_id));
+		LOG(4, "zone %u is on node %d", zone_id, zrt->node);
+	}
+
+	return zrt->node;
+}
+
+/*
+ * heap_zone_select -- (internal) returns the first zone that hasn't been
+ *	populated yet, preferring zones local to the given NUMA node
+ *
+ * Zones can be local to different nodes when the pool set consists of parts
+ * that reside on per-node persistent memory regions.
+ */
+static uint32_t
+heap_zone_select(struct palloc_heap *heap, int node)
+{
+	struct heap_rt *h = heap->rt;
+	uint32_t first = UINT32_MAX;
+
+	for (uint32_t i = 0; i < h->nzones; ++i) {
+		if (h->zones[i].exhausted)
+			continue;
+
+		if (first == UINT32_MAX)
+			first = i;
+
+		if (node < 0 || heap_zone_node(heap, i) == node)
+			return i;
+	}
+
+	ASSERTne(first, UINT32_MAX);
+
+	return first;
+}
+
+/*
+ * heap_zone_populate -- (internal) creates volatile state of the memory blocks
+ *	of a single zone
+ */
+static int
+heap_zone_populate(struct palloc_heap *heap, struct bucket *bucket,
+	uint32_t zone_id)
+{
+	struct zone *z = ZID_TO_ZONE(heap->layout, zone_id);
+
+	/* ignore zone and chunk headers */
+	VALGRIND_ADD_TO_GLOBAL_TX_IGNORE(z, sizeof(z->header) +
+		sizeof(z->chunk_headers));
+
+	if (z->header.magic != ZONE_HEADER_MAGIC)
+		heap_zone_init(heap, zone_id, 0);
+
+	return heap_reclaim_zone_garbage(heap, bucket, zone_id);
+}
+
+/*
+ * heap_bucket_merge -- (internal) moves all free chunks from one bucket to
+ *	another, returns the number of moved chunks
+ */
+static unsigned
+heap_bucket_merge(struct bucket *dst, struct bucket *src)
+{
+	unsigned n = 0;
+	struct memory_block m = MEMORY_BLOCK_NONE;
+	m.size_idx = 1;
+
+	while (src->c_ops->get_rm_bestfit(src->container, &m) == 0) {
+		bucket_insert_block(dst, &m);
+		n++;
+
+		m = MEMORY_BLOCK_NONE;
+		m.size_idx = 1;
+	}
+
+	return n;
+}
+
+/*
+ * heap_zone_claim -- (internal) marks the zone as being populated
+ *
+ * Must be called with the zones lock held.
+ */
+static void
+heap_zone_claim(struct heap_rt *h, uint32_t zone_id)
+{
+	h->zones[zone_id].exhausted = 1;
+	h->zones_exhausted++;
+}
+
+/*
+ * heap_zone_accounted -- (internal) marks all the chunks of the zone as
+ *	accounted, including the ones the zone gains by extending the heap
+ */
+static void
+heap_zone_accounted(struct heap_rt *h, uint32_t zone_id)
+{
+	util_atomic_store_explicit32(&h->zones[zone_id].accounted,
+		UINT32_MAX, memory_order_release);
+}
+
+/*
+ * heap_zone_populated -- (internal) marks the zone as populated
+ *
+ * Must be called with the zones lock held.
+ */
+static void
+heap_zone_populated(struct heap_rt *h, uint32_t zone_id)
+{
+	h->zones[zone_id].populated = 1;
+	heap_zone_accounted(h, zone_id);
+}
+
+/*
+ * heap_zone_is_populated -- checks whether the population of the zone has
+ *	finished
+ *
+ * A free chunk in a zone that isn't populated yet must not be inserted into
+ * a bucket, the population finds it on its own. If the zone is being populated
+ * right now, this waits until it's done.
+ */
+int
+heap_zone_is_populated(struct palloc_heap *heap, uint32_t zone_id)
+{
+	struct zone_rt *zrt = &heap->rt->zones[zone_id];
+
+	/* all the chunks of a populated zone are accounted */
+	uint32_t accounted;
+	util_atomic_load_explicit32(&zrt->accounted, &accounted,
+		memory_order_acquire);
+	if (accounted == UINT32_MAX)
+		return 1;
+
+	util_mutex_lock(&zrt->lock);
+	int populated = zrt->populated;
+	util_mutex_unlock(&zrt->lock);
+
+	return populated;
+}
+
+/*
+ * heap_zone_wait_pending -- (internal) waits for the zone that is being
+ *	populated in the background to be merged into the default bucket
+ *
+ * The default bucket lock is dropped for the time of waiting, because the
+ * background thread needs it for the merge. Must be called with the zones lock
+ * held, returns with it released.
+ */
+static int
+heap_zone_wait_pending(struct palloc_heap *heap, struct bucket *defb)
+{
+	struct heap_rt *h = heap->rt;
+
+	if (!h->zones_pending) {
+		util_mutex_unlock(&h->zones_lock);
+		return ENOMEM;
+	}
+
+	unsigned merged = h->zones_merged;
+	heap_bucket_release(heap, defb);
 
-		memblock_rebuild_state(heap, &m);
+	while (h->zones_merged == merged)
+		os_cond_wait(&h->zones_cond, &h->zones_lock);
 
-		switch (hdr->type) {
-			case CHUNK_TYPE_RUN:
-				if ((rret = heap_reclaim_run(heap, &m)) != 0) {
-					rchunks += rret;
-					heap_run_into_free_chunk(heap, bucket,
-						&m);
-				}
-				break;
-			case CHUNK_TYPE_FREE:
-				rchunks += (int)m.size_idx;
-				heap_free_chunk_reuse(heap, bucket, &m);
-				break;
-			case CHUNK_TYPE_USED:
-				break;
-			default:
-				ASSERT(0);
-		}
+	util_mutex_unlock(&h->zones_lock);
 
-		i = m.chunk_id + m.size_idx; /* hdr might have changed */
-	}
+	struct bucket *b = heap_bucket_acquire_by_id(heap,
+		DEFAULT_ALLOC_CLASS_ID);
+	ASSERTeq(b, defb);
 
-	return rchunks == 0 ? ENOMEM : 0;
+	return 0;
 }
 
 /*
  * heap_populate_bucket -- (internal) creates volatile state of memory blocks
+ *
+ * Must be called with the default bucket lock held. Only the zone that is
+ * being populated by this thread is locked, the other threads can keep on
+ * freeing huge blocks of the other zones.
  */
 static int
 heap_populate_bucket(struct palloc_heap *heap, struct bucket *bucket)
 {
 	struct heap_rt *h = heap->rt;
 
+	util_mutex_lock(&h->zones_lock);
+
 	if (h->zones_exhausted == h->nzones)
-		return ENOMEM;
+		return heap_zone_wait_pending(heap, bucket);
 
-	uint32_t zone_id = h->zones_exhausted++;
-	struct zone *z = ZID_TO_ZONE(heap->layout, zone_id);
+	uint32_t zone_id = heap_zone_select(heap, heap_thread_node(h));
+	heap_zone_claim(h, zone_id);
 
-	/* ignore zone and chunk headers */
-	VALGRIND_ADD_TO_GLOBAL_TX_IGNORE(z, sizeof(z->header) +
-		sizeof(z->chunk_headers));
+	util_mutex_unlock(&h->zones_lock);
 
-	if (z->header.magic != ZONE_HEADER_MAGIC)
-		heap_zone_init(heap, zone_id, 0);
+	struct zone_rt *zrt = &h->zones[zone_id];
+	util_mutex_lock(&zrt->lock);
 
-	return heap_reclaim_zone_garbage(heap, bucket, zone_id);
+	int ret = heap_zone_populate(heap, bucket, zone_id);
+
+	util_mutex_lock(&h->zones_lock);
+	heap_zone_populated(h, zone_id);
+	util_mutex_unlock(&h->zones_lock);
+
+	util_mutex_unlock(&zrt->lock);
+
+	return ret;
 }
 
 /*
@@ -908,25 +1828,49 @@ out:
 void
 heap_memblock_on_free(struct palloc_heap *heap, const struct memory_block *m)
 {
-	if (m->type != MEMORY_BLOCK_RUN)
+	int accounted = heap_chunk_is_accounted(heap, m->zone_id, m->chunk_id);
+
+	if (m->type != MEMORY_BLOCK_RUN) {
+		if (accounted)
+			heap_occupancy_add(heap, DEFAULT_ALLOC_CLASS_ID,
+				0, -(int64_t)m->size_idx);
 		return;
+	}
 
-	struct zone *z = ZID_TO_ZONE(heap->layout, m->zone_id);
-	struct chunk_header *hdr = (struct chunk_header *)
-		&z->chunk_headers[m->chunk_id];
-	struct chunk_run *run = (struct chunk_run *)
-		&z->chunks[m->chunk_id];
+	ASSERTeq(ZID_TO_ZONE(heap->layout, m->zone_id)->
+		chunk_headers[m->chunk_id].type, CHUNK_TYPE_RUN);
 
-	ASSERTeq(hdr->type, CHUNK_TYPE_RUN);
+	struct alloc_class *c = heap_run_get_class(heap, m);
+	if (c == NULL)
+		return;
 
-	struct alloc_class *c = alloc_class_by_run(
-		heap->rt->alloc_classes,
-		run->block_size, m->header_type, hdr->size_idx);
+	if (accounted)
+		heap_occupancy_add(heap, c->id, 0, -(int64_t)m->size_idx);
+	recycler_inc_unaccounted(heap->rt->recyclers[c->id], m);
+}
+
+/*
+ * heap_memblock_on_alloc -- bookkeeping actions executed at every allocation
+ *	of a block
+ */
+void
+heap_memblock_on_alloc(struct palloc_heap *heap,
+	const struct memory_block *m)
+{
+	if (!heap_chunk_is_accounted(heap, m->zone_id, m->chunk_id))
+		return;
+
+	if (m->type != MEMORY_BLOCK_RUN) {
+		heap_occupancy_add(heap, DEFAULT_ALLOC_CLASS_ID,
+			0, m->size_idx);
+		return;
+	}
 
+	struct alloc_class *c = heap_run_get_class(heap, m);
 	if (c == NULL)
 		return;
 
-	recycler_inc_unaccounted(heap->rt->recyclers[c->id], m);
+	heap_occupancy_add(heap, c->id, 0, m->size_idx);
 }
 
 /*
@@ -1112,14 +2056,16 @@ heap_end(struct palloc_heap *h)
 }
 
 /*
- * heap_get_narenas -- (internal) returns the number of arenas to create
+ * heap_get_default_narenas -- (internal) returns the number of arenas to create
  */
 static unsigned
-heap_get_narenas(void)
+heap_get_default_narenas(void)
 {
 	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
 	if (cpus < 1)
 		cpus = 1;
+	if (cpus > HEAP_MAX_ARENAS)
+		cpus = HEAP_MAX_ARENAS;
 
 	unsigned arenas = (unsigned)cpus;
 
@@ -1144,23 +2090,34 @@ heap_create_alloc_class_buckets(struct palloc_heap *heap, struct alloc_class *c)
 			goto error_recycler_new;
 	}
 
+	util_mutex_lock(&h->arenas_lock);
+
 	int i;
 	for (i = 0; i < (int)h->narenas; ++i) {
-		h->arenas[i].buckets[c->id] = bucket_new(
+		/* arena created after the class was registered */
+		if (h->arenas[i]->buckets[c->id] != NULL)
+			continue;
+
+		h->arenas[i]->buckets[c->id] = bucket_new(
 			container_new_seglists(heap), c);
-		if (h->arenas[i].buckets[c->id] == NULL)
+		if (h->arenas[i]->buckets[c->id] == NULL)
 			goto error_cache_bucket_new;
 	}
 
+	util_mutex_unlock(&h->arenas_lock);
+
 	return 0;
 
 error_cache_bucket_new:
 	recycler_delete(h->recyclers[c->id]);
 
 	for (i -= 1; i >= 0; --i) {
-		bucket_delete(h->arenas[i].buckets[c->id]);
+		bucket_delete(h->arenas[i]->buckets[c->id]);
+		h->arenas[i]->buckets[c->id] = NULL;
 	}
 
+	util_mutex_unlock(&h->arenas_lock);
+
 error_recycler_new:
 	return -1;
 }
@@ -1190,12 +2147,247 @@ heap_buckets_init(struct palloc_heap *heap)
 	return 0;
 
 error_bucket_create:
-	for (unsigned i = 0; i < h->narenas; ++i)
-		heap_arena_destroy(&h->arenas[i]);
+	for (unsigned i = 0; i < h->narenas; ++i) {
+		for (int c = 0; c < MAX_ALLOCATION_CLASSES; ++c) {
+			struct arena *a = h->arenas[i];
+			if (a->buckets[c] != NULL)
+				bucket_delete(a->buckets[c]);
+			a->buckets[c] = NULL;
+		}
+	}
 
 	return -1;
 }
 
+/*
+ * Per-thread state of the parallel scan of all zones. Each thread collects the
+ * free chunks in its own bucket, which is merged into the default bucket once
+ * the scan is done. Chunks are never coalesced across zone boundaries, so
+ * nothing is lost by scanning the zones separately.
+ */
+struct heap_zones_scan {
+	struct palloc_heap *heap;
+	struct bucket *bucket;
+	uint32_t *next_zone; /* shared among all of the scanning threads */
+};
+
+/*
+ * heap_zones_scan_worker -- (internal) populates zones until all of them
+ *	are done
+ */
+static void *
+heap_zones_scan_worker(void *arg)
+{
+	struct heap_zones_scan *scan = arg;
+	struct palloc_heap *heap = scan->heap;
+
+	uint32_t zone_id;
+	while ((zone_id = util_fetch_and_add32(scan->next_zone, 1)) <
+			heap->rt->nzones) {
+		heap_zone_populate(heap, scan->bucket, zone_id);
+		heap_zone_accounted(heap->rt, zone_id);
+	}
+
+	return NULL;
+}
+
+/*
+ * heap_populate_zones -- creates volatile state of all zones in the heap
+ *	using the given number of threads
+ *
+ * This replaces the lazy population of zones that otherwise happens, one zone
+ * at a time and under the lock of the default bucket, when the allocator runs
+ * out of memory blocks. Must be called before the heap is used.
+ *
+ * If successful function returns zero. Otherwise an error number is returned.
+ */
+int
+heap_populate_zones(struct palloc_heap *heap, unsigned nthreads)
+{
+	struct heap_rt *h = heap->rt;
+
+	ASSERTeq(h->zones_exhausted, 0);
+
+	if (nthreads > h->nzones)
+		nthreads = h->nzones;
+	if (nthreads == 0)
+		nthreads = 1;
+
+	LOG(3, "heap %p nzones %u nthreads %u", heap, h->nzones, nthreads);
+
+	struct heap_zones_scan *scans = Malloc(sizeof(*scans) * nthreads);
+	if (scans == NULL)
+		goto error_scans_malloc;
+
+	os_thread_t *threads = Malloc(sizeof(*threads) * nthreads);
+	if (threads == NULL)
+		goto error_threads_malloc;
+
+	struct alloc_class *c = h->default_bucket->aclass;
+	uint32_t next_zone = 0;
+	unsigned nscans;
+	for (nscans = 0; nscans < nthreads; ++nscans) {
+		struct bucket *b = bucket_new(container_new_ravl(heap), c);
+		if (b == NULL)
+			break;
+
+		scans[nscans].heap = heap;
+		scans[nscans].bucket = b;
+		scans[nscans].next_zone = &next_zone;
+	}
+
+	if (nscans == 0)
+		goto error_bucket_new;
+
+	for (uint32_t i = 0; i < h->nzones; ++i) {
+		h->zones[i].exhausted = 1;
+		h->zones[i].populated = 1;
+	}
+	h->zones_exhausted = h->nzones;
+
+	/* the calling thread scans zones using the first bucket */
+	unsigned nstarted;
+	for (nstarted = 1; nstarted < nscans; ++nstarted) {
+		errno = os_thread_create(&threads[nstarted], NULL,
+			heap_zones_scan_worker, &scans[nstarted]);
+		if (errno != 0) {
+			LOG(2, "!os_thread_create");
+			break;
+		}
+	}
+
+	heap_zones_scan_worker(&scans[0]);
+
+	for (unsigned t = 1; t < nstarted; ++t)
+		os_thread_join(&threads[t], NULL);
+
+	struct bucket *defb = heap_bucket_acquire_by_id(heap,
+		DEFAULT_ALLOC_CLASS_ID);
+
+	for (unsigned t = 0; t < nscans; ++t) {
+		heap_bucket_merge(defb, scans[t].bucket);
+		bucket_delete(scans[t].bucket);
+	}
+
+	heap_bucket_release(heap, defb);
+
+	Free(threads);
+	Free(scans);
+
+	return 0;
+
+error_bucket_new:
+	Free(threads);
+error_threads_malloc:
+	Free(scans);
+error_scans_malloc:
+	ERR("!cannot allocate the state of the zone scan");
+	return ENOMEM;
+}
+
+/*
+ * heap_rebuild_worker -- (internal) populates all of the zones that weren't
+ *	claimed by the allocating threads yet, in order
+ *
+ * Each zone is populated into a bucket of the thread with only the lock of
+ * that zone held, so the scan serializes just with the frees of huge blocks
+ * in the same zone. The default bucket is locked only to merge the free
+ * chunks of the zone once it's done.
+ */
+static void *
+heap_rebuild_worker(void *arg)
+{
+	struct palloc_heap *heap = arg;
+	struct heap_rt *h = heap->rt;
+
+	uint32_t zone_id = 0;
+	for (;;) {
+		util_mutex_lock(&h->zones_lock);
+
+		while (zone_id < h->nzones &&
+			h->zones[zone_id].exhausted)
+			zone_id++;
+
+		if (h->rebuild_stop || zone_id == h->nzones) {
+			util_mutex_unlock(&h->zones_lock);
+			break;
+		}
+
+		heap_zone_claim(h, zone_id);
+		h->zones_pending = 1;
+
+		util_mutex_unlock(&h->zones_lock);
+
+		LOG(4, "populating zone %u in the background", zone_id);
+
+		struct zone_rt *zrt = &h->zones[zone_id];
+		util_mutex_lock(&zrt->lock);
+
+		heap_zone_populate(heap, h->rebuild_bucket, zone_id);
+
+		util_mutex_lock(&h->zones_lock);
+		heap_zone_populated(h, zone_id);
+		util_mutex_unlock(&h->zones_lock);
+
+		util_mutex_unlock(&zrt->lock);
+
+		struct bucket *defb = heap_bucket_acquire_by_id(heap,
+			DEFAULT_ALLOC_CLASS_ID);
+		heap_bucket_merge(defb, h->rebuild_bucket);
+		heap_bucket_release(heap, defb);
+
+		util_mutex_lock(&h->zones_lock);
+		h->zones_pending = 0;
+		h->zones_merged++;
+		os_cond_broadcast(&h->zones_cond);
+		util_mutex_unlock(&h->zones_lock);
+	}
+
+	return NULL;
+}
+
+/*
+ * heap_populate_zones_background -- starts a thread that creates volatile
+ *	state of all zones in the heap
+ *
+ * The heap can be used right away, the allocating threads populate zones on
+ * their own only if the background thread has not yet claimed them.
+ *
+ * Must not be called before all of the lane sections are recovered, because
+ * the recovery can free huge blocks without taking the lock of their zone.
+ *
+ * If successful function returns zero. Otherwise an error number is returned.
+ */
+int
+heap_populate_zones_background(struct palloc_heap *heap)
+{
+	struct heap_rt *h = heap->rt;
+
+	ASSERTeq(h->rebuild_running, 0);
+
+	h->rebuild_bucket = bucket_new(container_new_ravl(heap),
+		h->default_bucket->aclass);
+	if (h->rebuild_bucket == NULL) {
+		ERR("!cannot allocate the bucket of the zone rebuild");
+		return ENOMEM;
+	}
+
+	h->rebuild_stop = 0;
+	int ret = os_thread_create(&h->rebuild_thread, NULL,
+		heap_rebuild_worker, heap);
+	if (ret != 0) {
+		bucket_delete(h->rebuild_bucket);
+		h->rebuild_bucket = NULL;
+		errno = ret;
+		ERR("!os_thread_create");
+		return ret;
+	}
+
+	h->rebuild_running = 1;
+
+	return 0;
+}
+
 /*
  * heap_extend -- extend the heap by the given size
  *
@@ -1212,6 +2404,12 @@ heap_extend(struct palloc_heap *heap, struct bucket *b, size_t size)
 	if (nptr == NULL)
 		return -1;
 
+	uint32_t nzones = heap_max_zone(*heap->sizep + size);
+	if (nzones > heap->rt->max_zones) {
+		ERR("heap extended beyond the reserved address space");
+		return -1;
+	}
+
 	*heap->sizep += size;
 	pmemops_persist(&heap->p_ops, heap->sizep, sizeof(*heap->sizep));
 
@@ -1220,17 +2418,29 @@ heap_extend(struct palloc_heap *heap, struct bucket *b, size_t size)
 	 * automatically on the next heap_boot.
 	 */
 
-	uint32_t nzones = heap_max_zone(*heap->sizep);
 	uint32_t zone_id = nzones - 1;
 	struct zone *z = ZID_TO_ZONE(heap->layout, zone_id);
+	struct zone_rt *zrt = &heap->rt->zones[zone_id];
+
+	/* the zone might be in the middle of being populated */
+	util_mutex_lock(&zrt->lock);
 	uint32_t chunk_id = heap->rt->nzones == nzones ? z->header.size_idx : 0;
 	heap_zone_init(heap, zone_id, chunk_id);
+	int populated = zrt->populated;
+	util_mutex_unlock(&zrt->lock);
 
 	if (heap->rt->nzones != nzones) {
+		util_mutex_lock(&heap->rt->zones_lock);
 		heap->rt->nzones = nzones;
+		util_mutex_unlock(&heap->rt->zones_lock);
+
 		return 0;
 	}
 
+	/* the population of the zone finds the new chunk on its own */
+	if (!populated)
+		return 0;
+
 	struct chunk_header *hdr = &z->chunk_headers[chunk_id];
 
 	struct memory_block m = MEMORY_BLOCK_NONE;
@@ -1305,23 +2515,64 @@ heap_boot(struct palloc_heap *heap, void *heap_start, uint64_t heap_size,
 		goto error_alloc_classes_new;
 	}
 
-	h->narenas = heap_get_narenas();
-	h->arenas = Malloc(sizeof(struct arena) * h->narenas);
+	h->narenas = heap_get_default_narenas();
+	h->arenas = Zalloc(sizeof(struct arena *) * HEAP_MAX_ARENAS);
 	if (h->arenas == NULL) {
 		err = ENOMEM;
 		goto error_arenas_malloc;
 	}
 
+	for (unsigned i = 0; i < h->narenas; ++i) {
+		h->arenas[i] = heap_arena_new(i, os_numa_node_of_cpu(i));
+		if (h->arenas[i] == NULL) {
+			err = ENOMEM;
+			goto error_arena_new;
+		}
+	}
+
 	h->nzones = heap_max_zone(heap_size);
 
 	h->zones_exhausted = 0;
 
+	/* the heap can grow up to the end of the address space reservation */
+	uint64_t max_size = heap_size;
+	if (set != NULL) {
+		size_t off = (size_t)((uintptr_t)heap_start - (uintptr_t)base);
+		if (set->resvsize > off && set->resvsize - off > max_size)
+			max_size = set->resvsize - off;
+	}
+
+	h->max_zones = heap_max_zone(max_size);
+	h->zones = Malloc(sizeof(struct zone_rt) * h->max_zones);
+	if (h->zones == NULL) {
+		err = ENOMEM;
+		goto error_zones_malloc;
+	}
+
+	for (unsigned i = 0; i < h->max_zones; ++i) {
+		h->zones[i].node = HEAP_ZONE_NODE_UNKNOWN;
+		h->zones[i].exhausted = 0;
+		h->zones[i].populated = 0;
+		h->zones[i].accounted = 0;
+		util_mutex_init(&h->zones[i].lock);
+	}
+
+	util_mutex_init(&h->zones_lock);
+	os_cond_init(&h->zones_cond);
+	h->rebuild_bucket = NULL;
+	h->rebuild_running = 0;
+	h->rebuild_stop = 0;
+	h->zones_pending = 0;
+	h->zones_merged = 0;
+
 	for (int i = 0; i < MAX_RUN_LOCKS; ++i)
 		util_mutex_init(&h->run_locks[i]);
 
 	util_mutex_init(&h->arenas_lock);
 
 	os_tls_key_create(&h->thread_arena, heap_thread_arena_destructor);
+	os_tls_key_create(&h->thread_cache, heap_thread_cache_destructor);
+	LIST_INIT(&h->thread_caches);
 
 	heap->p_ops = *p_ops;
 	heap->layout = heap_start;
@@ -1331,18 +2582,26 @@ heap_boot(struct palloc_heap *heap, void *heap_start, uint64_t heap_size,
 	heap->stats = stats;
 	heap->set = set;
 	heap->growsize = HEAP_DEFAULT_GROW_SIZE;
+	heap->thread_cache_size = 0;
+	heap->thread_cache_batch = HEAP_THREAD_CACHE_DEFAULT_BATCH;
+	heap->defrag_threshold = HEAP_DEFRAG_DEFAULT_THRESHOLD;
 	VALGRIND_DO_CREATE_MEMPOOL(heap->layout, 0, 0);
 
-	for (unsigned i = 0; i < h->narenas; ++i)
-		heap_arena_init(&h->arenas[i]);
-
 	for (unsigned i = 0; i < MAX_ALLOCATION_CLASSES; ++i)
 		h->recyclers[i] = NULL;
 
+	memset(h->occupancy, 0, sizeof(h->occupancy));
+	h->foreign_run_chunks = 0;
+
 	heap_zone_update_if_needed(heap);
 
 	return 0;
 
+error_zones_malloc:
+error_arena_new:
+	for (unsigned i = 0; i < h->narenas && h->arenas[i] != NULL; ++i)
+		heap_arena_delete(h->arenas[i]);
+	Free(h->arenas);
 error_arenas_malloc:
 	alloc_class_collection_delete(h->alloc_classes);
 error_alloc_classes_new:
@@ -1420,12 +2679,35 @@ heap_cleanup(struct palloc_heap *heap)
 {
 	struct heap_rt *rt = heap->rt;
 
+	if (rt->rebuild_running) {
+		util_mutex_lock(&rt->zones_lock);
+		rt->rebuild_stop = 1;
+		util_mutex_unlock(&rt->zones_lock);
+
+		os_thread_join(&rt->rebuild_thread, NULL);
+		rt->rebuild_running = 0;
+
+		bucket_delete(rt->rebuild_bucket);
+		rt->rebuild_bucket = NULL;
+	}
+
+	/*
+	 * The reservations held by the thread caches don't have to be released,
+	 * all of the runtime state is discarded anyway.
+	 */
+	os_tls_key_delete(rt->thread_cache);
+	while (!LIST_EMPTY(&rt->thread_caches)) {
+		struct thread_cache *tc = LIST_FIRST(&rt->thread_caches);
+		LIST_REMOVE(tc, entry);
+		heap_thread_cache_delete(tc);
+	}
+
 	alloc_class_collection_delete(rt->alloc_classes);
 
 	bucket_delete(rt->default_bucket);
 
 	for (unsigned i = 0; i < rt->narenas; ++i)
-		heap_arena_destroy(&rt->arenas[i]);
+		heap_arena_delete(rt->arenas[i]);
 
 	for (int i = 0; i < MAX_RUN_LOCKS; ++i)
 		util_mutex_destroy(&rt->run_locks[i]);
@@ -1436,6 +2718,13 @@ heap_cleanup(struct palloc_heap *heap)
 
 	Free(rt->arenas);
 
+	for (unsigned i = 0; i < rt->max_zones; ++i)
+		util_mutex_destroy(&rt->zones[i].lock);
+	Free(rt->zones);
+
+	util_mutex_destroy(&rt->zones_lock);
+	os_cond_destroy(&rt->zones_cond);
+
 	for (int i = 0; i < MAX_ALLOCATION_CLASSES; ++i) {
 		if (heap->rt->recyclers[i] == NULL)
 			continue;
@@ -1739,6 +3028,120 @@ heap_foreach_object(struct palloc_heap *heap, object_callback cb, void *arg,
 	}
 }
 
+/*
+ * heap_foreach_chunk -- calls the callback for every chunk in the heap, be it
+ *	a free chunk, a huge allocation or a run
+ *
+ * The chunk headers are read without holding any lock, chunks that are being
+ * split or merged concurrently might be missed.
+ */
+void
+heap_foreach_chunk(struct palloc_heap *heap, object_callback cb, void *arg)
+{
+	for (uint32_t zone_id = 0; zone_id < heap->rt->nzones; ++zone_id) {
+		struct zone *z = ZID_TO_ZONE(heap->layout, zone_id);
+		if (z->header.magic == 0)
+			continue;
+
+		uint32_t chunk_id = 0;
+		while (chunk_id < z->header.size_idx) {
+			struct chunk_header *hdr = &z->chunk_headers[chunk_id];
+			if (hdr->size_idx == 0)
+				break;
+
+			struct memory_block m = MEMORY_BLOCK_NONE;
+			m.zone_id = zone_id;
+			m.chunk_id = chunk_id;
+			m.size_idx = hdr->size_idx;
+			memblock_rebuild_state(heap, &m);
+
+			if (cb(&m, arg) != 0)
+				return;
+
+			chunk_id += hdr->size_idx;
+		}
+	}
+}
+
+/*
+ * heap_run_occupancy -- returns the unit size of the run along with
+ *	the number of all and of free units in it
+ */
+void
+heap_run_occupancy(struct palloc_heap *heap, const struct memory_block *m,
+	struct run_occupancy *occ)
+{
+	ASSERTeq(m->type, MEMORY_BLOCK_RUN);
+
+	struct zone *z = ZID_TO_ZONE(heap->layout, m->zone_id);
+	struct chunk_header *hdr = &z->chunk_headers[m->chunk_id];
+	struct chunk_run *run = (struct chunk_run *)&z->chunks[m->chunk_id];
+
+	/* the memory block might describe an object, not the entire run */
+	struct alloc_class_run_proto run_proto;
+	alloc_class_generate_run_proto(&run_proto,
+		run->block_size, hdr->size_idx);
+
+	uint64_t free_space;
+	recycler_calc_score(heap, m, &free_space);
+
+	occ->unit_size = run->block_size;
+	occ->nallocs = run_proto.bitmap_nallocs;
+	occ->nfree = (unsigned)free_space;
+}
+
+/*
+ * heap_get_occupancy -- reads the occupancy counters of the class
+ */
+void
+heap_get_occupancy(struct palloc_heap *heap, uint8_t class_id,
+	struct heap_occupancy *occ)
+{
+	struct heap_occupancy *c = &heap->rt->occupancy[class_id];
+
+	util_atomic_load_explicit64(&c->runs, &occ->runs,
+		memory_order_relaxed);
+	util_atomic_load_explicit64(&c->allocated, &occ->allocated,
+		memory_order_relaxed);
+}
+
+/*
+ * heap_get_foreign_run_chunks -- returns the number of chunks used by runs
+ *	of the allocation classes that are not defined at runtime
+ */
+uint64_t
+heap_get_foreign_run_chunks(struct palloc_heap *heap)
+{
+	uint64_t n;
+	util_atomic_load_explicit64(&heap->rt->foreign_run_chunks, &n,
+		memory_order_relaxed);
+
+	return n;
+}
+
+/*
+ * heap_get_populated_size -- returns the size of the zones for which the
+ *	occupancy is already known
+ */
+size_t
+heap_get_populated_size(struct palloc_heap *heap)
+{
+	struct heap_rt *h = heap->rt;
+	size_t size = 0;
+
+	util_mutex_lock(&h->zones_lock);
+	for (uint32_t i = 0; i < h->nzones; ++i) {
+		if (!h->zones[i].populated)
+			continue;
+
+		struct zone *z = ZID_TO_ZONE(heap->layout, i);
+		size += (size_t)z->header.size_idx * CHUNKSIZE;
+	}
+	util_mutex_unlock(&h->zones_lock);
+
+	return size;
+}
+
 #if VG_MEMCHECK_ENABLED
 
 /*
@@ -49,12 +49,27 @@
 
 #define MAX_RUN_LOCKS 1024
 
+#define HEAP_THREAD_CACHE_MAX_SIZE 4096
+
+#define HEAP_MAX_ARENAS 1024
+
 #define HEAP_OFF_TO_PTR(heap, off) ((void *)((char *)((heap)->base) + (off)))
 #define HEAP_PTR_TO_OFF(heap, ptr)\
 	((uintptr_t)(ptr) - (uintptr_t)(heap->base))
 
 #define BIT_IS_CLR(a, i)	(!((a) & (1ULL << (i))))
 
+struct heap_occupancy {
+	uint64_t runs; /* number of runs of the class */
+	uint64_t allocated; /* allocated units, chunks for the huge class */
+};
+
+struct run_occupancy {
+	size_t unit_size;
+	unsigned nallocs; /* number of units in the run */
+	unsigned nfree; /* number of free units in the run */
+};
+
 int heap_boot(struct palloc_heap *heap, void *heap_start, uint64_t heap_size,
 		uint64_t *sizep,
 		void *base, struct pmem_ops *p_ops,
@@ -69,6 +84,9 @@ int heap_buckets_init(struct palloc_heap *heap);
 int heap_create_alloc_class_buckets(struct palloc_heap *heap,
 	struct alloc_class *c);
 
+int heap_populate_zones(struct palloc_heap *heap, unsigned nthreads);
+int heap_populate_zones_background(struct palloc_heap *heap);
+int heap_zone_is_populated(struct palloc_heap *heap, uint32_t zone_id);
 int heap_extend(struct palloc_heap *heap, struct bucket *defb, size_t size);
 
 struct alloc_class *
@@ -83,6 +101,22 @@ heap_bucket_acquire_by_id(struct palloc_heap *heap, uint8_t class_id);
 void
 heap_bucket_release(struct palloc_heap *heap, struct bucket *b);
 
+int heap_thread_cache_get(struct palloc_heap *heap, struct alloc_class *c,
+	struct memory_block *m, int **resvp);
+void heap_thread_cache_put(struct palloc_heap *heap, struct alloc_class *c,
+	const struct memory_block *m, int *resvp);
+void heap_thread_cache_flush(struct palloc_heap *heap);
+
+unsigned heap_get_narenas(struct palloc_heap *heap);
+int heap_set_narenas(struct palloc_heap *heap, unsigned narenas);
+unsigned heap_get_thread_arena_id(struct palloc_heap *heap);
+int heap_set_thread_arena_id(struct palloc_heap *heap, unsigned arena_id);
+size_t heap_get_arena_nthreads(struct palloc_heap *heap, unsigned arena_id);
+size_t heap_get_arena_size(struct palloc_heap *heap, unsigned arena_id);
+int heap_get_arena_automatic(struct palloc_heap *heap, unsigned arena_id);
+void heap_set_arena_automatic(struct palloc_heap *heap, unsigned arena_id,
+	int automatic);
+
 int heap_get_bestfit_block(struct palloc_heap *heap, struct bucket *b,
 	struct memory_block *m);
 struct memory_block
@@ -94,6 +128,9 @@ os_mutex_t *heap_get_run_lock(struct palloc_heap *heap,
 void
 heap_memblock_on_free(struct palloc_heap *heap, const struct memory_block *m);
 void
+heap_memblock_on_alloc(struct palloc_heap *heap,
+	const struct memory_block *m);
+void
 heap_free_chunk_reuse(struct palloc_heap *heap,
 	struct bucket *bucket, struct memory_block *m);
 
@@ -102,9 +139,18 @@ heap_run_foreach_object(struct palloc_heap *heap, object_callback cb,
 	void *arg, struct memory_block *m);
 void heap_foreach_object(struct palloc_heap *heap, object_callback cb,
 	void *arg, struct memory_block start);
+void heap_foreach_chunk(struct palloc_heap *heap, object_callback cb,
+	void *arg);
+void heap_run_occupancy(struct palloc_heap *heap, const struct memory_block *m,
+	struct run_occupancy *occ);
 
 struct alloc_class_collection *heap_alloc_classes(struct palloc_heap *heap);
 
+void heap_get_occupancy(struct palloc_heap *heap, uint8_t class_id,
+	struct heap_occupancy *occ);
+uint64_t heap_get_foreign_run_chunks(struct palloc_heap *heap);
+size_t heap_get_populated_size(struct palloc_heap *heap);
+
 void *heap_end(struct palloc_heap *heap);
 
 void heap_vg_open(struct palloc_heap *heap, object_callback cb,
@@ -50,6 +50,7 @@
 #include "util.h"
 #include "obj.h"
 #include "os_thread.h"
+#include "os_numa.h"
 #include "valgrind_internal.h"
 
 static os_tls_key_t Lane_info_key;
@@ -60,6 +61,23 @@ static __thread struct lane_info *Lane_info_cache;
 
 struct section_operations *Section_ops[MAX_LANE_SECTION];
 
+/*
+ * Number of threads used to recover the lanes and to scan the heap when the
+ * pool is booted, values lower than 2 mean that the calling thread does all
+ * of the work by itself.
+ */
+unsigned Open_recovery_threads;
+
+/*
+ * Shared state of the threads recovering a single section type of all lanes.
+ */
+struct lane_recovery {
+	PMEMobjpool *pop;
+	int section; /* index of the section type being recovered */
+	uint64_t next_lane; /* the next lane to be picked up by a worker */
+	int err; /* the first error reported by any of the workers */
+};
+
 /*
  * lane_info_create -- (internal) constructor for thread shared data
  */
@@ -287,6 +305,82 @@ lane_cleanup(PMEMobjpool *pop)
 	lane_info_cleanup(pop);
 }
 
+/*
+ * lane_recover_worker -- (internal) recovers lanes until all of them are done
+ *	or one of them fails
+ */
+static void *
+lane_recover_worker(void *arg)
+{
+	struct lane_recovery *r = arg;
+	PMEMobjpool *pop = r->pop;
+	int i = r->section;
+
+	uint64_t j;
+	while ((j = util_fetch_and_add64(&r->next_lane, 1)) < pop->nlanes) {
+		if (r->err != 0)
+			break;
+
+		struct lane_layout *layout = lane_get_layout(pop, j);
+		int err = Section_ops[i]->recover(pop, &layout->sections[i],
+			sizeof(layout->sections[i]));
+
+		if (err != 0) {
+			LOG(2, "section_ops->recover %d %" PRIu64 " %d",
+				i, j, err);
+			util_bool_compare_and_swap32(&r->err, 0, err);
+			break;
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * lane_recover_section -- (internal) recovers a single section type of all
+ *	lanes, possibly using multiple threads
+ *
+ * The lanes are independent of each other, at most one operation could have
+ * been in progress on each of them, which means that their recovery does not
+ * need to be serialized.
+ */
+static int
+lane_recover_section(PMEMobjpool *pop, int section, unsigned nthreads)
+{
+	struct lane_recovery r = {pop, section, 0, 0};
+
+	if (nthreads > pop->nlanes)
+		nthreads = (unsigned)pop->nlanes;
+
+	os_thread_t *threads = NULL;
+	unsigned nstarted = 0;
+	if (nthreads > 1) {
+		threads = Malloc(sizeof(*threads) * (nthreads - 1));
+		if (threads == NULL)
+			LOG(2, "!Malloc, recovering lanes serially");
+	}
+
+	/* the calling thread is one of the workers */
+	for (unsigned t = 0; threads != NULL && t < nthreads - 1; ++t) {
+		errno = os_thread_create(&threads[t], NULL,
+			lane_recover_worker, &r);
+		if (errno != 0) {
+			LOG(2, "!os_thread_create");
+			break;
+		}
+		nstarted++;
+	}
+
+	lane_recover_worker(&r);
+
+	for (unsigned t = 0; t < nstarted; ++t)
+		os_thread_join(&threads[t], NULL);
+
+	Free(threads);
+
+	return r.err;
+}
+
 /*
  * lane_recover_and_section_boot -- performs initialization and recovery of all
  * lanes
@@ -296,21 +390,13 @@ lane_recover_and_section_boot(PMEMobjpool *pop)
 {
 	int err = 0;
 	int i; /* section index */
-	uint64_t j; /* lane index */
-	struct lane_layout *layout;
+	unsigned nthreads = Open_recovery_threads;
 
-	for (i = 0; i < MAX_LANE_SECTION; ++i) {
-		for (j = 0; j < pop->nlanes; ++j) {
-			layout = lane_get_layout(pop, j);
-			err = Section_ops[i]->recover(pop, &layout->sections[i],
-				sizeof(layout->sections[i]));
+	LOG(3, "pop %p recovery threads %u", pop, nthreads);
 
-			if (err != 0) {
-				LOG(2, "section_ops->recover %d %" PRIu64 " %d",
-					i, j, err);
-				return err;
-			}
-		}
+	for (i = 0; i < MAX_LANE_SECTION; ++i) {
+		if ((err = lane_recover_section(pop, i, nthreads)) != 0)
+			return err;
 
 		if ((err = Section_ops[i]->boot(pop)) != 0) {
 			LOG(2, "section_ops->init %d %d", i, err);
@@ -434,6 +520,7 @@ get_lane_info_record(PMEMobjpool *pop)
 		info->prev = NULL;
 		info->primary = 0;
 		info->primary_attempts = LANE_PRIMARY_ATTEMPTS;
+		info->cpu = -1;
 		if (Lane_info_records) {
 			Lane_info_records->prev = info;
 		}
@@ -450,7 +537,28 @@ get_lane_info_record(PMEMobjpool *pop)
 }
 
 /*
- * lane_hold -- grabs a per-thread lane in a round-robin fashion
+ * lane_cpu_primary -- (internal) picks the primary lane of the thread based
+ *	on the CPU it is running on
+ *
+ * The CPUs get lanes LANE_JUMP apart. If there are more CPUs than that
+ * allows, the following ones are shifted by one lane on each wraparound.
+ */
+static inline void
+lane_cpu_primary(struct lane_info *info, uint64_t nlanes)
+{
+	int cpu = os_numa_cpu();
+	if (likely(cpu == info->cpu) || cpu < 0)
+		return;
+
+	uint64_t idx = (uint64_t)cpu * LANE_JUMP;
+	info->primary = (idx % nlanes + idx / nlanes) % nlanes;
+	info->primary_attempts = LANE_PRIMARY_ATTEMPTS;
+	info->cpu = cpu;
+}
+
+/*
+ * lane_hold -- grabs a per-thread lane, preferably the one assigned to the
+ *	current CPU
  */
 unsigned
 lane_hold(PMEMobjpool *pop, struct lane_section **section,
@@ -480,6 +588,7 @@ lane_hold(PMEMobjpool *pop, struct lane_section **section,
 	uint64_t *llocks = pop->lanes_desc.lane_locks;
 	/* grab next free lane from lanes available at runtime */
 	if (!lane->nest_count++) {
+		lane_cpu_primary(lane, pop->lanes_desc.runtime_nlanes);
 		get_lane(llocks, lane, pop->lanes_desc.runtime_nlanes);
 	}
 
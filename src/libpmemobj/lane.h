@@ -132,10 +132,18 @@ struct lane_info {
 	uint64_t primary;
 	int primary_attempts;
 
+	/*
+	 * The CPU for which the primary lane was picked, -1 if unknown. The
+	 * primary lane is picked again when the thread migrates, so that the
+	 * threads running on a CPU keep using the lanes warm in its cache.
+	 */
+	int cpu;
+
 	struct lane_info *prev, *next;
 };
 
 extern struct section_operations *Section_ops[MAX_LANE_SECTION];
+extern unsigned Open_recovery_threads;
 
 void lane_info_boot(void);
 void lane_info_destroy(void);
@@ -558,14 +558,15 @@ run_prep_operation_hdr(const struct memory_block *m, enum memblock_state op,
 }
 
 /*
- * huge_get_lock -- because huge memory blocks are always allocated from a
- *	single bucket there's no reason to lock them - the bucket itself is
- *	protected.
+ * huge_get_lock -- huge memory blocks are always allocated from a single
+ *	bucket, which is protected by its own lock, but the allocations and
+ *	frees are serialized with the accounting of the chunk done by the
+ *	population of its zone, see heap_chunk_account().
  */
 static os_mutex_t *
 huge_get_lock(const struct memory_block *m)
 {
-	return NULL;
+	return heap_get_run_lock(m->heap, m->chunk_id);
 }
 
 /*
@@ -43,6 +43,8 @@
  * The modifications are not visible until the context is processed.
  */
 
+#include <string.h>
+
 #include "memops.h"
 #include "obj.h"
 #include "out.h"
@@ -63,8 +65,73 @@ operation_init(struct operation_context *ctx, const void *base,
 	else
 		ctx->p_ops = NULL;
 
-	ctx->nentries[ENTRY_PERSISTENT] = 0;
-	ctx->nentries[ENTRY_TRANSIENT] = 0;
+	ctx->redo_next = NULL;
+
+	for (int t = 0; t < MAX_OPERATION_ENTRY_TYPE; ++t) {
+		ctx->nentries[t] = 0;
+		ctx->capacity[t] = MAX_MEMOPS_ENTRIES;
+		ctx->entries[t] = ctx->inline_entries[t];
+	}
+}
+
+/*
+ * operation_set_redo_next -- sets the location of the offset of the first
+ *	extension block of the redo log, used when the operation doesn't fit
+ *	in the lane redo log
+ */
+void
+operation_set_redo_next(struct operation_context *ctx,
+	const uint64_t *redo_next)
+{
+	ctx->redo_next = redo_next;
+}
+
+/*
+ * operation_reserve -- makes sure that the operation can hold at least the
+ *	given number of entries of each type
+ */
+int
+operation_reserve(struct operation_context *ctx, size_t nentries)
+{
+	for (int t = 0; t < MAX_OPERATION_ENTRY_TYPE; ++t) {
+		if (ctx->capacity[t] >= nentries)
+			continue;
+
+		struct operation_entry *entries =
+			Malloc(nentries * sizeof(struct operation_entry));
+		if (entries == NULL) {
+			ERR("!Malloc");
+			return -1;
+		}
+
+		memcpy(entries, ctx->entries[t],
+			ctx->nentries[t] * sizeof(struct operation_entry));
+
+		if (ctx->entries[t] != ctx->inline_entries[t])
+			Free(ctx->entries[t]);
+
+		ctx->entries[t] = entries;
+		ctx->capacity[t] = nentries;
+	}
+
+	return 0;
+}
+
+/*
+ * operation_reset -- discards the entries of the operation and releases the
+ *	entry arrays allocated by operation_reserve
+ */
+void
+operation_reset(struct operation_context *ctx)
+{
+	for (int t = 0; t < MAX_OPERATION_ENTRY_TYPE; ++t) {
+		if (ctx->entries[t] != ctx->inline_entries[t])
+			Free(ctx->entries[t]);
+
+		ctx->nentries[t] = 0;
+		ctx->capacity[t] = MAX_MEMOPS_ENTRIES;
+		ctx->entries[t] = ctx->inline_entries[t];
+	}
 }
 
 /*
@@ -98,8 +165,10 @@ operation_add_typed_entry(struct operation_context *ctx,
 	void *ptr, uint64_t value,
 	enum operation_type type, enum operation_entry_type en_type)
 {
-	ASSERT(ctx->nentries[ENTRY_PERSISTENT] < MAX_MEMOPS_ENTRIES);
-	ASSERT(ctx->nentries[ENTRY_TRANSIENT] < MAX_MEMOPS_ENTRIES);
+	ASSERT(ctx->nentries[ENTRY_PERSISTENT] <
+		ctx->capacity[ENTRY_PERSISTENT]);
+	ASSERT(ctx->nentries[ENTRY_TRANSIENT] <
+		ctx->capacity[ENTRY_TRANSIENT]);
 
 	/*
 	 * New entry to be added to the operations, all operations eventually
@@ -155,18 +224,22 @@ operation_process_persistent_redo(struct operation_context *ctx)
 {
 	struct operation_entry *e;
 	const struct redo_ctx *redo = ctx->redo_ctx;
+	uint64_t next = ctx->redo_next ? *ctx->redo_next : 0;
+
+	ASSERT(ctx->nentries[ENTRY_PERSISTENT] <=
+		redo_log_capacity(redo, MAX_MEMOPS_ENTRIES, next));
 
 	size_t i;
 	for (i = 0; i < ctx->nentries[ENTRY_PERSISTENT]; ++i) {
 		e = &ctx->entries[ENTRY_PERSISTENT][i];
 
-		redo_log_store(redo, ctx->redo, i,
+		redo_log_store_ext(redo, ctx->redo, MAX_MEMOPS_ENTRIES, next, i,
 				(uintptr_t)e->ptr - (uintptr_t)ctx->base,
 				e->value);
 	}
 
-	redo_log_set_last(redo, ctx->redo, i - 1);
-	redo_log_process(redo, ctx->redo, i);
+	redo_log_set_last_ext(redo, ctx->redo, MAX_MEMOPS_ENTRIES, next, i - 1);
+	redo_log_process_ext(redo, ctx->redo, MAX_MEMOPS_ENTRIES, next);
 }
 
 /*
@@ -211,4 +284,6 @@ operation_process(struct operation_context *ctx)
 		 */
 		VALGRIND_SET_CLEAN(e->ptr, sizeof(e->value));
 	}
+
+	operation_reset(ctx);
 }
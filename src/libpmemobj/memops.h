@@ -77,13 +77,23 @@ struct operation_context {
 	struct redo_log *redo;
 	const struct pmem_ops *p_ops;
 
+	/* offset of the first redo log extension block, NULL if none */
+	const uint64_t *redo_next;
+
 	size_t nentries[MAX_OPERATION_ENTRY_TYPE];
+	size_t capacity[MAX_OPERATION_ENTRY_TYPE];
+	struct operation_entry *entries[MAX_OPERATION_ENTRY_TYPE];
+
 	struct operation_entry
-		entries[MAX_OPERATION_ENTRY_TYPE][MAX_MEMOPS_ENTRIES];
+		inline_entries[MAX_OPERATION_ENTRY_TYPE][MAX_MEMOPS_ENTRIES];
 };
 
 void operation_init(struct operation_context *ctx, const void *base,
 	const struct redo_ctx *redo_ctx, struct redo_log *redo);
+void operation_set_redo_next(struct operation_context *ctx,
+	const uint64_t *redo_next);
+int operation_reserve(struct operation_context *ctx, size_t nentries);
+void operation_reset(struct operation_context *ctx);
 void operation_add_entry(struct operation_context *ctx,
 	void *ptr, uint64_t value, enum operation_type type);
 void operation_add_typed_entry(struct operation_context *ctx,
@@ -72,6 +72,12 @@
  */
 #define OBJ_NLANES_ENV_VARIABLE "PMEMOBJ_NLANES"
 
+/* number of lanes in the newly created pools */
+unsigned Create_nlanes = OBJ_NLANES;
+
+/* max number of lanes available at runtime, 0 if not limited */
+unsigned Open_nlanes;
+
 static const struct pool_attr Obj_create_attr = {
 		OBJ_HDR_SIG,
 		OBJ_FORMAT_MAJOR,
@@ -770,6 +776,14 @@ obj_runtime_init_common(PMEMobjpool *pop)
 		return errno;
 	}
 
+	/* started only once the lane sections no longer modify the heap */
+	if ((errno = pmalloc_boot_background(pop)) != 0) {
+		ERR("!pmalloc_boot_background");
+		lane_section_cleanup(pop);
+		lane_cleanup(pop);
+		return errno;
+	}
+
 	pop->conversion_flags = 0;
 	pmemops_persist(&pop->p_ops,
 		&pop->conversion_flags, sizeof(pop->conversion_flags));
@@ -793,9 +807,11 @@ obj_runtime_cleanup_common(PMEMobjpool *pop)
  * obj_descr_create -- (internal) create obj pool descriptor
  */
 static int
-obj_descr_create(PMEMobjpool *pop, const char *layout, size_t poolsize)
+obj_descr_create(PMEMobjpool *pop, const char *layout, size_t poolsize,
+	unsigned nlanes)
 {
-	LOG(3, "pop %p layout %s poolsize %zu", pop, layout, poolsize);
+	LOG(3, "pop %p layout %s poolsize %zu nlanes %u", pop, layout,
+		poolsize, nlanes);
 
 	ASSERTeq(poolsize % Pagesize, 0);
 
@@ -809,15 +825,23 @@ obj_descr_create(PMEMobjpool *pop, const char *layout, size_t poolsize)
 	struct pmem_ops *p_ops = &pop->p_ops;
 
 	pop->lanes_offset = OBJ_LANES_OFFSET;
-	pop->nlanes = OBJ_NLANES;
+	pop->nlanes = nlanes;
+
+	size_t lanes_end = pop->lanes_offset +
+		pop->nlanes * sizeof(struct lane_layout);
+	if (lanes_end + Pagesize > poolsize) {
+		ERR("pool size %zu too small for %" PRIu64 " lanes",
+			poolsize, pop->nlanes);
+		errno = EINVAL;
+		return -1;
+	}
 
 	/* zero all lanes */
 	void *lanes_layout = (void *)((uintptr_t)pop + pop->lanes_offset);
 	pmemops_memset_persist(p_ops, lanes_layout, 0,
 				pop->nlanes * sizeof(struct lane_layout));
 
-	pop->heap_offset = pop->lanes_offset +
-		pop->nlanes * sizeof(struct lane_layout);
+	pop->heap_offset = lanes_end;
 	pop->heap_offset = (pop->heap_offset + Pagesize - 1) & ~(Pagesize - 1);
 
 	size_t heap_size = pop->set->poolsize - pop->heap_offset;
@@ -894,6 +918,14 @@ obj_descr_check(PMEMobjpool *pop, const char *layout, size_t poolsize)
 		return -1;
 	}
 
+	if (pop->nlanes == 0 || pop->nlanes > OBJ_MAX_NLANES ||
+	    pop->lanes_offset + pop->nlanes * sizeof(struct lane_layout) >
+	    pop->heap_offset) {
+		ERR("invalid number of lanes: %" PRIu64, pop->nlanes);
+		errno = EINVAL;
+		return -1;
+	}
+
 	return 0;
 }
 
@@ -1110,8 +1142,15 @@ obj_runtime_init(PMEMobjpool *pop, int rdonly, int boot, unsigned nlanes)
 	 */
 	pop->rdonly = rdonly;
 
+	pop->redo_ext_enabled = (le32toh(pop->hdr.incompat_features) &
+		POOL_FEAT_REDO_EXT) != 0;
+
 	pop->uuid_lo = pmemobj_get_uuid_lo(pop);
 
+	/* the pool might have been created with fewer lanes */
+	if (nlanes > pop->nlanes)
+		nlanes = (unsigned)pop->nlanes;
+
 	pop->lanes_desc.runtime_nlanes = nlanes;
 
 	pop->tx_params = tx_params_new();
@@ -1197,16 +1236,21 @@ err_boot:
 }
 
 /*
- * obj_get_nlanes -- get a number of lanes available at runtime. If the value
- * provided with the PMEMOBJ_NLANES environment variable is greater than 0 and
- * smaller than OBJ_NLANES constant it returns PMEMOBJ_NLANES. Otherwise it
- * returns OBJ_NLANES.
+ * obj_get_nlanes -- get a number of lanes available at runtime. It's the
+ * lowest of the OBJ_MAX_NLANES constant, the value set with the open.nlanes
+ * CTL entry point and the value provided with the PMEMOBJ_NLANES environment
+ * variable, if the latter two are greater than 0. The result is further
+ * limited by the number of lanes in the pool.
  */
 static unsigned
 obj_get_nlanes(void)
 {
 	LOG(3, NULL);
 
+	unsigned ret = OBJ_MAX_NLANES;
+	if (Open_nlanes != 0 && Open_nlanes < ret)
+		ret = Open_nlanes;
+
 	char *env_nlanes = os_getenv(OBJ_NLANES_ENV_VARIABLE);
 	if (env_nlanes) {
 		int nlanes = atoi(env_nlanes);
@@ -1217,11 +1261,12 @@ obj_get_nlanes(void)
 			goto no_valid_env;
 		}
 
-		return (unsigned)(OBJ_NLANES < nlanes ? OBJ_NLANES : nlanes);
+		if ((unsigned)nlanes < ret)
+			ret = (unsigned)nlanes;
 	}
 
 no_valid_env:
-	return OBJ_NLANES;
+	return ret;
 }
 
 /*
@@ -1254,10 +1299,21 @@ pmemobj_createU(const char *path, const char *layout,
 	 * available in the pool or the value provided with PMEMOBJ_NLANES
 	 * environment variable whichever is lower.
 	 */
+	unsigned nlanes = Create_nlanes;
 	unsigned runtime_nlanes = obj_get_nlanes();
+	if (runtime_nlanes > nlanes)
+		runtime_nlanes = nlanes;
+
+	/*
+	 * Older versions of the library assume the default number of lanes,
+	 * so they must not open pools with a different one.
+	 */
+	struct pool_attr attr = Obj_create_attr;
+	if (nlanes != OBJ_NLANES)
+		attr.incompat_features |= POOL_FEAT_NLANES;
 
 	if (util_pool_create(&set, path, poolsize, PMEMOBJ_MIN_POOL,
-			PMEMOBJ_MIN_PART, &Obj_create_attr, &runtime_nlanes,
+			PMEMOBJ_MIN_PART, &attr, &runtime_nlanes,
 			REPLICAS_ENABLED) != 0) {
 		LOG(2, "cannot create pool or pool set");
 		return NULL;
@@ -1295,7 +1351,7 @@ pmemobj_createU(const char *path, const char *layout,
 	pop->set = set;
 
 	/* create pool descriptor */
-	if (obj_descr_create(pop, layout, set->poolsize) != 0) {
+	if (obj_descr_create(pop, layout, set->poolsize, nlanes) != 0) {
 		LOG(2, "creation of pool descriptor failed");
 		goto err;
 	}
@@ -1853,6 +1909,8 @@ pmemobj_close(PMEMobjpool *pop)
 		ravl_remove(pools_tree, n);
 	}
 
+	tx_post_commit_workers_stop(pop);
+
 	if (pop->tx_postcommit_tasks != NULL) {
 		ringbuf_delete(pop->tx_postcommit_tasks);
 	}
@@ -2787,20 +2845,67 @@ pmemobj_set_value(PMEMobjpool *pop, struct pobj_action *act,
 }
 
 /*
- * pmemobj_publish -- publishes a collection of actions
+ * obj_publish -- (internal) publishes a collection of actions, or cancels
+ *	all of them if that's not possible
  */
-void
-pmemobj_publish(PMEMobjpool *pop, struct pobj_action *actv, size_t actvcnt)
+static int
+obj_publish(PMEMobjpool *pop, struct pobj_action *actv, size_t actvcnt)
 {
 	struct redo_log *redo = pmalloc_redo_hold(pop);
 
 	struct operation_context ctx;
 	operation_init(&ctx, pop, pop->redo, redo);
 
-	ASSERT(actvcnt <= POBJ_MAX_ACTIONS);
+	/* every action results in at most a single redo log entry */
+	if (actvcnt > POBJ_MAX_ACTIONS &&
+	    pmalloc_redo_reserve(pop, &ctx, actvcnt) != 0) {
+		int oerrno = errno;
+
+		operation_reset(&ctx);
+		pmalloc_redo_release(pop);
+		palloc_cancel(&pop->heap, actv, (int)actvcnt);
+
+		ERR("cannot extend the redo log for %zu actions", actvcnt);
+		errno = oerrno;
+		return -1;
+	}
+
 	palloc_publish(&pop->heap, actv, (int)actvcnt, &ctx);
 
 	pmalloc_redo_release(pop);
+
+	return 0;
+}
+
+/*
+ * pmemobj_publish -- publishes a collection of actions
+ */
+void
+pmemobj_publish(PMEMobjpool *pop, struct pobj_action *actv, size_t actvcnt)
+{
+	LOG(3, "pop %p actv %p actvcnt %zu", pop, actv, actvcnt);
+
+	(void) obj_publish(pop, actv, actvcnt);
+}
+
+/*
+ * pmemobj_xpublish -- publishes a collection of actions, reports failures
+ */
+int
+pmemobj_xpublish(PMEMobjpool *pop, struct pobj_action *actv, size_t actvcnt,
+	uint64_t flags)
+{
+	LOG(3, "pop %p actv %p actvcnt %zu flags %llx", pop, actv, actvcnt,
+		(unsigned long long)flags);
+
+	if (flags & ~POBJ_XPUBLISH_VALID_FLAGS) {
+		ERR("unknown flags 0x%" PRIx64,
+				flags & ~POBJ_XPUBLISH_VALID_FLAGS);
+		errno = EINVAL;
+		return -1;
+	}
+
+	return obj_publish(pop, actv, actvcnt);
 }
 
 /*
@@ -2809,7 +2914,6 @@ pmemobj_publish(PMEMobjpool *pop, struct pobj_action *actv, size_t actvcnt)
 void
 pmemobj_cancel(PMEMobjpool *pop, struct pobj_action *actv, size_t actvcnt)
 {
-	ASSERT(actvcnt <= POBJ_MAX_ACTIONS);
 	palloc_cancel(&pop->heap, actv, (int)actvcnt);
 }
 
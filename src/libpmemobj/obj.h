@@ -62,7 +62,8 @@
 #define OBJ_FORMAT_RO_COMPAT_DEFAULT 0x0000
 
 #define OBJ_FORMAT_COMPAT_CHECK 0x0000
-#define OBJ_FORMAT_INCOMPAT_CHECK POOL_FEAT_ALL
+#define OBJ_FORMAT_INCOMPAT_CHECK\
+	(POOL_FEAT_ALL | POOL_FEAT_NLANES | POOL_FEAT_REDO_EXT)
 #define OBJ_FORMAT_RO_COMPAT_CHECK 0x0000
 
 /* size of the persistent part of PMEMOBJ pool descriptor (2kB) */
@@ -71,7 +72,8 @@
 #define OBJ_DSC_P_UNUSED	(OBJ_DSC_P_SIZE - PMEMOBJ_MAX_LAYOUT - 40)
 
 #define OBJ_LANES_OFFSET	8192	/* lanes offset (8kB) */
-#define OBJ_NLANES		1024	/* number of lanes */
+#define OBJ_NLANES		1024	/* default number of lanes */
+#define OBJ_MAX_NLANES		16384	/* max number of lanes in a pool */
 
 #define OBJ_OFF_TO_PTR(pop, off) ((void *)((uintptr_t)(pop) + (off)))
 #define OBJ_PTR_TO_OFF(pop, ptr) ((uintptr_t)(ptr) - (uintptr_t)(pop))
@@ -174,6 +176,10 @@ struct pmemobjpool {
 	int is_master_replica;
 	int has_remote_replicas;
 
+	/* POOL_FEAT_REDO_EXT is set in the pool headers */
+	int redo_ext_enabled;
+	PMEMmutex redo_ext_lock; /* serializes setting of the feature flag */
+
 	/* remote replica section */
 	void *rpp;	/* RPMEMpool opaque handle if it is a remote replica */
 	uintptr_t remote_base;	/* beginning of the remote pool */
@@ -197,7 +203,7 @@ struct pmemobjpool {
 
 	/* padding to align size of this structure to page boundary */
 	/* sizeof(unused2) == 8192 - offsetof(struct pmemobjpool, unused2) */
-	char unused2[1004];
+	char unused2[920];
 };
 
 /*
@@ -240,6 +246,9 @@ OBJ_OID_IS_VALID(PMEMobjpool *pop, PMEMoid oid)
 		    oid.off < pop->heap_offset + pop->heap_size);
 }
 
+extern unsigned Create_nlanes;
+extern unsigned Open_nlanes;
+
 void obj_init(void);
 void obj_fini(void);
 int obj_read_remote(void *ctx, uintptr_t base, void *dest, void *addr,
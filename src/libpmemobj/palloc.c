@@ -208,6 +208,26 @@ palloc_reservation_create(struct palloc_heap *heap, size_t size,
 	ASSERT(size_idx <= UINT32_MAX);
 	new_block->size_idx = (uint32_t)size_idx;
 
+	/*
+	 * Unit-sized blocks are served from the thread cache, if enabled,
+	 * without acquiring the bucket lock. The cached blocks are already
+	 * tracked as reservations of their runs.
+	 */
+	if (size_idx == 1 &&
+	    heap_thread_cache_get(heap, c, new_block, &out->resvp) == 0) {
+		if (alloc_prep_block(heap, new_block, constructor, arg,
+			extra_field, object_flags, &out->offset) != 0) {
+			heap_thread_cache_put(heap, c, new_block, out->resvp);
+			errno = ECANCELED;
+			return -1;
+		}
+
+		out->lock = new_block->m_ops->get_lock(new_block);
+		out->new_state = MEMBLOCK_ALLOCATED;
+
+		return 0;
+	}
+
 	struct bucket *b = heap_bucket_acquire(heap, c);
 
 	err = heap_get_bestfit_block(heap, b, new_block);
@@ -280,13 +300,15 @@ palloc_heap_action_exec(struct palloc_heap *heap,
 /*
  * palloc_restore_free_chunk_state -- updates the runtime state of a free chunk.
  *
- * This function also takes care of coalescing of huge chunks.
+ * This function also takes care of coalescing of huge chunks. The chunks of
+ * zones that aren't populated yet are left to the population.
  */
 static void
 palloc_restore_free_chunk_state(struct palloc_heap *heap,
 	struct memory_block *m)
 {
-	if (m->type == MEMORY_BLOCK_HUGE) {
+	if (m->type == MEMORY_BLOCK_HUGE &&
+	    heap_zone_is_populated(heap, m->zone_id)) {
 		struct bucket *b = heap_bucket_acquire_by_id(heap,
 			DEFAULT_ALLOC_CLASS_ID);
 		heap_free_chunk_reuse(heap, b, m);
@@ -334,6 +356,7 @@ palloc_heap_action_on_process(struct palloc_heap *heap,
 	if (act->new_state == MEMBLOCK_ALLOCATED) {
 		STATS_INC(heap->stats, persistent, heap_curr_allocated,
 			act->m.m_ops->get_real_size(&act->m));
+		heap_memblock_on_alloc(heap, &act->m);
 		if (act->resvp)
 			util_fetch_and_sub64(act->resvp, 1);
 	} else if (act->new_state == MEMBLOCK_FREE) {
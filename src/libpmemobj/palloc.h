@@ -53,6 +53,13 @@ struct palloc_heap {
 	uint64_t *sizep;
 	uint64_t growsize;
 
+	/* per-thread, per-class cache of reserved blocks (0 - disabled) */
+	unsigned thread_cache_size;
+	/* number of blocks reserved from a bucket on each cache refill */
+	unsigned thread_cache_batch;
+	/* runs filled in at most this percent are compacted by defrag */
+	unsigned defrag_threshold;
+
 	struct stats *stats;
 	struct pool_set *set;
 
@@ -40,6 +40,7 @@
 
 #include <inttypes.h>
 #include "valgrind_internal.h"
+#include "defrag.h"
 #include "heap.h"
 #include "lane.h"
 #include "memops.h"
@@ -49,6 +50,8 @@
 #include "pmalloc.h"
 #include "alloc_class.h"
 #include "set.h"
+#include "mmap.h"
+#include "sync.h"
 
 #ifdef DEBUG
 /*
@@ -63,6 +66,12 @@
 #define ALLOC_INPROGRESS_MARK ((void *)0x1)
 #endif
 
+/*
+ * If set, the zones of the heap are populated by a background thread started
+ * when the pool is booted.
+ */
+int Open_heap_background_rebuild;
+
 /*
  * pmalloc_redo_hold -- acquires allocator lane section and returns a pointer to
  * it's redo log
@@ -98,6 +107,108 @@ pmalloc_redo_release(PMEMobjpool *pop)
 	lane_release(pop);
 }
 
+/*
+ * pmalloc_redo_ext_constr -- (internal) constructor of a redo log extension
+ *	block
+ */
+static int
+pmalloc_redo_ext_constr(void *base, void *ptr, size_t usable_size, void *arg)
+{
+	PMEMobjpool *pop = base;
+	struct redo_log_ext *ext = ptr;
+
+	/* stale finish flags must not be interpreted as a valid log */
+	pmemops_memset_persist(&pop->p_ops, ext, 0, usable_size);
+
+	ext->next = 0;
+	ext->nentries = (usable_size - sizeof(*ext)) / sizeof(struct redo_log);
+	pmemops_persist(&pop->p_ops, ext, sizeof(*ext));
+
+	return 0;
+}
+
+/*
+ * pmalloc_redo_ext_enable -- (internal) sets the incompat feature flag of
+ *	redo log extensions in the pool headers, unless already set
+ *
+ * Older versions of the library look for the finish flag of the redo log only
+ * in the lane, and would skip the recovery of an interrupted operation that
+ * continues into an extension block.
+ */
+static int
+pmalloc_redo_ext_enable(PMEMobjpool *pop)
+{
+	int ret = 0;
+
+	pmemobj_mutex_lock_nofail(pop, &pop->redo_ext_lock);
+
+	if (!pop->redo_ext_enabled) {
+		LOG(3, "enabling redo log extensions in pool %p", pop);
+
+		ret = util_poolset_incompat_set(pop->set, POOL_FEAT_REDO_EXT);
+		if (ret == 0)
+			pop->redo_ext_enabled = 1;
+
+		/* restore the protection of the header */
+		RANGE_NONE(pop->addr, sizeof(struct pool_hdr),
+			pop->is_dev_dax);
+	}
+
+	pmemobj_mutex_unlock_nofail(pop, &pop->redo_ext_lock);
+
+	return ret;
+}
+
+/*
+ * pmalloc_redo_reserve -- extends the held allocator redo log, if needed, so
+ *	that the operation can fit nentries entries
+ *
+ * The extension blocks are allocated from the heap as internal objects and
+ * stay linked to the lane, so that subsequent large operations can reuse them.
+ * The new block is linked in its own atomic operation that is performed using
+ * the (still empty) lane redo log.
+ */
+int
+pmalloc_redo_reserve(PMEMobjpool *pop, struct operation_context *ctx,
+	size_t nentries)
+{
+	struct lane_alloc_layout *sec = (struct lane_alloc_layout *)ctx->redo;
+
+	size_t capacity = ALLOC_REDO_LOG_SIZE;
+	uint64_t *dest = &sec->redo_next;
+	while (*dest != 0) {
+		struct redo_log_ext *ext = OBJ_OFF_TO_PTR(pop, *dest);
+		capacity += ext->nentries;
+		dest = &ext->next;
+	}
+
+	if (capacity < nentries) {
+		size_t n = nentries - capacity;
+		if (n < ALLOC_REDO_EXT_MIN_ENTRIES)
+			n = ALLOC_REDO_EXT_MIN_ENTRIES;
+
+		LOG(4, "extending redo log %p by %zu entries", sec, n);
+
+		if (!pop->redo_ext_enabled &&
+		    pmalloc_redo_ext_enable(pop) != 0)
+			return -1;
+
+		struct operation_context ext_ctx;
+		operation_init(&ext_ctx, pop, pop->redo, ctx->redo);
+
+		if (palloc_operation(&pop->heap, 0, dest,
+			sizeof(struct redo_log_ext) +
+			n * sizeof(struct redo_log),
+			pmalloc_redo_ext_constr, NULL,
+			0, OBJ_INTERNAL_OBJECT_MASK, 0, &ext_ctx) != 0)
+			return -1;
+	}
+
+	operation_set_redo_next(ctx, &sec->redo_next);
+
+	return operation_reserve(ctx, nentries);
+}
+
 /*
  * pmalloc_operation -- higher level wrapper for basic allocator API
  *
@@ -115,11 +226,22 @@ pmalloc_operation(struct palloc_heap *heap, uint64_t off, uint64_t *dest_off,
 		dest_off = &tmp;
 #endif
 
+	uint64_t start = stats_hist_start(heap->stats);
+
 	int ret = palloc_operation(heap, off, dest_off, size, constructor, arg,
 			extra_field, object_flags, class_id, ctx);
 	if (ret)
 		return ret;
 
+	if (start != 0) {
+		/* the allocator section of the lane is held by the caller */
+		PMEMobjpool *pop = heap->base;
+		unsigned lane = lane_hold(pop, NULL, LANE_ID);
+		stats_hist_record(heap->stats, STATS_HIST_HEAP_OPERATION,
+			lane, start);
+		lane_release(pop);
+	}
+
 	return 0;
 }
 
@@ -246,7 +368,8 @@ pmalloc_recovery(PMEMobjpool *pop, void *data, unsigned length)
 	struct lane_alloc_layout *sec = data;
 	ASSERT(sizeof(*sec) <= length);
 
-	redo_log_recover(pop->redo, sec->redo, ALLOC_REDO_LOG_SIZE);
+	redo_log_recover_ext(pop->redo, sec->redo, ALLOC_REDO_LOG_SIZE,
+		sec->redo_next);
 
 	return 0;
 }
@@ -261,7 +384,8 @@ pmalloc_check(PMEMobjpool *pop, void *data, unsigned length)
 
 	struct lane_alloc_layout *sec = data;
 
-	int ret = redo_log_check(pop->redo, sec->redo, ALLOC_REDO_LOG_SIZE);
+	int ret = redo_log_check_ext(pop->redo, sec->redo, ALLOC_REDO_LOG_SIZE,
+		sec->redo_next);
 	if (ret != 0)
 		ERR("allocator lane: redo log check failed");
 
@@ -288,11 +412,36 @@ pmalloc_boot(PMEMobjpool *pop)
 
 	ret = palloc_buckets_init(&pop->heap);
 	if (ret)
-		palloc_heap_cleanup(&pop->heap);
+		goto err;
 
+	if (Open_recovery_threads > 1) {
+		ret = heap_populate_zones(&pop->heap, Open_recovery_threads);
+		if (ret)
+			goto err;
+	}
+
+	return 0;
+
+err:
+	palloc_heap_cleanup(&pop->heap);
 	return ret;
 }
 
+/*
+ * pmalloc_boot_background -- starts the background rebuild of the heap,
+ *	if enabled
+ *
+ * Must be called after all of the lane sections have been recovered.
+ */
+int
+pmalloc_boot_background(PMEMobjpool *pop)
+{
+	if (Open_recovery_threads > 1 || !Open_heap_background_rebuild)
+		return 0;
+
+	return heap_populate_zones_background(&pop->heap);
+}
+
 /*
  * pmalloc_cleanup -- global cleanup routine of allocator section
  */
@@ -594,9 +743,469 @@ static const struct ctl_node CTL_NODE(size)[] = {
 	CTL_NODE_END
 };
 
+/*
+ * CTL_READ_HANDLER(size) -- reads the number of blocks cached per class
+ */
+static int
+CTL_READ_HANDLER(size)(PMEMobjpool *pop,
+	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
+{
+	int *arg_out = arg;
+
+	*arg_out = (int)pop->heap.thread_cache_size;
+
+	return 0;
+}
+
+/*
+ * CTL_WRITE_HANDLER(size) -- changes the number of blocks cached per class
+ */
+static int
+CTL_WRITE_HANDLER(size)(PMEMobjpool *pop,
+	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
+{
+	int arg_in = *(int *)arg;
+	if (arg_in < 0 || arg_in > HEAP_THREAD_CACHE_MAX_SIZE) {
+		ERR("incorrect thread cache size, must be between 0 and %d",
+			HEAP_THREAD_CACHE_MAX_SIZE);
+		return -1;
+	}
+
+	pop->heap.thread_cache_size = (unsigned)arg_in;
+
+	return 0;
+}
+
+static struct ctl_argument CTL_ARG(size) = CTL_ARG_INT;
+
+/*
+ * CTL_READ_HANDLER(batch) -- reads the number of blocks reserved at once
+ */
+static int
+CTL_READ_HANDLER(batch)(PMEMobjpool *pop,
+	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
+{
+	int *arg_out = arg;
+
+	*arg_out = (int)pop->heap.thread_cache_batch;
+
+	return 0;
+}
+
+/*
+ * CTL_WRITE_HANDLER(batch) -- changes the number of blocks reserved at once
+ */
+static int
+CTL_WRITE_HANDLER(batch)(PMEMobjpool *pop,
+	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
+{
+	int arg_in = *(int *)arg;
+	if (arg_in < 1 || arg_in > HEAP_THREAD_CACHE_MAX_SIZE) {
+		ERR("incorrect thread cache batch, must be between 1 and %d",
+			HEAP_THREAD_CACHE_MAX_SIZE);
+		return -1;
+	}
+
+	pop->heap.thread_cache_batch = (unsigned)arg_in;
+
+	return 0;
+}
+
+static struct ctl_argument CTL_ARG(batch) = CTL_ARG_INT;
+
+/*
+ * CTL_RUNNABLE_HANDLER(flush) -- returns the blocks cached by the calling
+ *	thread back to the heap
+ */
+static int
+CTL_RUNNABLE_HANDLER(flush)(PMEMobjpool *pop,
+	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
+{
+	heap_thread_cache_flush(&pop->heap);
+
+	return 0;
+}
+
+static const struct ctl_node CTL_NODE(thread_cache)[] = {
+	CTL_LEAF_RW(size),
+	CTL_LEAF_RW(batch),
+	CTL_LEAF_RUNNABLE(flush),
+
+	CTL_NODE_END
+};
+
+/*
+ * CTL_READ_HANDLER(narenas) -- reads the number of arenas
+ */
+static int
+CTL_READ_HANDLER(narenas)(PMEMobjpool *pop,
+	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
+{
+	int *arg_out = arg;
+
+	*arg_out = (int)heap_get_narenas(&pop->heap);
+
+	return 0;
+}
+
+/*
+ * CTL_WRITE_HANDLER(narenas) -- increases the number of arenas
+ */
+static int
+CTL_WRITE_HANDLER(narenas)(PMEMobjpool *pop,
+	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
+{
+	int arg_in = *(int *)arg;
+	if (arg_in < 1) {
+		ERR("incorrect number of arenas, must be positive");
+		errno = EINVAL;
+		return -1;
+	}
+
+	return heap_set_narenas(&pop->heap, (unsigned)arg_in);
+}
+
+static struct ctl_argument CTL_ARG(narenas) = CTL_ARG_INT;
+
+/*
+ * CTL_READ_HANDLER(arena_id) -- reads the id of the arena assigned to the
+ *	calling thread
+ */
+static int
+CTL_READ_HANDLER(arena_id)(PMEMobjpool *pop,
+	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
+{
+	int *arg_out = arg;
+
+	*arg_out = (int)heap_get_thread_arena_id(&pop->heap);
+
+	return 0;
+}
+
+/*
+ * CTL_WRITE_HANDLER(arena_id) -- binds the calling thread to the given arena
+ */
+static int
+CTL_WRITE_HANDLER(arena_id)(PMEMobjpool *pop,
+	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
+{
+	int arg_in = *(int *)arg;
+	if (arg_in < 0) {
+		ERR("arena id cannot be negative");
+		errno = EINVAL;
+		return -1;
+	}
+
+	return heap_set_thread_arena_id(&pop->heap, (unsigned)arg_in);
+}
+
+static struct ctl_argument CTL_ARG(arena_id) = CTL_ARG_INT;
+
+static const struct ctl_node CTL_NODE(thread)[] = {
+	CTL_LEAF_RW(arena_id),
+
+	CTL_NODE_END
+};
+
+/*
+ * The leaves of the arena node have names that are already taken by other
+ * heap leaves, their handlers are prefixed to avoid the conflict.
+ */
+#define ARENA_CTL_LEAF_RO(name)\
+{CTL_STR(name), CTL_NODE_LEAF,\
+{CTL_READ_HANDLER(arena_##name), NULL, NULL},\
+NULL, NULL}
+
+#define ARENA_CTL_LEAF_RW(name)\
+{CTL_STR(name), CTL_NODE_LEAF,\
+{CTL_READ_HANDLER(arena_##name), CTL_WRITE_HANDLER(arena_##name), NULL},\
+&CTL_ARG(arena_##name), NULL}
+
+/*
+ * pmalloc_ctl_arena_id -- (internal) retrieves the arena id from the indexes
+ */
+static int
+pmalloc_ctl_arena_id(PMEMobjpool *pop, struct ctl_indexes *indexes,
+	unsigned *arena_id)
+{
+	struct ctl_index *idx = SLIST_FIRST(indexes);
+	ASSERTeq(strcmp(idx->name, "arena_id"), 0);
+
+	if (idx->value < 0 ||
+	    idx->value >= (long)heap_get_narenas(&pop->heap)) {
+		ERR("arena id outside of the allowed range");
+		errno = ERANGE;
+		return -1;
+	}
+
+	*arena_id = (unsigned)idx->value;
+
+	return 0;
+}
+
+/*
+ * CTL_READ_HANDLER(arena_size) -- reads the size of the runs owned by
+ *	the arena
+ */
+static int
+CTL_READ_HANDLER(arena_size)(PMEMobjpool *pop,
+	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
+{
+	unsigned arena_id;
+	if (pmalloc_ctl_arena_id(pop, indexes, &arena_id) != 0)
+		return -1;
+
+	size_t *arg_out = arg;
+	*arg_out = heap_get_arena_size(&pop->heap, arena_id);
+
+	return 0;
+}
+
+/*
+ * CTL_READ_HANDLER(arena_nthreads) -- reads the number of threads assigned to
+ *	the arena
+ */
+static int
+CTL_READ_HANDLER(arena_nthreads)(PMEMobjpool *pop,
+	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
+{
+	unsigned arena_id;
+	if (pmalloc_ctl_arena_id(pop, indexes, &arena_id) != 0)
+		return -1;
+
+	size_t *arg_out = arg;
+	*arg_out = heap_get_arena_nthreads(&pop->heap, arena_id);
+
+	return 0;
+}
+
+/*
+ * CTL_READ_HANDLER(arena_automatic) -- reads whether the arena is assigned to
+ *	threads automatically
+ */
+static int
+CTL_READ_HANDLER(arena_automatic)(PMEMobjpool *pop,
+	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
+{
+	unsigned arena_id;
+	if (pmalloc_ctl_arena_id(pop, indexes, &arena_id) != 0)
+		return -1;
+
+	int *arg_out = arg;
+	*arg_out = heap_get_arena_automatic(&pop->heap, arena_id);
+
+	return 0;
+}
+
+/*
+ * CTL_WRITE_HANDLER(arena_automatic) -- changes whether the arena is assigned
+ *	to threads automatically
+ */
+static int
+CTL_WRITE_HANDLER(arena_automatic)(PMEMobjpool *pop,
+	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
+{
+	unsigned arena_id;
+	if (pmalloc_ctl_arena_id(pop, indexes, &arena_id) != 0)
+		return -1;
+
+	int arg_in = *(int *)arg;
+	heap_set_arena_automatic(&pop->heap, arena_id, arg_in);
+
+	return 0;
+}
+
+static struct ctl_argument CTL_ARG(arena_automatic) = CTL_ARG_BOOLEAN;
+
+static const struct ctl_node CTL_NODE(arena_id)[] = {
+	ARENA_CTL_LEAF_RO(size),
+	ARENA_CTL_LEAF_RO(nthreads),
+	ARENA_CTL_LEAF_RW(automatic),
+
+	CTL_NODE_END
+};
+
+static const struct ctl_node CTL_NODE(arena)[] = {
+	CTL_INDEXED(arena_id),
+
+	CTL_NODE_END
+};
+
+/*
+ * CTL_READ_HANDLER(threshold) -- reads the occupancy below which runs are
+ *	compacted
+ */
+static int
+CTL_READ_HANDLER(threshold)(PMEMobjpool *pop,
+	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
+{
+	int *arg_out = arg;
+
+	*arg_out = (int)pop->heap.defrag_threshold;
+
+	return 0;
+}
+
+/*
+ * CTL_WRITE_HANDLER(threshold) -- changes the occupancy below which runs
+ *	are compacted
+ */
+static int
+CTL_WRITE_HANDLER(threshold)(PMEMobjpool *pop,
+	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
+{
+	int arg_in = *(int *)arg;
+	if (arg_in < 1 || arg_in > 99) {
+		ERR("incorrect defrag threshold, must be between 1 and 99");
+		errno = EINVAL;
+		return -1;
+	}
+
+	pop->heap.defrag_threshold = (unsigned)arg_in;
+
+	return 0;
+}
+
+static struct ctl_argument CTL_ARG(threshold) = CTL_ARG_INT;
+
+/*
+ * CTL_READ_HANDLER(fragmentation) -- calculates the fragmentation of runs
+ */
+static int
+CTL_READ_HANDLER(fragmentation)(PMEMobjpool *pop,
+	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
+{
+	struct pobj_defrag_fragmentation *arg_out = arg;
+
+	defrag_fragmentation(pop, arg_out);
+
+	return 0;
+}
+
+/*
+ * CTL_RUNNABLE_HANDLER(run) -- relocates the objects from sparse runs
+ */
+static int
+CTL_RUNNABLE_HANDLER(run)(PMEMobjpool *pop,
+	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
+{
+	if (source != CTL_QUERY_PROGRAMMATIC) {
+		ERR("heap compaction can only be run programmatically");
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (arg == NULL) {
+		ERR("heap compaction requires non-NULL argument");
+		errno = EINVAL;
+		return -1;
+	}
+
+	return defrag_run(pop, arg);
+}
+
+static const struct ctl_node CTL_NODE(defrag)[] = {
+	CTL_LEAF_RW(threshold),
+	CTL_LEAF_RO(fragmentation),
+	CTL_LEAF_RUNNABLE(run),
+
+	CTL_NODE_END
+};
+
+struct pmalloc_walk {
+	PMEMobjpool *pop;
+	struct pobj_heap_walk *walk;
+};
+
+/*
+ * pmalloc_walk_cb -- (internal) describes a single range of chunks
+ */
+static int
+pmalloc_walk_cb(const struct memory_block *m, void *arg)
+{
+	struct pmalloc_walk *w = arg;
+	struct palloc_heap *heap = &w->pop->heap;
+
+	struct pobj_heap_chunk chunk;
+	memset(&chunk, 0, sizeof(chunk));
+	chunk.zone_id = m->zone_id;
+	chunk.chunk_id = m->chunk_id;
+	chunk.nchunks = m->size_idx;
+	chunk.class_id = -1;
+
+	if (m->type == MEMORY_BLOCK_RUN) {
+		struct run_occupancy occ;
+		heap_run_occupancy(heap, m, &occ);
+
+		struct alloc_class *c = alloc_class_by_run(
+			heap_alloc_classes(heap), occ.unit_size,
+			m->header_type, m->size_idx);
+
+		chunk.type = POBJ_HEAP_CHUNK_RUN;
+		chunk.class_id = c == NULL ? -1 : c->id;
+		chunk.unit_size = occ.unit_size;
+		chunk.units = occ.nallocs;
+		chunk.free_units = occ.nfree;
+	} else if (m->m_ops->get_state(m) == MEMBLOCK_FREE) {
+		unsigned i = util_mssb_index64(m->size_idx);
+		if (i >= POBJ_HEAP_WALK_HIST_SIZE)
+			i = POBJ_HEAP_WALK_HIST_SIZE - 1;
+
+		chunk.type = POBJ_HEAP_CHUNK_FREE;
+		w->walk->free_hist[i]++;
+	} else {
+		chunk.type = POBJ_HEAP_CHUNK_HUGE;
+		chunk.class_id = DEFAULT_ALLOC_CLASS_ID;
+	}
+
+	w->walk->nranges[chunk.type]++;
+	w->walk->nchunks[chunk.type] += chunk.nchunks;
+
+	if (w->walk->cb != NULL)
+		w->walk->cb(w->pop, &chunk, w->walk->arg);
+
+	return 0;
+}
+
+/*
+ * CTL_RUNNABLE_HANDLER(walk) -- produces the occupancy map of the heap
+ */
+static int
+CTL_RUNNABLE_HANDLER(walk)(PMEMobjpool *pop,
+	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
+{
+	if (source != CTL_QUERY_PROGRAMMATIC) {
+		ERR("heap walk can only be run programmatically");
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (arg == NULL) {
+		ERR("heap walk requires non-NULL argument");
+		errno = EINVAL;
+		return -1;
+	}
+
+	struct pobj_heap_walk *walk = arg;
+	memset(walk->nranges, 0, sizeof(walk->nranges));
+	memset(walk->nchunks, 0, sizeof(walk->nchunks));
+	memset(walk->free_hist, 0, sizeof(walk->free_hist));
+
+	struct pmalloc_walk w = {pop, walk};
+	heap_foreach_chunk(&pop->heap, pmalloc_walk_cb, &w);
+
+	return 0;
+}
+
 static const struct ctl_node CTL_NODE(heap)[] = {
 	CTL_CHILD(alloc_class),
 	CTL_CHILD(size),
+	CTL_CHILD(thread_cache),
+	CTL_LEAF_RW(narenas),
+	CTL_CHILD(thread),
+	CTL_CHILD(arena),
+	CTL_CHILD(defrag),
+	CTL_LEAF_RUNNABLE(walk),
 
 	CTL_NODE_END
 };
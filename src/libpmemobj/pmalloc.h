@@ -52,8 +52,16 @@
 #define ALLOC_REDO_LOG_SIZE MAX_MEMOPS_ENTRIES
 struct lane_alloc_layout {
 	struct redo_log redo[ALLOC_REDO_LOG_SIZE];
+	uint64_t redo_next; /* offset of the first redo log extension block */
+	uint64_t unused;
 };
 
+/*
+ * The minimum number of entries in a redo log extension block, allocated when
+ * an operation doesn't fit in the lane redo log.
+ */
+#define ALLOC_REDO_EXT_MIN_ENTRIES 256
+
 int pmalloc_operation(struct palloc_heap *heap,
 	uint64_t off, uint64_t *dest_off, size_t size,
 	palloc_constr constructor, void *arg,
@@ -73,6 +81,12 @@ void pfree(PMEMobjpool *pop, uint64_t *off);
 
 struct redo_log *pmalloc_redo_hold(PMEMobjpool *pop);
 void pmalloc_redo_release(PMEMobjpool *pop);
+int pmalloc_redo_reserve(PMEMobjpool *pop, struct operation_context *ctx,
+	size_t nentries);
+
+extern int Open_heap_background_rebuild;
+
+int pmalloc_boot_background(PMEMobjpool *pop);
 
 void pmalloc_ctl_register(PMEMobjpool *pop);
 
@@ -153,6 +153,22 @@ redo_log_store_last(const struct redo_ctx *ctx, struct redo_log *redo,
 	pmemops_persist(p_ops, &redo[index].offset, sizeof(redo[index].offset));
 }
 
+/*
+ * redo_log_set_flag -- (internal) persist entries up to the specified index and
+ *	set the finish flag in the last of them
+ */
+static void
+redo_log_set_flag(const struct pmem_ops *p_ops, struct redo_log *redo,
+		size_t index)
+{
+	/* persist all redo log entries */
+	pmemops_persist(p_ops, redo, (index + 1) * sizeof(struct redo_log));
+
+	/* set finish flag of last entry and persist */
+	redo[index].offset |= REDO_FINISH_FLAG;
+	pmemops_persist(p_ops, &redo[index].offset, sizeof(redo[index].offset));
+}
+
 /*
  * redo_log_set_last -- (internal) set finish flag in specified entry
  */
@@ -163,85 +179,243 @@ redo_log_set_last(const struct redo_ctx *ctx, struct redo_log *redo,
 	LOG(15, "redo %p index %zu", redo, index);
 
 	ASSERT(index < ctx->redo_num_entries);
+
+	redo_log_set_flag(&ctx->p_ops, redo, index);
+}
+
+/*
+ * redo_log_next_segment -- (internal) returns entries of the extension block
+ *	pointed to by next and advances next to the following block
+ */
+static struct redo_log *
+redo_log_next_segment(const struct redo_ctx *ctx, uint64_t *next,
+		size_t *nentries)
+{
+	if (*next == 0)
+		return NULL;
+
+	struct redo_log_ext *ext =
+		(struct redo_log_ext *)((uintptr_t)ctx->base + *next);
+
+	*next = ext->next;
+	*nentries = ext->nentries;
+
+	return ext->entries;
+}
+
+/*
+ * redo_log_ext_valid -- (internal) checks if the extension block at the given
+ *	offset lies within the pool
+ */
+static int
+redo_log_ext_valid(const struct redo_ctx *ctx, uint64_t off)
+{
+	void *cctx = ctx->check_offset_ctx;
+
+	if (!ctx->check_offset(cctx, off))
+		return 0;
+
+	struct redo_log_ext *ext =
+		(struct redo_log_ext *)((uintptr_t)ctx->base + off);
+
+	uint64_t end = off + sizeof(*ext) +
+		ext->nentries * sizeof(struct redo_log);
+
+	return end > off && ctx->check_offset(cctx, end - 1);
+}
+
+/*
+ * redo_log_nflags_ext -- (internal) get number of finish flags set in the
+ *	entire chain
+ */
+static size_t
+redo_log_nflags_ext(const struct redo_ctx *ctx, struct redo_log *redo,
+		size_t nentries, uint64_t next)
+{
+	size_t ret = 0;
+
+	do {
+		ret += redo_log_nflags(redo, nentries);
+	} while ((redo = redo_log_next_segment(ctx, &next, &nentries)));
+
+	return ret;
+}
+
+/*
+ * redo_log_capacity -- returns the number of entries that fit in the redo log
+ *	along with all of its extension blocks
+ */
+size_t
+redo_log_capacity(const struct redo_ctx *ctx, size_t nentries, uint64_t next)
+{
+	size_t capacity = nentries;
+
+	while (redo_log_next_segment(ctx, &next, &nentries) != NULL)
+		capacity += nentries;
+
+	return capacity;
+}
+
+/*
+ * redo_log_store_ext -- (internal) store redo log entry at specified index of
+ *	the redo log chain
+ */
+void
+redo_log_store_ext(const struct redo_ctx *ctx, struct redo_log *redo,
+		size_t nentries, uint64_t next,
+		size_t index, uint64_t offset, uint64_t value)
+{
+	LOG(15, "redo %p index %zu offset %" PRIu64 " value %" PRIu64,
+			redo, index, offset, value);
+
+	ASSERTeq(offset & REDO_FINISH_FLAG, 0);
+
+	while (index >= nentries) {
+		index -= nentries;
+		redo = redo_log_next_segment(ctx, &next, &nentries);
+		ASSERTne(redo, NULL);
+	}
+
+	redo[index].offset = offset;
+	redo[index].value = value;
+}
+
+/*
+ * redo_log_set_last_ext -- (internal) set finish flag in specified entry of the
+ *	redo log chain
+ */
+void
+redo_log_set_last_ext(const struct redo_ctx *ctx, struct redo_log *redo,
+		size_t nentries, uint64_t next, size_t index)
+{
+	LOG(15, "redo %p index %zu", redo, index);
+
 	const struct pmem_ops *p_ops = &ctx->p_ops;
 
-	/* persist all redo log entries */
-	pmemops_persist(p_ops, redo, (index + 1) * sizeof(struct redo_log));
+	/* the preceding segments are full, persist them as a whole */
+	while (index >= nentries) {
+		pmemops_persist(p_ops, redo,
+			nentries * sizeof(struct redo_log));
 
-	/* set finish flag of last entry and persist */
-	redo[index].offset |= REDO_FINISH_FLAG;
-	pmemops_persist(p_ops, &redo[index].offset, sizeof(redo[index].offset));
+		index -= nentries;
+		redo = redo_log_next_segment(ctx, &next, &nentries);
+		ASSERTne(redo, NULL);
+	}
+
+	redo_log_set_flag(p_ops, redo, index);
 }
 
 /*
- * redo_log_process -- (internal) process redo log entries
+ * redo_log_process_ext -- (internal) process entries of the redo log chain
  */
 void
-redo_log_process(const struct redo_ctx *ctx, struct redo_log *redo,
-		size_t nentries)
+redo_log_process_ext(const struct redo_ctx *ctx, struct redo_log *redo,
+		size_t nentries, uint64_t next)
 {
-	LOG(15, "redo %p nentries %zu", redo, nentries);
+	LOG(15, "redo %p nentries %zu next 0x%" PRIx64, redo, nentries, next);
 
 #ifdef DEBUG
-	ASSERTeq(redo_log_check(ctx, redo, nentries), 0);
+	ASSERTeq(redo_log_check_ext(ctx, redo, nentries, next), 0);
 #endif
 	const struct pmem_ops *p_ops = &ctx->p_ops;
 
 	uint64_t *val;
-	while ((redo->offset & REDO_FINISH_FLAG) == 0) {
-		val = (uint64_t *)((uintptr_t)ctx->base + redo->offset);
+	size_t i = 0;
+	while ((redo[i].offset & REDO_FINISH_FLAG) == 0) {
+		val = (uint64_t *)((uintptr_t)ctx->base + redo[i].offset);
 		VALGRIND_ADD_TO_TX(val, sizeof(*val));
-		*val = redo->value;
+		*val = redo[i].value;
 		VALGRIND_REMOVE_FROM_TX(val, sizeof(*val));
 
 		pmemops_flush(p_ops, val, sizeof(uint64_t));
 
-		redo++;
+		if (++i == nentries) {
+			redo = redo_log_next_segment(ctx, &next, &nentries);
+			ASSERTne(redo, NULL);
+			i = 0;
+		}
 	}
 
-	uint64_t offset = redo->offset & REDO_FLAG_MASK;
+	uint64_t offset = redo[i].offset & REDO_FLAG_MASK;
 	val = (uint64_t *)((uintptr_t)ctx->base + offset);
 	VALGRIND_ADD_TO_TX(val, sizeof(*val));
-	*val = redo->value;
+	*val = redo[i].value;
 	VALGRIND_REMOVE_FROM_TX(val, sizeof(*val));
 
 	pmemops_persist(p_ops, val, sizeof(uint64_t));
 
-	redo->offset = 0;
+	redo[i].offset = 0;
 
-	pmemops_persist(p_ops, &redo->offset, sizeof(redo->offset));
+	pmemops_persist(p_ops, &redo[i].offset, sizeof(redo[i].offset));
 }
 
 /*
- * redo_log_recover -- (internal) recovery of redo log
- *
- * The redo_log_recover shall be preceded by redo_log_check call.
+ * redo_log_process -- (internal) process redo log entries
  */
 void
-redo_log_recover(const struct redo_ctx *ctx, struct redo_log *redo,
+redo_log_process(const struct redo_ctx *ctx, struct redo_log *redo,
 		size_t nentries)
 {
-	LOG(15, "redo %p nentries %zu", redo, nentries);
+	redo_log_process_ext(ctx, redo, nentries, 0);
+}
+
+/*
+ * redo_log_recover_ext -- (internal) recovery of redo log chain
+ *
+ * The redo_log_recover_ext shall be preceded by redo_log_check_ext call.
+ */
+void
+redo_log_recover_ext(const struct redo_ctx *ctx, struct redo_log *redo,
+		size_t nentries, uint64_t next)
+{
+	LOG(15, "redo %p nentries %zu next 0x%" PRIx64, redo, nentries, next);
 	ASSERTne(ctx, NULL);
 
-	size_t nflags = redo_log_nflags(redo, nentries);
+	size_t nflags = redo_log_nflags_ext(ctx, redo, nentries, next);
 	ASSERT(nflags < 2);
 
 	if (nflags == 1)
-		redo_log_process(ctx, redo, nentries);
+		redo_log_process_ext(ctx, redo, nentries, next);
 }
 
 /*
- * redo_log_check -- (internal) check consistency of redo log entries
+ * redo_log_recover -- (internal) recovery of redo log
+ *
+ * The redo_log_recover shall be preceded by redo_log_check call.
  */
-int
-redo_log_check(const struct redo_ctx *ctx, struct redo_log *redo,
+void
+redo_log_recover(const struct redo_ctx *ctx, struct redo_log *redo,
 		size_t nentries)
 {
-	LOG(15, "redo %p nentries %zu", redo, nentries);
+	redo_log_recover_ext(ctx, redo, nentries, 0);
+}
+
+/*
+ * redo_log_check_ext -- (internal) check consistency of redo log chain
+ */
+int
+redo_log_check_ext(const struct redo_ctx *ctx, struct redo_log *redo,
+		size_t nentries, uint64_t next)
+{
+	LOG(15, "redo %p nentries %zu next 0x%" PRIx64, redo, nentries, next);
 	ASSERTne(ctx, NULL);
 
-	size_t nflags = redo_log_nflags(redo, nentries);
+	size_t nflags = 0;
+	struct redo_log *seg = redo;
+	size_t segn = nentries;
+	uint64_t segnext = next;
+	for (;;) {
+		nflags += redo_log_nflags(seg, segn);
+		if (segnext == 0)
+			break;
+
+		if (!redo_log_ext_valid(ctx, segnext)) {
+			LOG(15, "redo %p invalid extension offset %" PRIu64,
+				redo, segnext);
+			return -1;
+		}
+		seg = redo_log_next_segment(ctx, &segnext, &segn);
+	}
 
 	if (nflags > 1) {
 		LOG(15, "redo %p too many finish flags", redo);
@@ -251,16 +425,21 @@ redo_log_check(const struct redo_ctx *ctx, struct redo_log *redo,
 	if (nflags == 1) {
 		void *cctx = ctx->check_offset_ctx;
 
-		while ((redo->offset & REDO_FINISH_FLAG) == 0) {
-			if (!ctx->check_offset(cctx, redo->offset)) {
+		size_t i = 0;
+		while ((redo[i].offset & REDO_FINISH_FLAG) == 0) {
+			if (!ctx->check_offset(cctx, redo[i].offset)) {
 				LOG(15, "redo %p invalid offset %" PRIu64,
-						redo, redo->offset);
+						redo, redo[i].offset);
 				return -1;
 			}
-			redo++;
+			if (++i == nentries) {
+				redo = redo_log_next_segment(ctx, &next,
+					&nentries);
+				i = 0;
+			}
 		}
 
-		uint64_t offset = redo->offset & REDO_FLAG_MASK;
+		uint64_t offset = redo[i].offset & REDO_FLAG_MASK;
 		if (!ctx->check_offset(cctx, offset)) {
 			LOG(15, "redo %p invalid offset %" PRIu64,
 			    redo, offset);
@@ -271,6 +450,16 @@ redo_log_check(const struct redo_ctx *ctx, struct redo_log *redo,
 	return 0;
 }
 
+/*
+ * redo_log_check -- (internal) check consistency of redo log entries
+ */
+int
+redo_log_check(const struct redo_ctx *ctx, struct redo_log *redo,
+		size_t nentries)
+{
+	return redo_log_check_ext(ctx, redo, nentries, 0);
+}
+
 /*
  * redo_log_offset -- returns offset
  */
@@ -52,6 +52,19 @@ struct redo_log {
 	uint64_t value;
 };
 
+/*
+ * redo_log_ext -- extension block of a redo log
+ *
+ * Redo logs that do not fit in their fixed-size lane section continue into
+ * a chain of extension blocks. The offset of the first block is stored next to
+ * the lane entries, the finish flag can be set in any entry of the chain.
+ */
+struct redo_log_ext {
+	uint64_t next;		/* offset of the next extension block or 0 */
+	uint64_t nentries;	/* number of entries in this block */
+	struct redo_log entries[];
+};
+
 typedef int (*redo_check_offset_fn)(void *ctx, uint64_t offset);
 
 struct redo_ctx *redo_log_config_new(void *base,
@@ -75,6 +88,20 @@ void redo_log_recover(const struct redo_ctx *ctx, struct redo_log *redo,
 int redo_log_check(const struct redo_ctx *ctx, struct redo_log *redo,
 		size_t nentries);
 
+size_t redo_log_capacity(const struct redo_ctx *ctx, size_t nentries,
+		uint64_t next);
+void redo_log_store_ext(const struct redo_ctx *ctx, struct redo_log *redo,
+		size_t nentries, uint64_t next,
+		size_t index, uint64_t offset, uint64_t value);
+void redo_log_set_last_ext(const struct redo_ctx *ctx, struct redo_log *redo,
+		size_t nentries, uint64_t next, size_t index);
+void redo_log_process_ext(const struct redo_ctx *ctx, struct redo_log *redo,
+		size_t nentries, uint64_t next);
+void redo_log_recover_ext(const struct redo_ctx *ctx, struct redo_log *redo,
+		size_t nentries, uint64_t next);
+int redo_log_check_ext(const struct redo_ctx *ctx, struct redo_log *redo,
+		size_t nentries, uint64_t next);
+
 size_t redo_log_nflags(const struct redo_log *redo, size_t nentries);
 uint64_t redo_log_offset(const struct redo_log *redo);
 int redo_log_is_last(const struct redo_log *redo);
@@ -34,17 +34,422 @@
  * stats.c -- implementation of statistics
  */
 
+#include "alloc_class.h"
+#include "heap.h"
 #include "obj.h"
 #include "stats.h"
 
+/*
+ * stats_hist_bucket -- (internal) returns the bucket of the value
+ */
+static unsigned
+stats_hist_bucket(uint64_t value)
+{
+	if (value < STATS_HIST_SUB)
+		return (unsigned)value;
+
+	unsigned msb = util_mssb_index64(value);
+	if (msb >= STATS_HIST_MAX_BIT)
+		return STATS_HIST_NBUCKETS - 1;
+
+	unsigned shift = msb - STATS_HIST_SUB_BITS;
+	unsigned sub = (unsigned)(value >> shift) & (STATS_HIST_SUB - 1);
+
+	return (shift + 1) * STATS_HIST_SUB + sub;
+}
+
+/*
+ * stats_hist_bucket_max -- (internal) returns the highest value which falls
+ *	into the bucket
+ */
+static uint64_t
+stats_hist_bucket_max(unsigned bucket)
+{
+	if (bucket < STATS_HIST_SUB)
+		return bucket;
+
+	unsigned shift = bucket / STATS_HIST_SUB - 1;
+	uint64_t sub = bucket % STATS_HIST_SUB;
+
+	return ((STATS_HIST_SUB + sub + 1) << shift) - 1;
+}
+
+/*
+ * stats_hist_record -- records the time elapsed since start in the histogram
+ *	of the given lane
+ */
+void
+stats_hist_record(struct stats *stats, enum stats_hist_type type,
+	unsigned lane, uint64_t start)
+{
+	if (start == 0)
+		return;
+
+	struct stats_lane *lanes = stats->transient->lanes;
+	if (lanes == NULL || lane >= stats->transient->nlanes)
+		return;
+
+	uint64_t now = stats_hist_start(stats);
+	if (now == 0) /* disabled in the meantime */
+		return;
+
+	uint64_t elapsed = now > start ? now - start : 0;
+	struct stats_hist *h = &lanes[lane].hist[type];
+
+	/* the lane can be shared with a post-commit worker, hence atomics */
+	util_fetch_and_add64(&h->buckets[stats_hist_bucket(elapsed)], 1);
+	util_fetch_and_add64(&h->sum, elapsed);
+}
+
+/*
+ * stats_hist_percentile -- (internal) returns the value below or at which
+ *	the given permille of the measurements falls
+ */
+static uint64_t
+stats_hist_percentile(const uint64_t *buckets, uint64_t count,
+	unsigned permille)
+{
+	uint64_t target = (count * permille + 999) / 1000;
+	if (target == 0)
+		target = 1;
+
+	uint64_t seen = 0;
+	for (unsigned i = 0; i < STATS_HIST_NBUCKETS; ++i) {
+		seen += buckets[i];
+		if (seen >= target)
+			return stats_hist_bucket_max(i);
+	}
+
+	return 0;
+}
+
+/*
+ * stats_hist_read -- merges the histograms of all the lanes and computes
+ *	the latency summary
+ */
+void
+stats_hist_read(struct stats *stats, enum stats_hist_type type,
+	struct pobj_stats_latency *latency)
+{
+	uint64_t buckets[STATS_HIST_NBUCKETS] = {0};
+	uint64_t count = 0;
+	uint64_t sum = 0;
+
+	memset(latency, 0, sizeof(*latency));
+
+	struct stats_lane *lanes = stats->transient->lanes;
+	if (lanes == NULL)
+		return;
+
+	for (unsigned l = 0; l < stats->transient->nlanes; ++l) {
+		struct stats_hist *h = &lanes[l].hist[type];
+
+		for (unsigned i = 0; i < STATS_HIST_NBUCKETS; ++i) {
+			uint64_t n;
+			util_atomic_load_explicit64(&h->buckets[i], &n,
+				memory_order_relaxed);
+			buckets[i] += n;
+			count += n;
+		}
+
+		uint64_t n;
+		util_atomic_load_explicit64(&h->sum, &n, memory_order_relaxed);
+		sum += n;
+	}
+
+	if (count == 0)
+		return;
+
+	latency->count = count;
+	latency->avg = sum / count;
+	latency->p50 = stats_hist_percentile(buckets, count, 500);
+	latency->p90 = stats_hist_percentile(buckets, count, 900);
+	latency->p99 = stats_hist_percentile(buckets, count, 990);
+	latency->p999 = stats_hist_percentile(buckets, count, 999);
+	latency->max = stats_hist_percentile(buckets, count, 1000);
+}
+
+/*
+ * stats_counter_inc -- adds the value to the counter of the given lane
+ */
+void
+stats_counter_inc(struct stats *stats, enum stats_counter_type type,
+	unsigned lane, uint64_t value)
+{
+	if (!stats->enabled)
+		return;
+
+	struct stats_lane *lanes = stats->transient->lanes;
+	if (lanes == NULL || lane >= stats->transient->nlanes)
+		return;
+
+	util_fetch_and_add64(&lanes[lane].counters[type], value);
+}
+
+/*
+ * stats_counter_read -- sums the counters of all the lanes
+ */
+uint64_t
+stats_counter_read(struct stats *stats, enum stats_counter_type type)
+{
+	struct stats_lane *lanes = stats->transient->lanes;
+	if (lanes == NULL)
+		return 0;
+
+	uint64_t sum = 0;
+	for (unsigned l = 0; l < stats->transient->nlanes; ++l) {
+		uint64_t value;
+		util_atomic_load_explicit64(&lanes[l].counters[type],
+			&value, memory_order_relaxed);
+		sum += value;
+	}
+
+	return sum;
+}
+
+/*
+ * stats_hist_reset -- (internal) clears the histograms of all the lanes
+ */
+static void
+stats_hist_reset(struct stats *stats)
+{
+	struct stats_lane *lanes = stats->transient->lanes;
+	if (lanes == NULL)
+		return;
+
+	for (unsigned l = 0; l < stats->transient->nlanes; ++l) {
+		for (unsigned t = 0; t < MAX_STATS_HIST; ++t) {
+			struct stats_hist *h = &lanes[l].hist[t];
+
+			for (unsigned i = 0; i < STATS_HIST_NBUCKETS; ++i)
+				util_atomic_store_explicit64(&h->buckets[i],
+					0, memory_order_relaxed);
+			util_atomic_store_explicit64(&h->sum, 0,
+				memory_order_relaxed);
+		}
+	}
+}
+
+/*
+ * stats_lanes_alloc -- (internal) allocates the per-lane histograms
+ */
+static int
+stats_lanes_alloc(struct stats *stats)
+{
+	if (stats->transient->lanes != NULL)
+		return 0;
+
+	struct stats_lane *lanes =
+		Zalloc(stats->transient->nlanes * sizeof(*lanes));
+	if (lanes == NULL) {
+		ERR("!Zalloc");
+		return -1;
+	}
+
+	if (!util_bool_compare_and_swap64(&stats->transient->lanes,
+			NULL, lanes))
+		Free(lanes);
+
+	return 0;
+}
+
+/*
+ * stats_alloc_class_occupancy -- (internal) reads the occupancy of the class
+ */
+static void
+stats_alloc_class_occupancy(PMEMobjpool *pop, struct alloc_class *c,
+	struct pobj_stats_alloc_class *out)
+{
+	struct heap_occupancy occ;
+	heap_get_occupancy(&pop->heap, c->id, &occ);
+
+	memset(out, 0, sizeof(*out));
+	out->unit_size = c->unit_size;
+	out->allocated_units = occ.allocated;
+
+	if (c->type == CLASS_HUGE)
+		return;
+
+	out->units_per_run = c->run.bitmap_nallocs;
+	out->runs = occ.runs;
+
+	/* the counters are updated independently of each other */
+	size_t units = out->runs * out->units_per_run;
+	if (out->allocated_units > units)
+		out->allocated_units = units;
+
+	out->free_units = units - out->allocated_units;
+	if (units != 0)
+		out->fill = (unsigned)(out->allocated_units * 100 / units);
+}
+
+/*
+ * CTL_READ_HANDLER(occupancy) -- reads the occupancy of an allocation class
+ */
+static int
+CTL_READ_HANDLER(occupancy)(PMEMobjpool *pop,
+	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
+{
+	struct ctl_index *idx = SLIST_FIRST(indexes);
+	ASSERTeq(strcmp(idx->name, "class_id"), 0);
+
+	if (idx->value < 0 || idx->value >= MAX_ALLOCATION_CLASSES) {
+		ERR("class id outside of the allowed range");
+		errno = ERANGE;
+		return -1;
+	}
+
+	struct alloc_class *c = alloc_class_by_id(
+		heap_alloc_classes(&pop->heap), (uint8_t)idx->value);
+	if (c == NULL) {
+		ERR("class with the given id does not exist");
+		errno = ENOENT;
+		return -1;
+	}
+
+	stats_alloc_class_occupancy(pop, c, arg);
+
+	return 0;
+}
+
+static const struct ctl_node CTL_NODE(class_id)[] = {
+	CTL_LEAF_RO(occupancy),
+
+	CTL_NODE_END
+};
+
+static const struct ctl_node CTL_NODE(alloc_class)[] = {
+	CTL_INDEXED(class_id),
+
+	CTL_NODE_END
+};
+
+/*
+ * CTL_READ_HANDLER(fragmentation) -- sums up the occupancy of all the
+ *	allocation classes
+ */
+static int
+CTL_READ_HANDLER(fragmentation)(PMEMobjpool *pop,
+	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
+{
+	struct pobj_stats_fragmentation *frag = arg;
+	memset(frag, 0, sizeof(*frag));
+
+	struct alloc_class_collection *ac = heap_alloc_classes(&pop->heap);
+	size_t used_bytes = 0;
+
+	for (unsigned i = 0; i < MAX_ALLOCATION_CLASSES; ++i) {
+		struct alloc_class *c = alloc_class_by_id(ac, (uint8_t)i);
+		if (c == NULL)
+			continue;
+
+		struct pobj_stats_alloc_class occ;
+		stats_alloc_class_occupancy(pop, c, &occ);
+
+		if (c->type == CLASS_HUGE) {
+			frag->huge_bytes += occ.allocated_units * CHUNKSIZE;
+			continue;
+		}
+
+		frag->run_bytes += occ.runs * c->run.size_idx * CHUNKSIZE;
+		frag->run_free_bytes += occ.free_units * occ.unit_size;
+	}
+
+	frag->run_bytes +=
+		heap_get_foreign_run_chunks(&pop->heap) * CHUNKSIZE;
+	frag->heap_bytes = heap_get_populated_size(&pop->heap);
+
+	used_bytes = frag->run_bytes + frag->huge_bytes;
+	if (used_bytes < frag->heap_bytes)
+		frag->free_bytes = frag->heap_bytes - used_bytes;
+
+	size_t free_bytes = frag->free_bytes + frag->run_free_bytes;
+	if (free_bytes != 0)
+		frag->fragmentation =
+			(unsigned)(frag->run_free_bytes * 100 / free_bytes);
+
+	return 0;
+}
+
 STATS_CTL_HANDLER(persistent, curr_allocated, heap_curr_allocated);
+STATS_CTL_HIST_HANDLER(heap, operation_latency, STATS_HIST_HEAP_OPERATION);
 
 static const struct ctl_node CTL_NODE(heap)[] = {
 	STATS_CTL_LEAF(persistent, curr_allocated),
+	STATS_CTL_LEAF(heap, operation_latency),
+	CTL_CHILD(alloc_class),
+	CTL_LEAF_RO(fragmentation),
+
+	CTL_NODE_END
+};
+
+STATS_CTL_HIST_HANDLER(tx, latency, STATS_HIST_TX);
+STATS_CTL_HIST_HANDLER(tx, commit_latency, STATS_HIST_TX_COMMIT);
+STATS_CTL_HIST_HANDLER(tx, add_range_latency, STATS_HIST_TX_ADD_RANGE);
+STATS_CTL_COUNTER_HANDLER(tx, add_range_skipped,
+	STATS_COUNTER_TX_ADD_RANGE_SKIPPED);
+
+STATS_CTL_HANDLER(transient, queued, tx_post_commit_queued);
+STATS_CTL_HANDLER(transient, completed, tx_post_commit_completed);
+STATS_CTL_HANDLER(transient, queue_full, tx_post_commit_queue_full);
+
+/*
+ * CTL_READ_HANDLER(transient_pending) -- returns the number of post commit
+ *	tasks waiting in the queue or being processed
+ */
+static int
+CTL_READ_HANDLER(transient_pending)(PMEMobjpool *pop,
+	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
+{
+	uint64_t *argv = arg;
+	uint64_t completed;
+	uint64_t queued;
+
+	/* a task is always counted as queued before it's completed */
+	util_atomic_load_explicit64(
+		&pop->stats->transient->tx_post_commit_completed,
+		&completed, memory_order_acquire);
+	util_atomic_load_explicit64(
+		&pop->stats->transient->tx_post_commit_queued,
+		&queued, memory_order_acquire);
+
+	*argv = queued - completed;
+
+	return 0;
+}
+
+static const struct ctl_node CTL_NODE(post_commit)[] = {
+	STATS_CTL_LEAF(transient, queued),
+	STATS_CTL_LEAF(transient, completed),
+	STATS_CTL_LEAF(transient, queue_full),
+	STATS_CTL_LEAF(transient, pending),
+
+	CTL_NODE_END
+};
+
+static const struct ctl_node CTL_NODE(tx)[] = {
+	CTL_CHILD(post_commit),
+	STATS_CTL_LEAF(tx, latency),
+	STATS_CTL_LEAF(tx, commit_latency),
+	STATS_CTL_LEAF(tx, add_range_latency),
+	STATS_CTL_LEAF(tx, add_range_skipped),
 
 	CTL_NODE_END
 };
 
+/*
+ * CTL_RUNNABLE_HANDLER(reset_latency) -- clears the latency histograms
+ */
+static int
+CTL_RUNNABLE_HANDLER(reset_latency)(PMEMobjpool *pop,
+	enum ctl_query_source source, void *arg,
+	struct ctl_indexes *indexes)
+{
+	stats_hist_reset(pop->stats);
+
+	return 0;
+}
+
 /*
  * CTL_READ_HANDLER(enabled) -- returns whether or not statistics are enabled
  */
@@ -70,6 +475,9 @@ CTL_WRITE_HANDLER(enabled)(PMEMobjpool *pop,
 {
 	int arg_in = *(int *)arg;
 
+	if (arg_in > 0 && stats_lanes_alloc(pop->stats) != 0)
+		return -1;
+
 	pop->stats->enabled = arg_in > 0;
 
 	return 0;
@@ -79,7 +487,9 @@ static struct ctl_argument CTL_ARG(enabled) = CTL_ARG_BOOLEAN;
 
 static const struct ctl_node CTL_NODE(stats)[] = {
 	CTL_CHILD(heap),
+	CTL_CHILD(tx),
 	CTL_LEAF_RW(enabled),
+	CTL_LEAF_RUNNABLE(reset_latency),
 
 	CTL_NODE_END
 };
@@ -97,6 +507,8 @@ stats_new(PMEMobjpool *pop)
 	if (s->transient == NULL)
 		goto error_transient_alloc;
 
+	s->transient->nlanes = pop->lanes_desc.runtime_nlanes;
+
 	return s;
 
 error_transient_alloc:
@@ -112,6 +524,7 @@ stats_delete(PMEMobjpool *pop, struct stats *s)
 {
 	pmemops_persist(&pop->p_ops, s->persistent,
 		sizeof(struct stats_persistent));
+	Free(s->transient->lanes);
 	Free(s->transient);
 	Free(s);
 }
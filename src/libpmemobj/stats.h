@@ -38,9 +38,61 @@
 #define LIBPMEMOBJ_STATS_H 1
 
 #include "ctl.h"
+#include "os.h"
+
+/*
+ * Latency histograms use log-linear buckets: values below STATS_HIST_SUB
+ * nanoseconds have a bucket each, every larger power of two is split into
+ * STATS_HIST_SUB buckets of equal width. Values of 2^STATS_HIST_MAX_BIT
+ * nanoseconds (about 34 seconds) or more all land in the last bucket.
+ */
+#define STATS_HIST_SUB_BITS 2
+#define STATS_HIST_SUB (1U << STATS_HIST_SUB_BITS)
+#define STATS_HIST_MAX_BIT 35
+#define STATS_HIST_NBUCKETS\
+	((STATS_HIST_MAX_BIT - STATS_HIST_SUB_BITS + 1) * STATS_HIST_SUB)
+
+enum stats_hist_type {
+	STATS_HIST_TX, /* pmemobj_tx_begin to pmemobj_tx_end */
+	STATS_HIST_TX_COMMIT, /* commit of the outermost transaction */
+	STATS_HIST_TX_ADD_RANGE, /* pmemobj_tx_add_range and friends */
+	STATS_HIST_HEAP_OPERATION, /* palloc_operation */
+
+	MAX_STATS_HIST
+};
+
+enum stats_counter_type {
+	/* snapshots skipped because the range is inside a new object */
+	STATS_COUNTER_TX_ADD_RANGE_SKIPPED,
+
+	MAX_STATS_COUNTER
+};
+
+struct stats_hist {
+	uint64_t sum;
+	uint64_t buckets[STATS_HIST_NBUCKETS];
+};
+
+/*
+ * histograms and counters of a single lane, so that threads do not share
+ * cache lines
+ */
+struct stats_lane {
+	struct stats_hist hist[MAX_STATS_HIST];
+	uint64_t counters[MAX_STATS_COUNTER];
+};
 
 struct stats_transient {
-	int unused;
+	/* post commit tasks handed off to the workers and completed by them */
+	uint64_t tx_post_commit_queued;
+	uint64_t tx_post_commit_completed;
+	/* commits that found the post commit queue full */
+	uint64_t tx_post_commit_queue_full;
+
+	unsigned nlanes;
+
+	/* allocated when the statistics are enabled for the first time */
+	struct stats_lane *lanes;
 };
 
 struct stats_persistent {
@@ -74,6 +126,23 @@ struct stats {
 {CTL_READ_HANDLER(type##_##name), NULL, NULL},\
 NULL, NULL}
 
+#define STATS_CTL_HIST_HANDLER(type, name, hist)\
+static int CTL_READ_HANDLER(type##_##name)(PMEMobjpool *pop,\
+	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)\
+{\
+	stats_hist_read(pop->stats, (hist), arg);\
+	return 0;\
+}
+
+#define STATS_CTL_COUNTER_HANDLER(type, name, counter)\
+static int CTL_READ_HANDLER(type##_##name)(PMEMobjpool *pop,\
+	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)\
+{\
+	uint64_t *argv = arg;\
+	*argv = stats_counter_read(pop->stats, (counter));\
+	return 0;\
+}
+
 #define STATS_CTL_HANDLER(type, name, varname)\
 static int CTL_READ_HANDLER(type##_##name)(PMEMobjpool *pop,\
 	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)\
@@ -84,6 +153,32 @@ static int CTL_READ_HANDLER(type##_##name)(PMEMobjpool *pop,\
 	return 0;\
 }
 
+/*
+ * stats_hist_start -- returns the timestamp for stats_hist_record, or 0 if
+ *	the statistics are disabled
+ */
+static inline uint64_t
+stats_hist_start(struct stats *stats)
+{
+	if (!stats->enabled)
+		return 0;
+
+	struct timespec ts;
+	os_clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+void stats_hist_record(struct stats *stats, enum stats_hist_type type,
+	unsigned lane, uint64_t start);
+void stats_hist_read(struct stats *stats, enum stats_hist_type type,
+	struct pobj_stats_latency *latency);
+
+void stats_counter_inc(struct stats *stats, enum stats_counter_type type,
+	unsigned lane, uint64_t value);
+uint64_t stats_counter_read(struct stats *stats,
+	enum stats_counter_type type);
+
 void stats_ctl_register(PMEMobjpool *pop);
 
 struct stats *stats_new(PMEMobjpool *pop);
@@ -36,12 +36,14 @@
 
 #include <inttypes.h>
 #include <wchar.h>
+#include <unistd.h>
 
 #include "queue.h"
 #include "ravl.h"
 #include "obj.h"
 #include "out.h"
 #include "pmalloc.h"
+#include "sys_util.h"
 #include "tx.h"
 #include "valgrind_internal.h"
 
@@ -60,6 +62,10 @@ struct tx {
 
 	pmemobj_tx_callback stage_callback;
 	void *stage_callback_arg;
+
+	/* lane and start time of the outermost transaction, for statistics */
+	unsigned lane_idx;
+	uint64_t start;
 };
 
 /*
@@ -91,14 +97,41 @@ struct tx_undo_runtime {
 #define MAX_TX_ALLOC_RESERVATIONS (MAX_MEMOPS_ENTRIES /\
 	MAX_MEMOPS_ENTRIES_PER_TX_ALLOC)
 
+/*
+ * tx_range_hash -- volatile index of the bytes covered by the ranges of
+ *	the current transaction, with one bitmap per cache line
+ *
+ * This is an open-addressing hash table in front of the ranges tree that
+ * lets the repeated snapshots of already covered memory skip the tree
+ * lookups. The tree remains the source of truth, so the ranges that span
+ * too many cache lines are simply not indexed.
+ */
+struct tx_range_hash {
+	struct tx_range_hash_entry {
+		uint64_t line; /* cache line number, 0 if the slot is empty */
+		uint64_t mask; /* covered bytes of the cache line */
+	} *entries;
+	size_t capacity; /* always a power of two */
+	size_t count;
+};
+
 struct lane_tx_runtime {
 	unsigned lane_idx;
 	struct ravl *ranges;
+	struct tx_range_hash range_hash;
+	struct ravl *allocated; /* objects allocated in this transaction */
 	uint64_t cache_offset;
 	struct tx_undo_runtime undo;
 	struct pobj_action alloc_actv[MAX_TX_ALLOC_RESERVATIONS];
 	int actvcnt; /* reservation count */
 	int actvundo; /* reservations in undo log (to skip) */
+
+	enum pobj_tx_mode mode; /* mode of the current transaction */
+
+	/* volatile write set of a redo mode transaction */
+	char *wset;
+	size_t wset_size; /* bytes used by the tx_range entries */
+	size_t wset_capacity;
 };
 
 struct tx_alloc_args {
@@ -139,9 +172,47 @@ enum tx_clr_flag {
 	TX_CLR_FLAG_FREE_IF_EXISTS = 1 << 3,
 };
 
+/*
+ * tx_group_commit -- outermost transactions which persist their committed
+ *	state together
+ *
+ * The first transaction joining an empty group becomes its leader and waits
+ * until the group is full or the window elapses. It then persists the states
+ * of all the members with a single drain and wakes them up. The groups are
+ * persisted one at a time, the transactions arriving in the meantime gather
+ * in the next group.
+ */
+struct tx_group_commit {
+	os_mutex_t lock;
+	os_cond_t cond;
+
+	unsigned batch; /* max number of members, group commit is off if <= 1 */
+	unsigned window; /* how long the leader waits for members, in us */
+
+	struct lane_tx_layout *members[TX_MAX_GROUP_COMMIT_BATCH];
+	unsigned nmembers;
+	uint64_t group; /* number of the group being gathered */
+	uint64_t completed; /* number of the last persisted group */
+	int persisting;
+};
+
 struct tx_parameters {
 	size_t cache_size;
 	size_t cache_threshold;
+	enum pobj_tx_mode mode;
+	struct tx_group_commit group_commit;
+
+	/* post commit worker threads owned by the library */
+	unsigned post_commit_nworkers;
+	int post_commit_affinity;
+	os_thread_t *post_commit_workers;
+
+	/*
+	 * Held for reading by the committing transactions while they enqueue
+	 * their lanes to the post commit queue, and for writing while the
+	 * queue is stopped or replaced.
+	 */
+	os_rwlock_t post_commit_lock;
 };
 
 /*
@@ -161,6 +232,182 @@ tx_range_def_cmp(const void *lhs, const void *rhs)
 	return 0;
 }
 
+/*
+ * tx_range_hash_slot -- (internal) returns the first slot to probe for the
+ *	given cache line
+ */
+static inline size_t
+tx_range_hash_slot(const struct tx_range_hash *h, uint64_t line)
+{
+	uint64_t k = line * 0x9E3779B97F4A7C15ULL;
+
+	return (size_t)(k ^ (k >> 32)) & (h->capacity - 1);
+}
+
+/*
+ * tx_range_hash_find -- (internal) returns the entry of the given cache line
+ */
+static struct tx_range_hash_entry *
+tx_range_hash_find(const struct tx_range_hash *h, uint64_t line)
+{
+	if (h->count == 0)
+		return NULL;
+
+	size_t i = tx_range_hash_slot(h, line);
+	while (h->entries[i].line != line) {
+		if (h->entries[i].line == 0)
+			return NULL;
+		i = (i + 1) & (h->capacity - 1);
+	}
+
+	return &h->entries[i];
+}
+
+/*
+ * tx_range_hash_grow -- (internal) doubles the capacity of the hash table
+ */
+static int
+tx_range_hash_grow(struct tx_range_hash *h)
+{
+	struct tx_range_hash old = *h;
+
+	h->capacity = old.capacity != 0 ?
+		old.capacity * 2 : TX_RANGE_HASH_INIT_SIZE;
+	h->entries = Zalloc(h->capacity * sizeof(*h->entries));
+	if (h->entries == NULL) {
+		*h = old;
+		return -1;
+	}
+
+	for (size_t n = 0; n < old.capacity; ++n) {
+		if (old.entries[n].line == 0)
+			continue;
+
+		size_t i = tx_range_hash_slot(h, old.entries[n].line);
+		while (h->entries[i].line != 0)
+			i = (i + 1) & (h->capacity - 1);
+
+		h->entries[i] = old.entries[n];
+	}
+
+	Free(old.entries);
+
+	return 0;
+}
+
+/*
+ * tx_range_hash_get -- (internal) returns the entry of the given cache line,
+ *	inserts an empty one if there's none
+ */
+static struct tx_range_hash_entry *
+tx_range_hash_get(struct tx_range_hash *h, uint64_t line)
+{
+	/* keep the load factor below 1/2 */
+	if ((h->count + 1) * 2 > h->capacity && tx_range_hash_grow(h) != 0)
+		return NULL;
+
+	size_t i = tx_range_hash_slot(h, line);
+	while (h->entries[i].line != line) {
+		if (h->entries[i].line == 0) {
+			h->entries[i].line = line;
+			h->entries[i].mask = 0;
+			h->count++;
+			break;
+		}
+		i = (i + 1) & (h->capacity - 1);
+	}
+
+	return &h->entries[i];
+}
+
+/*
+ * tx_range_hash_line_mask -- (internal) returns the bitmap of the bytes of
+ *	the cache line that are within the range
+ */
+static inline uint64_t
+tx_range_hash_line_mask(uint64_t line, uint64_t offset, uint64_t end)
+{
+	uint64_t lbegin = line << TX_RANGE_HASH_LINE_SHIFT;
+	uint64_t lend = lbegin + (1ULL << TX_RANGE_HASH_LINE_SHIFT);
+
+	uint64_t b = MAX(offset, lbegin) - lbegin;
+	uint64_t e = MIN(end, lend) - lbegin;
+	uint64_t width = e - b;
+
+	return (width == 64 ? UINT64_MAX : ((1ULL << width) - 1)) << b;
+}
+
+/*
+ * tx_range_hash_mark -- (internal) marks the range as covered
+ *
+ * Failures are not reported, the range is then only known to the tree.
+ */
+static void
+tx_range_hash_mark(struct tx_range_hash *h, uint64_t offset, uint64_t size)
+{
+	if (size == 0)
+		return;
+
+	uint64_t end = offset + size;
+	uint64_t first = offset >> TX_RANGE_HASH_LINE_SHIFT;
+	uint64_t last = (end - 1) >> TX_RANGE_HASH_LINE_SHIFT;
+	if (last - first >= TX_RANGE_HASH_MAX_LINES)
+		return;
+
+	for (uint64_t line = first; line <= last; ++line) {
+		struct tx_range_hash_entry *e = tx_range_hash_get(h, line);
+		if (e == NULL)
+			return;
+
+		e->mask |= tx_range_hash_line_mask(line, offset, end);
+	}
+}
+
+/*
+ * tx_range_hash_covered -- (internal) checks if the whole range is already
+ *	covered by the ranges of the transaction
+ */
+static int
+tx_range_hash_covered(const struct tx_range_hash *h,
+	uint64_t offset, uint64_t size)
+{
+	if (h->count == 0 || size == 0)
+		return 0;
+
+	uint64_t end = offset + size;
+	uint64_t first = offset >> TX_RANGE_HASH_LINE_SHIFT;
+	uint64_t last = (end - 1) >> TX_RANGE_HASH_LINE_SHIFT;
+	if (last - first >= TX_RANGE_HASH_MAX_LINES)
+		return 0;
+
+	for (uint64_t line = first; line <= last; ++line) {
+		struct tx_range_hash_entry *e = tx_range_hash_find(h, line);
+		uint64_t mask = tx_range_hash_line_mask(line, offset, end);
+		if (e == NULL || (e->mask & mask) != mask)
+			return 0;
+	}
+
+	return 1;
+}
+
+/*
+ * tx_range_hash_clear -- (internal) removes all entries, the table is
+ *	released if it grew past its initial size
+ */
+static void
+tx_range_hash_clear(struct tx_range_hash *h)
+{
+	if (h->capacity > TX_RANGE_HASH_INIT_SIZE) {
+		Free(h->entries);
+		h->entries = NULL;
+		h->capacity = 0;
+	} else if (h->count != 0) {
+		memset(h->entries, 0, h->capacity * sizeof(*h->entries));
+	}
+
+	h->count = 0;
+}
+
 /*
  * tx_params_new -- creates a new transactional parameters instance and fills it
  *	with default values.
@@ -174,6 +421,21 @@ tx_params_new(void)
 
 	tx_params->cache_size = TX_DEFAULT_RANGE_CACHE_SIZE;
 	tx_params->cache_threshold = TX_DEFAULT_RANGE_CACHE_THRESHOLD;
+	tx_params->mode = POBJ_TX_MODE_UNDO;
+	tx_params->post_commit_nworkers = 0;
+	tx_params->post_commit_affinity = -1;
+	tx_params->post_commit_workers = NULL;
+	util_rwlock_init(&tx_params->post_commit_lock);
+
+	struct tx_group_commit *g = &tx_params->group_commit;
+	util_mutex_init(&g->lock);
+	os_cond_init(&g->cond);
+	g->batch = 0;
+	g->window = 0;
+	g->nmembers = 0;
+	g->group = 1;
+	g->completed = 0;
+	g->persisting = 0;
 
 	return tx_params;
 }
@@ -184,6 +446,9 @@ tx_params_new(void)
 void
 tx_params_delete(struct tx_parameters *tx_params)
 {
+	util_mutex_destroy(&tx_params->group_commit.lock);
+	os_cond_destroy(&tx_params->group_commit.cond);
+	util_rwlock_destroy(&tx_params->post_commit_lock);
 	Free(tx_params);
 }
 
@@ -297,6 +562,105 @@ tx_set_state(PMEMobjpool *pop, struct lane_tx_layout *layout, uint64_t state)
 	pmemops_persist(&pop->p_ops, &layout->state, sizeof(layout->state));
 }
 
+/*
+ * tx_group_commit_deadline -- (internal) computes the absolute time until
+ *	which the leader waits for the members of its group
+ */
+static void
+tx_group_commit_deadline(struct timespec *ts, unsigned window)
+{
+	os_clock_gettime(CLOCK_REALTIME, ts);
+
+	uint64_t nsec = (uint64_t)ts->tv_nsec + (uint64_t)window * 1000;
+	ts->tv_sec += (time_t)(nsec / 1000000000ULL);
+	ts->tv_nsec = (long)(nsec % 1000000000ULL);
+}
+
+/*
+ * tx_set_state_group -- (internal) sets the transaction state and persists
+ *	it together with the states of the other committing transactions
+ *
+ * The caller must have already drained its own flushes, the drain issued by
+ * the leader doesn't order the stores of other threads.
+ *
+ * The batch size can be changed at any time, so it's read once under the
+ * lock. If group commit has been turned off in the meantime, the state is
+ * persisted on its own.
+ */
+static void
+tx_set_state_group(PMEMobjpool *pop, struct lane_tx_layout *layout,
+	uint64_t state)
+{
+	struct tx_group_commit *g = &pop->tx_params->group_commit;
+
+	util_mutex_lock(&g->lock);
+
+	unsigned batch = g->batch;
+	if (batch <= 1) {
+		util_mutex_unlock(&g->lock);
+		tx_set_state(pop, layout, state);
+		return;
+	}
+
+	/* the group is full but its leader hasn't closed it yet */
+	while (g->nmembers >= batch)
+		os_cond_wait(&g->cond, &g->lock);
+
+	layout->state = state;
+
+	uint64_t group = g->group;
+	g->members[g->nmembers++] = layout;
+
+	if (g->nmembers != 1) {
+		if (g->nmembers >= batch)
+			os_cond_broadcast(&g->cond);
+
+		while (g->completed < group)
+			os_cond_wait(&g->cond, &g->lock);
+
+		util_mutex_unlock(&g->lock);
+		return;
+	}
+
+	/* this transaction leads the group */
+	if (g->window != 0) {
+		struct timespec deadline;
+		tx_group_commit_deadline(&deadline, g->window);
+
+		while (g->nmembers < batch) {
+			if (os_cond_timedwait(&g->cond, &g->lock,
+					&deadline) == ETIMEDOUT)
+				break;
+		}
+	}
+
+	while (g->persisting)
+		os_cond_wait(&g->cond, &g->lock);
+
+	struct lane_tx_layout *members[TX_MAX_GROUP_COMMIT_BATCH];
+	unsigned nmembers = g->nmembers;
+	memcpy(members, g->members, nmembers * sizeof(members[0]));
+
+	g->nmembers = 0;
+	g->group++;
+	g->persisting = 1;
+
+	/* let the waiting transactions gather in the next group */
+	os_cond_broadcast(&g->cond);
+	util_mutex_unlock(&g->lock);
+
+	for (unsigned i = 0; i < nmembers; ++i)
+		pmemops_flush(&pop->p_ops, &members[i]->state,
+			sizeof(members[i]->state));
+	pmemops_drain(&pop->p_ops);
+
+	util_mutex_lock(&g->lock);
+	g->completed = group;
+	g->persisting = 0;
+	os_cond_broadcast(&g->cond);
+	util_mutex_unlock(&g->lock);
+}
+
 /*
  * tx_clear_vec_entry -- (internal) clear undo log vector entry
  */
@@ -811,9 +1175,110 @@ tx_flush_range(void *data, void *ctx)
 }
 
 /*
- * tx_pre_commit -- (internal) do pre-commit operations
+ * constructor_tx_redo -- (internal) redo buffer constructor, copies the
+ *	volatile write set and terminates it with an empty range
+ */
+static int
+constructor_tx_redo(void *ctx, void *ptr, size_t usable_size, void *arg)
+{
+	LOG(5, NULL);
+	PMEMobjpool *pop = ctx;
+	const struct pmem_ops *p_ops = &pop->p_ops;
+	struct lane_tx_runtime *lane = arg;
+
+	ASSERTne(ptr, NULL);
+	ASSERT(usable_size >= lane->wset_size + sizeof(struct tx_range));
+
+	VALGRIND_ADD_TO_TX(ptr, usable_size);
+
+	memcpy(ptr, lane->wset, lane->wset_size);
+	memset((char *)ptr + lane->wset_size, 0,
+		usable_size - lane->wset_size);
+	pmemops_persist(p_ops, ptr, usable_size);
+
+	VALGRIND_REMOVE_FROM_TX(ptr, usable_size);
+
+	return 0;
+}
+
+/*
+ * tx_redo_persist -- (internal) stores the write set of a redo mode
+ *	transaction in the pool
+ *
+ * The redo buffer is put at the end of the UNDO_ALLOC vector, so that
+ * an interrupted transaction frees it just like any other allocation, and
+ * a committed one finds it by the internal object flag.
+ */
+static int
+tx_redo_persist(PMEMobjpool *pop, struct lane_tx_runtime *lane)
+{
+	LOG(5, "write set size %zu", lane->wset_size);
+
+	struct pvector_context *undo = lane->undo.ctx[UNDO_ALLOC];
+	uint64_t *entry = pvector_push_back(undo);
+	if (entry == NULL) {
+		ERR("alloc undo log too large");
+		return -1;
+	}
+
+	int ret = pmalloc_construct(pop, entry,
+		lane->wset_size + sizeof(struct tx_range),
+		constructor_tx_redo, lane,
+		0, OBJ_INTERNAL_OBJECT_MASK, 0);
+	if (ret != 0)
+		pvector_pop_back(undo, NULL);
+
+	return ret;
+}
+
+/*
+ * tx_redo_apply -- (internal) applies the committed write set, if there's
+ *	one, and frees the redo buffer
+ *
+ * This is idempotent, so it can be safely repeated in recovery if it was
+ * interrupted.
  */
 static void
+tx_redo_apply(PMEMobjpool *pop, struct tx_undo_runtime *tx_rt)
+{
+	LOG(7, NULL);
+
+	struct pvector_context *undo = tx_rt->ctx[UNDO_ALLOC];
+	uint64_t off = pvector_last(undo);
+	if (off == 0 ||
+		!(palloc_flags(&pop->heap, off) & OBJ_INTERNAL_OBJECT_MASK))
+		return;
+
+	char *redo = OBJ_OFF_TO_PTR(pop, off);
+	uint64_t redo_size = palloc_usable_size(&pop->heap, off);
+
+	uint64_t redo_offset = 0;
+	while (redo_offset + sizeof(struct tx_range) <= redo_size) {
+		struct tx_range *range =
+			(struct tx_range *)(redo + redo_offset);
+		if (range->offset == 0 || range->size == 0)
+			break;
+
+		void *dest = OBJ_OFF_TO_PTR(pop, range->offset);
+
+		VALGRIND_ADD_TO_TX(dest, range->size);
+		memcpy(dest, range->data, range->size);
+		pmemops_flush(&pop->p_ops, dest, range->size);
+		VALGRIND_REMOVE_FROM_TX(dest, range->size);
+
+		redo_offset += TX_ALIGN_SIZE(range->size, TX_RANGE_MASK) +
+			sizeof(struct tx_range);
+	}
+
+	pmemops_drain(&pop->p_ops);
+
+	pvector_pop_back(undo, tx_free_vec_entry);
+}
+
+/*
+ * tx_pre_commit -- (internal) do pre-commit operations
+ */
+static int
 tx_pre_commit(PMEMobjpool *pop, struct tx *tx, struct lane_tx_runtime *lane)
 {
 	LOG(5, NULL);
@@ -822,9 +1287,16 @@ tx_pre_commit(PMEMobjpool *pop, struct tx *tx, struct lane_tx_runtime *lane)
 
 	tx_fulfill_reservations(tx);
 
+	if (lane->wset_size != 0 && tx_redo_persist(pop, lane) != 0)
+		return -1;
+
 	/* Flush all regions and destroy the whole tree. */
 	ravl_delete_cb(lane->ranges, tx_flush_range, pop);
 	lane->ranges = NULL;
+	ravl_delete_cb(lane->allocated, tx_flush_range, pop);
+	lane->allocated = NULL;
+
+	return 0;
 }
 
 /*
@@ -889,6 +1361,13 @@ tx_post_commit(PMEMobjpool *pop, struct tx *tx, struct lane_tx_layout *layout,
 		tx_rt = &lane->undo;
 	}
 
+	/*
+	 * Outside of recovery the write set has already been applied by
+	 * pmemobj_tx_commit.
+	 */
+	if (recovery)
+		tx_redo_apply(pop, tx_rt);
+
 	tx_post_commit_set(pop, tx, tx_rt, recovery);
 	tx_post_commit_alloc(pop, tx_rt);
 	tx_post_commit_free(pop, tx_rt);
@@ -951,6 +1430,8 @@ tx_abort(PMEMobjpool *pop, struct lane_tx_runtime *lane,
 		ASSERTne(lane, NULL);
 		ravl_delete(lane->ranges);
 		lane->ranges = NULL;
+		ravl_delete(lane->allocated);
+		lane->allocated = NULL;
 	}
 }
 
@@ -1063,6 +1544,43 @@ tx_lane_ranges_insert_def(struct lane_tx_runtime *lane,
 	return ret;
 }
 
+/*
+ * tx_lane_allocated_insert -- (internal) inserts the range of an object
+ *	allocated in this transaction
+ */
+static int
+tx_lane_allocated_insert(struct lane_tx_runtime *lane,
+	const struct tx_range_def *rdef)
+{
+	LOG(3, "rdef->offset %"PRIu64" rdef->size %"PRIu64,
+		rdef->offset, rdef->size);
+
+	int ret = ravl_emplace_copy(lane->allocated, rdef);
+	if (ret == EEXIST)
+		FATAL("invalid state of allocated objects tree");
+
+	return ret;
+}
+
+/*
+ * tx_lane_allocated_find -- (internal) returns the object allocated in this
+ *	transaction which entirely contains the range, if any
+ */
+static struct tx_range_def *
+tx_lane_allocated_find(struct lane_tx_runtime *lane,
+	uint64_t offset, uint64_t size)
+{
+	struct tx_range_def search = {offset, 0, 0};
+	struct ravl_node *n = ravl_find(lane->allocated, &search,
+		RAVL_PREDICATE_LESS_EQUAL);
+	if (n == NULL)
+		return NULL;
+
+	struct tx_range_def *f = ravl_data(n);
+
+	return offset + size <= f->offset + f->size ? f : NULL;
+}
+
 /*
  * tx_alloc_common -- (internal) common function for alloc and zalloc
  */
@@ -1105,7 +1623,7 @@ tx_alloc_common(struct tx *tx, size_t size, type_num_t type_num,
 	size = palloc_usable_size(&pop->heap, retoid.off);
 
 	const struct tx_range_def r = {retoid.off, size, flags};
-	if (tx_lane_ranges_insert_def(lane, &r) != 0)
+	if (tx_lane_allocated_insert(lane, &r) != 0)
 		goto err_oom;
 
 	uint64_t *entry_offset = pvector_push_back(lane->undo.ctx[UNDO_ALLOC]);
@@ -1212,8 +1730,11 @@ pmemobj_tx_begin(PMEMobjpool *pop, jmp_buf env, ...)
 	} else if (tx->stage == TX_STAGE_NONE) {
 		VALGRIND_START_TX;
 
+		tx->start = stats_hist_start(pop->stats);
+
 		unsigned idx = lane_hold(pop, &tx->section,
 			LANE_SECTION_TRANSACTION);
+		tx->lane_idx = idx;
 
 		lane = tx->section->runtime;
 		VALGRIND_ANNOTATE_NEW_MEMORY(lane, sizeof(*lane));
@@ -1223,12 +1744,18 @@ pmemobj_tx_begin(PMEMobjpool *pop, jmp_buf env, ...)
 
 		lane->ranges = ravl_new_sized(tx_range_def_cmp,
 			sizeof(struct tx_range_def));
+		lane->allocated = ravl_new_sized(tx_range_def_cmp,
+			sizeof(struct tx_range_def));
+		tx_range_hash_clear(&lane->range_hash);
 		lane->cache_offset = 0;
 		lane->lane_idx = idx;
 
 		lane->actvcnt = 0;
 		lane->actvundo = 0;
 
+		lane->mode = pop->tx_params->mode;
+		lane->wset_size = 0;
+
 		struct lane_tx_layout *layout =
 			(struct lane_tx_layout *)tx->section->layout;
 
@@ -1411,6 +1938,33 @@ pmemobj_tx_errno(void)
 	return get_tx()->last_errnum;
 }
 
+/*
+ * tx_post_commit_enqueue -- (internal) hands the lane over to the post commit
+ *	queue, returns 0 on success
+ */
+static int
+tx_post_commit_enqueue(PMEMobjpool *pop, struct lane_section *section)
+{
+	struct tx_parameters *params = pop->tx_params;
+	int ret = -1;
+
+	util_rwlock_rdlock(&params->post_commit_lock);
+
+	if (pop->tx_postcommit_tasks != NULL) {
+		ret = ringbuf_tryenqueue(pop->tx_postcommit_tasks, section);
+		if (ret == 0)
+			STATS_INC(pop->stats, transient,
+				tx_post_commit_queued, 1);
+		else
+			STATS_INC(pop->stats, transient,
+				tx_post_commit_queue_full, 1);
+	}
+
+	util_rwlock_unlock(&params->post_commit_lock);
+
+	return ret;
+}
+
 /*
  * tx_post_commit_cleanup -- performs all the necessary cleanup on a lane after
  *	successful commit
@@ -1447,6 +2001,9 @@ tx_post_commit_cleanup(PMEMobjpool *pop,
 	/* post commit phase */
 	tx_post_commit(pop, tx, layout, 0 /* not recovery */);
 
+	if (detached)
+		STATS_INC(pop->stats, transient, tx_post_commit_completed, 1);
+
 	/* clear transaction state */
 	tx_set_state(pop, layout, TX_STATE_NONE);
 
@@ -1489,22 +2046,44 @@ pmemobj_tx_commit(void)
 		struct lane_tx_layout *layout =
 			(struct lane_tx_layout *)tx->section->layout;
 		PMEMobjpool *pop = tx->pop;
+		uint64_t start = stats_hist_start(pop->stats);
 
 		/* pre-commit phase */
-		tx_pre_commit(pop, tx, lane);
+		if (tx_pre_commit(pop, tx, lane) != 0) {
+			ERR("out of memory");
+			obj_tx_abort(ENOMEM, 0);
+			return;
+		}
 
 		pmemops_drain(&pop->p_ops);
 
-		/* set transaction state as committed */
-		tx_set_state(pop, layout, TX_STATE_COMMITTED);
+		/*
+		 * Set transaction state as committed. The batch size is
+		 * checked again under the lock of the group.
+		 */
+		if (pop->tx_params->group_commit.batch > 1)
+			tx_set_state_group(pop, layout, TX_STATE_COMMITTED);
+		else
+			tx_set_state(pop, layout, TX_STATE_COMMITTED);
+
+		/* the write set must be visible once commit returns */
+		if (lane->wset_size != 0) {
+			tx_redo_apply(pop, &lane->undo);
+			lane->wset_size = 0;
+		}
 
+		/*
+		 * The queue is checked without the lock first, so that the
+		 * commits don't touch the lock when there's no queue.
+		 */
 		if (pop->tx_postcommit_tasks != NULL &&
-			ringbuf_tryenqueue(pop->tx_postcommit_tasks,
-				tx->section) == 0) {
+			tx_post_commit_enqueue(pop, tx->section) == 0)
 			lane_detach(pop);
-		} else {
+		else
 			tx_post_commit_cleanup(pop, tx->section, 0);
-		}
+
+		stats_hist_record(pop->stats, STATS_HIST_TX_COMMIT,
+			tx->lane_idx, start);
 
 		tx->section = NULL;
 	}
@@ -1548,6 +2127,10 @@ pmemobj_tx_end(void)
 		ASSERTeq(tx->section, NULL);
 
 		release_and_free_tx_locks(tx);
+
+		stats_hist_record(tx->pop->stats, STATS_HIST_TX,
+			tx->lane_idx, tx->start);
+
 		tx->pop = NULL;
 		tx->stage = TX_STAGE_NONE;
 
@@ -1836,6 +2419,23 @@ pmemobj_tx_add_common(struct tx *tx, struct tx_range_def *args)
 
 	int ret = 0;
 	struct lane_tx_runtime *runtime = tx->section->runtime;
+	uint64_t start = stats_hist_start(tx->pop->stats);
+
+	/* the whole range is already snapshotted, no need to search the tree */
+	if (tx_range_hash_covered(&runtime->range_hash,
+			args->offset, args->size))
+		goto out;
+
+	/*
+	 * The object was allocated in this transaction, so it's freed on
+	 * abort and there's nothing to restore.
+	 */
+	if (tx_lane_allocated_find(runtime, args->offset, args->size) != NULL) {
+		stats_counter_inc(tx->pop->stats,
+			STATS_COUNTER_TX_ADD_RANGE_SKIPPED,
+			runtime->lane_idx, 1);
+		goto out;
+	}
 
 	/*
 	 * Search existing ranges backwards starting from the end of the
@@ -1971,6 +2571,12 @@ pmemobj_tx_add_common(struct tx *tx, struct tx_range_def *args)
 		return obj_tx_abort_err(ENOMEM);
 	}
 
+	tx_range_hash_mark(&runtime->range_hash, args->offset, args->size);
+
+out:
+	stats_hist_record(tx->pop->stats, STATS_HIST_TX_ADD_RANGE,
+		runtime->lane_idx, start);
+
 	return 0;
 }
 
@@ -2094,6 +2700,125 @@ pmemobj_tx_xadd_range(PMEMoid oid, uint64_t hoff, size_t size, uint64_t flags)
 	return pmemobj_tx_add_common(tx, &args);
 }
 
+/*
+ * tx_write_set_append -- (internal) appends a new range to the volatile
+ *	write set of the transaction
+ */
+static int
+tx_write_set_append(struct lane_tx_runtime *lane, uint64_t offset,
+	const void *src, size_t size)
+{
+	size_t rsize = sizeof(struct tx_range) +
+		TX_ALIGN_SIZE(size, TX_RANGE_MASK);
+	size_t needed = lane->wset_size + rsize;
+
+	/* the redo buffer is terminated with an empty range */
+	if (needed + sizeof(struct tx_range) > PMEMOBJ_MAX_ALLOC_SIZE) {
+		ERR("write set too large");
+		return ENOMEM;
+	}
+
+	if (needed > lane->wset_capacity) {
+		size_t capacity = lane->wset_capacity != 0 ?
+			lane->wset_capacity : TX_DEFAULT_WRITE_SET_SIZE;
+		while (capacity < needed)
+			capacity *= 2;
+
+		char *wset = Realloc(lane->wset, capacity);
+		if (wset == NULL) {
+			ERR("!Realloc");
+			return ENOMEM;
+		}
+
+		lane->wset = wset;
+		lane->wset_capacity = capacity;
+	}
+
+	struct tx_range *range =
+		(struct tx_range *)(lane->wset + lane->wset_size);
+	range->offset = offset;
+	range->size = size;
+	memcpy(range->data, src, size);
+	memset(range->data + size, 0, rsize - sizeof(*range) - size);
+
+	lane->wset_size = needed;
+
+	return 0;
+}
+
+/*
+ * pmemobj_tx_write -- transactionally writes the memory range
+ */
+int
+pmemobj_tx_write(void *dest, const void *src, size_t size)
+{
+	LOG(3, "dest %p src %p size %zu", dest, src, size);
+	struct tx *tx = get_tx();
+
+	ASSERT_IN_TX(tx);
+	ASSERT_TX_STAGE_WORK(tx);
+
+	PMEMobjpool *pop = tx->pop;
+
+	if (!OBJ_PTR_FROM_POOL(pop, dest)) {
+		ERR("object outside of pool");
+		return obj_tx_abort_err(EINVAL);
+	}
+
+	struct tx_range_def args = {
+		.offset = (uint64_t)((char *)dest - (char *)pop),
+		.size = size,
+		.flags = 0,
+	};
+
+	struct lane_tx_runtime *lane = tx->section->runtime;
+	if (lane->mode == POBJ_TX_MODE_UNDO) {
+		int ret = pmemobj_tx_add_common(tx, &args);
+		if (ret == 0)
+			memcpy(dest, src, size);
+
+		return ret;
+	}
+
+	if (args.size > PMEMOBJ_MAX_ALLOC_SIZE) {
+		ERR("write size too large");
+		return obj_tx_abort_err(EINVAL);
+	}
+
+	if (args.offset < pop->heap_offset ||
+		(args.offset + args.size) >
+		(pop->heap_offset + pop->heap_size)) {
+		ERR("object outside of heap");
+		return obj_tx_abort_err(EINVAL);
+	}
+
+	if (args.size == 0)
+		return 0;
+
+	/*
+	 * New objects are freed on abort, so they can be written in place.
+	 * They are flushed on commit, unless they were allocated with
+	 * POBJ_FLAG_NO_FLUSH (e.g. published reservations), in which case
+	 * the written range is flushed here and drained on commit.
+	 */
+	struct tx_range_def *obj = tx_lane_allocated_find(lane,
+		args.offset, args.size);
+	if (obj != NULL) {
+		stats_counter_inc(pop->stats,
+			STATS_COUNTER_TX_ADD_RANGE_SKIPPED, lane->lane_idx, 1);
+		memcpy(dest, src, size);
+		if (obj->flags & POBJ_FLAG_NO_FLUSH)
+			pmemops_flush(&pop->p_ops, dest, size);
+		return 0;
+	}
+
+	int ret = tx_write_set_append(lane, args.offset, src, args.size);
+	if (ret != 0)
+		return obj_tx_abort_err(ret);
+
+	return 0;
+}
+
 /*
  * pmemobj_tx_alloc -- allocates a new object
  */
@@ -2330,7 +3055,7 @@ pmemobj_tx_publish(struct pobj_action *actv, size_t actvcnt)
 
 		const struct tx_range_def r = {actv[i].heap.offset,
 				size, POBJ_FLAG_NO_FLUSH};
-		if (tx_lane_ranges_insert_def(lane, &r) != 0)
+		if (tx_lane_allocated_insert(lane, &r) != 0)
 			break;
 	}
 
@@ -2374,6 +3099,8 @@ lane_transaction_destroy_rt(PMEMobjpool *pop, void *rt)
 {
 	struct lane_tx_runtime *lane = rt;
 	tx_destroy_undo_runtime(&lane->undo);
+	Free(lane->wset);
+	Free(lane->range_hash.entries);
 	Free(lane);
 }
 
@@ -2574,6 +3301,71 @@ static const struct ctl_node CTL_NODE(debug)[] = {
 	CTL_NODE_END
 };
 
+/*
+ * tx_mode_parser -- (internal) parses the transaction mode argument
+ */
+static int
+tx_mode_parser(const void *arg, void *dest, size_t dest_size)
+{
+	const char *vstr = arg;
+	enum pobj_tx_mode *mode = dest;
+	ASSERTeq(dest_size, sizeof(enum pobj_tx_mode));
+
+	if (strcmp(vstr, "undo") == 0) {
+		*mode = POBJ_TX_MODE_UNDO;
+	} else if (strcmp(vstr, "redo") == 0) {
+		*mode = POBJ_TX_MODE_REDO;
+	} else {
+		ERR("invalid transaction mode");
+		errno = EINVAL;
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * CTL_READ_HANDLER(mode) -- returns the mode of new transactions
+ */
+static int
+CTL_READ_HANDLER(mode)(PMEMobjpool *pop,
+	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
+{
+	enum pobj_tx_mode *arg_out = arg;
+
+	*arg_out = pop->tx_params->mode;
+
+	return 0;
+}
+
+/*
+ * CTL_WRITE_HANDLER(mode) -- sets the mode of new transactions
+ */
+static int
+CTL_WRITE_HANDLER(mode)(PMEMobjpool *pop,
+	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
+{
+	enum pobj_tx_mode arg_in = *(enum pobj_tx_mode *)arg;
+
+	if ((unsigned)arg_in >= MAX_POBJ_TX_MODES) {
+		errno = EINVAL;
+		ERR("invalid transaction mode");
+		return -1;
+	}
+
+	pop->tx_params->mode = arg_in;
+
+	return 0;
+}
+
+static struct ctl_argument CTL_ARG(mode) = {
+	.dest_size = sizeof(enum pobj_tx_mode),
+	.parsers = {
+		CTL_ARG_PARSER(enum pobj_tx_mode, tx_mode_parser),
+		CTL_ARG_PARSER_END
+	}
+};
+
 /*
  * CTL_WRITE_HANDLER(queue_depth) -- returns the depth of the post commit queue
  */
@@ -2588,6 +3380,141 @@ CTL_READ_HANDLER(queue_depth)(PMEMobjpool *pop, enum ctl_query_source source,
 	return 0;
 }
 
+/*
+ * tx_post_commit_worker -- (internal) the post commit worker thread owned by
+ *	the library, returns once the post commit queue is stopped
+ */
+static void *
+tx_post_commit_worker(void *arg)
+{
+	PMEMobjpool *pop = arg;
+
+	struct lane_section *section;
+	while ((section = ringbuf_dequeue_s(pop->tx_postcommit_tasks,
+		sizeof(*section))) != NULL) {
+		tx_post_commit_cleanup(pop, section, 1);
+	}
+
+	return NULL;
+}
+
+/*
+ * tx_post_commit_workers_stop -- drains the post commit queue, stops and
+ *	joins the worker threads owned by the library and removes the queue
+ *
+ * Does nothing if the library doesn't own any workers.
+ */
+void
+tx_post_commit_workers_stop(PMEMobjpool *pop)
+{
+	struct tx_parameters *params = pop->tx_params;
+	if (params->post_commit_nworkers == 0)
+		return;
+
+	LOG(3, "stopping %u post commit workers",
+		params->post_commit_nworkers);
+
+	util_rwlock_wrlock(&params->post_commit_lock);
+
+	/* waits for the queue to become empty */
+	ringbuf_stop(pop->tx_postcommit_tasks);
+
+	for (unsigned i = 0; i < params->post_commit_nworkers; ++i)
+		os_thread_join(&params->post_commit_workers[i], NULL);
+
+	Free(params->post_commit_workers);
+	params->post_commit_workers = NULL;
+	params->post_commit_nworkers = 0;
+
+	ringbuf_delete(pop->tx_postcommit_tasks);
+	pop->tx_postcommit_tasks = NULL;
+
+	util_rwlock_unlock(&params->post_commit_lock);
+}
+
+/*
+ * tx_post_commit_workers_start -- (internal) replaces the worker threads owned
+ *	by the library with the given number of new ones
+ *
+ * The workers are started on a new post commit queue of the same depth as the
+ * existing one, because a queue cannot be reused once it has been stopped.
+ */
+static int
+tx_post_commit_workers_start(PMEMobjpool *pop, unsigned nworkers)
+{
+	struct tx_parameters *params = pop->tx_params;
+
+	tx_post_commit_workers_stop(pop);
+
+	if (nworkers == 0)
+		return 0;
+
+	util_rwlock_wrlock(&params->post_commit_lock);
+
+	unsigned depth = TX_DEFAULT_POST_COMMIT_QUEUE_DEPTH;
+	if (pop->tx_postcommit_tasks != NULL) {
+		if (ringbuf_length(pop->tx_postcommit_tasks) != 0)
+			depth = ringbuf_length(pop->tx_postcommit_tasks);
+		ringbuf_delete(pop->tx_postcommit_tasks);
+	}
+
+	pop->tx_postcommit_tasks = ringbuf_new(depth);
+
+	util_rwlock_unlock(&params->post_commit_lock);
+
+	if (pop->tx_postcommit_tasks == NULL)
+		return -1;
+
+	params->post_commit_workers =
+		Malloc(nworkers * sizeof(*params->post_commit_workers));
+	if (params->post_commit_workers == NULL)
+		goto err;
+
+	long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (ncpus < 1)
+		ncpus = 1;
+
+	for (unsigned i = 0; i < nworkers; ++i) {
+		os_thread_t *t = &params->post_commit_workers[i];
+		errno = os_thread_create(t, NULL, tx_post_commit_worker, pop);
+		if (errno) {
+			ERR("!cannot create post commit worker");
+			goto err;
+		}
+		params->post_commit_nworkers++;
+
+		if (params->post_commit_affinity < 0)
+			continue;
+
+		os_cpu_set_t set;
+		os_cpu_zero(&set);
+		os_cpu_set((size_t)(((unsigned)params->post_commit_affinity +
+			i) % (unsigned long)ncpus), &set);
+
+		int ret = os_thread_setaffinity_np(t, sizeof(set), &set);
+		if (ret)
+			LOG(2, "cannot set post commit worker affinity: %d",
+				ret);
+	}
+
+	return 0;
+
+err:
+	if (params->post_commit_nworkers != 0) {
+		tx_post_commit_workers_stop(pop);
+	} else {
+		Free(params->post_commit_workers);
+		params->post_commit_workers = NULL;
+
+		util_rwlock_wrlock(&params->post_commit_lock);
+		ringbuf_delete(pop->tx_postcommit_tasks);
+		pop->tx_postcommit_tasks = NULL;
+		util_rwlock_unlock(&params->post_commit_lock);
+	}
+
+	return -1;
+}
+
 /*
  * CTL_WRITE_HANDLER(queue_depth) -- sets the depth of the post commit queue
  */
@@ -2601,13 +3528,21 @@ CTL_WRITE_HANDLER(queue_depth)(PMEMobjpool *pop, enum ctl_query_source source,
 	if (ntasks == NULL)
 		return -1;
 
+	/* the library owned workers are restarted on the new queue */
+	unsigned nworkers = pop->tx_params->post_commit_nworkers;
+	tx_post_commit_workers_stop(pop);
+
+	util_rwlock_wrlock(&pop->tx_params->post_commit_lock);
+
 	if (pop->tx_postcommit_tasks != NULL) {
 		ringbuf_delete(pop->tx_postcommit_tasks);
 	}
 
 	pop->tx_postcommit_tasks = ntasks;
 
-	return 0;
+	util_rwlock_unlock(&pop->tx_params->post_commit_lock);
+
+	return tx_post_commit_workers_start(pop, nworkers);
 }
 
 static struct ctl_argument CTL_ARG(queue_depth) = CTL_ARG_INT;
@@ -2636,15 +3571,189 @@ static int
 CTL_READ_HANDLER(stop)(PMEMobjpool *pop, enum ctl_query_source source,
 	void *arg, struct ctl_indexes *indexes)
 {
-	ringbuf_stop(pop->tx_postcommit_tasks);
+	if (pop->tx_params->post_commit_nworkers != 0) {
+		tx_post_commit_workers_stop(pop);
+	} else {
+		util_rwlock_wrlock(&pop->tx_params->post_commit_lock);
+		ringbuf_stop(pop->tx_postcommit_tasks);
+		util_rwlock_unlock(&pop->tx_params->post_commit_lock);
+	}
+
+	return 0;
+}
+
+/*
+ * CTL_READ_HANDLER(workers) -- returns the number of post commit worker
+ *	threads owned by the library
+ */
+static int
+CTL_READ_HANDLER(workers)(PMEMobjpool *pop, enum ctl_query_source source,
+	void *arg, struct ctl_indexes *indexes)
+{
+	int *arg_out = arg;
+
+	*arg_out = (int)pop->tx_params->post_commit_nworkers;
+
+	return 0;
+}
+
+/*
+ * CTL_WRITE_HANDLER(workers) -- sets the number of post commit worker threads
+ *	owned by the library
+ */
+static int
+CTL_WRITE_HANDLER(workers)(PMEMobjpool *pop, enum ctl_query_source source,
+	void *arg, struct ctl_indexes *indexes)
+{
+	int arg_in = *(int *)arg;
+	if (arg_in < 0 || arg_in > TX_MAX_POST_COMMIT_WORKERS) {
+		ERR("invalid number of post commit workers, "
+			"must be between 0 and %d", TX_MAX_POST_COMMIT_WORKERS);
+		errno = EINVAL;
+		return -1;
+	}
+
+	return tx_post_commit_workers_start(pop, (unsigned)arg_in);
+}
+
+static struct ctl_argument CTL_ARG(workers) = CTL_ARG_INT;
+
+/*
+ * CTL_READ_HANDLER(affinity) -- returns the CPU of the first post commit
+ *	worker thread
+ */
+static int
+CTL_READ_HANDLER(affinity)(PMEMobjpool *pop, enum ctl_query_source source,
+	void *arg, struct ctl_indexes *indexes)
+{
+	int *arg_out = arg;
+
+	*arg_out = pop->tx_params->post_commit_affinity;
 
 	return 0;
 }
 
+/*
+ * CTL_WRITE_HANDLER(affinity) -- pins the post commit worker threads to
+ *	consecutive CPUs, starting with the given one, -1 disables pinning
+ */
+static int
+CTL_WRITE_HANDLER(affinity)(PMEMobjpool *pop, enum ctl_query_source source,
+	void *arg, struct ctl_indexes *indexes)
+{
+	int arg_in = *(int *)arg;
+	if (arg_in < -1) {
+		ERR("invalid post commit worker affinity");
+		errno = EINVAL;
+		return -1;
+	}
+
+	pop->tx_params->post_commit_affinity = arg_in;
+
+	/* restart the running workers, if any, to apply the new affinity */
+	return tx_post_commit_workers_start(pop,
+		pop->tx_params->post_commit_nworkers);
+}
+
+static struct ctl_argument CTL_ARG(affinity) = CTL_ARG_INT;
+
 static const struct ctl_node CTL_NODE(post_commit)[] = {
 	CTL_LEAF_RW(queue_depth),
 	CTL_LEAF_RO(worker),
 	CTL_LEAF_RO(stop),
+	CTL_LEAF_RW(workers),
+	CTL_LEAF_RW(affinity),
+
+	CTL_NODE_END
+};
+
+/*
+ * CTL_READ_HANDLER(batch) -- returns the max number of transactions
+ *	committed together
+ */
+static int
+CTL_READ_HANDLER(batch)(PMEMobjpool *pop, enum ctl_query_source source,
+	void *arg, struct ctl_indexes *indexes)
+{
+	int *arg_out = arg;
+
+	*arg_out = (int)pop->tx_params->group_commit.batch;
+
+	return 0;
+}
+
+/*
+ * CTL_WRITE_HANDLER(batch) -- sets the max number of transactions committed
+ *	together, 0 or 1 disables group commit
+ */
+static int
+CTL_WRITE_HANDLER(batch)(PMEMobjpool *pop, enum ctl_query_source source,
+	void *arg, struct ctl_indexes *indexes)
+{
+	int arg_in = *(int *)arg;
+	if (arg_in < 0 || arg_in > TX_MAX_GROUP_COMMIT_BATCH) {
+		ERR("invalid group commit batch size, "
+			"must be between 0 and %d", TX_MAX_GROUP_COMMIT_BATCH);
+		errno = EINVAL;
+		return -1;
+	}
+
+	struct tx_group_commit *g = &pop->tx_params->group_commit;
+
+	util_mutex_lock(&g->lock);
+	g->batch = (unsigned)arg_in;
+	util_mutex_unlock(&g->lock);
+
+	return 0;
+}
+
+static struct ctl_argument CTL_ARG(batch) = CTL_ARG_INT;
+
+/*
+ * CTL_READ_HANDLER(window) -- returns how long the leader of a group waits
+ *	for other transactions, in microseconds
+ */
+static int
+CTL_READ_HANDLER(window)(PMEMobjpool *pop, enum ctl_query_source source,
+	void *arg, struct ctl_indexes *indexes)
+{
+	int *arg_out = arg;
+
+	*arg_out = (int)pop->tx_params->group_commit.window;
+
+	return 0;
+}
+
+/*
+ * CTL_WRITE_HANDLER(window) -- sets how long the leader of a group waits
+ *	for other transactions, in microseconds
+ */
+static int
+CTL_WRITE_HANDLER(window)(PMEMobjpool *pop, enum ctl_query_source source,
+	void *arg, struct ctl_indexes *indexes)
+{
+	int arg_in = *(int *)arg;
+	if (arg_in < 0 || arg_in > TX_MAX_GROUP_COMMIT_WINDOW) {
+		ERR("invalid group commit window, "
+			"must be between 0 and %d", TX_MAX_GROUP_COMMIT_WINDOW);
+		errno = EINVAL;
+		return -1;
+	}
+
+	struct tx_group_commit *g = &pop->tx_params->group_commit;
+
+	util_mutex_lock(&g->lock);
+	g->window = (unsigned)arg_in;
+	util_mutex_unlock(&g->lock);
+
+	return 0;
+}
+
+static struct ctl_argument CTL_ARG(window) = CTL_ARG_INT;
+
+static const struct ctl_node CTL_NODE(group_commit)[] = {
+	CTL_LEAF_RW(batch),
+	CTL_LEAF_RW(window),
 
 	CTL_NODE_END
 };
@@ -2653,6 +3762,8 @@ static const struct ctl_node CTL_NODE(tx)[] = {
 	CTL_CHILD(debug),
 	CTL_CHILD(cache),
 	CTL_CHILD(post_commit),
+	CTL_CHILD(group_commit),
+	CTL_LEAF_RW(mode),
 
 	CTL_NODE_END
 };
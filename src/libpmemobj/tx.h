@@ -43,6 +43,17 @@
 #define TX_DEFAULT_RANGE_CACHE_SIZE (1 << 15)
 #define TX_DEFAULT_RANGE_CACHE_THRESHOLD (1 << 12)
 
+#define TX_DEFAULT_WRITE_SET_SIZE (1 << 12)
+
+#define TX_RANGE_HASH_LINE_SHIFT 6 /* cache line granularity */
+#define TX_RANGE_HASH_INIT_SIZE 64
+#define TX_RANGE_HASH_MAX_LINES 64 /* larger ranges are not indexed */
+
+#define TX_DEFAULT_POST_COMMIT_QUEUE_DEPTH 512
+#define TX_MAX_POST_COMMIT_WORKERS 64
+#define TX_MAX_GROUP_COMMIT_BATCH 64
+#define TX_MAX_GROUP_COMMIT_WINDOW 1000000 /* 1 second */
+
 #define TX_RANGE_MASK (8ULL - 1)
 #define TX_RANGE_MASK_LEGACY (32ULL - 1)
 
@@ -85,6 +96,8 @@ PMEMobjpool *tx_get_pop(void);
 
 void tx_ctl_register(PMEMobjpool *pop);
 
+void tx_post_commit_workers_stop(PMEMobjpool *pop);
+
 struct tx_parameters *tx_params_new(void);
 void tx_params_delete(struct tx_parameters *tx_params);
 
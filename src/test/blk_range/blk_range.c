@@ -0,0 +1,283 @@
+/*
+ * Copyright 2018, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * blk_range.c -- unit test for pmemblk_write_range, pmemblk_set_zero_range
+ *	and pmemblk_set_error_range
+ *
+ * usage: blk_range bsize file
+ */
+
+#include "unittest.h"
+
+#define NBLOCKS 100
+
+/* the blocks zeroed by test_set_zero_range */
+#define ZERO_START 20
+#define ZERO_END 50
+
+static size_t Bsize;
+
+/*
+ * pattern -- return the byte which fills the block in the given generation
+ */
+static unsigned char
+pattern(long long blockno, int gen)
+{
+	return (unsigned char)((blockno * 7 + gen) % 255 + 1);
+}
+
+/*
+ * fill -- fill a buffer of consecutive blocks with their patterns
+ */
+static void
+fill(unsigned char *buf, long long blockno, size_t count, int gen)
+{
+	for (size_t i = 0; i < count; ++i)
+		memset(buf + i * Bsize, pattern(blockno + (long long)i, gen),
+			Bsize);
+}
+
+/*
+ * check_block -- verify the content of a single block
+ */
+static void
+check_block(PMEMblkpool *pbp, long long blockno, unsigned char val)
+{
+	unsigned char *buf = MALLOC(Bsize);
+
+	UT_ASSERTeq(pmemblk_read(pbp, buf, blockno), 0);
+	for (size_t i = 0; i < Bsize; ++i)
+		if (buf[i] != val)
+			UT_FATAL("block %lld byte %zu: %u != %u", blockno, i,
+				buf[i], val);
+
+	FREE(buf);
+}
+
+/*
+ * test_write_range -- load blocks into a new pool
+ */
+static void
+test_write_range(PMEMblkpool *pbp)
+{
+	unsigned char *buf = MALLOC(Bsize * NBLOCKS);
+
+	/* an already written block in the range takes the regular path */
+	fill(buf, 5, 1, 0);
+	UT_ASSERTeq(pmemblk_write(pbp, buf, 5), 0);
+
+	fill(buf, 0, NBLOCKS, 1);
+	UT_ASSERTeq(pmemblk_write_range(pbp, buf, 0, NBLOCKS), 0);
+
+	for (long long b = 0; b < NBLOCKS; ++b)
+		check_block(pbp, b, pattern(b, 1));
+	check_block(pbp, NBLOCKS, 0);
+
+	/* overwrite an unaligned part of the loaded blocks */
+	fill(buf, 7, 30, 2);
+	UT_ASSERTeq(pmemblk_write_range(pbp, buf, 7, 30), 0);
+
+	for (long long b = 0; b < NBLOCKS; ++b)
+		check_block(pbp, b, pattern(b, b >= 7 && b < 37 ? 2 : 1));
+
+	/* the end of the pool */
+	long long nblock = (long long)pmemblk_nblock(pbp);
+	fill(buf, nblock - 20, 20, 3);
+	UT_ASSERTeq(pmemblk_write_range(pbp, buf, nblock - 20, 20), 0);
+	for (long long b = nblock - 20; b < nblock; ++b)
+		check_block(pbp, b, pattern(b, 3));
+
+	UT_ASSERTeq(pmemblk_write_range(pbp, buf, 0, 0), 0);
+
+	errno = 0;
+	UT_ASSERTeq(pmemblk_write_range(pbp, buf, nblock - 5, 10), -1);
+	UT_ASSERTeq(errno, EINVAL);
+
+	errno = 0;
+	UT_ASSERTeq(pmemblk_write_range(pbp, buf, -1, 1), -1);
+	UT_ASSERTeq(errno, EINVAL);
+
+	/* the rejected ranges were not written */
+	check_block(pbp, nblock - 5, pattern(nblock - 5, 3));
+
+	FREE(buf);
+}
+
+/*
+ * expected -- return the byte expected in a loaded block at the end
+ */
+static unsigned char
+expected(long long blockno)
+{
+	if (blockno >= ZERO_START && blockno < ZERO_END)
+		return 0;
+
+	return pattern(blockno, blockno >= 7 && blockno < 37 ? 2 : 1);
+}
+
+/*
+ * test_set_zero_range -- zero a part of the loaded blocks
+ */
+static void
+test_set_zero_range(PMEMblkpool *pbp)
+{
+	UT_ASSERTeq(pmemblk_set_zero_range(pbp, ZERO_START,
+			ZERO_END - ZERO_START), 0);
+
+	for (long long b = 0; b < NBLOCKS; ++b)
+		check_block(pbp, b, expected(b));
+
+	/* zeroing blocks which already read as zero is a no-op */
+	UT_ASSERTeq(pmemblk_set_zero_range(pbp, NBLOCKS, NBLOCKS), 0);
+	check_block(pbp, NBLOCKS - 1, expected(NBLOCKS - 1));
+	check_block(pbp, NBLOCKS, 0);
+
+	UT_ASSERTeq(pmemblk_set_zero_range(pbp, 0, 0), 0);
+
+	long long nblock = (long long)pmemblk_nblock(pbp);
+
+	errno = 0;
+	UT_ASSERTeq(pmemblk_set_zero_range(pbp, nblock - 5, 10), -1);
+	UT_ASSERTeq(errno, EINVAL);
+
+	errno = 0;
+	UT_ASSERTeq(pmemblk_set_zero_range(pbp, -1, 1), -1);
+	UT_ASSERTeq(errno, EINVAL);
+
+	/* the rejected range was not zeroed */
+	check_block(pbp, nblock - 5, pattern(nblock - 5, 3));
+}
+
+/*
+ * test_set_error_range -- put a range of blocks in the error state and
+ *	return them to normal use
+ */
+static void
+test_set_error_range(PMEMblkpool *pbp)
+{
+	const long long start = NBLOCKS + 10;
+	const size_t count = 20;
+	unsigned char *buf = MALLOC(Bsize);
+
+	UT_ASSERTeq(pmemblk_set_error_range(pbp, start, count), 0);
+
+	for (long long b = start; b < start + (long long)count; ++b) {
+		errno = 0;
+		UT_ASSERTeq(pmemblk_read(pbp, buf, b), -1);
+		UT_ASSERTeq(errno, EIO);
+	}
+	check_block(pbp, start - 1, 0);
+	check_block(pbp, start + (long long)count, 0);
+
+	/* writing a block clears its error state */
+	fill(buf, start, 1, 4);
+	UT_ASSERTeq(pmemblk_write(pbp, buf, start), 0);
+	check_block(pbp, start, pattern(start, 4));
+
+	/* so does zeroing it */
+	UT_ASSERTeq(pmemblk_set_zero_range(pbp, start, count), 0);
+	for (long long b = start; b < start + (long long)count; ++b)
+		check_block(pbp, b, 0);
+
+	UT_ASSERTeq(pmemblk_set_error_range(pbp, 0, 0), 0);
+
+	long long nblock = (long long)pmemblk_nblock(pbp);
+
+	errno = 0;
+	UT_ASSERTeq(pmemblk_set_error_range(pbp, nblock - 5, 10), -1);
+	UT_ASSERTeq(errno, EINVAL);
+
+	errno = 0;
+	UT_ASSERTeq(pmemblk_set_error_range(pbp, -1, 1), -1);
+	UT_ASSERTeq(errno, EINVAL);
+
+	/* the rejected range was not put in the error state */
+	check_block(pbp, nblock - 5, pattern(nblock - 5, 3));
+
+	FREE(buf);
+}
+
+/*
+ * check_content -- verify the blocks modified by the tests
+ */
+static void
+check_content(PMEMblkpool *pbp)
+{
+	long long nblock = (long long)pmemblk_nblock(pbp);
+
+	for (long long b = 0; b < NBLOCKS; ++b)
+		check_block(pbp, b, expected(b));
+
+	for (long long b = nblock - 20; b < nblock; ++b)
+		check_block(pbp, b, pattern(b, 3));
+}
+
+int
+main(int argc, char *argv[])
+{
+	START(argc, argv, "blk_range");
+
+	if (argc != 3)
+		UT_FATAL("usage: %s bsize file", argv[0]);
+
+	Bsize = strtoul(argv[1], NULL, 0);
+	const char *path = argv[2];
+
+	PMEMblkpool *pbp = pmemblk_create(path, Bsize, 0, S_IWUSR | S_IRUSR);
+	if (pbp == NULL)
+		UT_FATAL("!%s: pmemblk_create", path);
+
+	UT_ASSERT(pmemblk_nblock(pbp) > 2 * NBLOCKS);
+
+	test_write_range(pbp);
+	test_set_zero_range(pbp);
+	test_set_error_range(pbp);
+
+	pmemblk_close(pbp);
+
+	int result = pmemblk_check(path, Bsize);
+	if (result < 0)
+		UT_OUT("!%s: pmemblk_check", path);
+	else if (result == 0)
+		UT_OUT("%s: pmemblk_check: not consistent", path);
+
+	pbp = pmemblk_open(path, Bsize);
+	if (pbp == NULL)
+		UT_FATAL("!%s: pmemblk_open", path);
+
+	check_content(pbp);
+
+	pmemblk_close(pbp);
+
+	DONE(NULL);
+}
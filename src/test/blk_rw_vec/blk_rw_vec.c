@@ -0,0 +1,252 @@
+/*
+ * Copyright 2018, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * blk_rw_vec.c -- unit test for pmemblk_readv and pmemblk_writev
+ *
+ * usage: blk_rw_vec bsize file
+ */
+
+#include "unittest.h"
+
+#define NBLOCKS 64
+
+static size_t Bsize;
+
+/*
+ * fill -- fill the buffers of the vector with a pattern unique to the block
+ */
+static void
+fill(struct pmemblk_iov *iov, int iovcnt, int seed)
+{
+	for (int i = 0; i < iovcnt; ++i)
+		memset(iov[i].buf, (int)(iov[i].blockno + seed) % 255 + 1,
+			Bsize);
+}
+
+/*
+ * check_block -- verify the content of a single block
+ */
+static void
+check_block(const unsigned char *buf, long long blockno, int seed)
+{
+	unsigned char val = (unsigned char)((blockno + seed) % 255 + 1);
+
+	for (size_t i = 0; i < Bsize; ++i)
+		if (buf[i] != val)
+			UT_FATAL("block %lld byte %zu: %u != %u", blockno, i,
+				buf[i], val);
+}
+
+/*
+ * iov_alloc -- allocate a vector of blocks with buffers
+ */
+static struct pmemblk_iov *
+iov_alloc(int iovcnt)
+{
+	struct pmemblk_iov *iov = MALLOC(sizeof(*iov) * (size_t)iovcnt);
+
+	for (int i = 0; i < iovcnt; ++i) {
+		iov[i].buf = MALLOC(Bsize);
+		iov[i].blockno = i;
+	}
+
+	return iov;
+}
+
+/*
+ * iov_free -- free a vector of blocks
+ */
+static void
+iov_free(struct pmemblk_iov *iov, int iovcnt)
+{
+	for (int i = 0; i < iovcnt; ++i)
+		FREE(iov[i].buf);
+
+	FREE(iov);
+}
+
+/*
+ * test_rw -- write a batch of blocks and read them back
+ */
+static void
+test_rw(PMEMblkpool *pbp)
+{
+	struct pmemblk_iov *iov = iov_alloc(NBLOCKS);
+
+	/* every other block, in descending order */
+	for (int i = 0; i < NBLOCKS; ++i)
+		iov[i].blockno = 2 * (NBLOCKS - 1 - i);
+
+	fill(iov, NBLOCKS, 0);
+	UT_ASSERTeq(pmemblk_writev(pbp, iov, NBLOCKS), 0);
+
+	for (int i = 0; i < NBLOCKS; ++i)
+		memset(iov[i].buf, 0, Bsize);
+
+	UT_ASSERTeq(pmemblk_readv(pbp, iov, NBLOCKS), 0);
+	for (int i = 0; i < NBLOCKS; ++i)
+		check_block(iov[i].buf, iov[i].blockno, 0);
+
+	/* the blocks in between were never written */
+	for (int i = 0; i < NBLOCKS; ++i)
+		iov[i].blockno = 2 * i + 1;
+
+	UT_ASSERTeq(pmemblk_readv(pbp, iov, NBLOCKS), 0);
+	for (int i = 0; i < NBLOCKS; ++i)
+		for (size_t j = 0; j < Bsize; ++j)
+			UT_ASSERTeq(((unsigned char *)iov[i].buf)[j], 0);
+
+	/* the same block written twice in a batch, the last write wins */
+	iov[0].blockno = 0;
+	iov[1].blockno = 0;
+	memset(iov[0].buf, 0x11, Bsize);
+	memset(iov[1].buf, 0x22, Bsize);
+	UT_ASSERTeq(pmemblk_writev(pbp, iov, 2), 0);
+
+	unsigned char *buf = MALLOC(Bsize);
+	UT_ASSERTeq(pmemblk_read(pbp, buf, 0), 0);
+	UT_ASSERTeq(buf[0], 0x22);
+	UT_ASSERTeq(buf[Bsize - 1], 0x22);
+
+	/* restore the pattern of block 0 */
+	fill(iov, 1, 0);
+	UT_ASSERTeq(pmemblk_writev(pbp, iov, 1), 0);
+	FREE(buf);
+
+	/* empty batches are no-ops */
+	UT_ASSERTeq(pmemblk_writev(pbp, iov, 0), 0);
+	UT_ASSERTeq(pmemblk_readv(pbp, iov, 0), 0);
+
+	iov_free(iov, NBLOCKS);
+}
+
+/*
+ * test_invalid -- batches with invalid arguments are rejected as a whole
+ */
+static void
+test_invalid(PMEMblkpool *pbp)
+{
+	struct pmemblk_iov *iov = iov_alloc(4);
+	long long nblock = (long long)pmemblk_nblock(pbp);
+
+	for (int i = 0; i < 4; ++i)
+		iov[i].blockno = 2 * i;
+
+	fill(iov, 4, 1);
+	iov[3].blockno = nblock;
+
+	errno = 0;
+	UT_ASSERTeq(pmemblk_writev(pbp, iov, 4), -1);
+	UT_ASSERTeq(errno, EINVAL);
+
+	errno = 0;
+	UT_ASSERTeq(pmemblk_readv(pbp, iov, 4), -1);
+	UT_ASSERTeq(errno, EINVAL);
+
+	iov[3].blockno = -1;
+
+	errno = 0;
+	UT_ASSERTeq(pmemblk_writev(pbp, iov, 4), -1);
+	UT_ASSERTeq(errno, EINVAL);
+
+	errno = 0;
+	UT_ASSERTeq(pmemblk_writev(pbp, iov, -1), -1);
+	UT_ASSERTeq(errno, EINVAL);
+
+	errno = 0;
+	UT_ASSERTeq(pmemblk_readv(pbp, iov, -1), -1);
+	UT_ASSERTeq(errno, EINVAL);
+
+	/* none of the valid blocks of the rejected batches was written */
+	iov[3].blockno = 6;
+	UT_ASSERTeq(pmemblk_readv(pbp, iov, 4), 0);
+	for (int i = 0; i < 4; ++i)
+		check_block(iov[i].buf, iov[i].blockno, 0);
+
+	iov_free(iov, 4);
+}
+
+/*
+ * check_content -- verify the blocks written by test_rw after reopening
+ */
+static void
+check_content(PMEMblkpool *pbp)
+{
+	unsigned char *buf = MALLOC(Bsize);
+
+	for (long long b = 0; b < 2 * NBLOCKS; b += 2) {
+		UT_ASSERTeq(pmemblk_read(pbp, buf, b), 0);
+		check_block(buf, b, 0);
+	}
+
+	FREE(buf);
+}
+
+int
+main(int argc, char *argv[])
+{
+	START(argc, argv, "blk_rw_vec");
+
+	if (argc != 3)
+		UT_FATAL("usage: %s bsize file", argv[0]);
+
+	Bsize = strtoul(argv[1], NULL, 0);
+	const char *path = argv[2];
+
+	PMEMblkpool *pbp = pmemblk_create(path, Bsize, 0, S_IWUSR | S_IRUSR);
+	if (pbp == NULL)
+		UT_FATAL("!%s: pmemblk_create", path);
+
+	UT_ASSERT(pmemblk_nblock(pbp) > 2 * NBLOCKS);
+
+	test_rw(pbp);
+	test_invalid(pbp);
+
+	pmemblk_close(pbp);
+
+	int result = pmemblk_check(path, Bsize);
+	if (result < 0)
+		UT_OUT("!%s: pmemblk_check", path);
+	else if (result == 0)
+		UT_OUT("%s: pmemblk_check: not consistent", path);
+
+	pbp = pmemblk_open(path, Bsize);
+	if (pbp == NULL)
+		UT_FATAL("!%s: pmemblk_open", path);
+
+	check_content(pbp);
+
+	pmemblk_close(pbp);
+
+	DONE(NULL);
+}
@@ -36,6 +36,7 @@
 
 #include <stdlib.h>
 #include "unittest.h"
+#include "pool_hdr.h"
 
 #define LAYOUT_NAME "obj_action"
 
@@ -96,6 +97,76 @@ test_resv_cancel_huge(PMEMobjpool *pop)
 	FREE(act);
 }
 
+#define LARGE_PUBLISH_NACTS (POBJ_MAX_ACTIONS * 8)
+#define LARGE_PUBLISH_TYPE 1
+
+/*
+ * test_publish_large -- publishes collections of actions that do not fit in
+ *	the lane redo log
+ */
+static void
+test_publish_large(PMEMobjpool *pop)
+{
+	struct pobj_action *act = (struct pobj_action *)
+		ZALLOC(sizeof(struct pobj_action) * LARGE_PUBLISH_NACTS);
+
+	for (int n = 0; n < 2; ++n) {
+		for (int i = 0; i < LARGE_PUBLISH_NACTS; ++i) {
+			PMEMoid oid = pmemobj_reserve(pop, &act[i],
+				sizeof(struct foo), LARGE_PUBLISH_TYPE);
+			UT_ASSERT(!OID_IS_NULL(oid));
+
+			struct foo *foop = (struct foo *)pmemobj_direct(oid);
+			foop->bar = i + 1;
+			pmemobj_persist(pop, foop, sizeof(*foop));
+		}
+
+		errno = 0;
+		UT_ASSERTeq(pmemobj_xpublish(pop, act,
+			LARGE_PUBLISH_NACTS, ~0ULL), -1);
+		UT_ASSERTeq(errno, EINVAL);
+
+		if (n == 0) {
+			UT_ASSERTeq(pmemobj_xpublish(pop, act,
+				LARGE_PUBLISH_NACTS, 0), 0);
+		} else {
+			pmemobj_publish(pop, act, LARGE_PUBLISH_NACTS);
+		}
+	}
+
+	/* the redo log extension must not be visible to the application */
+	int nobjs = 0;
+	int sum = 0;
+	PMEMoid oid;
+	POBJ_FOREACH(pop, oid) {
+		if (pmemobj_type_num(oid) != LARGE_PUBLISH_TYPE)
+			continue;
+
+		sum += ((struct foo *)pmemobj_direct(oid))->bar;
+		nobjs++;
+	}
+
+	UT_ASSERTeq(nobjs, LARGE_PUBLISH_NACTS * 2);
+	UT_ASSERTeq(sum, LARGE_PUBLISH_NACTS * (LARGE_PUBLISH_NACTS + 1));
+
+	FREE(act);
+}
+
+/*
+ * incompat_features -- reads the incompat feature flags of the pool header
+ */
+static uint32_t
+incompat_features(const char *path)
+{
+	struct pool_hdr hdr;
+
+	int fd = OPEN(path, O_RDONLY);
+	READ(fd, &hdr, sizeof(hdr));
+	CLOSE(fd);
+
+	return le32toh(hdr.incompat_features);
+}
+
 int
 main(int argc, char *argv[])
 {
@@ -197,6 +268,18 @@ main(int argc, char *argv[])
 
 	test_resv_cancel_huge(pop);
 
+	UT_ASSERTeq(incompat_features(path) & POOL_FEAT_REDO_EXT, 0);
+
+	test_publish_large(pop);
+
+	/* older libraries must not open pools with extended redo logs */
+	UT_ASSERTne(incompat_features(path) & POOL_FEAT_REDO_EXT, 0);
+
+	pmemobj_close(pop);
+
+	UT_ASSERTeq(pmemobj_check(path, LAYOUT_NAME), 1);
+
+	UT_ASSERTne(pop = pmemobj_open(path, LAYOUT_NAME), NULL);
 	pmemobj_close(pop);
 
 	DONE(NULL);
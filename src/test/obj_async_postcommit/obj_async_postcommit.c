@@ -36,6 +36,8 @@
  * This test runs N threads that populate lane transaction section, M threads
  * that perform asynchronous cleanup of that section, and sets a queue depth
  * to check if the transactions with these settings can be properly performed.
+ * It also runs the transactions with the post commit workers owned by the
+ * library and checks the post commit statistics.
  */
 
 #include "unittest.h"
@@ -44,6 +46,7 @@
 
 #define OIDS_PER_WORKER 10000
 #define OIDS_PER_TX 10
+#define TX_INVALID_WORKERS 65
 
 struct worker_args {
 	PMEMobjpool *pop;
@@ -122,6 +125,135 @@ run_test(PMEMobjpool *pop, int nworkers_pc, int nworkers, int qdepth)
 	FREE(th_pc);
 }
 
+/*
+ * run_test_managed -- runs the transactions with the post commit workers
+ *	owned by the library
+ */
+static void
+run_test_managed(PMEMobjpool *pop, int nworkers_pc, int nworkers,
+	int affinity)
+{
+	int ret = pmemobj_ctl_set(pop, "tx.post_commit.affinity", &affinity);
+	UT_ASSERTeq(ret, 0);
+	ret = pmemobj_ctl_set(pop, "tx.post_commit.workers", &nworkers_pc);
+	UT_ASSERTeq(ret, 0);
+
+	int val;
+	ret = pmemobj_ctl_get(pop, "tx.post_commit.workers", &val);
+	UT_ASSERTeq(ret, 0);
+	UT_ASSERTeq(val, nworkers_pc);
+	ret = pmemobj_ctl_get(pop, "tx.post_commit.affinity", &val);
+	UT_ASSERTeq(ret, 0);
+	UT_ASSERTeq(val, affinity);
+
+	uint64_t queued0;
+	uint64_t full0;
+	ret = pmemobj_ctl_get(pop, "stats.tx.post_commit.queued", &queued0);
+	UT_ASSERTeq(ret, 0);
+	ret = pmemobj_ctl_get(pop, "stats.tx.post_commit.queue_full", &full0);
+	UT_ASSERTeq(ret, 0);
+
+	os_thread_t *th = MALLOC(sizeof(*th) * nworkers);
+	struct worker_args *args = MALLOC(sizeof(*args) * nworkers);
+	for (int i = 0; i < nworkers; ++i) {
+		args[i].pop = pop;
+		args[i].oids = MALLOC(sizeof(PMEMoid) * OIDS_PER_WORKER);
+		for (int j = 0; j < OIDS_PER_WORKER; ++j) {
+			int ret = pmemobj_alloc(pop,
+				&args[i].oids[j], 1, 1, NULL, NULL);
+			UT_ASSERTeq(ret, 0);
+		}
+	}
+
+	for (int i = 0; i < nworkers; ++i) {
+		PTHREAD_CREATE(&th[i], NULL, worker, &args[i]);
+	}
+
+	for (int i = 0; i < nworkers; ++i) {
+		PTHREAD_JOIN(&th[i], NULL);
+		FREE(args[i].oids);
+	}
+
+	/* disabling the workers processes all the remaining tasks */
+	int zero = 0;
+	ret = pmemobj_ctl_set(pop, "tx.post_commit.workers", &zero);
+	UT_ASSERTeq(ret, 0);
+
+	uint64_t queued;
+	uint64_t full;
+	uint64_t completed;
+	uint64_t pending;
+	ret = pmemobj_ctl_get(pop, "stats.tx.post_commit.queued", &queued);
+	UT_ASSERTeq(ret, 0);
+	ret = pmemobj_ctl_get(pop, "stats.tx.post_commit.queue_full", &full);
+	UT_ASSERTeq(ret, 0);
+	ret = pmemobj_ctl_get(pop, "stats.tx.post_commit.completed",
+		&completed);
+	UT_ASSERTeq(ret, 0);
+	ret = pmemobj_ctl_get(pop, "stats.tx.post_commit.pending", &pending);
+	UT_ASSERTeq(ret, 0);
+
+	UT_ASSERTeq((queued - queued0) + (full - full0),
+		(uint64_t)nworkers * OIDS_PER_WORKER / OIDS_PER_TX);
+	UT_ASSERTeq(pending, 0);
+	UT_ASSERTeq(completed, queued);
+
+	FREE(args);
+	FREE(th);
+}
+
+/*
+ * run_test_restart -- restarts the post commit workers owned by the library,
+ *	with varying numbers and affinities, while transactions are committed
+ */
+static void
+run_test_restart(PMEMobjpool *pop, int nworkers)
+{
+	os_thread_t *th = MALLOC(sizeof(*th) * nworkers);
+	struct worker_args *args = MALLOC(sizeof(*args) * nworkers);
+	for (int i = 0; i < nworkers; ++i) {
+		args[i].pop = pop;
+		args[i].oids = MALLOC(sizeof(PMEMoid) * OIDS_PER_WORKER);
+		for (int j = 0; j < OIDS_PER_WORKER; ++j) {
+			int ret = pmemobj_alloc(pop,
+				&args[i].oids[j], 1, 1, NULL, NULL);
+			UT_ASSERTeq(ret, 0);
+		}
+	}
+
+	for (int i = 0; i < nworkers; ++i) {
+		PTHREAD_CREATE(&th[i], NULL, worker, &args[i]);
+	}
+
+	int nworkers_pc[] = {1, 4, 0, 2};
+	for (int i = 0; i < 16; ++i) {
+		int affinity = i % 2 - 1;
+		int ret = pmemobj_ctl_set(pop, "tx.post_commit.affinity",
+			&affinity);
+		UT_ASSERTeq(ret, 0);
+		ret = pmemobj_ctl_set(pop, "tx.post_commit.workers",
+			&nworkers_pc[i % 4]);
+		UT_ASSERTeq(ret, 0);
+	}
+
+	for (int i = 0; i < nworkers; ++i) {
+		PTHREAD_JOIN(&th[i], NULL);
+		FREE(args[i].oids);
+	}
+
+	int zero = 0;
+	int ret = pmemobj_ctl_set(pop, "tx.post_commit.workers", &zero);
+	UT_ASSERTeq(ret, 0);
+
+	uint64_t pending;
+	ret = pmemobj_ctl_get(pop, "stats.tx.post_commit.pending", &pending);
+	UT_ASSERTeq(ret, 0);
+	UT_ASSERTeq(pending, 0);
+
+	FREE(args);
+	FREE(th);
+}
+
 int
 main(int argc, char *argv[])
 {
@@ -143,6 +275,35 @@ main(int argc, char *argv[])
 	run_test(pop, 1, 4, 1024);
 	run_test(pop, 0, 2, 0);
 
+	int enabled = 1;
+	int ret = pmemobj_ctl_set(pop, "stats.enabled", &enabled);
+	UT_ASSERTeq(ret, 0);
+
+	int invalid = TX_INVALID_WORKERS;
+	errno = 0;
+	ret = pmemobj_ctl_set(pop, "tx.post_commit.workers", &invalid);
+	UT_ASSERTeq(ret, -1);
+	UT_ASSERTeq(errno, EINVAL);
+	invalid = -2;
+	errno = 0;
+	ret = pmemobj_ctl_set(pop, "tx.post_commit.affinity", &invalid);
+	UT_ASSERTeq(ret, -1);
+	UT_ASSERTeq(errno, EINVAL);
+
+	run_test_managed(pop, 1, 2, -1);
+	run_test_managed(pop, 4, 4, 0);
+	run_test_restart(pop, 4);
+
+	/* the workers owned by the library are stopped by pmemobj_close */
+	int nworkers_pc = 2;
+	ret = pmemobj_ctl_set(pop, "tx.post_commit.workers", &nworkers_pc);
+	UT_ASSERTeq(ret, 0);
+
+	run_test(pop, 0, 2, 256);
+
+	ret = pmemobj_ctl_set(pop, "tx.post_commit.workers", &nworkers_pc);
+	UT_ASSERTeq(ret, 0);
+
 	pmemobj_close(pop);
 
 	DONE(NULL);
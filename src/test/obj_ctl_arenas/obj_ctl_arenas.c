@@ -0,0 +1,280 @@
+/*
+ * Copyright 2018, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * obj_ctl_arenas.c -- tests for the ctl entry points: heap.narenas,
+ *	heap.thread.arena_id and heap.arena.[arena_id].*
+ */
+
+#include "unittest.h"
+
+#define LAYOUT "obj_ctl_arenas"
+#define NTHREADS 4
+#define NOBJS 128
+#define OBJ_SIZE 128
+
+static PMEMobjpool *pop;
+
+/*
+ * arena_entry -- formats the name of the ctl entry point of the given arena
+ */
+static void
+arena_entry(char *name, size_t len, unsigned arena_id, const char *leaf)
+{
+	int ret = snprintf(name, len, "heap.arena.%u.%s", arena_id, leaf);
+	if (ret < 0 || (size_t)ret >= len)
+		UT_FATAL("!snprintf");
+}
+
+/*
+ * get_int -- reads an integer ctl entry point
+ */
+static int
+get_int(const char *name)
+{
+	int val;
+	int ret = pmemobj_ctl_get(pop, name, &val);
+	UT_ASSERTeq(ret, 0);
+
+	return val;
+}
+
+/*
+ * get_arena_stat -- reads a statistic of the given arena
+ */
+static size_t
+get_arena_stat(unsigned arena_id, const char *stat)
+{
+	char name[64];
+	arena_entry(name, sizeof(name), arena_id, stat);
+
+	size_t val;
+	int ret = pmemobj_ctl_get(pop, name, &val);
+	UT_ASSERTeq(ret, 0);
+
+	return val;
+}
+
+/*
+ * test_narenas -- verifies that the number of arenas can only be increased
+ */
+static void
+test_narenas(void)
+{
+	int narenas = get_int("heap.narenas");
+	UT_ASSERT(narenas > 0);
+
+	int val = narenas + 2;
+	int ret = pmemobj_ctl_set(pop, "heap.narenas", &val);
+	UT_ASSERTeq(ret, 0);
+	UT_ASSERTeq(get_int("heap.narenas"), narenas + 2);
+
+	val = narenas;
+	ret = pmemobj_ctl_set(pop, "heap.narenas", &val);
+	UT_ASSERTeq(ret, -1);
+	UT_ASSERTeq(errno, EINVAL);
+
+	val = 0;
+	ret = pmemobj_ctl_set(pop, "heap.narenas", &val);
+	UT_ASSERTeq(ret, -1);
+	UT_ASSERTeq(errno, EINVAL);
+
+	UT_ASSERTeq(get_int("heap.narenas"), narenas + 2);
+}
+
+/*
+ * test_arena_range -- verifies that arena indexes are validated
+ */
+static void
+test_arena_range(void)
+{
+	unsigned narenas = (unsigned)get_int("heap.narenas");
+	char name[64];
+	size_t val;
+
+	arena_entry(name, sizeof(name), narenas, "size");
+	int ret = pmemobj_ctl_get(pop, name, &val);
+	UT_ASSERTeq(ret, -1);
+	UT_ASSERTeq(errno, ERANGE);
+
+	int id = (int)narenas;
+	ret = pmemobj_ctl_set(pop, "heap.thread.arena_id", &id);
+	UT_ASSERTeq(ret, -1);
+	UT_ASSERTeq(errno, EINVAL);
+
+	id = -1;
+	ret = pmemobj_ctl_set(pop, "heap.thread.arena_id", &id);
+	UT_ASSERTeq(ret, -1);
+	UT_ASSERTeq(errno, EINVAL);
+}
+
+/*
+ * test_bind -- binds the main thread to the last arena and verifies that
+ *	its allocations are served from there
+ */
+static void
+test_bind(void)
+{
+	unsigned narenas = (unsigned)get_int("heap.narenas");
+	unsigned last = narenas - 1;
+
+	unsigned old = (unsigned)get_int("heap.thread.arena_id");
+	UT_ASSERT(old < narenas);
+
+	size_t nthreads = get_arena_stat(last, "nthreads");
+	UT_ASSERTeq(get_arena_stat(last, "size"), 0);
+
+	int id = (int)last;
+	int ret = pmemobj_ctl_set(pop, "heap.thread.arena_id", &id);
+	UT_ASSERTeq(ret, 0);
+	UT_ASSERTeq(get_int("heap.thread.arena_id"), id);
+	UT_ASSERTeq(get_arena_stat(last, "nthreads"), nthreads + 1);
+
+	PMEMoid oids[NOBJS];
+	for (unsigned i = 0; i < NOBJS; ++i) {
+		ret = pmemobj_alloc(pop, &oids[i], OBJ_SIZE, 0, NULL, NULL);
+		UT_ASSERTeq(ret, 0);
+	}
+
+	UT_ASSERTne(get_arena_stat(last, "size"), 0);
+
+	/* rebinding with a populated thread cache flushes it first */
+	int size = 64;
+	ret = pmemobj_ctl_set(pop, "heap.thread_cache.size", &size);
+	UT_ASSERTeq(ret, 0);
+
+	for (unsigned i = 0; i < NOBJS; ++i)
+		pmemobj_free(&oids[i]);
+
+	id = (int)old;
+	ret = pmemobj_ctl_set(pop, "heap.thread.arena_id", &id);
+	UT_ASSERTeq(ret, 0);
+	UT_ASSERTeq(get_arena_stat(last, "nthreads"), nthreads);
+
+	size = 0;
+	ret = pmemobj_ctl_set(pop, "heap.thread_cache.size", &size);
+	UT_ASSERTeq(ret, 0);
+}
+
+/*
+ * worker -- records the arena to which the thread was assigned
+ */
+static void *
+worker(void *arg)
+{
+	PMEMoid oid;
+	int ret = pmemobj_alloc(pop, &oid, OBJ_SIZE, 0, NULL, NULL);
+	UT_ASSERTeq(ret, 0);
+
+	*(int *)arg = get_int("heap.thread.arena_id");
+
+	pmemobj_free(&oid);
+
+	return NULL;
+}
+
+/*
+ * test_automatic -- verifies that arenas excluded from automatic assignment
+ *	are not handed out to new threads
+ */
+static void
+test_automatic(void)
+{
+	unsigned narenas = (unsigned)get_int("heap.narenas");
+	unsigned last = narenas - 1;
+
+	char name[64];
+	arena_entry(name, sizeof(name), last, "automatic");
+
+	int automatic;
+	int ret = pmemobj_ctl_get(pop, name, &automatic);
+	UT_ASSERTeq(ret, 0);
+	UT_ASSERTeq(automatic, 1);
+
+	automatic = 0;
+	ret = pmemobj_ctl_set(pop, name, &automatic);
+	UT_ASSERTeq(ret, 0);
+	ret = pmemobj_ctl_get(pop, name, &automatic);
+	UT_ASSERTeq(ret, 0);
+	UT_ASSERTeq(automatic, 0);
+
+	os_thread_t threads[NTHREADS];
+	int ids[NTHREADS];
+
+	for (unsigned t = 0; t < NTHREADS; ++t)
+		PTHREAD_CREATE(&threads[t], NULL, worker, &ids[t]);
+
+	for (unsigned t = 0; t < NTHREADS; ++t)
+		PTHREAD_JOIN(&threads[t], NULL);
+
+	for (unsigned t = 0; t < NTHREADS; ++t) {
+		UT_ASSERT(ids[t] >= 0);
+		UT_ASSERT((unsigned)ids[t] < narenas);
+		UT_ASSERTne((unsigned)ids[t], last);
+	}
+
+	/* explicit binding is still allowed */
+	int id = (int)last;
+	ret = pmemobj_ctl_set(pop, "heap.thread.arena_id", &id);
+	UT_ASSERTeq(ret, 0);
+
+	PMEMoid oid;
+	ret = pmemobj_alloc(pop, &oid, OBJ_SIZE, 0, NULL, NULL);
+	UT_ASSERTeq(ret, 0);
+	pmemobj_free(&oid);
+}
+
+int
+main(int argc, char *argv[])
+{
+	START(argc, argv, "obj_ctl_arenas");
+
+	if (argc != 2)
+		UT_FATAL("usage: %s file-name", argv[0]);
+
+	const char *path = argv[1];
+
+	if ((pop = pmemobj_create(path, LAYOUT, PMEMOBJ_MIN_POOL * 4,
+			S_IWUSR | S_IRUSR)) == NULL)
+		UT_FATAL("!pmemobj_create: %s", path);
+
+	test_narenas();
+	test_arena_range();
+	test_bind();
+	test_automatic();
+
+	pmemobj_close(pop);
+
+	UT_ASSERTeq(pmemobj_check(path, LAYOUT), 1);
+
+	DONE(NULL);
+}
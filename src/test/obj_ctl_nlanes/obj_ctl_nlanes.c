@@ -0,0 +1,210 @@
+/*
+ * Copyright 2018, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * obj_ctl_nlanes.c -- tests for the ctl entry points: create.nlanes and
+ *	open.nlanes
+ */
+
+#include "unittest.h"
+#include "pool_hdr.h"
+
+#define LAYOUT "obj_ctl_nlanes"
+#define NTHREADS 32
+#define NOPS 64
+#define ALLOC_SIZE (1 << 20)
+
+/*
+ * set_nlanes -- sets the given lanes entry point and verifies the result
+ */
+static void
+set_nlanes(const char *name, int nlanes)
+{
+	int ret = pmemobj_ctl_set(NULL, name, &nlanes);
+	UT_ASSERTeq(ret, 0);
+
+	int val = -1;
+	ret = pmemobj_ctl_get(NULL, name, &val);
+	UT_ASSERTeq(ret, 0);
+	UT_ASSERTeq(val, nlanes);
+}
+
+/*
+ * worker -- runs transactions, so that the threads compete for the lanes
+ */
+static void *
+worker(void *arg)
+{
+	PMEMobjpool *pop = arg;
+
+	for (int i = 0; i < NOPS; ++i) {
+		TX_BEGIN(pop) {
+			pmemobj_tx_free(pmemobj_tx_alloc(64, 0));
+		} TX_ONABORT {
+			UT_ASSERT(0);
+		} TX_END
+	}
+
+	return NULL;
+}
+
+/*
+ * run_workers -- runs the workers on the pool
+ */
+static void
+run_workers(PMEMobjpool *pop)
+{
+	os_thread_t threads[NTHREADS];
+	for (unsigned t = 0; t < NTHREADS; ++t)
+		PTHREAD_CREATE(&threads[t], NULL, worker, pop);
+
+	for (unsigned t = 0; t < NTHREADS; ++t)
+		PTHREAD_JOIN(&threads[t], NULL);
+}
+
+/*
+ * incompat_features -- reads the incompat feature flags of the pool header
+ */
+static uint32_t
+incompat_features(const char *path)
+{
+	struct pool_hdr hdr;
+
+	int fd = OPEN(path, O_RDONLY);
+	READ(fd, &hdr, sizeof(hdr));
+	CLOSE(fd);
+
+	return le32toh(hdr.incompat_features);
+}
+
+/*
+ * exhaust -- creates the pool with the given number of lanes, runs the
+ *	workers and returns the number of objects which fit in the pool
+ */
+static size_t
+exhaust(const char *path, int nlanes, size_t poolsize)
+{
+	set_nlanes("create.nlanes", nlanes);
+
+	PMEMobjpool *pop = pmemobj_create(path, LAYOUT, poolsize,
+		S_IWUSR | S_IRUSR);
+	if (pop == NULL)
+		UT_FATAL("!pmemobj_create: %s", path);
+
+	run_workers(pop);
+
+	size_t n = 0;
+	while (pmemobj_alloc(pop, NULL, ALLOC_SIZE, 0, NULL, NULL) == 0)
+		n++;
+
+	pmemobj_close(pop);
+
+	return n;
+}
+
+int
+main(int argc, char *argv[])
+{
+	START(argc, argv, "obj_ctl_nlanes");
+
+	if (argc != 3)
+		UT_FATAL("usage: %s file-name1 file-name2", argv[0]);
+
+	int val = -1;
+	int ret = pmemobj_ctl_get(NULL, "create.nlanes", &val);
+	UT_ASSERTeq(ret, 0);
+	UT_ASSERTeq(val, 1024);
+
+	ret = pmemobj_ctl_get(NULL, "open.nlanes", &val);
+	UT_ASSERTeq(ret, 0);
+	UT_ASSERTeq(val, 0);
+
+	val = 0;
+	ret = pmemobj_ctl_set(NULL, "create.nlanes", &val);
+	UT_ASSERTeq(ret, -1);
+	UT_ASSERTeq(errno, EINVAL);
+
+	val = 16385;
+	ret = pmemobj_ctl_set(NULL, "create.nlanes", &val);
+	UT_ASSERTeq(ret, -1);
+	UT_ASSERTeq(errno, EINVAL);
+
+	val = -1;
+	ret = pmemobj_ctl_set(NULL, "open.nlanes", &val);
+	UT_ASSERTeq(ret, -1);
+	UT_ASSERTeq(errno, EINVAL);
+
+	/* the lanes of the pool don't fit in the minimal pool */
+	set_nlanes("create.nlanes", 4096);
+	PMEMobjpool *pop = pmemobj_create(argv[1], LAYOUT, PMEMOBJ_MIN_POOL,
+		S_IWUSR | S_IRUSR);
+	UT_ASSERTeq(pop, NULL);
+	UT_ASSERTeq(errno, EINVAL);
+
+	/* the space not used by the lanes goes to the heap */
+	size_t few = exhaust(argv[1], 16, PMEMOBJ_MIN_POOL * 4);
+	size_t many = exhaust(argv[2], 4096, PMEMOBJ_MIN_POOL * 4);
+	UT_ASSERT(few > many);
+
+	/* older libraries must not open pools with a non-default lane count */
+	UT_ASSERTne(incompat_features(argv[1]) & POOL_FEAT_NLANES, 0);
+	UT_ASSERTne(incompat_features(argv[2]) & POOL_FEAT_NLANES, 0);
+
+	/* the pools keep their lanes regardless of the current setting */
+	set_nlanes("create.nlanes", 1024);
+
+	set_nlanes("open.nlanes", 2);
+	for (int i = 1; i <= 2; ++i) {
+		pop = pmemobj_open(argv[i], LAYOUT);
+		if (pop == NULL)
+			UT_FATAL("!pmemobj_open: %s", argv[i]);
+
+		PMEMoid oid;
+		POBJ_FOREACH(pop, oid) {
+			pmemobj_free(&oid);
+			break;
+		}
+		run_workers(pop);
+
+		pmemobj_close(pop);
+
+		UT_ASSERTeq(pmemobj_check(argv[i], LAYOUT), 1);
+	}
+
+	set_nlanes("open.nlanes", 0);
+
+	UNLINK(argv[2]);
+	exhaust(argv[2], 1024, PMEMOBJ_MIN_POOL * 4);
+	UT_ASSERTeq(incompat_features(argv[2]) & POOL_FEAT_NLANES, 0);
+
+	DONE(NULL);
+}
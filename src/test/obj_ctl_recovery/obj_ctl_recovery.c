@@ -0,0 +1,215 @@
+/*
+ * Copyright 2018, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * obj_ctl_recovery.c -- tests for the ctl entry points: open.recovery.* and
+ *	open.heap.*
+ */
+
+#include "unittest.h"
+
+#define LAYOUT "obj_ctl_recovery"
+#define NOBJS 1024
+#define NTHREADS 8
+
+static const size_t Obj_sizes[] = {64, 200, 1024, 4000, 16384, 100000};
+
+/*
+ * fill -- creates a pool with a fragmented heap
+ */
+static void
+fill(const char *path)
+{
+	PMEMobjpool *pop = pmemobj_create(path, LAYOUT, PMEMOBJ_MIN_POOL * 4,
+		S_IWUSR | S_IRUSR);
+	if (pop == NULL)
+		UT_FATAL("!pmemobj_create: %s", path);
+
+	static PMEMoid oids[NOBJS];
+	for (unsigned i = 0; i < NOBJS; ++i) {
+		size_t size = Obj_sizes[i % ARRAY_SIZE(Obj_sizes)];
+		int ret = pmemobj_alloc(pop, &oids[i], size, 0, NULL, NULL);
+		UT_ASSERTeq(ret, 0);
+	}
+
+	for (unsigned i = 0; i < NOBJS; i += 2)
+		pmemobj_free(&oids[i]);
+
+	pmemobj_close(pop);
+}
+
+/*
+ * exhaust -- opens the pool and allocates objects until it runs out of
+ *	memory, returns the number of allocated objects
+ */
+static size_t
+exhaust(const char *path, size_t size)
+{
+	PMEMobjpool *pop = pmemobj_open(path, LAYOUT);
+	if (pop == NULL)
+		UT_FATAL("!pmemobj_open: %s", path);
+
+	size_t n = 0;
+	while (pmemobj_alloc(pop, NULL, size, 0, NULL, NULL) == 0)
+		n++;
+
+	pmemobj_close(pop);
+
+	UT_ASSERTeq(pmemobj_check(path, LAYOUT), 1);
+
+	return n;
+}
+
+/*
+ * set_threads -- sets the number of recovery threads and verifies the result
+ */
+static void
+set_threads(int nthreads)
+{
+	int ret = pmemobj_ctl_set(NULL, "open.recovery.threads", &nthreads);
+	UT_ASSERTeq(ret, 0);
+
+	int val = -1;
+	ret = pmemobj_ctl_get(NULL, "open.recovery.threads", &val);
+	UT_ASSERTeq(ret, 0);
+	UT_ASSERTeq(val, nthreads);
+}
+
+/*
+ * set_background -- enables or disables the background rebuild of the heap
+ */
+static void
+set_background(int enabled)
+{
+	int ret = pmemobj_ctl_set(NULL, "open.heap.background_rebuild",
+		&enabled);
+	UT_ASSERTeq(ret, 0);
+
+	int val = -1;
+	ret = pmemobj_ctl_get(NULL, "open.heap.background_rebuild", &val);
+	UT_ASSERTeq(ret, 0);
+	UT_ASSERTeq(val, enabled);
+}
+
+/*
+ * worker -- allocates objects right after the pool was opened
+ */
+static void *
+worker(void *arg)
+{
+	PMEMobjpool *pop = arg;
+
+	for (unsigned i = 0; i < NOBJS / NTHREADS; ++i) {
+		size_t size = Obj_sizes[i % ARRAY_SIZE(Obj_sizes)];
+		int ret = pmemobj_alloc(pop, NULL, size, 0, NULL, NULL);
+		UT_ASSERTeq(ret, 0);
+	}
+
+	return NULL;
+}
+
+/*
+ * test_background_mt -- allocates from multiple threads while the heap is
+ *	being rebuilt in the background
+ */
+static void
+test_background_mt(const char *path)
+{
+	UNLINK(path);
+
+	PMEMobjpool *pop = pmemobj_create(path, LAYOUT, PMEMOBJ_MIN_POOL * 20,
+		S_IWUSR | S_IRUSR);
+	if (pop == NULL)
+		UT_FATAL("!pmemobj_create: %s", path);
+
+	os_thread_t threads[NTHREADS];
+	for (unsigned t = 0; t < NTHREADS; ++t)
+		PTHREAD_CREATE(&threads[t], NULL, worker, pop);
+
+	for (unsigned t = 0; t < NTHREADS; ++t)
+		PTHREAD_JOIN(&threads[t], NULL);
+
+	pmemobj_close(pop);
+
+	UT_ASSERTeq(pmemobj_check(path, LAYOUT), 1);
+}
+
+int
+main(int argc, char *argv[])
+{
+	START(argc, argv, "obj_ctl_recovery");
+
+	if (argc != 4)
+		UT_FATAL("usage: %s file-name1 file-name2 file-name3",
+			argv[0]);
+
+	int val = -1;
+	int ret = pmemobj_ctl_get(NULL, "open.recovery.threads", &val);
+	UT_ASSERTeq(ret, 0);
+	UT_ASSERTeq(val, 0);
+
+	val = -1;
+	ret = pmemobj_ctl_set(NULL, "open.recovery.threads", &val);
+	UT_ASSERTeq(ret, -1);
+	UT_ASSERTeq(errno, EINVAL);
+
+	ret = pmemobj_ctl_get(NULL, "open.heap.background_rebuild", &val);
+	UT_ASSERTeq(ret, 0);
+	UT_ASSERTeq(val, 0);
+
+	fill(argv[1]);
+	fill(argv[2]);
+	fill(argv[3]);
+
+	/* all ways of opening the pool must yield the same free space */
+	size_t sizes[] = {128, 4096, 1 << 20};
+	for (unsigned i = 0; i < ARRAY_SIZE(sizes); ++i) {
+		set_threads(0);
+		size_t serial = exhaust(argv[1], sizes[i]);
+
+		set_threads(8);
+		size_t parallel = exhaust(argv[2], sizes[i]);
+
+		set_threads(0);
+		set_background(1);
+		size_t background = exhaust(argv[3], sizes[i]);
+		set_background(0);
+
+		UT_ASSERTeq(serial, parallel);
+		UT_ASSERTeq(serial, background);
+	}
+
+	set_background(1);
+	test_background_mt(argv[1]);
+
+	DONE(NULL);
+}
@@ -36,6 +36,352 @@
 
 #include "unittest.h"
 
+#define NTXS 100
+
+/*
+ * check_latency -- verifies the latency summary is consistent
+ */
+static void
+check_latency(PMEMobjpool *pop, const char *name, uint64_t count)
+{
+	struct pobj_stats_latency lat;
+	int ret = pmemobj_ctl_get(pop, name, &lat);
+	UT_ASSERTeq(ret, 0);
+
+	UT_ASSERTeq(lat.count, count);
+	if (count == 0)
+		return;
+
+	UT_ASSERT(lat.p50 <= lat.p90);
+	UT_ASSERT(lat.p90 <= lat.p99);
+	UT_ASSERT(lat.p99 <= lat.p999);
+	UT_ASSERT(lat.p999 <= lat.max);
+	UT_ASSERT(lat.avg <= lat.max);
+	UT_ASSERTne(lat.max, 0);
+}
+
+/*
+ * test_latency -- checks the transaction and allocator latency statistics
+ */
+static void
+test_latency(PMEMobjpool *pop)
+{
+	int ret = pmemobj_ctl_exec(pop, "stats.reset_latency", NULL);
+	UT_ASSERTeq(ret, 0);
+
+	check_latency(pop, "stats.tx.latency", 0);
+
+	PMEMoid oid;
+	ret = pmemobj_alloc(pop, &oid, 128, 0, NULL, NULL);
+	UT_ASSERTeq(ret, 0);
+
+	check_latency(pop, "stats.heap.operation_latency", 1);
+
+	for (int i = 0; i < NTXS; ++i) {
+		TX_BEGIN(pop) {
+			pmemobj_tx_add_range(oid, 0, 64);
+			pmemobj_tx_add_range(oid, 64, 64);
+
+			/* nested transactions are not measured on their own */
+			TX_BEGIN(pop) {
+				pmemobj_tx_add_range(oid, 0, 8);
+			} TX_END
+		} TX_END
+	}
+
+	/* aborted transactions are measured too */
+	TX_BEGIN(pop) {
+		pmemobj_tx_abort(ECANCELED);
+	} TX_END
+
+	check_latency(pop, "stats.tx.latency", NTXS + 1);
+	check_latency(pop, "stats.tx.commit_latency", NTXS);
+	check_latency(pop, "stats.tx.add_range_latency", 3 * NTXS);
+
+	int enabled = 0;
+	ret = pmemobj_ctl_set(pop, "stats.enabled", &enabled);
+	UT_ASSERTeq(ret, 0);
+
+	TX_BEGIN(pop) {
+	} TX_END
+
+	check_latency(pop, "stats.tx.latency", NTXS + 1);
+
+	ret = pmemobj_ctl_exec(pop, "stats.reset_latency", NULL);
+	UT_ASSERTeq(ret, 0);
+
+	check_latency(pop, "stats.tx.latency", 0);
+	check_latency(pop, "stats.heap.operation_latency", 0);
+
+	pmemobj_free(&oid);
+}
+
+/*
+ * get_skipped -- returns the number of skipped snapshots
+ */
+static uint64_t
+get_skipped(PMEMobjpool *pop)
+{
+	uint64_t skipped;
+	int ret = pmemobj_ctl_get(pop, "stats.tx.add_range_skipped", &skipped);
+	UT_ASSERTeq(ret, 0);
+
+	return skipped;
+}
+
+/*
+ * test_add_range_skipped -- checks that snapshots of objects allocated in
+ *	the same transaction are skipped and counted
+ */
+static void
+test_add_range_skipped(PMEMobjpool *pop)
+{
+	int enabled = 1;
+	int ret = pmemobj_ctl_set(pop, "stats.enabled", &enabled);
+	UT_ASSERTeq(ret, 0);
+
+	PMEMoid oid;
+	ret = pmemobj_zalloc(pop, &oid, 128, 0);
+	UT_ASSERTeq(ret, 0);
+
+	uint64_t skipped = get_skipped(pop);
+	PMEMoid new_oid = OID_NULL;
+
+	TX_BEGIN(pop) {
+		new_oid = pmemobj_tx_zalloc(128, 0);
+		pmemobj_tx_add_range(new_oid, 0, 64);
+		pmemobj_tx_add_range_direct(pmemobj_direct(new_oid), 128);
+
+		/* not entirely within the new object */
+		pmemobj_tx_add_range(oid, 0, 8);
+
+		memset(pmemobj_direct(oid), 0xc, 8);
+		memset(pmemobj_direct(new_oid), 0xc, 128);
+		pmemobj_tx_abort(ECANCELED);
+	} TX_END
+
+	UT_ASSERTeq(get_skipped(pop), skipped + 2);
+	UT_ASSERTeq(*(char *)pmemobj_direct(oid), 0);
+
+	/* the writes of new objects in redo mode bypass the write set */
+	enum pobj_tx_mode mode = POBJ_TX_MODE_REDO;
+	ret = pmemobj_ctl_set(pop, "tx.mode", &mode);
+	UT_ASSERTeq(ret, 0);
+
+	char buf[64];
+	memset(buf, 0xd, sizeof(buf));
+	TX_BEGIN(pop) {
+		new_oid = pmemobj_tx_zalloc(128, 0);
+		pmemobj_tx_write(pmemobj_direct(new_oid), buf, sizeof(buf));
+		UT_ASSERTeq(*(char *)pmemobj_direct(new_oid), 0xd);
+	} TX_ONABORT {
+		UT_ASSERT(0);
+	} TX_END
+
+	mode = POBJ_TX_MODE_UNDO;
+	ret = pmemobj_ctl_set(pop, "tx.mode", &mode);
+	UT_ASSERTeq(ret, 0);
+
+	UT_ASSERTeq(get_skipped(pop), skipped + 3);
+	UT_ASSERTeq(memcmp(pmemobj_direct(new_oid), buf, sizeof(buf)), 0);
+
+	pmemobj_free(&new_oid);
+	pmemobj_free(&oid);
+}
+
+#define CHUNK_SIZE ((size_t)256 << 10)
+#define NOBJS 100
+#define HUGE_CHUNKS 12 /* more than the biggest run */
+
+struct walk_arg {
+	int class_id;
+	size_t chunks;
+	size_t class_runs;
+	size_t class_allocated;
+};
+
+/*
+ * walk_cb -- sums up the chunks reported by heap.walk
+ */
+static void
+walk_cb(PMEMobjpool *pop, const struct pobj_heap_chunk *chunk, void *arg)
+{
+	struct walk_arg *w = arg;
+
+	UT_ASSERTne(chunk->nchunks, 0);
+	w->chunks += chunk->nchunks;
+
+	if (chunk->type != POBJ_HEAP_CHUNK_RUN)
+		return;
+
+	UT_ASSERT(chunk->free_units <= chunk->units);
+	if (chunk->class_id == w->class_id) {
+		w->class_runs++;
+		w->class_allocated += chunk->units - chunk->free_units;
+	}
+}
+
+/*
+ * check_heap_walk -- verifies that the statistics maintained by the heap
+ *	match its occupancy map
+ */
+static void
+check_heap_walk(PMEMobjpool *pop, int class_id)
+{
+	struct pobj_stats_fragmentation frag;
+	int ret = pmemobj_ctl_get(pop, "stats.heap.fragmentation", &frag);
+	UT_ASSERTeq(ret, 0);
+
+	struct walk_arg w = {class_id, 0, 0, 0};
+	struct pobj_heap_walk walk;
+	memset(&walk, 0, sizeof(walk));
+	walk.cb = walk_cb;
+	walk.arg = &w;
+	ret = pmemobj_ctl_exec(pop, "heap.walk", &walk);
+	UT_ASSERTeq(ret, 0);
+
+	UT_ASSERTeq(w.chunks * CHUNK_SIZE, frag.heap_bytes);
+	UT_ASSERTeq(walk.nchunks[POBJ_HEAP_CHUNK_RUN] * CHUNK_SIZE,
+		frag.run_bytes);
+	UT_ASSERTeq(walk.nchunks[POBJ_HEAP_CHUNK_HUGE] * CHUNK_SIZE,
+		frag.huge_bytes);
+	UT_ASSERTeq(walk.nchunks[POBJ_HEAP_CHUNK_FREE] * CHUNK_SIZE,
+		frag.free_bytes);
+
+	size_t nfree = 0;
+	for (int i = 0; i < POBJ_HEAP_WALK_HIST_SIZE; ++i)
+		nfree += walk.free_hist[i];
+	UT_ASSERTeq(nfree, walk.nranges[POBJ_HEAP_CHUNK_FREE]);
+
+	if (class_id < 0)
+		return;
+
+	char name[64];
+	snprintf(name, sizeof(name), "stats.heap.alloc_class.%d.occupancy",
+		class_id);
+
+	struct pobj_stats_alloc_class occ;
+	ret = pmemobj_ctl_get(pop, name, &occ);
+	UT_ASSERTeq(ret, 0);
+	UT_ASSERTeq(occ.runs, w.class_runs);
+	UT_ASSERTeq(occ.allocated_units, w.class_allocated);
+}
+
+/*
+ * get_occupancy -- reads the occupancy of the allocation class
+ */
+static struct pobj_stats_alloc_class
+get_occupancy(PMEMobjpool *pop, unsigned class_id)
+{
+	char name[64];
+	snprintf(name, sizeof(name), "stats.heap.alloc_class.%u.occupancy",
+		class_id);
+
+	struct pobj_stats_alloc_class occ;
+	int ret = pmemobj_ctl_get(pop, name, &occ);
+	UT_ASSERTeq(ret, 0);
+
+	return occ;
+}
+
+/*
+ * check_huge_occupancy -- verifies that the occupancy of the huge class
+ *	matches the used chunks reported by heap.walk
+ */
+static void
+check_huge_occupancy(PMEMobjpool *pop)
+{
+	struct walk_arg w;
+	memset(&w, 0, sizeof(w));
+	w.class_id = -1;
+	struct pobj_heap_walk walk;
+	memset(&walk, 0, sizeof(walk));
+	walk.cb = walk_cb;
+	walk.arg = &w;
+	int ret = pmemobj_ctl_exec(pop, "heap.walk", &walk);
+	UT_ASSERTeq(ret, 0);
+
+	struct pobj_stats_alloc_class occ = get_occupancy(pop, 0);
+	UT_ASSERTeq(occ.allocated_units, walk.nchunks[POBJ_HEAP_CHUNK_HUGE]);
+}
+
+/*
+ * test_occupancy -- checks the occupancy statistics of allocation classes
+ */
+static void
+test_occupancy(PMEMobjpool *pop)
+{
+	struct pobj_stats_alloc_class occ;
+	int ret = pmemobj_ctl_get(pop, "stats.heap.alloc_class.254.occupancy",
+		&occ);
+	UT_ASSERTeq(ret, -1);
+	UT_ASSERTeq(errno, ENOENT);
+
+	ret = pmemobj_ctl_get(pop, "stats.heap.alloc_class.255.occupancy",
+		&occ);
+	UT_ASSERTeq(ret, -1);
+	UT_ASSERTeq(errno, ERANGE);
+
+	struct pobj_alloc_class_desc desc;
+	desc.unit_size = 128;
+	desc.alignment = 0;
+	desc.units_per_block = 1000;
+	desc.header_type = POBJ_HEADER_NONE;
+	ret = pmemobj_ctl_set(pop, "heap.alloc_class.new.desc", &desc);
+	UT_ASSERTeq(ret, 0);
+
+	occ = get_occupancy(pop, desc.class_id);
+	UT_ASSERTeq(occ.unit_size, 128);
+	UT_ASSERT(occ.units_per_run >= 1000);
+	UT_ASSERTeq(occ.runs, 0);
+	UT_ASSERTeq(occ.allocated_units, 0);
+	UT_ASSERTeq(occ.fill, 0);
+
+	PMEMoid oids[NOBJS];
+	for (int i = 0; i < NOBJS; ++i) {
+		ret = pmemobj_xalloc(pop, &oids[i], 100, 0,
+			POBJ_CLASS_ID(desc.class_id), NULL, NULL);
+		UT_ASSERTeq(ret, 0);
+	}
+
+	for (int i = 0; i < NOBJS; i += 2)
+		pmemobj_free(&oids[i]);
+
+	occ = get_occupancy(pop, desc.class_id);
+	UT_ASSERTeq(occ.runs, 1);
+	UT_ASSERTeq(occ.allocated_units, NOBJS / 2);
+	UT_ASSERTeq(occ.free_units, occ.units_per_run - NOBJS / 2);
+	UT_ASSERTeq(occ.fill, NOBJS / 2 * 100 / occ.units_per_run);
+
+	struct pobj_stats_alloc_class huge = get_occupancy(pop, 0);
+	UT_ASSERTeq(huge.unit_size, CHUNK_SIZE);
+	UT_ASSERTeq(huge.runs, 0);
+
+	PMEMoid oid;
+	ret = pmemobj_alloc(pop, &oid, HUGE_CHUNKS * CHUNK_SIZE, 0, NULL, NULL);
+	UT_ASSERTeq(ret, 0);
+
+	occ = get_occupancy(pop, 0);
+	UT_ASSERTeq(occ.allocated_units,
+		huge.allocated_units + HUGE_CHUNKS + 1);
+
+	struct pobj_stats_fragmentation frag;
+	ret = pmemobj_ctl_get(pop, "stats.heap.fragmentation", &frag);
+	UT_ASSERTeq(ret, 0);
+	UT_ASSERT(frag.huge_bytes > HUGE_CHUNKS * CHUNK_SIZE);
+	UT_ASSERT(frag.run_free_bytes >= occ.free_units * 128);
+	UT_ASSERT(frag.fragmentation <= 100);
+
+	check_heap_walk(pop, (int)desc.class_id);
+
+	pmemobj_free(&oid);
+
+	occ = get_occupancy(pop, 0);
+	UT_ASSERTeq(occ.allocated_units, huge.allocated_units);
+
+	check_heap_walk(pop, (int)desc.class_id);
+}
+
 int
 main(int argc, char *argv[])
 {
@@ -47,7 +393,7 @@ main(int argc, char *argv[])
 	const char *path = argv[1];
 
 	PMEMobjpool *pop;
-	if ((pop = pmemobj_create(path, "ctl", PMEMOBJ_MIN_POOL,
+	if ((pop = pmemobj_create(path, "ctl", PMEMOBJ_MIN_POOL * 4,
 		S_IWUSR | S_IRUSR)) == NULL)
 		UT_FATAL("!pmemobj_create: %s", path);
 
@@ -82,6 +428,39 @@ main(int argc, char *argv[])
 	UT_ASSERTeq(ret, 0);
 	UT_ASSERTeq(allocated, 0);
 
+	test_latency(pop);
+	test_add_range_skipped(pop);
+	test_occupancy(pop);
+
+	PMEMoid root = pmemobj_root(pop, sizeof(PMEMoid));
+	PMEMoid *huge = pmemobj_direct(root);
+	ret = pmemobj_alloc(pop, huge, HUGE_CHUNKS * CHUNK_SIZE, 0, NULL,
+		NULL);
+	UT_ASSERTeq(ret, 0);
+	pmemobj_persist(pop, huge, sizeof(*huge));
+
+	pmemobj_close(pop);
+
+	/* the runs of the custom class are no longer attributed to it */
+	if ((pop = pmemobj_open(path, "ctl")) == NULL)
+		UT_FATAL("!pmemobj_open: %s", path);
+
+	/* freed before its zone is populated, must not be counted twice */
+	root = pmemobj_root(pop, sizeof(PMEMoid));
+	pmemobj_free(pmemobj_direct(root));
+
+	ret = pmemobj_alloc(pop, NULL, 1, 0, NULL, NULL);
+	UT_ASSERTeq(ret, 0);
+
+	/* doesn't fit in the freed chunks, populates the zone */
+	ret = pmemobj_alloc(pop, &oid, 2 * HUGE_CHUNKS * CHUNK_SIZE, 0, NULL,
+		NULL);
+	UT_ASSERTeq(ret, 0);
+	pmemobj_free(&oid);
+
+	check_heap_walk(pop, -1);
+	check_huge_occupancy(pop);
+
 	pmemobj_close(pop);
 
 	DONE(NULL);
@@ -0,0 +1,259 @@
+/*
+ * Copyright 2018, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * obj_ctl_thread_cache.c -- tests for the ctl entry points: heap.thread_cache.*
+ */
+
+#include "unittest.h"
+
+#define LAYOUT "obj_ctl_thread_cache"
+#define NTHREADS 8
+#define NOBJS 512
+#define OBJ_SIZE 128
+
+struct obj {
+	unsigned thread;
+	unsigned idx;
+};
+
+static PMEMobjpool *pop;
+static PMEMoid oids[NTHREADS][NOBJS];
+
+/*
+ * obj_constr -- stores the identity of the object in its content
+ */
+static int
+obj_constr(PMEMobjpool *pop, void *ptr, void *arg)
+{
+	struct obj *o = ptr;
+	*o = *(struct obj *)arg;
+	pmemobj_persist(pop, o, sizeof(*o));
+
+	return 0;
+}
+
+/*
+ * obj_constr_fail -- cancels the allocation
+ */
+static int
+obj_constr_fail(PMEMobjpool *pop, void *ptr, void *arg)
+{
+	return -1;
+}
+
+/*
+ * worker -- allocates objects using all of the allocation interfaces
+ */
+static void *
+worker(void *arg)
+{
+	unsigned t = *(unsigned *)arg;
+
+	for (unsigned i = 0; i < NOBJS; ++i) {
+		struct obj o = {t, i};
+
+		/* every few allocations a constructor cancels one */
+		if (i % 8 == 0) {
+			int ret = pmemobj_alloc(pop, NULL, OBJ_SIZE, 0,
+				obj_constr_fail, NULL);
+			UT_ASSERTeq(ret, -1);
+			UT_ASSERTeq(errno, ECANCELED);
+		}
+
+		if (i % 3 == 0) {
+			int ret = pmemobj_alloc(pop, &oids[t][i], OBJ_SIZE,
+				0, obj_constr, &o);
+			UT_ASSERTeq(ret, 0);
+		} else if (i % 3 == 1) {
+			struct pobj_action act[2];
+			pmemobj_reserve(pop, &act[0], OBJ_SIZE, 0);
+			oids[t][i] = pmemobj_reserve(pop, &act[1], OBJ_SIZE, 0);
+			UT_ASSERT(!OID_IS_NULL(oids[t][i]));
+
+			*(struct obj *)pmemobj_direct(oids[t][i]) = o;
+			pmemobj_persist(pop, pmemobj_direct(oids[t][i]),
+				sizeof(o));
+
+			pmemobj_cancel(pop, &act[0], 1);
+			pmemobj_publish(pop, &act[1], 1);
+		} else {
+			TX_BEGIN(pop) {
+				oids[t][i] = pmemobj_tx_alloc(OBJ_SIZE, 0);
+				*(struct obj *)pmemobj_direct(oids[t][i]) = o;
+			} TX_ONABORT {
+				UT_ASSERT(0);
+			} TX_END
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * test_params -- verifies the defaults and limits of the ctl entry points
+ */
+static void
+test_params(void)
+{
+	int size;
+	int ret = pmemobj_ctl_get(pop, "heap.thread_cache.size", &size);
+	UT_ASSERTeq(ret, 0);
+	UT_ASSERTeq(size, 0);
+
+	int batch;
+	ret = pmemobj_ctl_get(pop, "heap.thread_cache.batch", &batch);
+	UT_ASSERTeq(ret, 0);
+	UT_ASSERTeq(batch, 32);
+
+	int val = -1;
+	ret = pmemobj_ctl_set(pop, "heap.thread_cache.size", &val);
+	UT_ASSERTeq(ret, -1);
+	val = 4097;
+	ret = pmemobj_ctl_set(pop, "heap.thread_cache.size", &val);
+	UT_ASSERTeq(ret, -1);
+	val = 0;
+	ret = pmemobj_ctl_set(pop, "heap.thread_cache.batch", &val);
+	UT_ASSERTeq(ret, -1);
+
+	size = 64;
+	ret = pmemobj_ctl_set(pop, "heap.thread_cache.size", &size);
+	UT_ASSERTeq(ret, 0);
+	batch = 16;
+	ret = pmemobj_ctl_set(pop, "heap.thread_cache.batch", &batch);
+	UT_ASSERTeq(ret, 0);
+
+	ret = pmemobj_ctl_get(pop, "heap.thread_cache.size", &val);
+	UT_ASSERTeq(ret, 0);
+	UT_ASSERTeq(val, size);
+	ret = pmemobj_ctl_get(pop, "heap.thread_cache.batch", &val);
+	UT_ASSERTeq(ret, 0);
+	UT_ASSERTeq(val, batch);
+}
+
+/*
+ * test_alloc_mt -- allocates from the thread caches in parallel and checks
+ *	that no block was handed out twice
+ */
+static void
+test_alloc_mt(void)
+{
+	os_thread_t threads[NTHREADS];
+	unsigned args[NTHREADS];
+
+	for (unsigned t = 0; t < NTHREADS; ++t) {
+		args[t] = t;
+		PTHREAD_CREATE(&threads[t], NULL, worker, &args[t]);
+	}
+
+	for (unsigned t = 0; t < NTHREADS; ++t)
+		PTHREAD_JOIN(&threads[t], NULL);
+
+	for (unsigned t = 0; t < NTHREADS; ++t) {
+		for (unsigned i = 0; i < NOBJS; ++i) {
+			struct obj *o = pmemobj_direct(oids[t][i]);
+			UT_ASSERTeq(o->thread, t);
+			UT_ASSERTeq(o->idx, i);
+			UT_ASSERT(pmemobj_alloc_usable_size(oids[t][i]) >=
+				OBJ_SIZE);
+		}
+	}
+
+	for (unsigned t = 0; t < NTHREADS; ++t)
+		for (unsigned i = 0; i < NOBJS; ++i)
+			pmemobj_free(&oids[t][i]);
+}
+
+/*
+ * test_resize -- shrinks, flushes and disables the cache of the main thread
+ */
+static void
+test_resize(void)
+{
+	PMEMoid oid;
+	int ret = pmemobj_alloc(pop, &oid, OBJ_SIZE, 0, NULL, NULL);
+	UT_ASSERTeq(ret, 0);
+	pmemobj_free(&oid);
+
+	int size = 1;
+	ret = pmemobj_ctl_set(pop, "heap.thread_cache.size", &size);
+	UT_ASSERTeq(ret, 0);
+
+	ret = pmemobj_alloc(pop, &oid, OBJ_SIZE, 0, NULL, NULL);
+	UT_ASSERTeq(ret, 0);
+	pmemobj_free(&oid);
+
+	ret = pmemobj_ctl_exec(pop, "heap.thread_cache.flush", NULL);
+	UT_ASSERTeq(ret, 0);
+
+	size = 0;
+	ret = pmemobj_ctl_set(pop, "heap.thread_cache.size", &size);
+	UT_ASSERTeq(ret, 0);
+
+	ret = pmemobj_alloc(pop, &oid, OBJ_SIZE, 0, NULL, NULL);
+	UT_ASSERTeq(ret, 0);
+	pmemobj_free(&oid);
+
+	/* leave blocks in the cache of the main thread when closing the pool */
+	size = 64;
+	ret = pmemobj_ctl_set(pop, "heap.thread_cache.size", &size);
+	UT_ASSERTeq(ret, 0);
+
+	ret = pmemobj_alloc(pop, &oid, OBJ_SIZE, 0, NULL, NULL);
+	UT_ASSERTeq(ret, 0);
+	pmemobj_free(&oid);
+}
+
+int
+main(int argc, char *argv[])
+{
+	START(argc, argv, "obj_ctl_thread_cache");
+
+	if (argc != 2)
+		UT_FATAL("usage: %s file-name", argv[0]);
+
+	const char *path = argv[1];
+
+	if ((pop = pmemobj_create(path, LAYOUT, PMEMOBJ_MIN_POOL * 4,
+			S_IWUSR | S_IRUSR)) == NULL)
+		UT_FATAL("!pmemobj_create: %s", path);
+
+	test_params();
+	test_alloc_mt();
+	test_resize();
+
+	pmemobj_close(pop);
+
+	UT_ASSERTeq(pmemobj_check(path, LAYOUT), 1);
+
+	DONE(NULL);
+}
@@ -0,0 +1,256 @@
+/*
+ * Copyright 2018, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * obj_defrag.c -- tests for the heap.defrag.* ctl entry points
+ */
+
+#include "unittest.h"
+
+#define LAYOUT "obj_defrag"
+#define NOBJS 4096
+#define OBJ_SIZE 200
+#define KEEP_EVERY 20
+
+struct root {
+	PMEMoid objs[NOBJS];
+};
+
+TOID_DECLARE_ROOT(struct root);
+
+struct relocation {
+	struct root *root;
+	size_t calls;
+};
+
+/*
+ * relocated -- updates the reference to the moved object
+ */
+static void
+relocated(PMEMobjpool *pop, PMEMoid oldoid, PMEMoid newoid, void *arg)
+{
+	struct relocation *rel = arg;
+
+	UT_ASSERTeq(pmemobj_tx_stage(), TX_STAGE_WORK);
+	UT_ASSERTne(oldoid.off, newoid.off);
+	UT_ASSERTeq(pmemobj_type_num(oldoid), pmemobj_type_num(newoid));
+	UT_ASSERTeq(memcmp(pmemobj_direct(oldoid), pmemobj_direct(newoid),
+		OBJ_SIZE), 0);
+
+	for (int i = 0; i < NOBJS; ++i) {
+		if (rel->root->objs[i].off != oldoid.off)
+			continue;
+
+		pmemobj_tx_add_range_direct(&rel->root->objs[i],
+			sizeof(PMEMoid));
+		rel->root->objs[i] = newoid;
+		rel->calls++;
+
+		return;
+	}
+
+	UT_ASSERT(0);
+}
+
+/*
+ * check_objects -- verifies the content of all the referenced objects
+ */
+static void
+check_objects(struct root *root)
+{
+	for (int i = 0; i < NOBJS; ++i) {
+		if (OID_IS_NULL(root->objs[i]))
+			continue;
+
+		UT_ASSERTeq(pmemobj_type_num(root->objs[i]), i % 8);
+
+		unsigned char *data = pmemobj_direct(root->objs[i]);
+		for (int j = 0; j < OBJ_SIZE; ++j)
+			UT_ASSERTeq(data[j], (unsigned char)i);
+	}
+}
+
+/*
+ * get_fragmentation -- reads the fragmentation of the heap
+ */
+static struct pobj_defrag_fragmentation
+get_fragmentation(PMEMobjpool *pop)
+{
+	struct pobj_defrag_fragmentation frag;
+	int ret = pmemobj_ctl_get(pop, "heap.defrag.fragmentation", &frag);
+	UT_ASSERTeq(ret, 0);
+
+	UT_ASSERT(frag.free_bytes <= frag.run_bytes);
+	UT_ASSERT(frag.sparse_runs <= frag.runs);
+
+	return frag;
+}
+
+/*
+ * test_ctl -- checks the validation of the arguments
+ */
+static void
+test_ctl(PMEMobjpool *pop)
+{
+	int threshold = -1;
+	int ret = pmemobj_ctl_get(pop, "heap.defrag.threshold", &threshold);
+	UT_ASSERTeq(ret, 0);
+	UT_ASSERTeq(threshold, 25);
+
+	threshold = 0;
+	ret = pmemobj_ctl_set(pop, "heap.defrag.threshold", &threshold);
+	UT_ASSERTeq(ret, -1);
+	UT_ASSERTeq(errno, EINVAL);
+
+	threshold = 100;
+	ret = pmemobj_ctl_set(pop, "heap.defrag.threshold", &threshold);
+	UT_ASSERTeq(ret, -1);
+	UT_ASSERTeq(errno, EINVAL);
+
+	threshold = 10;
+	ret = pmemobj_ctl_set(pop, "heap.defrag.threshold", &threshold);
+	UT_ASSERTeq(ret, 0);
+
+	struct pobj_defrag d;
+	memset(&d, 0, sizeof(d));
+	ret = pmemobj_ctl_exec(pop, "heap.defrag.run", &d);
+	UT_ASSERTeq(ret, -1);
+	UT_ASSERTeq(errno, EINVAL);
+
+	ret = pmemobj_ctl_exec(pop, "heap.defrag.run", NULL);
+	UT_ASSERTeq(ret, -1);
+	UT_ASSERTeq(errno, EINVAL);
+
+	struct relocation rel = {NULL, 0};
+	d.relocated = relocated;
+	d.arg = &rel;
+	TX_BEGIN(pop) {
+		ret = pmemobj_ctl_exec(pop, "heap.defrag.run", &d);
+		UT_ASSERTeq(ret, -1);
+		UT_ASSERTeq(errno, EINVAL);
+	} TX_ONABORT {
+		UT_ASSERT(0);
+	} TX_END
+}
+
+/*
+ * test_defrag -- empties the sparse runs left after freeing most objects
+ */
+static void
+test_defrag(PMEMobjpool *pop)
+{
+	TOID(struct root) root = POBJ_ROOT(pop, struct root);
+	struct root *rootp = D_RW(root);
+
+	for (int i = 0; i < NOBJS; ++i) {
+		int ret = pmemobj_alloc(pop, &rootp->objs[i], OBJ_SIZE,
+			(uint64_t)(i % 8), NULL, NULL);
+		UT_ASSERTeq(ret, 0);
+
+		pmemobj_memset_persist(pop, pmemobj_direct(rootp->objs[i]),
+			i, OBJ_SIZE);
+	}
+
+	struct pobj_defrag_fragmentation full = get_fragmentation(pop);
+
+	size_t kept = 0;
+	for (int i = 0; i < NOBJS; ++i) {
+		if (i % KEEP_EVERY == 0)
+			kept++;
+		else
+			pmemobj_free(&rootp->objs[i]);
+	}
+
+	struct pobj_defrag_fragmentation frag = get_fragmentation(pop);
+	UT_ASSERT(frag.sparse_runs > full.sparse_runs);
+	UT_ASSERT(frag.free_bytes > full.free_bytes);
+	UT_ASSERT(frag.sparse_bytes >= kept * OBJ_SIZE);
+
+	struct relocation rel = {rootp, 0};
+	struct pobj_defrag d;
+	memset(&d, 0, sizeof(d));
+	d.relocated = relocated;
+	d.arg = &rel;
+
+	/* the number of relocations can be limited */
+	d.max_objects = 1;
+	int ret = pmemobj_ctl_exec(pop, "heap.defrag.run", &d);
+	UT_ASSERTeq(ret, 0);
+	UT_ASSERTeq(d.objects, 1);
+	UT_ASSERTeq(rel.calls, 1);
+	check_objects(rootp);
+
+	d.max_objects = 0;
+	ret = pmemobj_ctl_exec(pop, "heap.defrag.run", &d);
+	UT_ASSERTeq(ret, 0);
+	UT_ASSERTne(d.objects, 0);
+	UT_ASSERTne(d.runs, 0);
+	UT_ASSERTeq(rel.calls, d.objects + 1);
+	check_objects(rootp);
+
+	struct pobj_defrag_fragmentation after = get_fragmentation(pop);
+	UT_ASSERT(after.sparse_runs < frag.sparse_runs);
+}
+
+int
+main(int argc, char *argv[])
+{
+	START(argc, argv, "obj_defrag");
+
+	if (argc != 2)
+		UT_FATAL("usage: %s file-name", argv[0]);
+
+	const char *path = argv[1];
+
+	PMEMobjpool *pop = pmemobj_create(path, LAYOUT, PMEMOBJ_MIN_POOL * 4,
+		S_IWUSR | S_IRUSR);
+	if (pop == NULL)
+		UT_FATAL("!pmemobj_create: %s", path);
+
+	test_ctl(pop);
+	test_defrag(pop);
+
+	pmemobj_close(pop);
+
+	pop = pmemobj_open(path, LAYOUT);
+	if (pop == NULL)
+		UT_FATAL("!pmemobj_open: %s", path);
+
+	TOID(struct root) root = POBJ_ROOT(pop, struct root);
+	check_objects(D_RW(root));
+
+	pmemobj_close(pop);
+
+	UT_ASSERTeq(pmemobj_check(path, LAYOUT), 1);
+
+	DONE(NULL);
+}
@@ -45,6 +45,7 @@
 #include "tx.h"
 #include "unittest.h"
 #include "pmemcommon.h"
+#include "os_numa.h"
 
 #define MAX_MOCK_LANES 5
 #define MOCK_RUNTIME (void *)(0xABC)
@@ -385,6 +386,68 @@ test_lane_cleanup_in_separate_thread(void)
 	FREE(pop);
 }
 
+/*
+ * test_cpu_lane_thread -- pins itself to the current CPU and checks that it
+ *	gets the lane assigned to the CPU
+ */
+static void *
+test_cpu_lane_thread(void *arg)
+{
+	PMEMobjpool *pop = arg;
+
+	int cpu = os_numa_cpu();
+	if (cpu < 0) /* unknown CPU, lanes are assigned in a round-robin */
+		return NULL;
+
+	os_cpu_set_t set;
+	os_cpu_zero(&set);
+	os_cpu_set((size_t)cpu, &set);
+	os_thread_t self;
+	os_thread_self(&self);
+	UT_ASSERTeq(os_thread_setaffinity_np(&self, sizeof(set), &set), 0);
+
+	uint64_t idx = (uint64_t)cpu * LANE_JUMP;
+	uint64_t expected = (idx % OBJ_NLANES + idx / OBJ_NLANES) % OBJ_NLANES;
+
+	unsigned lane = lane_hold(pop, NULL, LANE_ID);
+	UT_ASSERTeq(lane, expected);
+	lane_release(pop);
+
+	/* the lane of the CPU is taken, the next free one is used */
+	pop->lanes_desc.lane_locks[expected] = 1;
+	lane = lane_hold(pop, NULL, LANE_ID);
+	UT_ASSERTeq(lane, (expected + 1) % OBJ_NLANES);
+	lane_release(pop);
+
+	pop->lanes_desc.lane_locks[expected] = 0;
+	lane = lane_hold(pop, NULL, LANE_ID);
+	UT_ASSERTeq(lane, expected);
+	lane_release(pop);
+
+	return NULL;
+}
+
+/*
+ * test_lane_hold_cpu -- checks that threads get the lanes of their CPUs
+ */
+static void
+test_lane_hold_cpu(void)
+{
+	struct mock_pop *pop = MALLOC(sizeof(struct mock_pop));
+	pop->p.nlanes = OBJ_NLANES;
+	pop->p.lanes_desc.runtime_nlanes = OBJ_NLANES;
+	pop->p.lanes_desc.next_lane_idx = 0;
+	pop->p.lanes_desc.lane_locks = CALLOC(OBJ_NLANES, sizeof(uint64_t));
+	pop->p.uuid_lo = 654321;
+
+	os_thread_t thread;
+	PTHREAD_CREATE(&thread, NULL, test_cpu_lane_thread, &pop->p);
+	PTHREAD_JOIN(&thread, NULL);
+
+	FREE(pop->p.lanes_desc.lane_locks);
+	FREE(pop);
+}
+
 static void
 usage(const char *app)
 {
@@ -416,6 +479,7 @@ main(int argc, char *argv[])
 		/* multithreaded scenarios */
 		test_lane_info_destroy_in_separate_thread();
 		test_lane_cleanup_in_separate_thread();
+		test_lane_hold_cpu();
 		break;
 	default:
 		usage(argv[0]);
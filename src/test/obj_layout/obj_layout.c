@@ -66,7 +66,8 @@
 #define SIZEOF_TX_RANGE_META_V3 (16)
 #define SIZEOF_REDO_LOG_V3 (16)
 #define SIZEOF_LANE_LIST_LAYOUT_V3 (1024 - 8)
-#define SIZEOF_LANE_ALLOC_LAYOUT_V3 (1024 - 16)
+#define SIZEOF_REDO_LOG_EXT_V3 (16)
+#define SIZEOF_LANE_ALLOC_LAYOUT_V3 (1024)
 #define SIZEOF_LANE_TX_LAYOUT_V3 (8 + (4 * SIZEOF_PVECTOR_V3))
 
 POBJ_LAYOUT_BEGIN(layout);
@@ -159,6 +160,13 @@ main(int argc, char *argv[])
 	UT_COMPILE_ERROR_ON(sizeof(struct redo_log) !=
 		SIZEOF_REDO_LOG_V3);
 
+	ASSERT_ALIGNED_BEGIN(struct redo_log_ext);
+	ASSERT_ALIGNED_FIELD(struct redo_log_ext, next);
+	ASSERT_ALIGNED_FIELD(struct redo_log_ext, nentries);
+	ASSERT_ALIGNED_CHECK(struct redo_log_ext);
+	UT_COMPILE_ERROR_ON(sizeof(struct redo_log_ext) !=
+		SIZEOF_REDO_LOG_EXT_V3);
+
 	ASSERT_ALIGNED_BEGIN(PMEMoid);
 	ASSERT_ALIGNED_FIELD(PMEMoid, pool_uuid_lo);
 	ASSERT_ALIGNED_FIELD(PMEMoid, off);
@@ -207,6 +215,8 @@ main(int argc, char *argv[])
 
 	ASSERT_ALIGNED_BEGIN(struct lane_alloc_layout);
 	ASSERT_ALIGNED_FIELD(struct lane_alloc_layout, redo);
+	ASSERT_ALIGNED_FIELD(struct lane_alloc_layout, redo_next);
+	ASSERT_ALIGNED_FIELD(struct lane_alloc_layout, unused);
 	ASSERT_ALIGNED_CHECK(struct lane_alloc_layout);
 	UT_COMPILE_ERROR_ON(sizeof(struct lane_alloc_layout) >
 		sizeof(struct lane_section_layout));
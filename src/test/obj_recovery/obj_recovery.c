@@ -67,14 +67,14 @@ main(int argc, char *argv[])
 
 	if (argc != 5)
 		UT_FATAL("usage: %s [file] [lock: y/n] "
-			"[cmd: c/o] [type: n/f/s]",
+			"[cmd: c/o] [type: n/f/s/w]",
 			argv[0]);
 
 	const char *path = argv[1];
 
 	PMEMobjpool *pop = NULL;
 	int exists = argv[3][0] == 'o';
-	enum { TEST_NEW, TEST_FREE, TEST_SET } type;
+	enum { TEST_NEW, TEST_FREE, TEST_SET, TEST_WRITE } type;
 
 	if (argv[4][0] == 'n')
 		type = TEST_NEW;
@@ -82,6 +82,8 @@ main(int argc, char *argv[])
 		type = TEST_FREE;
 	else if (argv[4][0] == 's')
 		type = TEST_SET;
+	else if (argv[4][0] == 'w')
+		type = TEST_WRITE;
 	else
 		UT_FATAL("invalid type");
 
@@ -143,6 +145,32 @@ main(int argc, char *argv[])
 		} else {
 			UT_ASSERT(D_RW(D_RW(root)->foo)->bar == BAR_VALUE);
 		}
+	} else if (type == TEST_WRITE) {
+		if (!exists) {
+			TX_BEGIN_PARAM(pop, lock_type, lock) {
+				TOID(struct foo) f = TX_ZNEW(struct foo);
+				TX_SET(root, foo, f);
+			} TX_END
+
+			int bar = BAR_VALUE;
+			TX_BEGIN_PARAM(pop, lock_type, lock) {
+				pmemobj_tx_write(&D_RW(D_RW(root)->foo)->bar,
+					&bar, sizeof(bar));
+			} TX_END
+
+			UT_ASSERT(D_RW(D_RW(root)->foo)->bar == BAR_VALUE);
+
+			bar = BAR_VALUE * 2;
+			TX_BEGIN_PARAM(pop, lock_type, lock) {
+				pmemobj_tx_write(&D_RW(D_RW(root)->foo)->bar,
+					&bar, sizeof(bar));
+				VALGRIND_PMEMCHECK_END_TX;
+
+				exit(0); /* simulate a crash */
+			} TX_END
+		} else {
+			UT_ASSERT(D_RW(D_RW(root)->foo)->bar == BAR_VALUE);
+		}
 	} else if (type == TEST_NEW) {
 		if (!exists) {
 			TX_BEGIN_PARAM(pop, lock_type, lock) {
@@ -574,6 +574,72 @@ do_tx_add_range_overlapping(PMEMobjpool *pop)
 	UT_ASSERT(util_is_zeroed(D_RO(obj)->data, OVERLAP_SIZE));
 }
 
+/*
+ * do_tx_add_range_fields -- adds many small, distinct and repeated fields,
+ *	also partially covered ones, in one transaction
+ */
+static void
+do_tx_add_range_fields(PMEMobjpool *pop)
+{
+	TOID(struct root) root;
+	TOID_ASSIGN(root, pmemobj_root(pop, sizeof(struct root)));
+
+	int *tab = D_RW(root)->tab;
+	int *copy = MALLOC(sizeof(D_RO(root)->tab));
+	memcpy(copy, tab, sizeof(D_RO(root)->tab));
+
+	TX_BEGIN(pop) {
+		for (int i = 0; i < ROOT_TAB_SIZE; i += 3) {
+			TX_ADD_DIRECT(&tab[i]);
+			tab[i] = i + 1;
+		}
+
+		/* all of these are already snapshotted */
+		for (int i = 0; i < ROOT_TAB_SIZE; i += 3) {
+			TX_ADD_DIRECT(&tab[i]);
+			tab[i] = i + 2;
+		}
+
+		/* these are covered only in part */
+		for (int i = 0; i + 3 < ROOT_TAB_SIZE; i += 30) {
+			pmemobj_tx_add_range_direct(&tab[i], sizeof(int) * 3);
+			tab[i + 1] = tab[i + 2] = -1;
+		}
+
+		pmemobj_tx_abort(-1);
+	} TX_ONCOMMIT {
+		UT_ASSERT(0);
+	} TX_END
+
+	UT_ASSERTeq(memcmp(copy, tab, sizeof(D_RO(root)->tab)), 0);
+
+	TX_BEGIN(pop) {
+		for (int i = 0; i < ROOT_TAB_SIZE; i += 3) {
+			TX_ADD_DIRECT(&tab[i]);
+			tab[i] = i + 1;
+		}
+	} TX_ONABORT {
+		UT_ASSERT(0);
+	} TX_END
+
+	for (int i = 0; i < ROOT_TAB_SIZE; i += 3)
+		UT_ASSERTeq(tab[i], i + 1);
+
+	/* nothing from the previous transaction is snapshotted anymore */
+	TX_BEGIN(pop) {
+		TX_ADD_DIRECT(&tab[3]);
+		tab[3] = -1;
+
+		pmemobj_tx_abort(-1);
+	} TX_ONCOMMIT {
+		UT_ASSERT(0);
+	} TX_END
+
+	UT_ASSERTeq(tab[3], 4);
+
+	FREE(copy);
+}
+
 /*
  * do_tx_add_range_reopen -- check for persistent memory leak in undo log set
  */
@@ -675,6 +741,8 @@ main(int argc, char *argv[])
 		VALGRIND_WRITE_STATS;
 		do_tx_add_range_overlapping(pop);
 		VALGRIND_WRITE_STATS;
+		do_tx_add_range_fields(pop);
+		VALGRIND_WRITE_STATS;
 		do_tx_add_range_too_large(pop);
 		VALGRIND_WRITE_STATS;
 		do_tx_add_huge_range_abort(pop);
@@ -0,0 +1,235 @@
+/*
+ * Copyright 2018, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * obj_tx_group_commit.c -- unit test for group commit of transactions
+ */
+#include "unittest.h"
+
+#define THREADS 16
+#define LOOPS 64
+
+struct root {
+	uint64_t counters[THREADS];
+};
+
+TOID_DECLARE_ROOT(struct root);
+
+static PMEMobjpool *pop;
+static volatile int Toggle_stop;
+
+/*
+ * set_group_commit -- sets the batch size and the window of group commit
+ */
+static void
+set_group_commit(int batch, int window)
+{
+	int ret = pmemobj_ctl_set(pop, "tx.group_commit.batch", &batch);
+	UT_ASSERTeq(ret, 0);
+	ret = pmemobj_ctl_set(pop, "tx.group_commit.window", &window);
+	UT_ASSERTeq(ret, 0);
+}
+
+/*
+ * test_ctl -- checks the group commit entry points
+ */
+static void
+test_ctl(void)
+{
+	int batch;
+	int window;
+
+	int ret = pmemobj_ctl_get(pop, "tx.group_commit.batch", &batch);
+	UT_ASSERTeq(ret, 0);
+	UT_ASSERTeq(batch, 0);
+	ret = pmemobj_ctl_get(pop, "tx.group_commit.window", &window);
+	UT_ASSERTeq(ret, 0);
+	UT_ASSERTeq(window, 0);
+
+	batch = 65;
+	errno = 0;
+	ret = pmemobj_ctl_set(pop, "tx.group_commit.batch", &batch);
+	UT_ASSERTeq(ret, -1);
+	UT_ASSERTeq(errno, EINVAL);
+	batch = -1;
+	errno = 0;
+	ret = pmemobj_ctl_set(pop, "tx.group_commit.batch", &batch);
+	UT_ASSERTeq(ret, -1);
+	UT_ASSERTeq(errno, EINVAL);
+	window = -1;
+	errno = 0;
+	ret = pmemobj_ctl_set(pop, "tx.group_commit.window", &window);
+	UT_ASSERTeq(ret, -1);
+	UT_ASSERTeq(errno, EINVAL);
+
+	set_group_commit(8, 100);
+
+	ret = pmemobj_ctl_get(pop, "tx.group_commit.batch", &batch);
+	UT_ASSERTeq(ret, 0);
+	UT_ASSERTeq(batch, 8);
+	ret = pmemobj_ctl_get(pop, "tx.group_commit.window", &window);
+	UT_ASSERTeq(ret, 0);
+	UT_ASSERTeq(window, 100);
+}
+
+/*
+ * worker -- increments the counter of the thread in many transactions,
+ *	every other of the nested transactions aborts
+ */
+static void *
+worker(void *arg)
+{
+	unsigned idx = *(unsigned *)arg;
+	TOID(struct root) root = POBJ_ROOT(pop, struct root);
+
+	for (int i = 0; i < LOOPS; ++i) {
+		TX_BEGIN(pop) {
+			TX_ADD_FIELD(root, counters[idx]);
+			D_RW(root)->counters[idx]++;
+		} TX_END
+
+		TX_BEGIN(pop) {
+			TX_ADD_FIELD(root, counters[idx]);
+			D_RW(root)->counters[idx]++;
+			pmemobj_tx_abort(ECANCELED);
+		} TX_END
+	}
+
+	return NULL;
+}
+
+/*
+ * run_workers -- runs the workers and checks that each of them committed
+ *	all of its transactions
+ */
+static void
+run_workers(int nthreads)
+{
+	os_thread_t threads[THREADS];
+	unsigned idx[THREADS];
+	uint64_t prev[THREADS];
+
+	TOID(struct root) root = POBJ_ROOT(pop, struct root);
+	for (int i = 0; i < nthreads; ++i)
+		prev[i] = D_RO(root)->counters[i];
+
+	for (int i = 0; i < nthreads; ++i) {
+		idx[i] = (unsigned)i;
+		PTHREAD_CREATE(&threads[i], NULL, worker, &idx[i]);
+	}
+
+	for (int i = 0; i < nthreads; ++i)
+		PTHREAD_JOIN(&threads[i], NULL);
+
+	for (int i = 0; i < nthreads; ++i)
+		UT_ASSERTeq(D_RO(root)->counters[i], prev[i] + LOOPS);
+}
+
+/*
+ * toggler -- keeps changing the batch size, turning group commit on and off
+ */
+static void *
+toggler(void *arg)
+{
+	int batches[] = {0, 1, THREADS, 2};
+	size_t nbatches = sizeof(batches) / sizeof(batches[0]);
+	size_t i = 0;
+
+	while (!Toggle_stop) {
+		int batch = batches[i++ % nbatches];
+		int ret = pmemobj_ctl_set(pop, "tx.group_commit.batch",
+			&batch);
+		UT_ASSERTeq(ret, 0);
+	}
+
+	return NULL;
+}
+
+/*
+ * run_workers_toggle -- runs the workers while the batch size changes
+ */
+static void
+run_workers_toggle(int nthreads)
+{
+	os_thread_t t;
+
+	Toggle_stop = 0;
+	PTHREAD_CREATE(&t, NULL, toggler, NULL);
+
+	run_workers(nthreads);
+
+	Toggle_stop = 1;
+	PTHREAD_JOIN(&t, NULL);
+}
+
+int
+main(int argc, char *argv[])
+{
+	START(argc, argv, "obj_tx_group_commit");
+
+	if (argc != 2)
+		UT_FATAL("usage: %s [file]", argv[0]);
+
+	const char *path = argv[1];
+
+	if ((pop = pmemobj_create(path, "group_commit", PMEMOBJ_MIN_POOL,
+			S_IWUSR | S_IRUSR)) == NULL)
+		UT_FATAL("!pmemobj_create");
+
+	test_ctl();
+
+	/* the leader of a lonely transaction gives up after the window */
+	run_workers(1);
+
+	run_workers(THREADS);
+
+	/* without a window, the next group gathers while one is persisted */
+	set_group_commit(THREADS, 0);
+	run_workers(THREADS);
+
+	/* group commit turned on and off under the committing transactions */
+	run_workers_toggle(THREADS);
+
+	pmemobj_close(pop);
+
+	if ((pop = pmemobj_open(path, "group_commit")) == NULL)
+		UT_FATAL("!pmemobj_open");
+
+	TOID(struct root) root = POBJ_ROOT(pop, struct root);
+	UT_ASSERTeq(D_RO(root)->counters[0], 4 * LOOPS);
+	for (int i = 1; i < THREADS; ++i)
+		UT_ASSERTeq(D_RO(root)->counters[i], 3 * LOOPS);
+
+	pmemobj_close(pop);
+
+	DONE(NULL);
+}
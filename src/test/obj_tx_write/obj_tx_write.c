@@ -0,0 +1,320 @@
+/*
+ * Copyright 2018, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * obj_tx_write.c -- unit test for pmemobj_tx_write and the tx.mode entry point
+ */
+
+#include "unittest.h"
+
+#define LAYOUT "obj_tx_write"
+#define NVALUES 4096
+#define TEST_VALUE 0xC0FFEE
+
+struct root {
+	uint64_t values[NVALUES];
+	uint64_t single;
+};
+
+static PMEMobjpool *pop;
+static struct root *root;
+
+/*
+ * set_mode -- changes the mode of new transactions
+ */
+static void
+set_mode(enum pobj_tx_mode mode)
+{
+	int ret = pmemobj_ctl_set(pop, "tx.mode", &mode);
+	UT_ASSERTeq(ret, 0);
+
+	enum pobj_tx_mode cur;
+	ret = pmemobj_ctl_get(pop, "tx.mode", &cur);
+	UT_ASSERTeq(ret, 0);
+	UT_ASSERTeq(cur, mode);
+}
+
+/*
+ * reset_values -- sets all of the values to zero
+ */
+static void
+reset_values(void)
+{
+	pmemobj_memset_persist(pop, root, 0, sizeof(*root));
+}
+
+/*
+ * test_ctl -- verifies the default and invalid transaction modes
+ */
+static void
+test_ctl(void)
+{
+	enum pobj_tx_mode mode;
+	int ret = pmemobj_ctl_get(pop, "tx.mode", &mode);
+	UT_ASSERTeq(ret, 0);
+	UT_ASSERTeq(mode, POBJ_TX_MODE_UNDO);
+
+	mode = MAX_POBJ_TX_MODES;
+	ret = pmemobj_ctl_set(pop, "tx.mode", &mode);
+	UT_ASSERTeq(ret, -1);
+	UT_ASSERTeq(errno, EINVAL);
+}
+
+/*
+ * test_commit -- writes a value and checks when it becomes visible
+ */
+static void
+test_commit(enum pobj_tx_mode mode)
+{
+	reset_values();
+	set_mode(mode);
+
+	uint64_t val = TEST_VALUE;
+	TX_BEGIN(pop) {
+		pmemobj_tx_write(&root->single, &val, sizeof(val));
+
+		if (mode == POBJ_TX_MODE_REDO)
+			UT_ASSERTeq(root->single, 0);
+		else
+			UT_ASSERTeq(root->single, TEST_VALUE);
+	} TX_ONABORT {
+		UT_ASSERT(0);
+	} TX_END
+
+	UT_ASSERTeq(root->single, TEST_VALUE);
+}
+
+/*
+ * test_abort -- verifies that an aborted write is not visible
+ */
+static void
+test_abort(enum pobj_tx_mode mode)
+{
+	reset_values();
+	set_mode(mode);
+
+	uint64_t val = TEST_VALUE;
+	TX_BEGIN(pop) {
+		pmemobj_tx_write(&root->single, &val, sizeof(val));
+		pmemobj_tx_abort(ECANCELED);
+	} TX_ONCOMMIT {
+		UT_ASSERT(0);
+	} TX_END
+
+	UT_ASSERTeq(root->single, 0);
+}
+
+/*
+ * test_nested -- writes values in nested transactions, the values must be
+ *	applied once the outermost one commits
+ */
+static void
+test_nested(enum pobj_tx_mode mode)
+{
+	reset_values();
+	set_mode(mode);
+
+	uint64_t val = TEST_VALUE;
+	TX_BEGIN(pop) {
+		pmemobj_tx_write(&root->values[0], &val, sizeof(val));
+
+		TX_BEGIN(pop) {
+			pmemobj_tx_write(&root->values[1], &val, sizeof(val));
+		} TX_ONABORT {
+			UT_ASSERT(0);
+		} TX_END
+
+		if (mode == POBJ_TX_MODE_REDO)
+			UT_ASSERTeq(root->values[1], 0);
+	} TX_ONABORT {
+		UT_ASSERT(0);
+	} TX_END
+
+	UT_ASSERTeq(root->values[0], TEST_VALUE);
+	UT_ASSERTeq(root->values[1], TEST_VALUE);
+}
+
+/*
+ * test_large -- writes a write set much bigger than the initial buffer, with
+ *	overlapping and unaligned ranges
+ */
+static void
+test_large(enum pobj_tx_mode mode)
+{
+	reset_values();
+	set_mode(mode);
+
+	TX_BEGIN(pop) {
+		for (uint64_t i = 0; i < NVALUES; ++i)
+			pmemobj_tx_write(&root->values[i], &i, sizeof(i));
+
+		/* the later writes must override the earlier ones */
+		uint64_t val = TEST_VALUE;
+		for (uint64_t i = 0; i < NVALUES; i += 2)
+			pmemobj_tx_write(&root->values[i], &val, sizeof(val));
+
+		char c = 1;
+		pmemobj_tx_write((char *)&root->single + 3, &c, sizeof(c));
+	} TX_ONABORT {
+		UT_ASSERT(0);
+	} TX_END
+
+	for (uint64_t i = 0; i < NVALUES; ++i)
+		UT_ASSERTeq(root->values[i], i % 2 ? i : TEST_VALUE);
+
+	UT_ASSERTeq(root->single, 1ULL << 24);
+}
+
+/*
+ * test_mixed -- modifies the same range with a snapshot and a write
+ */
+static void
+test_mixed(enum pobj_tx_mode mode)
+{
+	reset_values();
+	set_mode(mode);
+
+	uint64_t val = TEST_VALUE;
+	TX_BEGIN(pop) {
+		pmemobj_tx_write(&root->values[0], &val, sizeof(val));
+
+		TX_ADD_DIRECT(&root->values[0]);
+		root->values[0] = TEST_VALUE + 1;
+		root->values[1] = TEST_VALUE + 1;
+	} TX_ONABORT {
+		UT_ASSERT(0);
+	} TX_END
+
+	/* a buffered write is applied after the in-place modifications */
+	UT_ASSERTeq(root->values[0],
+		mode == POBJ_TX_MODE_REDO ? TEST_VALUE : TEST_VALUE + 1);
+	UT_ASSERTeq(root->values[1], TEST_VALUE + 1);
+
+	TX_BEGIN(pop) {
+		TX_ADD_DIRECT(&root->values[1]);
+		root->values[1] = 0;
+		pmemobj_tx_write(&root->values[0], &val, sizeof(val));
+		pmemobj_tx_abort(ECANCELED);
+	} TX_END
+
+	UT_ASSERTeq(root->values[1], TEST_VALUE + 1);
+}
+
+/*
+ * test_new_objects -- writes to objects allocated in the same transaction,
+ *	including the ones which are not flushed on commit
+ */
+static void
+test_new_objects(enum pobj_tx_mode mode)
+{
+	set_mode(mode);
+
+	struct pobj_action act;
+	PMEMoid rsv = pmemobj_reserve(pop, &act, sizeof(uint64_t), 0);
+	UT_ASSERT(!OID_IS_NULL(rsv));
+
+	PMEMoid oids[3];
+	uint64_t val = TEST_VALUE;
+	TX_BEGIN(pop) {
+		oids[0] = pmemobj_tx_alloc(sizeof(uint64_t), 0);
+		oids[1] = pmemobj_tx_xalloc(sizeof(uint64_t), 0,
+			POBJ_XALLOC_NO_FLUSH);
+		pmemobj_tx_publish(&act, 1);
+		oids[2] = rsv;
+
+		for (int i = 0; i < 3; ++i) {
+			uint64_t *p = pmemobj_direct(oids[i]);
+			pmemobj_tx_write(p, &val, sizeof(val));
+			UT_ASSERTeq(*p, TEST_VALUE);
+		}
+	} TX_ONABORT {
+		UT_ASSERT(0);
+	} TX_END
+
+	for (int i = 0; i < 3; ++i) {
+		UT_ASSERTeq(*(uint64_t *)pmemobj_direct(oids[i]), TEST_VALUE);
+		pmemobj_free(&oids[i]);
+	}
+}
+
+/*
+ * test_invalid -- writes outside of the pool
+ */
+static void
+test_invalid(enum pobj_tx_mode mode)
+{
+	set_mode(mode);
+
+	uint64_t val = TEST_VALUE;
+	uint64_t dest;
+	TX_BEGIN(pop) {
+		pmemobj_tx_write(&dest, &val, sizeof(val));
+	} TX_ONCOMMIT {
+		UT_ASSERT(0);
+	} TX_END
+
+	UT_ASSERTeq(errno, EINVAL);
+}
+
+int
+main(int argc, char *argv[])
+{
+	START(argc, argv, "obj_tx_write");
+
+	if (argc != 2)
+		UT_FATAL("usage: %s file-name", argv[0]);
+
+	const char *path = argv[1];
+
+	if ((pop = pmemobj_create(path, LAYOUT, PMEMOBJ_MIN_POOL * 4,
+			S_IWUSR | S_IRUSR)) == NULL)
+		UT_FATAL("!pmemobj_create: %s", path);
+
+	root = pmemobj_direct(pmemobj_root(pop, sizeof(struct root)));
+
+	test_ctl();
+
+	enum pobj_tx_mode modes[] = {POBJ_TX_MODE_UNDO, POBJ_TX_MODE_REDO};
+	for (size_t i = 0; i < sizeof(modes) / sizeof(modes[0]); ++i) {
+		test_commit(modes[i]);
+		test_abort(modes[i]);
+		test_nested(modes[i]);
+		test_large(modes[i]);
+		test_mixed(modes[i]);
+		test_new_objects(modes[i]);
+		test_invalid(modes[i]);
+	}
+
+	pmemobj_close(pop);
+
+	DONE(NULL);
+}
@@ -0,0 +1,226 @@
+/*
+ * Copyright 2018, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * pmem_flush_async.c -- unit test for pmem_flush_async and pmem_wait
+ *
+ * usage: pmem_flush_async file nthreads
+ */
+
+#include "unittest.h"
+
+#define NTHREADS_MAX 32
+#define NRANGES 64 /* number of ranges flushed by each thread */
+#define RANGE_LEN (300 * 1024) /* more than a single flush request */
+
+struct worker_args {
+	char *dest;
+	size_t len;
+	int idx;
+};
+
+/*
+ * worker -- fill and flush the thread's part of the mapping
+ */
+static void *
+worker(void *arg)
+{
+	struct worker_args *a = arg;
+	size_t rlen = a->len / NRANGES;
+	unsigned long long token = 0;
+
+	for (int i = 0; i < NRANGES; ++i) {
+		char *addr = a->dest + (size_t)i * rlen;
+
+		memset(addr, 'a' + (a->idx + i) % 26, rlen);
+		unsigned long long t = pmem_flush_async(addr, rlen);
+
+		/* tokens increase, unless flushing is synchronous */
+		UT_ASSERT(t == 0 || t > token);
+		token = t;
+
+		/* wait for some of the ranges only */
+		if (i % 8 == 0)
+			UT_ASSERTeq(pmem_wait(t), 0);
+	}
+
+	UT_ASSERTeq(pmem_wait(token), 0);
+
+	return NULL;
+}
+
+/*
+ * check_file -- verify the file contents match the mapping
+ */
+static void
+check_file(int fd, const char *dest, size_t len)
+{
+	char *buf = MALLOC(len);
+
+	LSEEK(fd, (os_off_t)0, SEEK_SET);
+	if (READ(fd, buf, len) == (ssize_t)len) {
+		if (memcmp(buf, dest, len))
+			UT_FATAL("file contents do not match the mapping");
+	}
+
+	FREE(buf);
+}
+
+/*
+ * test_threads -- flush ranges concurrently from several threads
+ */
+static void
+test_threads(int fd, char *dest, size_t len, int nthreads)
+{
+	os_thread_t threads[NTHREADS_MAX];
+	struct worker_args args[NTHREADS_MAX];
+	size_t part = len / (size_t)nthreads;
+
+	for (int i = 0; i < nthreads; ++i) {
+		args[i].dest = dest + (size_t)i * part;
+		args[i].len = part;
+		args[i].idx = i;
+		PTHREAD_CREATE(&threads[i], NULL, worker, &args[i]);
+	}
+
+	for (int i = 0; i < nthreads; ++i)
+		PTHREAD_JOIN(&threads[i], NULL);
+
+	check_file(fd, dest, len);
+}
+
+/*
+ * test_big_range -- flush a range split into many requests
+ */
+static void
+test_big_range(int fd, char *dest, size_t len)
+{
+	memset(dest, 'x', len);
+
+	unsigned long long token = pmem_flush_async(dest, len);
+	UT_ASSERTeq(pmem_wait(token), 0);
+
+	check_file(fd, dest, len);
+}
+
+/*
+ * test_invalid -- pass an empty range and a token never returned
+ */
+static void
+test_invalid(char *dest)
+{
+	UT_ASSERTeq(pmem_flush_async(dest, 0), 0);
+	UT_ASSERTeq(pmem_wait(0), 0);
+
+	errno = 0;
+	UT_ASSERTeq(pmem_wait(~0ULL), -1);
+	UT_ASSERTeq(errno, EINVAL);
+}
+
+#ifndef _WIN32
+/*
+ * test_fork -- wait in a child for the ranges queued before fork, then queue
+ *	new ones, which restarts the workers in the child
+ */
+static void
+test_fork(char *dest, size_t len)
+{
+	memset(dest, 'f', len);
+	unsigned long long token = pmem_flush_async(dest, len);
+
+	pid_t pid = fork();
+	if (pid < 0)
+		UT_FATAL("!fork");
+
+	if (pid == 0) {
+		/* child */
+		UT_ASSERTeq(pmem_wait(token), 0);
+
+		memset(dest, 'c', RANGE_LEN);
+		unsigned long long t = pmem_flush_async(dest, RANGE_LEN);
+		UT_ASSERTeq(pmem_wait(t), 0);
+
+		exit(0);
+	}
+
+	UT_ASSERTeq(pmem_wait(token), 0);
+
+	int status;
+	if (waitpid(pid, &status, 0) < 0)
+		UT_FATAL("!waitpid");
+
+	UT_ASSERT(WIFEXITED(status));
+	UT_ASSERTeq(WEXITSTATUS(status), 0);
+}
+#else
+static void
+test_fork(char *dest, size_t len)
+{
+}
+#endif
+
+int
+main(int argc, char *argv[])
+{
+	int fd;
+	size_t mapped_len;
+	char *dest;
+
+	START(argc, argv, "pmem_flush_async");
+
+	if (argc != 3)
+		UT_FATAL("usage: %s file nthreads", argv[0]);
+
+	int nthreads = atoi(argv[2]);
+	if (nthreads < 1 || nthreads > NTHREADS_MAX)
+		UT_FATAL("invalid number of threads %d", nthreads);
+
+	fd = OPEN(argv[1], O_RDWR);
+
+	/* open a pmem file and memory map it */
+	if ((dest = pmem_map_file(argv[1], 0, 0, 0, &mapped_len, NULL)) == NULL)
+		UT_FATAL("!Could not mmap %s\n", argv[1]);
+
+	size_t len = (size_t)nthreads * NRANGES * RANGE_LEN;
+	UT_ASSERT(mapped_len >= len);
+
+	test_threads(fd, dest, len, nthreads);
+	test_big_range(fd, dest, mapped_len);
+	test_invalid(dest);
+	test_fork(dest, mapped_len);
+
+	UT_ASSERTeq(pmem_unmap(dest, mapped_len), 0);
+
+	CLOSE(fd);
+
+	DONE(NULL);
+}
@@ -0,0 +1,136 @@
+/*
+ * Copyright 2018, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * pmem_movnt_threshold.c -- unit test for pmem_get_movnt_threshold and
+ * pmem_set_movnt_threshold
+ *
+ * usage: pmem_movnt_threshold file set|auto
+ */
+
+#include "unittest.h"
+
+#define DEFAULT_THRESHOLD 256
+
+/*
+ * test_set -- set the global and the per-range thresholds
+ */
+static void
+test_set(char *dest, size_t len)
+{
+	UT_ASSERTeq(pmem_get_movnt_threshold(NULL), DEFAULT_THRESHOLD);
+	UT_ASSERTeq(pmem_get_movnt_threshold(dest), DEFAULT_THRESHOLD);
+
+	UT_ASSERTeq(pmem_set_movnt_threshold(NULL, 0, 1024), 0);
+	UT_ASSERTeq(pmem_get_movnt_threshold(NULL), 1024);
+	UT_ASSERTeq(pmem_get_movnt_threshold(dest), 1024);
+
+	UT_ASSERTeq(pmem_set_movnt_threshold(dest, len / 2, 0), 0);
+	UT_ASSERTeq(pmem_get_movnt_threshold(dest), 0);
+	UT_ASSERTeq(pmem_get_movnt_threshold(dest + len / 2 - 1), 0);
+	UT_ASSERTeq(pmem_get_movnt_threshold(dest + len / 2), 1024);
+
+	/* setting the same range again replaces the threshold */
+	UT_ASSERTeq(pmem_set_movnt_threshold(dest, len / 2, 4096), 0);
+	UT_ASSERTeq(pmem_get_movnt_threshold(dest), 4096);
+
+	UT_ASSERTne(pmem_set_movnt_threshold(dest, 0, 4096), 0);
+	UT_ASSERTeq(errno, EINVAL);
+
+	/* both thresholds have to produce the same result */
+	char *src = MALLOC(len / 2);
+	for (size_t i = 0; i < len / 2; ++i)
+		src[i] = (char)i;
+
+	pmem_memcpy_persist(dest, src, len / 2);
+	pmem_memcpy_persist(dest + len / 2, src, len / 2);
+	UT_ASSERTeq(memcmp(dest, dest + len / 2, len / 2), 0);
+
+	FREE(src);
+}
+
+/*
+ * test_auto -- check the calibrated threshold
+ */
+static void
+test_auto(char *dest, size_t len, const char *copy)
+{
+	size_t threshold = pmem_get_movnt_threshold(NULL);
+
+	UT_ASSERT(threshold >= 64);
+	UT_ASSERT(threshold <= 64 * 1024);
+	UT_ASSERTeq(threshold & (threshold - 1), 0);
+
+	/* calibration must not change the content of the mapping */
+	UT_ASSERTeq(memcmp(dest, copy, len), 0);
+}
+
+int
+main(int argc, char *argv[])
+{
+	size_t mapped_len;
+	char *dest;
+
+	START(argc, argv, "pmem_movnt_threshold");
+
+	if (argc != 3)
+		UT_FATAL("usage: %s file set|auto", argv[0]);
+
+	/* fill the file with a pattern before it gets calibrated on */
+	int fd = OPEN(argv[1], O_RDWR);
+	os_stat_t stbuf;
+	STAT(argv[1], &stbuf);
+	size_t flen = (size_t)stbuf.st_size;
+	char *copy = MALLOC(flen);
+	for (size_t i = 0; i < flen; ++i)
+		copy[i] = (char)(i * 7);
+	UT_ASSERTeq(WRITE(fd, copy, flen), (ssize_t)flen);
+	CLOSE(fd);
+
+	if ((dest = pmem_map_file(argv[1], 0, 0, 0, &mapped_len, NULL)) == NULL)
+		UT_FATAL("!Could not mmap %s\n", argv[1]);
+
+	UT_ASSERTeq(mapped_len, flen);
+
+	if (strcmp(argv[2], "set") == 0)
+		test_set(dest, mapped_len);
+	else if (strcmp(argv[2], "auto") == 0)
+		test_auto(dest, mapped_len, copy);
+	else
+		UT_FATAL("unknown mode %s", argv[2]);
+
+	UT_ASSERTeq(pmem_unmap(dest, mapped_len), 0);
+
+	FREE(copy);
+
+	DONE(NULL);
+}
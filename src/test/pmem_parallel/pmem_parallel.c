@@ -0,0 +1,222 @@
+/*
+ * Copyright 2018, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * pmem_parallel.c -- unit test for the PMEM_MEM_PARALLEL flag
+ *
+ * usage: pmem_parallel file
+ */
+
+#include "unittest.h"
+
+#define SMALL_LEN (4096 + 7) /* too short to be split */
+
+/*
+ * check_file -- verify the file contents match the mapping
+ */
+static void
+check_file(int fd, const char *dest, size_t len)
+{
+	char *buf = MALLOC(len);
+
+	LSEEK(fd, (os_off_t)0, SEEK_SET);
+	if (READ(fd, buf, len) == (ssize_t)len) {
+		if (memcmp(buf, dest, len))
+			UT_FATAL("file contents do not match the mapping");
+	}
+
+	FREE(buf);
+}
+
+/*
+ * test_memcpy -- copy from a volatile buffer, with and without the drain
+ */
+static void
+test_memcpy(int fd, char *dest, size_t len)
+{
+	char *src = MALLOC(len);
+
+	for (size_t i = 0; i < len; ++i)
+		src[i] = (char)(i * 31 + i / 4096);
+
+	/* unaligned length and destination */
+	pmem_memcpy(dest + 1, src, len - 65,
+			PMEM_MEM_PARALLEL | PMEM_MEM_NONTEMPORAL);
+	UT_ASSERTeq(memcmp(dest + 1, src, len - 65), 0);
+
+	pmem_memcpy(dest, src, len, PMEM_MEM_PARALLEL | PMEM_MEM_NODRAIN);
+	pmem_drain();
+	UT_ASSERTeq(memcmp(dest, src, len), 0);
+
+	pmem_memcpy(dest, src + 1, SMALL_LEN, PMEM_MEM_PARALLEL);
+	UT_ASSERTeq(memcmp(dest, src + 1, SMALL_LEN), 0);
+
+	check_file(fd, dest, len);
+
+	FREE(src);
+}
+
+/*
+ * test_memmove -- move overlapping and disjoint ranges
+ */
+static void
+test_memmove(int fd, char *dest, size_t len)
+{
+	size_t half = len / 2;
+	char *copy = MALLOC(len);
+
+	memcpy(copy, dest, len);
+
+	/* overlapping ranges are not split */
+	pmem_memmove(dest + 4096, dest, half, PMEM_MEM_PARALLEL);
+	memmove(copy + 4096, copy, half);
+	UT_ASSERTeq(memcmp(dest, copy, len), 0);
+
+	pmem_memmove(dest + half, dest, half, PMEM_MEM_PARALLEL);
+	UT_ASSERTeq(memcmp(dest + half, dest, half), 0);
+
+	check_file(fd, dest, len);
+
+	FREE(copy);
+}
+
+/*
+ * test_memset -- fill the whole range and a part of it
+ */
+static void
+test_memset(int fd, char *dest, size_t len)
+{
+	pmem_memset(dest, 'x', len, PMEM_MEM_PARALLEL);
+	pmem_memset(dest + 3, 'y', len / 3, PMEM_MEM_PARALLEL);
+
+	for (size_t i = 0; i < len; ++i) {
+		char c = i >= 3 && i < 3 + len / 3 ? 'y' : 'x';
+		if (dest[i] != c)
+			UT_FATAL("unexpected byte at offset %zu", i);
+	}
+
+	check_file(fd, dest, len);
+}
+
+/*
+ * test_threads -- change the number of threads
+ */
+static void
+test_threads(void)
+{
+	unsigned nthreads = pmem_get_parallel_threads();
+	UT_ASSERT(nthreads >= 1);
+
+	errno = 0;
+	UT_ASSERTeq(pmem_set_parallel_threads(0), -1);
+	UT_ASSERTeq(errno, EINVAL);
+
+	errno = 0;
+	UT_ASSERTeq(pmem_set_parallel_threads(65), -1);
+	UT_ASSERTeq(errno, EINVAL);
+
+	UT_ASSERTeq(pmem_set_parallel_threads(3), 0);
+	UT_ASSERTeq(pmem_get_parallel_threads(), 3);
+}
+
+#ifndef _WIN32
+/*
+ * test_fork -- copy in a child, which has to start its own workers, then
+ *	again in the parent, whose workers have to survive the fork
+ */
+static void
+test_fork(int fd, char *dest, size_t len)
+{
+	/* make sure the workers of the parent are running */
+	test_memset(fd, dest, len);
+
+	pid_t pid = fork();
+	if (pid < 0)
+		UT_FATAL("!fork");
+
+	if (pid == 0) {
+		/* child */
+		test_memcpy(fd, dest, len);
+		exit(0);
+	}
+
+	int status;
+	if (waitpid(pid, &status, 0) < 0)
+		UT_FATAL("!waitpid");
+
+	UT_ASSERT(WIFEXITED(status));
+	UT_ASSERTeq(WEXITSTATUS(status), 0);
+
+	test_memset(fd, dest, len);
+}
+#else
+static void
+test_fork(int fd, char *dest, size_t len)
+{
+}
+#endif
+
+int
+main(int argc, char *argv[])
+{
+	int fd;
+	size_t mapped_len;
+	char *dest;
+
+	START(argc, argv, "pmem_parallel");
+
+	if (argc != 2)
+		UT_FATAL("usage: %s file", argv[0]);
+
+	fd = OPEN(argv[1], O_RDWR);
+
+	/* open a pmem file and memory map it */
+	if ((dest = pmem_map_file(argv[1], 0, 0, 0, &mapped_len, NULL)) == NULL)
+		UT_FATAL("!Could not mmap %s\n", argv[1]);
+
+	test_memcpy(fd, dest, mapped_len);
+	test_memmove(fd, dest, mapped_len);
+	test_memset(fd, dest, mapped_len);
+
+	/* once more with a different number of threads */
+	test_threads();
+	test_memcpy(fd, dest, mapped_len);
+	test_memset(fd, dest, mapped_len);
+
+	test_fork(fd, dest, mapped_len);
+
+	UT_ASSERTeq(pmem_unmap(dest, mapped_len), 0);
+
+	CLOSE(fd);
+
+	DONE(NULL);
+}
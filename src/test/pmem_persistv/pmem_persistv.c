@@ -0,0 +1,167 @@
+/*
+ * Copyright 2018, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * pmem_persistv.c -- unit test for pmem_persistv and pmem_memcpy_persistv
+ *
+ * usage: pmem_persistv file
+ */
+
+#include "unittest.h"
+
+#define NRANGES 100 /* more than a single batch of pmem_persistv */
+#define RANGE_STRIDE 4096
+
+/*
+ * check_file -- verify the file contents match the mapping
+ */
+static void
+check_file(int fd, const char *dest, size_t len)
+{
+	char *buf = MALLOC(len);
+
+	LSEEK(fd, (os_off_t)0, SEEK_SET);
+	if (READ(fd, buf, len) == (ssize_t)len) {
+		if (memcmp(buf, dest, len))
+			UT_FATAL("file contents do not match the mapping");
+	}
+
+	FREE(buf);
+}
+
+/*
+ * test_persistv -- persist a vector of scattered, overlapping, adjacent and
+ *	empty ranges
+ */
+static void
+test_persistv(int fd, char *dest, size_t len)
+{
+	struct iovec iov[NRANGES];
+
+	for (int i = 0; i < NRANGES; ++i) {
+		/* reverse order, so that the ranges have to be sorted */
+		size_t off = (size_t)(NRANGES - 1 - i) * RANGE_STRIDE;
+		size_t rlen;
+
+		switch (i % 4) {
+		case 0: /* overlaps with the next range */
+			off += 100;
+			rlen = 300;
+			break;
+		case 1:
+			rlen = 200;
+			break;
+		case 2: /* empty range */
+			rlen = 0;
+			break;
+		default: /* unaligned, spans several cache lines */
+			off += 1;
+			rlen = 1000;
+			break;
+		}
+
+		memset(dest + off, 'a' + i % 26, rlen);
+		iov[i].iov_base = dest + off;
+		iov[i].iov_len = rlen;
+	}
+
+	/* adjacent to the first range */
+	struct iovec adjacent;
+	adjacent.iov_base = (char *)iov[0].iov_base + iov[0].iov_len;
+	adjacent.iov_len = 64;
+	memset(adjacent.iov_base, 'z', adjacent.iov_len);
+
+	pmem_persistv(iov, NRANGES);
+	pmem_persistv(&adjacent, 1);
+	pmem_persistv(NULL, 0);
+
+	check_file(fd, dest, len);
+}
+
+/*
+ * test_memcpy_persistv -- copy a vector of buffers to scattered ranges
+ */
+static void
+test_memcpy_persistv(int fd, char *dest, size_t len)
+{
+	struct pmem_memcpy_desc descs[NRANGES];
+	char *src = MALLOC(RANGE_STRIDE);
+
+	for (int i = 0; i < NRANGES; ++i) {
+		descs[i].pmemdest = dest + (size_t)i * RANGE_STRIDE + i % 64;
+		descs[i].src = src + i;
+		descs[i].len = (size_t)RANGE_STRIDE / 2 + (size_t)i * 7;
+	}
+
+	for (int i = 0; i < RANGE_STRIDE; ++i)
+		src[i] = (char)i;
+
+	pmem_memcpy_persistv(descs, NRANGES);
+
+	for (int i = 0; i < NRANGES; ++i)
+		UT_ASSERTeq(memcmp(descs[i].pmemdest, descs[i].src,
+				descs[i].len), 0);
+
+	check_file(fd, dest, len);
+
+	FREE(src);
+}
+
+int
+main(int argc, char *argv[])
+{
+	int fd;
+	size_t mapped_len;
+	char *dest;
+
+	START(argc, argv, "pmem_persistv");
+
+	if (argc != 2)
+		UT_FATAL("usage: %s file", argv[0]);
+
+	fd = OPEN(argv[1], O_RDWR);
+
+	/* open a pmem file and memory map it */
+	if ((dest = pmem_map_file(argv[1], 0, 0, 0, &mapped_len, NULL)) == NULL)
+		UT_FATAL("!Could not mmap %s\n", argv[1]);
+
+	UT_ASSERT(mapped_len >= (size_t)NRANGES * RANGE_STRIDE);
+
+	test_persistv(fd, dest, mapped_len);
+	test_memcpy_persistv(fd, dest, mapped_len);
+
+	UT_ASSERTeq(pmem_unmap(dest, mapped_len), 0);
+
+	CLOSE(fd);
+
+	DONE(NULL);
+}
@@ -869,6 +869,32 @@ out_get_incompat_features_str(uint32_t incompat)
 			incompat &= (uint32_t)(~(POOL_FEAT_SINGLEHDR));
 		}
 
+		/* print the name of NLANES option */
+		if (incompat & POOL_FEAT_NLANES) {
+			ret = snprintf(str_buff + curr,
+				(size_t)(STR_MAX - curr), "%s%s",
+				count ? ", " : "", "NLANES");
+			if (ret < 0 || curr + ret >= STR_MAX)
+				return "";
+			curr += ret;
+			++count;
+			/* take off the flag */
+			incompat &= (uint32_t)(~(POOL_FEAT_NLANES));
+		}
+
+		/* print the name of REDO_EXT option */
+		if (incompat & POOL_FEAT_REDO_EXT) {
+			ret = snprintf(str_buff + curr,
+				(size_t)(STR_MAX - curr), "%s%s",
+				count ? ", " : "", "REDO_EXT");
+			if (ret < 0 || curr + ret >= STR_MAX)
+				return "";
+			curr += ret;
+			++count;
+			/* take off the flag */
+			incompat &= (uint32_t)(~(POOL_FEAT_REDO_EXT));
+		}
+
 		/* handle other flags here */
 
 		/* check if any unknown flags are set */